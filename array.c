@@ -1,21 +1,55 @@
 /**
  * @file array.c
  * @brief Array implementation.
+ *
+ * Dropping the last reference to an array frees its entries, and with them
+ * every array only it held. While the host defers frees
+ * (array_defer_frees()), one drop frees at most LX_FREE_SLICE_ENTRIES
+ * entries; arrays it could not finish go on a free queue, entries freed
+ * from the back, and are finished in slices by array_free_step() at
+ * safepoints and a few entries per array_new(). Frees nested deeper than
+ * ARRAY_FREE_MAX_DEPTH are queued as well, so dropping deeply nested data
+ * does not exhaust the C stack; without deferral the outermost drop
+ * empties the queue before it returns.
  */
 #include "array.h"
+#include "config.h"
 #include "lx_error.h"
 #include "gc.h"
+#include "heapprof.h"
 #include "memguard.h"
+#include "pool.h"
+#include "region.h"
+#include <limits.h>
 #include <stdbool.h>
 #include <stdlib.h>
 #include <string.h>
 
-static void key_free(Key k) {
-    if (k.type == KEY_STRING) free(k.s);
+#ifndef LX_FREE_SLICE_ENTRIES
+#define LX_FREE_SLICE_ENTRIES 0
+#endif
+
+/* Nesting of frees past which arrays are queued instead of recursed into. */
+#define ARRAY_FREE_MAX_DEPTH 1024
+/* Queued entries each array_new() frees. */
+#define ARRAY_FREE_PACE 8
+
+static Array **g_free_queue = NULL; /* arrays left to free, entries [0, size) */
+size_t array_free_pending = 0;      /* arrays in g_free_queue */
+static size_t g_free_queue_cap = 0;
+static int g_free_defer = 0;
+static int g_free_depth = 0;
+static long g_free_work = 0;     /* entries freed by the current drop or slice */
+static long g_free_budget = LONG_MAX;
+
+static void array_free_queued(long budget);
+
+void key_free(Key k) {
+    if (k.type == KEY_STRING) lx_region_free(k.s);
 }
 static Key key_copy(Key k) {
     Key out = k;
-    if (k.type == KEY_STRING) out.s = strdup(k.s ? k.s : "");
+    if (k.type == KEY_STRING) out.s = lx_region_strdup(k.s ? k.s : "");
     return out;
 }
 static int key_eq(Key a, Key b) {
@@ -57,13 +91,15 @@ static int array_contains(Array *hay, Array *needle) {
 }
 
 Key key_int(lx_int_t i) { Key k; k.type=KEY_INT; k.i=i; return k; }
-Key key_string(const char *s) { Key k; k.type=KEY_STRING; k.s=strdup(s?s:""); return k; }
+Key key_string(const char *s) { Key k; k.type=KEY_STRING; k.s=lx_region_strdup(s?s:""); return k; }
 
 Array *array_new(void) {
-    Array *a = (Array*)calloc(1, sizeof(Array));
+    if (array_free_pending) array_free_queued(ARRAY_FREE_PACE);
+    Array *a = (Array*)lx_pool_alloc(sizeof(Array));
     if (a) {
         a->refcount = 1;
         gc_register_array(a);
+        LX_HEAPPROF_ALLOC(LX_HEAP_ARRAY, a, sizeof(Array));
     }
     return a;
 }
@@ -72,23 +108,162 @@ void array_retain(Array *a) {
     if (a) a->refcount++;
 }
 
+static bool ensure(Array *a, size_t need);
+
+Array *array_share(Array *src) {
+    if (!src) return NULL;
+    Array *a = array_new();
+    if (!a) return NULL;
+    array_retain(src);
+    a->shared = src;
+    a->entries = src->entries;
+    a->size = src->size;
+    a->capacity = 0;
+    a->next_index = src->next_index;
+    return a;
+}
+
+/* Copy entries still read from a constant array. Keys and order stay the
+ * same, so this is all a write to an existing value needs. */
+static void own_entries(Array *a) {
+    if (!a->shared) return;
+    Array *src = a->shared;
+    ArrayEntry *ne = NULL;
+    a->shared = NULL;
+    a->entries = NULL;
+    a->capacity = 0;
+    if (src->size > 0 && lx_memguard_check(src->size * sizeof(ArrayEntry))) {
+        ne = (ArrayEntry*)lx_region_alloc(src->size * sizeof(ArrayEntry));
+    }
+    if (!ne) {
+        if (src->size > 0 && !lx_has_error()) lx_set_error(LX_ERR_INTERNAL, 0, 0, "out of memory");
+        a->size = 0;
+        array_free(src);
+        return;
+    }
+    LX_HEAPPROF_ALLOC(LX_HEAP_ARRAY, a, src->size * sizeof(ArrayEntry));
+    for (size_t i = 0; i < src->size; i++) {
+        ne[i].key = key_copy(src->entries[i].key);
+        ne[i].value = value_copy(src->entries[i].value);
+    }
+    a->entries = ne;
+    a->size = src->size;
+    a->capacity = src->size;
+    array_free(src);
+}
+
+/* Give the entries private copies of the keys borrowed from the shape. */
+static void drop_shape(Array *a) {
+    ArrayShape *s = a->shape;
+    if (!s) return;
+    for (size_t i = 0; i < a->size; i++) {
+        a->entries[i].key.s = lx_region_strdup(a->entries[i].key.s);
+    }
+    a->shape = NULL;
+    array_shape_release(s);
+}
+
+void array_own(Array *a) {
+    if (!a) return;
+    own_entries(a);
+    drop_shape(a);
+}
+
+static unsigned long g_next_shape_id = 1;
+
+ArrayShape *array_shape_new(const char *const *keys, size_t count) {
+    ArrayShape *s = (ArrayShape*)lx_region_calloc(sizeof(ArrayShape));
+    if (!s) return NULL;
+    s->keys = (char**)lx_region_calloc((count ? count : 1) * sizeof(char*));
+    if (!s->keys) { lx_region_free(s); return NULL; }
+    for (size_t i = 0; i < count; i++) {
+        s->keys[i] = lx_region_strdup(keys[i] ? keys[i] : "");
+    }
+    s->refcount = 1;
+    s->id = g_next_shape_id++;
+    s->count = count;
+    return s;
+}
+
+void array_shape_release(ArrayShape *s) {
+    if (!s || lx_region_dead(s) || --s->refcount > 0) return;
+    for (size_t i = 0; i < s->count; i++) lx_region_free(s->keys[i]);
+    lx_region_free(s->keys);
+    lx_region_free(s);
+}
+
+Array *array_new_shaped(ArrayShape *s) {
+    Array *a = array_new();
+    if (!a || !s) return a;
+    if (!ensure(a, s->count)) return a;
+    for (size_t i = 0; i < s->count; i++) {
+        a->entries[i].key.type = KEY_STRING;
+        a->entries[i].key.s = s->keys[i];
+        a->entries[i].value = value_undefined();
+    }
+    a->size = s->count;
+    s->refcount++;
+    a->shape = s;
+    return a;
+}
+
+/* Records only; larger string-keyed arrays are maps, not rows. */
+#define SHAPE_MAX_KEYS 64
+
+void array_adopt_shape(Array *a, ArrayShape **hint) {
+    if (!a || a->shape || a->shared || a->size == 0 || a->size > SHAPE_MAX_KEYS) return;
+    for (size_t i = 0; i < a->size; i++) {
+        if (a->entries[i].key.type != KEY_STRING) return;
+    }
+    ArrayShape *s = *hint;
+    int same = s && s->count == a->size;
+    for (size_t i = 0; same && i < a->size; i++) {
+        same = strcmp(s->keys[i], a->entries[i].key.s) == 0;
+    }
+    if (same) {
+        for (size_t i = 0; i < a->size; i++) {
+            lx_region_free(a->entries[i].key.s);
+            a->entries[i].key.s = s->keys[i];
+        }
+    } else {
+        s = (ArrayShape*)lx_region_calloc(sizeof(ArrayShape));
+        if (!s) return;
+        s->keys = (char**)lx_region_alloc(a->size * sizeof(char*));
+        if (!s->keys) { lx_region_free(s); return; }
+        for (size_t i = 0; i < a->size; i++) s->keys[i] = a->entries[i].key.s;
+        s->refcount = 1;
+        s->id = g_next_shape_id++;
+        s->count = a->size;
+        array_shape_release(*hint);
+        *hint = s;
+    }
+    s->refcount++;
+    a->shape = s;
+}
+
 static bool ensure(Array *a, size_t need) {
+    array_own(a);
     if (a->capacity >= need) return true;
     size_t cap = a->capacity ? a->capacity : 8;
     while (cap < need) cap *= 2;
     if (!lx_memguard_check(cap * sizeof(ArrayEntry))) {
         return false;
     }
-    ArrayEntry *ne = (ArrayEntry*)realloc(a->entries, cap * sizeof(ArrayEntry));
+    ArrayEntry *ne = (ArrayEntry*)lx_region_realloc(a->entries, cap * sizeof(ArrayEntry));
     if (!ne) {
-        lx_set_error(LX_ERR_INTERNAL, 0, 0, "out of memory");
+        if (!lx_has_error()) lx_set_error(LX_ERR_INTERNAL, 0, 0, "out of memory");
         return false;
     }
+    LX_HEAPPROF_ALLOC(LX_HEAP_ARRAY, a, (cap - a->capacity) * sizeof(ArrayEntry));
     a->entries = ne;
     a->capacity = cap;
     return true;
 }
 
+int array_reserve(Array *a, size_t n) {
+    return a && ensure(a, n);
+}
+
 size_t array_len(Array *a) { return a ? a->size : 0; }
 
 Value array_get(Array *a, Key k) {
@@ -103,6 +278,54 @@ Value array_get(Array *a, Key k) {
     return value_undefined();
 }
 
+Value *array_lookup(Array *a, Key k) {
+    if (!a) return NULL;
+    for (size_t i = 0; i < a->size; i++) {
+        if (key_eq(a->entries[i].key, k)) return &a->entries[i].value;
+    }
+    return NULL;
+}
+
+Value *array_lookup_cached(Array *a, Key k, ArrayIC *ic) {
+    if (!a) return NULL;
+    if (a->shape && a->shape->id == ic->shape_id) return &a->entries[ic->pos].value;
+    if (ic->pos < a->size && key_eq(a->entries[ic->pos].key, k)) {
+        ic->shape_id = a->shape ? a->shape->id : 0;
+        return &a->entries[ic->pos].value;
+    }
+    for (size_t i = 0; i < a->size; i++) {
+        if (key_eq(a->entries[i].key, k)) {
+            ic->pos = i;
+            ic->shape_id = a->shape ? a->shape->id : 0;
+            return &a->entries[i].value;
+        }
+    }
+    return NULL;
+}
+
+/* Keep the cached next index ahead of an inserted integer key. */
+static void note_key(Array *a, Key k) {
+    if (k.type == KEY_INT && a->next_index >= 0 && k.i >= a->next_index) a->next_index = k.i + 1;
+}
+
+lx_int_t array_next_index(Array *a) {
+    if (!a) return 0;
+    if (a->next_index < 0) {
+        lx_int_t next = 0;
+        for (size_t i = 0; i < a->size; i++) {
+            if (a->entries[i].key.type == KEY_INT && a->entries[i].key.i >= next) {
+                next = a->entries[i].key.i + 1;
+            }
+        }
+        a->next_index = next;
+    }
+    return a->next_index;
+}
+
+void array_keys_changed(Array *a) {
+    if (a) a->next_index = -1;
+}
+
 void array_set(Array *a, Key k, Value v) {
     if (!a) { key_free(k); value_free(v); return; }
     if (v.type == VAL_ARRAY && v.a) {
@@ -113,6 +336,8 @@ void array_set(Array *a, Key k, Value v) {
             return;
         }
     }
+    gc_write_barrier(v);
+    own_entries(a);
     for (size_t i = 0; i < a->size; i++) {
         if (key_eq(a->entries[i].key, k)) {
             key_free(k);
@@ -129,9 +354,44 @@ void array_set(Array *a, Key k, Value v) {
     a->entries[a->size].key = key_copy(k);
     a->entries[a->size].value = v;
     a->size++;
+    note_key(a, k);
     key_free(k);
 }
 
+void array_push(Array *a, Value v) {
+    if (!a) { value_free(v); return; }
+    if (v.type == VAL_ARRAY && v.a) {
+        if (array_contains(v.a, a)) {
+            lx_set_error(LX_ERR_CYCLE, 0, 0, "cyclic array reference");
+            value_free(v);
+            return;
+        }
+    }
+    gc_write_barrier(v);
+    lx_int_t idx = array_next_index(a);
+    if (!ensure(a, a->size + 1)) {
+        value_free(v);
+        return;
+    }
+    a->entries[a->size].key = key_int(idx);
+    a->entries[a->size].value = v;
+    a->size++;
+    a->next_index = idx + 1;
+}
+
+void array_append(Array *a, Key k, Value v) {
+    if (!a || !ensure(a, a->size + 1)) {
+        key_free(k);
+        value_free(v);
+        return;
+    }
+    gc_write_barrier(v);
+    a->entries[a->size].key = k;
+    a->entries[a->size].value = v;
+    a->size++;
+    note_key(a, k);
+}
+
 Array *array_copy(Array *a) {
     if (!a) return NULL;
     Array *b = array_new();
@@ -141,23 +401,104 @@ Array *array_copy(Array *a) {
         return NULL;
     }
     for (size_t i = 0; i < a->size; i++) {
-        b->entries[i].key = key_copy(a->entries[i].key);
+        b->entries[i].key = a->shape ? a->entries[i].key : key_copy(a->entries[i].key);
         b->entries[i].value = value_copy(a->entries[i].value);
     }
     b->size = a->size;
+    b->next_index = a->next_index;
+    if (a->shape) {
+        a->shape->refcount++;
+        b->shape = a->shape;
+    }
     return b;
 }
 
+/* ---------- freeing ---------- */
+
+static int array_defer(Array *a) {
+    if (array_free_pending == g_free_queue_cap) {
+        size_t cap = g_free_queue_cap ? g_free_queue_cap * 2 : 64;
+        Array **nq = (Array **)realloc(g_free_queue, cap * sizeof(Array *));
+        if (!nq) return 0;
+        g_free_queue = nq;
+        g_free_queue_cap = cap;
+    }
+    g_free_queue[array_free_pending++] = a;
+    return 1;
+}
+
+/* Free the entries of unreferenced @p a from the back, then @p a itself;
+ * queue it instead once the budget is spent or the nesting is too deep. */
+static void array_destroy(Array *a) {
+    size_t i = a->size;
+    if (i && g_free_depth >= ARRAY_FREE_MAX_DEPTH && array_defer(a)) return;
+    g_free_depth++;
+    while (i > 0) {
+        if (g_free_work >= g_free_budget) {
+            a->size = i;
+            if (array_defer(a)) {
+                g_free_depth--;
+                return;
+            }
+        }
+        ArrayEntry *e = &a->entries[--i];
+        if (!a->shape) key_free(e->key);
+        value_free(e->value);
+        g_free_work++;
+    }
+    g_free_depth--;
+    array_shape_release(a->shape);
+    lx_region_free(a->entries);
+    lx_pool_free(a, sizeof(Array));
+}
+
+/* Free queued arrays until the queue is empty or @p budget entries have
+ * been freed (no limit if negative). */
+static void array_free_queued(long budget) {
+    if (g_free_depth > 0) return;
+    g_free_work = 0;
+    g_free_budget = budget < 0 ? LONG_MAX : budget;
+    while (array_free_pending > 0 && g_free_work < g_free_budget) {
+        Array *a = g_free_queue[--array_free_pending];
+        /* the region's memory is gone along with its arrays */
+        if (!lx_region_dead(a)) array_destroy(a);
+    }
+}
+
 void array_free(Array *a) {
-    if (!a) return;
-    if (--a->refcount > 0) return;
+    if (!a || lx_region_dead(a)) return;
+    if (--a->refcount > 0) {
+        gc_possible_cycle(a);
+        return;
+    }
     gc_unregister_array(a);
-    for (size_t i = 0; i < a->size; i++) {
-        key_free(a->entries[i].key);
-        value_free(a->entries[i].value);
+    LX_HEAPPROF_FREE(a);
+    if (a->shared) {
+        array_free(a->shared);
+        lx_pool_free(a, sizeof(Array));
+        return;
+    }
+    if (g_free_depth > 0) {
+        array_destroy(a);
+        return;
     }
-    free(a->entries);
-    free(a);
+    g_free_work = 0;
+    g_free_budget = g_free_defer ? LX_FREE_SLICE_ENTRIES : LONG_MAX;
+    array_destroy(a);
+    if (!g_free_defer && array_free_pending) array_free_queued(-1);
+}
+
+void array_defer_frees(int on) {
+    g_free_defer = on && LX_FREE_SLICE_ENTRIES > 0;
+    if (g_free_defer) return;
+    array_free_queued(-1);
+    free(g_free_queue);
+    g_free_queue = NULL;
+    g_free_queue_cap = 0;
+}
+
+void array_free_step(void) {
+    if (array_free_pending) array_free_queued(g_free_defer ? LX_FREE_SLICE_ENTRIES : -1);
 }
 
 void array_unset(Array *a, Key k) {
@@ -168,6 +509,12 @@ void array_unset(Array *a, Key k) {
 
     for (size_t i = 0; i < a->size; i++) {
         if (key_eq(a->entries[i].key, k)) {
+            array_own(a);
+
+            /* Removing the largest integer key lowers the next index. */
+            if (a->entries[i].key.type == KEY_INT && a->entries[i].key.i + 1 == a->next_index) {
+                a->next_index = -1;
+            }
 
             /* Free key and value. */
             key_free(a->entries[i].key);
@@ -188,24 +535,25 @@ void array_unset(Array *a, Key k) {
     key_free(k);
 }
 
-Value *array_get_ref(Array *a, Key k) {
-    if (!a) { key_free(k); return NULL; }
+Value *array_slot(Array *a, Key k) {
+    if (!a) return NULL;
+    own_entries(a);
 
     for (size_t i = 0; i < a->size; i++) {
-        if (key_eq(a->entries[i].key, k)) {
-            key_free(k);
-            return &a->entries[i].value;
-        }
+        if (key_eq(a->entries[i].key, k)) return &a->entries[i].value;
     }
 
     /* Missing key: create slot. */
-    if (!ensure(a, a->size + 1)) {
-        key_free(k);
-        return NULL;
-    }
+    if (!ensure(a, a->size + 1)) return NULL;
     a->entries[a->size].key = key_copy(k);
     a->entries[a->size].value = value_undefined();
-    key_free(k);
+    note_key(a, k);
 
     return &a->entries[a->size++].value;
 }
+
+Value *array_get_ref(Array *a, Key k) {
+    Value *slot = array_slot(a, k);
+    key_free(k);
+    return slot;
+}
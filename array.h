@@ -25,41 +25,131 @@ typedef struct {
     Value value;  /**< Entry value. */
 } ArrayEntry;
 
+/**
+ * Key layout shared by record-like arrays: the same string keys in the
+ * same order. Entries of a shaped array borrow their key strings from
+ * the shape. Any change to the key set or order drops the shape first.
+ */
+typedef struct ArrayShape {
+    int refcount;        /**< Arrays and builders holding this shape. */
+    unsigned long id;    /**< Never reused; identifies the shape in caches. */
+    size_t count;        /**< Number of keys. */
+    char **keys;         /**< Owned key strings. */
+} ArrayShape;
+
+/** Inline cache for repeated lookups of one constant key. */
+typedef struct {
+    unsigned long shape_id; /**< Shape the cached position belongs to (0: none). */
+    size_t pos;             /**< Entry position of the key last time. */
+} ArrayIC;
+
 /** Dynamic array backing store. */
 struct Array {
     size_t size;         /**< Number of live entries. */
     size_t capacity;     /**< Allocated entry capacity. */
     ArrayEntry *entries; /**< Entry storage. */
     int refcount;        /**< Reference count for shared arrays. */
-    int gc_mark;         /**< Mark bit used by GC. */
+    int gc_mark;         /**< GC color: 0 untracked, else black or white for the current cycle. */
+    int gc_grey;         /**< 1 + position on the GC grey stack, or 0. */
+    int gc_refs;         /**< GC scratch: references not explained by unreachable arrays. */
+    int gc_cand;         /**< 1 + position in the cycle candidate buffer, or 0. */
+    unsigned gc_color;   /**< Trial deletion color, tagged with the collection it belongs to. */
     struct Array *gc_next; /**< Next array in GC list. */
+    struct Array *gc_prev; /**< Previous array in GC list (NULL at the head). */
+    struct Array *shared; /**< Constant array whose entries are read until the first write. */
+    ArrayShape *shape;   /**< Shared key layout, or NULL. */
+    lx_int_t next_index; /**< array_next_index(), or -1 until it is recomputed. */
 };
 
 /** @return An integer key wrapper. */
 Key   key_int(lx_int_t i);
 /** @return A string key wrapper (owned copy). */
 Key   key_string(const char *s);
+/** Release the string owned by @p k, if any. */
+void  key_free(Key k);
 
 /** @return A new empty array with refcount 1. */
 Array *array_new(void);
 /** Retain an array reference. */
 void   array_retain(Array *a);
+/**
+ * @return A new array that reads the entries of @p src until it is first
+ * written (see array_own). @p src holds only scalar and string values and
+ * must not be modified while shared.
+ */
+Array *array_share(Array *src);
+/**
+ * Give @p a a private copy of entries it still shares with a constant
+ * array, and private copies of keys borrowed from its shape. Every write
+ * to @p a, including direct edits of a->entries, must be preceded by this
+ * call; the array_* mutators already do it.
+ */
+void   array_own(Array *a);
+
+/** @return A new shape holding copies of @p count string @p keys. */
+ArrayShape *array_shape_new(const char *const *keys, size_t count);
+/** Release a reference to @p s. */
+void   array_shape_release(ArrayShape *s);
+/** @return A new array with one entry per key of @p s, values undefined. */
+Array *array_new_shaped(ArrayShape *s);
+/**
+ * Let @p a borrow its keys from @p *hint when both have the same string
+ * keys in the same order; otherwise move the keys of @p a into a new
+ * shape stored in @p *hint. Builders pass the same hint for every row
+ * and release it with array_shape_release when done.
+ */
+void   array_adopt_shape(Array *a, ArrayShape **hint);
+/** Grow the entry storage of @p a to at least @p n entries. @return Non-zero on success. */
+int    array_reserve(Array *a, size_t n);
 /** @return A shallow copy of entries (arrays retained). */
 Array *array_copy(Array *a);
 /** Release a reference to @p a. */
 void   array_free(Array *a);
+/**
+ * While @p on, dropping an array frees at most LX_FREE_SLICE_ENTRIES
+ * entries at once and queues the rest for array_free_step(). Hosts turn
+ * this on while a script runs; turning it off frees everything queued.
+ */
+void   array_defer_frees(int on);
+/** Safepoint: free one slice of the queued arrays. */
+void   array_free_step(void);
+/** Number of arrays waiting in the free queue (checked before array_free_step()). */
+extern size_t array_free_pending;
 
 /** @return A copy of the value for @p k (undefined if missing). */
 Value  array_get(Array *a, Key k);
+/** @return Pointer to the existing value slot for @p k, or NULL. @p k is borrowed. */
+Value *array_lookup(Array *a, Key k);
+/**
+ * array_lookup for a key that is the same on every call with @p ic: the
+ * position found last time is tried first, without comparing keys when
+ * @p a still has the shape it was found in.
+ */
+Value *array_lookup_cached(Array *a, Key k, ArrayIC *ic);
 /** @return Pointer to the value slot for @p k (creates if missing). */
 Value *array_get_ref(Array *a, Key k);
+/** Like array_get_ref, but @p k is borrowed (copied only when inserted). */
+Value *array_slot(Array *a, Key k);
 /** Store @p v under @p k, taking ownership of @p v. */
 void   array_set(Array *a, Key k, Value v);
+/** Append @p v under the next numeric index, taking ownership of @p v. */
+void   array_push(Array *a, Value v);
+/**
+ * Append @p v under @p k without searching for an existing entry; the
+ * caller guarantees @p k is not present. Takes ownership of @p k and @p v.
+ */
+void   array_append(Array *a, Key k, Value v);
 
 /** @return Number of entries in @p a. */
 size_t array_len(Array *a);
-/** @return Next numeric index after the largest integer key. */
+/** @return Next numeric index after the largest integer key (cached, O(1) when appending). */
 lx_int_t array_next_index(Array *a);
+/**
+ * Call after changing the integer keys of @p a other than through the
+ * array_* functions (direct edits of a->entries), so array_next_index()
+ * recomputes them.
+ */
+void     array_keys_changed(Array *a);
 
 /** Remove the entry for @p k if present. */
 void array_unset(Array *a, Key k);
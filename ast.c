@@ -1,4 +1,8 @@
 #include "ast.h"
+#include "array.h"
+#if !defined(LX_TARGET_LXSH) || !LX_TARGET_LXSH
+#include "vm.h"
+#endif
 
 #include <stdlib.h>
 
@@ -69,10 +73,15 @@ void ast_free(AstNode *node) {
                 }
                 free(node->switch_stmt.case_bodies);
             }
+            free(node->switch_stmt.jump);
             break;
         case AST_GLOBAL:
             ast_free_strings(node->global_stmt.names, node->global_stmt.count);
             break;
+        case AST_CONST_DECL:
+            free(node->const_decl.name);
+            ast_free(node->const_decl.value);
+            break;
         case AST_FUNCTION:
             free(node->func.name);
             if (node->func.params) {
@@ -87,6 +96,7 @@ void ast_free(AstNode *node) {
                 }
                 free(node->func.param_defaults);
             }
+            free(node->func.param_types);
             ast_free(node->func.body);
             break;
         case AST_RETURN:
@@ -137,6 +147,7 @@ void ast_free(AstNode *node) {
         case AST_INDEX:
             ast_free(node->index.target);
             ast_free(node->index.index);
+            free(node->index.lval);
             break;
         case AST_PRE_INC:
         case AST_PRE_DEC:
@@ -157,6 +168,7 @@ void ast_free(AstNode *node) {
                 }
                 free(node->array.values);
             }
+            array_free(node->array.shared);
             break;
         case AST_TERNARY:
             ast_free(node->ternary.cond);
@@ -169,6 +181,9 @@ void ast_free(AstNode *node) {
             break;
         case AST_MAGIC_FUNCTION:
             break;
+        case AST_CONST:
+            free(node->constant.name);
+            break;
         case AST_LITERAL:
             switch (node->literal.token.type) {
                 case TOK_STRING:
@@ -185,5 +200,339 @@ void ast_free(AstNode *node) {
             break;
     }
 
+#if !defined(LX_TARGET_LXSH) || !LX_TARGET_LXSH
+    if (node->vm_code) vm_code_free(node->vm_code);
+#endif
     free(node);
 }
+
+static void visit_list(AstNode **items, int count, AstVisitFn fn, void *ctx) {
+    if (!items) return;
+    for (int i = 0; i < count; i++) {
+        if (items[i]) fn(&items[i], ctx);
+    }
+}
+
+#define VISIT(child) do { if (child) fn(&(child), ctx); } while (0)
+
+void ast_visit_children(AstNode *node, AstVisitFn fn, void *ctx) {
+    if (!node || !fn) return;
+
+    switch (node->type) {
+        case AST_PROGRAM:
+        case AST_BLOCK:
+            visit_list(node->block.items, node->block.count, fn, ctx);
+            break;
+        case AST_EXPR_STMT:
+            VISIT(node->expr_stmt.expr);
+            break;
+        case AST_IF:
+            VISIT(node->if_stmt.cond);
+            VISIT(node->if_stmt.then_branch);
+            VISIT(node->if_stmt.else_branch);
+            break;
+        case AST_WHILE:
+            VISIT(node->while_stmt.cond);
+            VISIT(node->while_stmt.body);
+            break;
+        case AST_FOR:
+            VISIT(node->for_stmt.init);
+            VISIT(node->for_stmt.cond);
+            VISIT(node->for_stmt.step);
+            VISIT(node->for_stmt.body);
+            break;
+        case AST_FOREACH:
+            VISIT(node->foreach_stmt.iterable);
+            VISIT(node->foreach_stmt.body);
+            break;
+        case AST_DO_WHILE:
+            VISIT(node->do_while_stmt.body);
+            VISIT(node->do_while_stmt.cond);
+            break;
+        case AST_SWITCH:
+            VISIT(node->switch_stmt.expr);
+            VISIT(node->switch_stmt.strict_expr);
+            visit_list(node->switch_stmt.case_exprs, node->switch_stmt.case_count, fn, ctx);
+            visit_list(node->switch_stmt.case_bodies, node->switch_stmt.case_count, fn, ctx);
+            break;
+        case AST_CONST_DECL:
+            VISIT(node->const_decl.value);
+            break;
+        case AST_FUNCTION:
+            visit_list(node->func.param_defaults, node->func.param_count, fn, ctx);
+            VISIT(node->func.body);
+            break;
+        case AST_RETURN:
+            VISIT(node->ret.value);
+            break;
+        case AST_UNSET:
+            VISIT(node->unset.target);
+            break;
+        case AST_INDEX_ASSIGN:
+            VISIT(node->index_assign.target);
+            VISIT(node->index_assign.value);
+            break;
+        case AST_ASSIGN:
+            VISIT(node->assign.value);
+            break;
+        case AST_ASSIGN_DYNAMIC:
+            VISIT(node->assign_dynamic.name_expr);
+            VISIT(node->assign_dynamic.value);
+            break;
+        case AST_INDEX_APPEND:
+            VISIT(node->index_append.target);
+            break;
+        case AST_DESTRUCT_ASSIGN:
+            visit_list(node->destruct_assign.targets, node->destruct_assign.target_count, fn, ctx);
+            VISIT(node->destruct_assign.value);
+            break;
+        case AST_VAR_DYNAMIC:
+            VISIT(node->var_dynamic.expr);
+            break;
+        case AST_BINARY:
+            VISIT(node->binary.left);
+            VISIT(node->binary.right);
+            break;
+        case AST_UNARY:
+            VISIT(node->unary.expr);
+            break;
+        case AST_CALL:
+            visit_list(node->call.args, node->call.argc, fn, ctx);
+            break;
+        case AST_INDEX:
+            VISIT(node->index.target);
+            VISIT(node->index.index);
+            break;
+        case AST_PRE_INC:
+        case AST_PRE_DEC:
+        case AST_POST_INC:
+        case AST_POST_DEC:
+            VISIT(node->incdec.target);
+            break;
+        case AST_ARRAY_LITERAL:
+            visit_list(node->array.keys, node->array.count, fn, ctx);
+            visit_list(node->array.values, node->array.count, fn, ctx);
+            break;
+        case AST_TERNARY:
+            VISIT(node->ternary.cond);
+            VISIT(node->ternary.then_expr);
+            VISIT(node->ternary.else_expr);
+            break;
+        case AST_NULL_COALESCE:
+            VISIT(node->null_coalesce.left);
+            VISIT(node->null_coalesce.right);
+            break;
+        default:
+            break;
+    }
+}
+
+#undef VISIT
+
+static const char *ast_type_name(AstType t) {
+    switch (t) {
+        case AST_PROGRAM: return "PROGRAM";
+        case AST_BLOCK: return "BLOCK";
+        case AST_EXPR_STMT: return "EXPR_STMT";
+        case AST_IF: return "IF";
+        case AST_WHILE: return "WHILE";
+        case AST_FOR: return "FOR";
+        case AST_FOREACH: return "FOREACH";
+        case AST_DO_WHILE: return "DO_WHILE";
+        case AST_SWITCH: return "SWITCH";
+        case AST_GLOBAL: return "GLOBAL";
+        case AST_CONST_DECL: return "CONST_DECL";
+        case AST_FUNCTION: return "FUNCTION";
+        case AST_RETURN: return "RETURN";
+        case AST_BREAK: return "BREAK";
+        case AST_CONTINUE: return "CONTINUE";
+        case AST_UNSET: return "UNSET";
+        case AST_INDEX_ASSIGN: return "INDEX_ASSIGN";
+        case AST_ASSIGN: return "ASSIGN";
+        case AST_ASSIGN_DYNAMIC: return "ASSIGN_DYNAMIC";
+        case AST_INDEX_APPEND: return "INDEX_APPEND";
+        case AST_DESTRUCT_ASSIGN: return "DESTRUCT_ASSIGN";
+        case AST_VAR: return "VAR";
+        case AST_VAR_DYNAMIC: return "VAR_DYNAMIC";
+        case AST_BINARY: return "BINARY";
+        case AST_UNARY: return "UNARY";
+        case AST_CALL: return "CALL";
+        case AST_INDEX: return "INDEX";
+        case AST_PRE_INC: return "PRE_INC";
+        case AST_PRE_DEC: return "PRE_DEC";
+        case AST_POST_INC: return "POST_INC";
+        case AST_POST_DEC: return "POST_DEC";
+        case AST_ARRAY_LITERAL: return "ARRAY";
+        case AST_TERNARY: return "TERNARY";
+        case AST_NULL_COALESCE: return "NULL_COALESCE";
+        case AST_MAGIC_FUNCTION: return "MAGIC_FUNCTION";
+        case AST_CONST: return "CONST";
+        case AST_LITERAL: return "LITERAL";
+    }
+    return "?";
+}
+
+static const char *ast_op_name(Operator op) {
+    switch (op) {
+        case OP_ADD: return "+";
+        case OP_SUB: return "-";
+        case OP_MUL: return "*";
+        case OP_DIV: return "/";
+        case OP_MOD: return "%";
+        case OP_POW: return "**";
+        case OP_CONCAT: return ".";
+        case OP_ASSIGN: return "=";
+        case OP_EQ: return "==";
+        case OP_NEQ: return "!=";
+        case OP_SEQ: return "===";
+        case OP_SNEQ: return "!==";
+        case OP_LT: return "<";
+        case OP_LTE: return "<=";
+        case OP_GT: return ">";
+        case OP_GTE: return ">=";
+        case OP_AND: return "&&";
+        case OP_OR: return "||";
+        case OP_NOT: return "!";
+        case OP_BIT_AND: return "&";
+        case OP_BIT_OR: return "|";
+        case OP_BIT_XOR: return "^";
+        case OP_BIT_NOT: return "~";
+        case OP_SHL: return "<<";
+        case OP_SHR: return ">>";
+    }
+    return "?";
+}
+
+const char *ast_type_hint_name(TypeHint t) {
+    switch (t) {
+        case TYPE_ANY: return "mixed";
+        case TYPE_INT: return "int";
+        case TYPE_FLOAT: return "float";
+        case TYPE_BOOL: return "bool";
+        case TYPE_STRING: return "string";
+        case TYPE_ARRAY: return "array";
+        case TYPE_BLOB: return "blob";
+    }
+    return "?";
+}
+
+static void ast_dump_string(const char *s, FILE *out) {
+    fputc('"', out);
+    for (; s && *s; s++) {
+        unsigned char c = (unsigned char)*s;
+        if (c == '"' || c == '\\') fprintf(out, "\\%c", c);
+        else if (c == '\n') fputs("\\n", out);
+        else if (c == '\r') fputs("\\r", out);
+        else if (c == '\t') fputs("\\t", out);
+        else if (c < 0x20 || c == 0x7f) fprintf(out, "\\x%02x", c);
+        else fputc(c, out);
+    }
+    fputc('"', out);
+}
+
+static void ast_dump_literal(const Token *t, FILE *out) {
+    switch (t->type) {
+        case TOK_INT: fprintf(out, "%lld", (long long)t->int_val); break;
+        case TOK_FLOAT: fprintf(out, "%.17g", t->float_val); break;
+        case TOK_STRING:
+        case TOK_DSTRING: ast_dump_string(t->string_val, out); break;
+        case TOK_TRUE: fputs("true", out); break;
+        case TOK_FALSE: fputs("false", out); break;
+        case TOK_NULL: fputs("null", out); break;
+        case TOK_UNDEFINED: fputs("undefined", out); break;
+        case TOK_VOID: fputs("void", out); break;
+        case TOK_ARRAY: fputs("[]", out); break;
+        default: fputs("?", out); break;
+    }
+}
+
+typedef struct {
+    FILE *out;
+    int depth;
+} AstDumpCtx;
+
+static void ast_dump_slot(AstNode **slot, void *ctx);
+
+static void ast_dump_node(AstNode *node, AstDumpCtx *d) {
+    FILE *out = d->out;
+
+    fprintf(out, "%*s%s", d->depth * 2, "", ast_type_name(node->type));
+    switch (node->type) {
+        case AST_BLOCK:
+        case AST_PROGRAM:
+            fprintf(out, " (%d)", node->block.count);
+            break;
+        case AST_FOREACH:
+            if (node->foreach_stmt.key_name) fprintf(out, " $%s =>", node->foreach_stmt.key_name);
+            fprintf(out, node->foreach_stmt.by_ref ? " &$%s" : " $%s",
+                    node->foreach_stmt.value_name);
+            break;
+        case AST_GLOBAL:
+            for (int i = 0; i < node->global_stmt.count; i++) {
+                fprintf(out, " $%s", node->global_stmt.names[i]);
+            }
+            break;
+        case AST_FUNCTION:
+            fprintf(out, " %s(", node->func.name);
+            for (int i = 0; i < node->func.param_count; i++) {
+                TypeHint t = node->func.param_types ? node->func.param_types[i] : TYPE_ANY;
+                fprintf(out, "%s", i ? ", " : "");
+                if (t != TYPE_ANY) fprintf(out, "%s ", ast_type_hint_name(t));
+                fprintf(out, "$%s", node->func.params[i]);
+            }
+            fputc(')', out);
+            if (node->func.ret_type != TYPE_ANY) fprintf(out, ": %s", ast_type_hint_name(node->func.ret_type));
+            break;
+        case AST_INDEX_ASSIGN:
+            if (node->index_assign.is_compound) fprintf(out, " %s=", ast_op_name(node->index_assign.op));
+            break;
+        case AST_ASSIGN:
+            fprintf(out, " $%s", node->assign.name);
+            if (node->assign.is_compound) fprintf(out, " %s=", ast_op_name(node->assign.op));
+            break;
+        case AST_ASSIGN_DYNAMIC:
+            if (node->assign_dynamic.is_compound) fprintf(out, " %s=", ast_op_name(node->assign_dynamic.op));
+            break;
+        case AST_VAR:
+            fprintf(out, " $%s", node->var.name);
+            break;
+        case AST_CONST:
+            fprintf(out, " %s", node->constant.name);
+            break;
+        case AST_CONST_DECL:
+            fprintf(out, " %s", node->const_decl.name);
+            break;
+        case AST_BINARY:
+            fprintf(out, " %s", ast_op_name(node->binary.op));
+            break;
+        case AST_UNARY:
+            fprintf(out, " %s", ast_op_name(node->unary.op));
+            break;
+        case AST_CALL:
+            fprintf(out, " %s", node->call.name ? node->call.name : "?");
+            break;
+        case AST_ARRAY_LITERAL:
+            fprintf(out, " (%d)", node->array.count);
+            break;
+        case AST_LITERAL:
+            fputc(' ', out);
+            ast_dump_literal(&node->literal.token, out);
+            break;
+        default:
+            break;
+    }
+    fputc('\n', out);
+
+    d->depth++;
+    ast_visit_children(node, ast_dump_slot, d);
+    d->depth--;
+}
+
+static void ast_dump_slot(AstNode **slot, void *ctx) {
+    ast_dump_node(*slot, (AstDumpCtx *)ctx);
+}
+
+void ast_dump(AstNode *node, FILE *out) {
+    AstDumpCtx d = { out, 0 };
+    if (node) ast_dump_node(node, &d);
+}
@@ -6,6 +6,10 @@
 #define AST_H
 
 #include "lexer.h"
+#include "value.h"
+#include "array.h"
+
+#include <stdio.h>
 
 /** AST node kinds. */
 typedef enum {
@@ -20,6 +24,7 @@ typedef enum {
     AST_DO_WHILE,
     AST_SWITCH,
     AST_GLOBAL,
+    AST_CONST_DECL,
 
     AST_FUNCTION,
     AST_RETURN,
@@ -52,6 +57,7 @@ typedef enum {
     AST_NULL_COALESCE,
 
     AST_MAGIC_FUNCTION,
+    AST_CONST,
 
     AST_LITERAL
 } AstType;
@@ -76,9 +82,26 @@ typedef enum {
     OP_SHL, OP_SHR
 } Operator;
 
+/** Declared parameter or return type of a function; TYPE_ANY when omitted. */
+typedef enum {
+    TYPE_ANY = 0,
+    TYPE_INT,
+    TYPE_FLOAT,
+    TYPE_BOOL,
+    TYPE_STRING,
+    TYPE_ARRAY,
+    TYPE_BLOB
+} TypeHint;
+
 /** Forward declaration for AST nodes. */
 typedef struct AstNode AstNode;
 
+struct Env;
+struct NativeDef;
+
+/** Specialized expression handler installed by the lowering pass (lower.c). */
+typedef Value (*AstExecFn)(AstNode *n, struct Env *env, int *ok_flag);
+
 /**
  * AST node container. The active union field depends on @p type.
  */
@@ -86,6 +109,19 @@ struct AstNode {
     AstType type;
     int line;
     int col;
+    struct VmCode *vm_code; /* compiled bytecode cache (function bodies) */
+
+    /* Closure-compiled evaluation (lower.c); exec is NULL for generic nodes. */
+    AstExecFn exec;
+    int slot_hint;          /* env binding cache for variable reads */
+    const struct NativeDef *native; /* call nodes: resolved native, NULL for user functions */
+    unsigned native_gen;    /* registry generation @p native was resolved at */
+
+    /* Type feedback for binary and index nodes (eval.c). */
+    unsigned char fb_kind;  /* operand class observed so far */
+    unsigned char fb_hits;  /* consecutive observations of fb_kind */
+    unsigned char fb_deopts; /* guard failures after quickening */
+    ArrayIC ic;             /* record shape cache for constant string-key reads */
 
     union {
         /* program / block */
@@ -124,6 +160,7 @@ struct AstNode {
             AstNode *cond;
             AstNode *step;
             AstNode *body;
+            int counted;    /* counted-loop analysis (eval.c), 0 = not done */
         } for_stmt;
 
         /* foreach */
@@ -132,6 +169,7 @@ struct AstNode {
             char *key_name;   /* may be NULL */
             char *value_name;
             AstNode *body;
+            int by_ref;       /* foreach ($a as &$v) */
         } foreach_stmt;
 
         /* switch */
@@ -141,6 +179,8 @@ struct AstNode {
             AstNode **case_exprs;  /* NULL for default */
             AstNode **case_bodies; /* AST_BLOCK */
             int case_count;
+            struct SwitchJump *jump; /* case lookup table (eval.c), single allocation */
+            int jump_checked;        /* non-zero once @p jump has been considered */
         } switch_stmt;
 
         /* global */
@@ -149,18 +189,27 @@ struct AstNode {
             int count;
         } global_stmt;
 
+        /* const declaration */
+        struct {
+            char *name;
+            AstNode *value;
+        } const_decl;
+
         /* function */
         struct {
             char *name;
             char **params;
             AstNode **param_defaults;
+            TypeHint *param_types; /* NULL when no parameter is typed */
             int param_count;
+            TypeHint ret_type;
             AstNode *body;
         } func;
 
         /* return */
         struct {
             AstNode *value;   /* may be NULL */
+            int tail;         /* value is a call in tail position of a function body (eval.c) */
         } ret;
 
         /* unset */
@@ -204,6 +253,11 @@ struct AstNode {
             char *name;
         } var;
 
+        /* constant reference (bare name) */
+        struct {
+            char *name;
+        } constant;
+
         /* dynamic variable */
         struct {
             AstNode *expr;
@@ -233,6 +287,7 @@ struct AstNode {
         struct {
             AstNode *target;
             AstNode *index;
+            struct LvalPath *lval; /* cached assignment path (eval.c) */
         } index;
 
         /* index append */
@@ -250,6 +305,8 @@ struct AstNode {
             AstNode **keys;   /* NULL for auto index */
             AstNode **values;
             int count;
+            struct Array *shared; /* prebuilt constant literal (eval.c) */
+            int shared_checked;
         } array;
 
         /* ternary */
@@ -274,4 +331,16 @@ struct AstNode {
 
 void ast_free(AstNode *node);
 
+/** Callback for ast_visit_children; @p slot may be rewritten in place. */
+typedef void (*AstVisitFn)(AstNode **slot, void *ctx);
+
+/** Call @p fn on the address of each non-NULL direct child of @p node. */
+void ast_visit_children(AstNode *node, AstVisitFn fn, void *ctx);
+
+/** @return The source spelling of @p t ("int", "float", ...), or "mixed" for TYPE_ANY. */
+const char *ast_type_hint_name(TypeHint t);
+
+/** Print @p node and its children to @p out, one indented node per line. */
+void ast_dump(AstNode *node, FILE *out);
+
 #endif /* AST_H */
@@ -0,0 +1,33 @@
+#!/bin/sh
+# Run every benchmark under each execution engine and report wall time.
+# Usage: ./run_bench.sh [engine ...]   (default: ast closure vm)
+
+LX=${LX:-../lx}
+ENGINES=${*:-"ast closure vm"}
+
+now() {
+    date +%s.%N
+}
+
+printf "%-20s" "benchmark"
+for e in $ENGINES; do printf "%12s" "$e"; done
+printf "\n"
+
+for b in *.lx; do
+    printf "%-20s" "${b%.lx}"
+    ref=""
+    for e in $ENGINES; do
+        start=$(now)
+        # Scripts are fed on stdin so the run does not depend on a tty.
+        res=$($LX --engine="$e" < "$b" 2>&1)
+        end=$(now)
+        if [ -z "$ref" ]; then
+            ref=$res
+        elif [ "$res" != "$ref" ]; then
+            printf "%12s" "MISMATCH"
+            continue
+        fi
+        awk -v s="$start" -v e="$end" 'BEGIN { printf "%11.3fs", e - s }'
+    done
+    printf "\n"
+done
@@ -39,6 +39,22 @@
 /* CGI error display (lx_cgi only). */
 #define LX_CGI_DISPLAY_ERRORS 1
 
+/* Allocate each request's values from a region that is dropped at once
+ * when the script ends (lx_cgi only; see LX_REGION_CHUNK_BYTES). */
+#define LX_CGI_REGION 0
+
+/* Memory limit of a request in bytes (lx_cgi only; 0 = unlimited). The
+ * LX_MEMORY_LIMIT environment variable overrides it, e.g. "64M". */
+#define LX_CGI_MEMORY_LIMIT (128 * 1024 * 1024)
+
+/* Longest collector pause a request should see, in milliseconds (lx_cgi
+ * only; see LX_GC_PAUSE_BUDGET_MS). */
+#define LX_CGI_GC_PAUSE_BUDGET_MS 2.0
+
+/* End the process once the response is written and the session saved,
+ * without freeing the request's values one by one (lx_cgi only). */
+#define LX_CGI_FAST_EXIT 1
+
 /* CGI session settings (lx_cgi only). */
 #define SESSION_NAME "LXSESSID"
 #define SESSION_FILE_PATH "/tmp"
@@ -50,6 +66,65 @@
 /* Timezone default (ext_time). Empty string keeps the system default. */
 #define LX_DEFAULT_TIMEZONE ""
 
+/* Chunk size of the pools for array, blob and environment headers (pool.c).
+ * 0 allocates every header with calloc (useful with sanitizers). */
+#if defined(LX_TARGET_LXSH) && LX_TARGET_LXSH
+#define LX_POOL_CHUNK_BYTES 4096
+#else
+#define LX_POOL_CHUNK_BYTES 65536
+#endif
+
+/* Growth of the accounted memory after which the platform heap is queried
+ * again by lx_memguard_check() (memguard.c). */
+#if defined(LX_TARGET_LXSH) && LX_TARGET_LXSH
+#define LX_MEMGUARD_POLL_BYTES 2048
+#else
+#define LX_MEMGUARD_POLL_BYTES 65536
+#endif
+
+/* Average number of bytes allocated between two samples of the heap
+ * profiler (heapprof.c, `--heap-profile`, LX_HEAP_PROFILE). */
+#if defined(LX_TARGET_LXSH) && LX_TARGET_LXSH
+#define LX_HEAP_PROFILE_SAMPLE_BYTES 16384
+#else
+#define LX_HEAP_PROFILE_SAMPLE_BYTES 524288
+#endif
+
+/* Collector defaults (gc.c, gc_tune()): the smallest trigger (candidate
+ * roots, or live arrays with --gc=trace), how fast the trigger grows with
+ * the work of the last collection, and the target for the longest pause
+ * in milliseconds (0 = no target, favour throughput). */
+#define LX_GC_THRESHOLD 1024
+#define LX_GC_GROWTH 2.0
+#define LX_GC_PAUSE_BUDGET_MS 0.0
+
+/* Parallel marking (gc.c, --gc=trace): threads that mark once at least
+ * LX_GC_PARALLEL_MARK_ARRAYS arrays are live. 0 or 1 builds without
+ * threads. */
+#if defined(LX_TARGET_LXSH) && LX_TARGET_LXSH
+#define LX_GC_MARK_THREADS 0
+#else
+#define LX_GC_MARK_THREADS 4
+#endif
+#define LX_GC_PARALLEL_MARK_ARRAYS 1048576
+
+/* Entries that dropping an array frees at once while a script runs
+ * (array.c); what is left of a larger array is freed in slices of this
+ * size at later safepoints. 0 frees everything at once. */
+#if defined(LX_TARGET_LXSH) && LX_TARGET_LXSH
+#define LX_FREE_SLICE_ENTRIES 0
+#else
+#define LX_FREE_SLICE_ENTRIES 32768
+#endif
+
+/* Chunk size of the request region (region.c, `--region`, LX_CGI_REGION).
+ * Must be a power of two; 0 turns regions off. */
+#if defined(LX_TARGET_LXSH) && LX_TARGET_LXSH
+#define LX_REGION_CHUNK_BYTES 16384
+#else
+#define LX_REGION_CHUNK_BYTES 1048576
+#endif
+
 /* 32 = int (assuming 32-bit int), 64 = long long */
 #define LX_INT_BITS 64
 
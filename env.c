@@ -3,6 +3,8 @@
  * @brief Environment implementation.
  */
 #include "env.h"
+#include "pool.h"
+#include "region.h"
 #include <stdlib.h>
 #include <string.h>
 
@@ -25,27 +27,40 @@ static int global_index(Env *e, const char *name);
 int env_is_global(Env *e, const char *name);
 
 Env *env_new(Env *parent){
-    Env *e = (Env*)calloc(1, sizeof(Env));
-    e->parent = parent;
+    Env *e = (Env*)lx_pool_alloc(sizeof(Env));
+    if (e) e->parent = parent;
     return e;
 }
 
 static void env_items_free(Env *e){
     for (int i=0;i<e->count;i++){
-        free(e->items[i].name);
+        lx_region_free(e->items[i].name);
         value_free(e->items[i].value);
     }
-    free(e->items);
+    lx_region_free(e->items);
 }
 
 void env_free(Env *e){
-    if (!e) return;
+    if (!e || lx_region_dead(e)) return;
     env_items_free(e);
     for (int i = 0; i < e->global_count; i++) {
-        free(e->globals[i]);
+        lx_region_free(e->globals[i]);
     }
-    free(e->globals);
-    free(e);
+    lx_region_free(e->globals);
+    lx_pool_free(e, sizeof(Env));
+}
+
+void env_clear(Env *e){
+    if (!e) return;
+    for (int i=0;i<e->count;i++){
+        lx_region_free(e->items[i].name);
+        value_free(e->items[i].value);
+    }
+    e->count = 0;
+    for (int i = 0; i < e->global_count; i++) {
+        lx_region_free(e->globals[i]);
+    }
+    e->global_count = 0;
 }
 
 static int find_local(Env *e, const char *name){
@@ -89,23 +104,38 @@ Value *env_get_ref(Env *e, const char *name){
         int idx = find_local(root, name);
         if (idx >= 0) return &root->items[idx].value;
         ensure(root, root->count + 1);
-        root->items[root->count].name = strdup(name);
+        root->items[root->count].name = lx_region_strdup(name);
         root->items[root->count].value = value_undefined();
         return &root->items[root->count++].value;
     }
     int idx = find_local(e, name);
     if (idx >= 0) return &e->items[idx].value;
     ensure(e, e->count+1);
-    e->items[e->count].name = strdup(name);
+    e->items[e->count].name = lx_region_strdup(name);
     e->items[e->count].value = value_undefined();
     return &e->items[e->count++].value;
 }
 
+Value *env_lookup(Env *e, const char *name, int *hint){
+    if (!e) return NULL;
+    if (e->global_count > 0 && env_is_global(e, name)) {
+        while (e->parent) e = e->parent;
+    }
+    int h = *hint;
+    if (h >= 0 && h < e->count && strcmp(e->items[h].name, name) == 0) {
+        return &e->items[h].value;
+    }
+    int idx = find_local(e, name);
+    if (idx < 0) return NULL;
+    *hint = idx;
+    return &e->items[idx].value;
+}
+
 static void ensure(Env *e, int need){
     if (e->cap >= need) return;
     int cap = e->cap ? e->cap : 16;
     while (cap < need) cap *= 2;
-    Binding *nb = (Binding*)realloc(e->items, cap*sizeof(Binding));
+    Binding *nb = (Binding*)lx_region_realloc(e->items, cap*sizeof(Binding));
     if (!nb) return;
     e->items = nb;
     e->cap = cap;
@@ -123,7 +153,7 @@ void env_set(Env *e, const char *name, Value v){
             return;
         }
         ensure(root, root->count+1);
-        root->items[root->count].name = strdup(name);
+        root->items[root->count].name = lx_region_strdup(name);
         root->items[root->count].value = v;
         root->count++;
         return;
@@ -135,7 +165,7 @@ void env_set(Env *e, const char *name, Value v){
         return;
     }
     ensure(e, e->count+1);
-    e->items[e->count].name = strdup(name);
+    e->items[e->count].name = lx_region_strdup(name);
     e->items[e->count].value = v;
     e->count++;
 }
@@ -147,7 +177,7 @@ void env_unset(Env *e, const char *name){
         while (root->parent) root = root->parent;
         int idx = find_local(root, name);
         if (idx < 0) return;
-        free(root->items[idx].name);
+        lx_region_free(root->items[idx].name);
         value_free(root->items[idx].value);
         for (int i=idx; i<root->count-1; i++){
             root->items[i] = root->items[i+1];
@@ -157,7 +187,7 @@ void env_unset(Env *e, const char *name){
     }
     int idx = find_local(e, name);
     if (idx < 0) return;
-    free(e->items[idx].name);
+    lx_region_free(e->items[idx].name);
     value_free(e->items[idx].value);
     for (int i=idx; i<e->count-1; i++){
         e->items[i] = e->items[i+1];
@@ -187,12 +217,12 @@ void env_add_global(Env *e, const char *name) {
     if (e->global_cap <= e->global_count) {
         int cap = e->global_cap ? e->global_cap * 2 : 8;
         while (cap <= e->global_count) cap *= 2;
-        char **nn = (char **)realloc(e->globals, (size_t)cap * sizeof(char *));
+        char **nn = (char **)lx_region_realloc(e->globals, (size_t)cap * sizeof(char *));
         if (!nn) return;
         e->globals = nn;
         e->global_cap = cap;
     }
-    e->globals[e->global_count++] = strdup(name);
+    e->globals[e->global_count++] = lx_region_strdup(name);
 }
 
 int env_is_global(Env *e, const char *name) {
@@ -10,10 +10,15 @@
 /** Opaque environment type. */
 typedef struct Env Env;
 
-/** Create a new environment with an optional @p parent. */
+/**
+ * Create a new environment with an optional @p parent.
+ * @return NULL, with the error set, when the memory limit or the heap refuses.
+ */
 Env  *env_new(Env *parent);
 /** Free an environment and all owned bindings. */
 void  env_free(Env *e);
+/** Drop every binding and global declaration of @p e, keeping its storage for reuse. */
+void  env_clear(Env *e);
 
 /** @return Non-zero if @p name exists in this environment chain. */
 int   env_has(Env *e, const char *name);
@@ -24,6 +29,11 @@ Value env_get(Env *e, const char *name);
  * Creates a local binding if none exists in the chain.
  */
 Value *env_get_ref(Env *e, const char *name);
+/**
+ * @return Pointer to the existing binding for @p name, or NULL.
+ * @p hint caches the binding slot between lookups; initialize it to -1.
+ */
+Value *env_lookup(Env *e, const char *name, int *hint);
 /** Set @p name to @p v, taking ownership of @p v. */
 void  env_set(Env *e, const char *name, Value v);
 /** Remove @p name from the current scope if present. */
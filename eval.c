@@ -8,6 +8,8 @@
 #include "env.h"
 #include "natives.h"
 #include "array.h"
+#include "memguard.h"
+#include "heapprof.h"
 #include "lx_error.h"
 #if defined(LX_TARGET_LXSH) && LX_TARGET_LXSH
 #include "lxsh_runtime.h"
@@ -23,22 +25,29 @@ typedef struct FunctionDef {
     char *name;
     char **params;
     AstNode **param_defaults;
+    TypeHint *param_types;
     int param_count;
+    TypeHint ret_type;
     AstNode *body;
+    int specialized;    /* body binaries seeded from the declared types */
+    const char *file;   /* defining file, recorded while heap profiling */
     struct FunctionDef *next;
 } FunctionDef;
 
 static FunctionDef *g_user_fns = NULL;
+static void mark_tail_calls(AstNode **slot, void *ctx);
 typedef struct FnFrame {
     const char *name;
+    FunctionDef *def;
     struct FnFrame *prev;
 } FnFrame;
 static FnFrame *g_fn_stack = NULL;
 
-static void push_fn(const char *name) {
+static void push_fn(FunctionDef *def) {
     FnFrame *f = (FnFrame *)calloc(1, sizeof(FnFrame));
     if (!f) return;
-    f->name = name ? name : "";
+    f->name = def->name ? def->name : "";
+    f->def = def;
     f->prev = g_fn_stack;
     g_fn_stack = f;
 }
@@ -54,6 +63,11 @@ static const char *current_fn_name(void) {
     return g_fn_stack ? g_fn_stack->name : "";
 }
 
+const char *eval_current_function(const char **file) {
+    if (file) *file = g_fn_stack && g_fn_stack->def ? g_fn_stack->def->file : NULL;
+    return current_fn_name();
+}
+
 static int array_contains_inner(Array *hay, Array *needle, Array ***visited, int *count, int *cap) {
     if (!hay || !needle) return 0;
     if (hay == needle) return 1;
@@ -104,8 +118,14 @@ static void register_user_fn(AstNode *func_node) {
     }
     f->params = func_node->func.params;
     f->param_defaults = func_node->func.param_defaults;
+    f->param_types = func_node->func.param_types;
     f->param_count = func_node->func.param_count;
+    f->ret_type = func_node->func.ret_type;
     f->body = func_node->func.body;
+    f->specialized = 0;
+    f->file = lx_heapprof_file();
+    AstNode *slot = f->body;
+    if (slot) mark_tail_calls(&slot, NULL);
 }
 
 static EvalResult ok(Value v) { EvalResult r; r.flow=FLOW_NORMAL; r.value=v; return r; }
@@ -114,6 +134,10 @@ static EvalResult brk(void) { EvalResult r; r.flow=FLOW_BREAK; r.value=value_voi
 static EvalResult cont(void) { EvalResult r; r.flow=FLOW_CONTINUE; r.value=value_void(); return r; }
 
 static Value eval_expr(AstNode *n, Env *env, int *ok_flag);
+static int body_mentions(AstNode *body, const char *name);
+static int coerce_to_type(TypeHint t, Value *v);
+static void specialize_typed_body(FunctionDef *f);
+static EvalBodyFn g_body_runner = NULL;
 
 static void runtime_error(AstNode *n, LxErrorCode code, const char *fmt, ...) {
     va_list ap;
@@ -139,6 +163,10 @@ static Value literal_to_value(Token t) {
     }
 }
 
+Value eval_literal(const Token *t) {
+    return literal_to_value(*t);
+}
+
 static int strict_equal(Value a, Value b) {
     if (a.type != b.type) return 0;
     switch (a.type) {
@@ -156,6 +184,8 @@ static int strict_equal(Value a, Value b) {
 }
 
 int weak_equal(Value a, Value b) {
+    if (a.type == VAL_INT && b.type == VAL_INT) return a.i == b.i;
+
     /* number == number */
     if (value_is_number(a) && value_is_number(b)) {
         return value_as_double(a) == value_as_double(b);
@@ -201,76 +231,104 @@ static Value do_concat(Value a, Value b) {
     Value sa = value_to_string(a);
     Value sb = value_to_string(b);
     size_t la = strlen(sa.s), lb = strlen(sb.s);
-    Value out = value_string_n("", la+lb);
-    memcpy(out.s, sa.s, la);
-    memcpy(out.s + la, sb.s, lb);
-    out.s[la+lb] = 0;
+    Value out = value_null();
+    if (lx_memguard_check(la + lb + 1)) {
+        out = value_string_n(NULL, la+lb);
+        if (out.type == VAL_STRING) {
+            memcpy(out.s, sa.s, la);
+            memcpy(out.s + la, sb.s, lb);
+            out.s[la+lb] = 0;
+        }
+    }
     value_free(sa); value_free(sb);
     return out;
 }
 
-static Value apply_assign_op(AstNode *n, Operator op, Value lhs, Value rhs) {
-    if (op == OP_CONCAT) {
-        Value out = do_concat(lhs, rhs);
-        value_free(lhs);
-        value_free(rhs);
-        return out;
+/*
+ * Arithmetic (+ - * / %) on integers. Results that do not fit lx_int_t,
+ * including LX_INT_MIN / -1, are promoted to float.
+ */
+static Value int_arith(AstNode *n, Operator op, lx_int_t x, lx_int_t y, int *ok_flag) {
+    lx_int_t r;
+    switch (op) {
+        case OP_ADD:
+            if (lx_add_overflow(x, y, &r)) return value_float((double)x + (double)y);
+            return value_int(r);
+        case OP_SUB:
+            if (lx_sub_overflow(x, y, &r)) return value_float((double)x - (double)y);
+            return value_int(r);
+        case OP_MUL:
+            if (lx_mul_overflow(x, y, &r)) return value_float((double)x * (double)y);
+            return value_int(r);
+        case OP_DIV:
+            if (y == 0) {
+                runtime_error(n, LX_ERR_DIV_ZERO, "division by zero");
+                *ok_flag = 0;
+                return value_null();
+            }
+            if (y == -1 && x == LX_INT_MIN) return value_float(-(double)x);
+            return value_int(x / y);
+        case OP_MOD:
+            if (y == 0) {
+                runtime_error(n, LX_ERR_MOD_ZERO, "modulo by zero");
+                *ok_flag = 0;
+                return value_null();
+            }
+            if (y == -1) return value_int(0);
+            return value_int(x % y);
+        default:
+            return value_int(0);
     }
+}
 
-    int lhs_isf = (lhs.type == VAL_FLOAT);
-    int rhs_isf = (rhs.type == VAL_FLOAT);
-    if (lhs.type == VAL_STRING) { Value t = value_to_float(lhs); value_free(lhs); lhs = t; lhs_isf = 1; }
-    if (rhs.type == VAL_STRING) { Value t = value_to_float(rhs); value_free(rhs); rhs = t; rhs_isf = 1; }
-
-    if (lhs_isf || rhs_isf) {
-        Value lf = value_to_float(lhs);
-        Value rf = value_to_float(rhs);
-        double res = 0.0;
-        if (op == OP_ADD) res = lf.f + rf.f;
-        if (op == OP_SUB) res = lf.f - rf.f;
-        if (op == OP_MUL) res = lf.f * rf.f;
-        if (op == OP_DIV) {
-            if (rf.f == 0.0) {
-                value_free(lhs);
-                value_free(rhs);
-                value_free(lf);
-                value_free(rf);
+/* Arithmetic (+ - * / %) on floats. */
+static Value float_arith(AstNode *n, Operator op, double x, double y, int *ok_flag) {
+    switch (op) {
+        case OP_ADD: return value_float(x + y);
+        case OP_SUB: return value_float(x - y);
+        case OP_MUL: return value_float(x * y);
+        case OP_DIV:
+            if (y == 0.0) {
                 runtime_error(n, LX_ERR_DIV_ZERO, "division by zero");
+                *ok_flag = 0;
                 return value_null();
             }
-            res = lf.f / rf.f;
-        }
-        Value out = value_float(res);
-        value_free(lhs);
-        value_free(rhs);
-        value_free(lf);
-        value_free(rf);
-        return out;
-    } else {
-        Value li = value_to_int(lhs);
-        Value ri = value_to_int(rhs);
-        int res = 0;
-        if (op == OP_ADD) res = li.i + ri.i;
-        if (op == OP_SUB) res = li.i - ri.i;
-        if (op == OP_MUL) res = li.i * ri.i;
-        if (op == OP_DIV) {
-            if (ri.i == 0) {
-                value_free(lhs);
-                value_free(rhs);
-                value_free(li);
-                value_free(ri);
-                runtime_error(n, LX_ERR_DIV_ZERO, "division by zero");
+            return value_float(x / y);
+        case OP_MOD:
+            if (y == 0.0) {
+                runtime_error(n, LX_ERR_MOD_ZERO, "modulo by zero");
+                *ok_flag = 0;
                 return value_null();
             }
-            res = li.i / ri.i;
-        }
-        Value out = value_int(res);
+            return value_float(fmod(x, y));
+        default:
+            return value_float(0.0);
+    }
+}
+
+static Value apply_assign_op(AstNode *n, Operator op, Value lhs, Value rhs) {
+    if (op == OP_CONCAT) {
+        Value out = do_concat(lhs, rhs);
         value_free(lhs);
         value_free(rhs);
-        value_free(li);
-        value_free(ri);
         return out;
     }
+
+    int ok_flag = 1;
+    Value out;
+    if (lhs.type == VAL_FLOAT || rhs.type == VAL_FLOAT ||
+        lhs.type == VAL_STRING || rhs.type == VAL_STRING) {
+        out = float_arith(n, op, value_as_double(lhs), value_as_double(rhs), &ok_flag);
+    } else {
+        out = int_arith(n, op, value_as_int(lhs), value_as_int(rhs), &ok_flag);
+    }
+    value_free(lhs);
+    value_free(rhs);
+    return out;
+}
+
+Value eval_assign_op(AstNode *n, Operator op, Value lhs, Value rhs) {
+    return apply_assign_op(n, op, lhs, rhs);
 }
 
 static Value incdec_value(Value cur, int delta) {
@@ -284,11 +342,10 @@ static Value incdec_value(Value cur, int delta) {
         value_free(cur);
         return out;
     }
-    Value i = value_to_int(cur);
-    Value out = value_int(i.i + delta);
-    value_free(i);
+    lx_int_t x = value_as_int(cur), r;
     value_free(cur);
-    return out;
+    if (lx_add_overflow(x, (lx_int_t)delta, &r)) return value_float((double)x + delta);
+    return value_int(r);
 }
 
 static char *eval_dynamic_name(AstNode *expr, Env *env, int *ok_flag) {
@@ -301,125 +358,248 @@ static char *eval_dynamic_name(AstNode *expr, Env *env, int *ok_flag) {
         *ok_flag = 0;
         return NULL;
     }
-    char *name = s.s;
-    s.s = NULL;
+    char *name = strdup(s.s);
     value_free(s);
     return name;
 }
 
-static Value *get_lvalue_ref(AstNode *target, Env *env, int *ok_flag, Value *out_base) {
-    if (target->type == AST_VAR) {
-        return env_get_ref(env, target->var.name);
+/* ---------- array literals ---------- */
+
+/*
+ * Implicit keys are always past every int key seen so far, so they are
+ * appended without searching the array. Literals made only of scalar and
+ * string literals are built once; each evaluation then returns a fresh
+ * array that reads the prebuilt entries until its first write.
+ */
+static Value build_array_literal(AstNode *n, Env *env, int *ok_flag) {
+    Value arrv = value_array();
+    lx_int_t next_index = 0;
+    array_reserve(arrv.a, (size_t)n->array.count);
+    for (int i = 0; i < n->array.count; i++) {
+        Value val = eval_expr(n->array.values[i], env, ok_flag);
+        if (!*ok_flag) { value_free(arrv); return value_null(); }
+
+        if (n->array.keys[i]) {
+            Value keyv = eval_expr(n->array.keys[i], env, ok_flag);
+            if (!*ok_flag) { value_free(val); value_free(arrv); return value_null(); }
+            if (keyv.type == VAL_STRING) {
+                array_set(arrv.a, key_string(keyv.s), val);
+            } else {
+                Value ki = value_to_int(keyv);
+                array_set(arrv.a, key_int(ki.i), val);
+                if (ki.i >= next_index) next_index = ki.i + 1;
+                value_free(ki);
+            }
+            value_free(keyv);
+        } else {
+            array_append(arrv.a, key_int(next_index++), val);
+        }
     }
-    if (target->type == AST_VAR_DYNAMIC) {
-        char *name = eval_dynamic_name(target->var_dynamic.expr, env, ok_flag);
-        if (!*ok_flag || !name) return NULL;
-        Value *slot = env_get_ref(env, name);
-        free(name);
-        return slot;
+    return arrv;
+}
+
+/* @return 1 if @p a and @p b have the same type and value (constants are scalars). */
+static int same_constant(Value a, Value b) {
+    if (a.type != b.type) return 0;
+    switch (a.type) {
+        case VAL_INT:    return a.i == b.i;
+        case VAL_FLOAT:  return a.f == b.f;
+        case VAL_BOOL:   return a.b == b.b;
+        case VAL_BYTE:   return a.byte == b.byte;
+        case VAL_STRING: return strcmp(a.s ? a.s : "", b.s ? b.s : "") == 0;
+        case VAL_NULL:   return 1;
+        default:         return 0;
     }
-    if (target->type != AST_INDEX) {
-        *ok_flag = 0;
-        return NULL;
+}
+
+static int is_scalar_literal(const AstNode *x) {
+    return x && x->type == AST_LITERAL && x->literal.token.type != TOK_ARRAY;
+}
+
+static void share_array_literal(AstNode *n, Env *env) {
+    n->array.shared_checked = 1;
+    if (n->array.count == 0) return;
+    for (int i = 0; i < n->array.count; i++) {
+        if (!is_scalar_literal(n->array.values[i])) return;
+        if (n->array.keys[i] && !is_scalar_literal(n->array.keys[i])) return;
     }
+    int ok_flag = 1;
+    Value arrv = build_array_literal(n, env, &ok_flag);
+    if (!ok_flag || lx_has_error() || arrv.type != VAL_ARRAY) {
+        value_free(arrv);
+        return;
+    }
+    /* owned by the node; the collector must never sweep it */
+    gc_unregister_array(arrv.a);
+    n->array.shared = arrv.a;
+}
+
+/* ---------- index lvalue paths ---------- */
+
+/*
+ * `$a[i][j]...[k]` used as an assignment target is flattened once into
+ * the base variable and its index expressions, outermost first, and
+ * cached on the outermost AST_INDEX node. Assignments then walk the path
+ * without building temporary index lists: string keys borrow the index
+ * value (or the index variable's own buffer) and are copied only when a
+ * new entry is inserted.
+ */
+struct LvalPath {
+    AstNode *base;      /* AST_VAR or AST_VAR_DYNAMIC */
+    int count;
+    int borrow_last;    /* last key may borrow across the assigned value (-1: unknown) */
+    AstNode *indices[]; /* indices[0] is applied to the base */
+};
+
+enum { LVAL_OK, LVAL_FAILED, LVAL_NOT_ARRAY };
 
+static struct LvalPath *lval_path(AstNode *target) {
+    if (target->index.lval) return target->index.lval;
+    int count = 0;
     AstNode *cur = target;
-    AstNode **indices = NULL;
-    int index_count = 0;
     while (cur && cur->type == AST_INDEX) {
-        indices = realloc(indices, sizeof(AstNode *) * (index_count + 1));
-        indices[index_count++] = cur->index.index;
+        count++;
         cur = cur->index.target;
     }
-    if (!cur || (cur->type != AST_VAR && cur->type != AST_VAR_DYNAMIC)) {
-        *ok_flag = 0;
-        free(indices);
-        return NULL;
+    if (!cur || (cur->type != AST_VAR && cur->type != AST_VAR_DYNAMIC)) return NULL;
+
+    struct LvalPath *p = (struct LvalPath *)malloc(sizeof(*p) + (size_t)count * sizeof(AstNode *));
+    if (!p) return NULL;
+    p->base = cur;
+    p->count = count;
+    p->borrow_last = -1;
+    cur = target;
+    for (int i = count - 1; i >= 0; i--) {
+        p->indices[i] = cur->index.index;
+        cur = cur->index.target;
     }
+    target->index.lval = p;
+    return p;
+}
 
-    char *dyn_name = NULL;
-    const char *varname = NULL;
-    if (cur->type == AST_VAR_DYNAMIC) {
-        dyn_name = eval_dynamic_name(cur->var_dynamic.expr, env, ok_flag);
-        if (!*ok_flag || !dyn_name) {
-            free(indices);
-            return NULL;
-        }
-        varname = dyn_name;
+/* Evaluate index @p ix into a borrowed key. A string key points into
+ * *tmp (released by the caller with value_free) or, when @p borrow is
+ * set, into the buffer of the variable named by @p ix, which stays valid
+ * only until that variable is next written. */
+static Key lval_key(AstNode *ix, Env *env, Value *tmp, int *ok_flag, int borrow) {
+    Key k;
+    *tmp = value_undefined();
+    if (borrow && ix->type == AST_VAR) {
+        Value *v = env_lookup(env, ix->var.name, &ix->slot_hint);
+        if (v && v->type == VAL_STRING && v->s) {
+            k.type = KEY_STRING;
+            k.s = v->s;
+            return k;
+        }
+        if (v && v->type == VAL_INT) {
+            k.type = KEY_INT;
+            k.i = v->i;
+            return k;
+        }
+    }
+    *tmp = eval_expr(ix, env, ok_flag);
+    if (tmp->type == VAL_STRING) {
+        k.type = KEY_STRING;
+        k.s = tmp->s ? tmp->s : "";
+    } else {
+        k.type = KEY_INT;
+        k.i = value_as_int(*tmp);
+    }
+    return k;
+}
+
+/* Load the base array of @p p, creating an empty one when the variable is
+ * unset or null. *name_out receives the evaluated name of a dynamic base
+ * (caller frees). */
+static Value lval_base(struct LvalPath *p, Env *env, int *ok_flag, char **name_out) {
+    const char *name;
+    *name_out = NULL;
+    if (p->base->type == AST_VAR_DYNAMIC) {
+        *name_out = eval_dynamic_name(p->base->var_dynamic.expr, env, ok_flag);
+        if (!*ok_flag || !*name_out) return value_undefined();
+        name = *name_out;
     } else {
-        varname = cur->var.name;
+        name = p->base->var.name;
     }
-    Value arrv = env_get(env, varname);
+    Value *bs = env_lookup(env, name, &p->base->slot_hint);
+    Value arrv = bs ? value_copy(*bs) : value_undefined();
     if (arrv.type == VAL_UNDEFINED || arrv.type == VAL_NULL) {
         arrv = value_array();
-        env_set(env, varname, value_copy(arrv));
-    }
-    if (arrv.type != VAL_ARRAY) {
-        *ok_flag = 0;
-        value_free(arrv);
-        free(indices);
-        free(dyn_name);
-        return NULL;
+        env_set(env, name, value_copy(arrv));
     }
+    return arrv;
+}
 
-    Array *current = arrv.a;
-    for (int i = index_count - 1; i > 0; i--) {
-        Value idx = eval_expr(indices[i], env, ok_flag);
-        if (!*ok_flag) { value_free(arrv); free(indices); free(dyn_name); return NULL; }
-
-        Value *slot = NULL;
-        if (idx.type == VAL_STRING) {
-            slot = array_get_ref(current, key_string(idx.s));
-        } else {
-            Value ii = value_to_int(idx);
-            slot = array_get_ref(current, key_int(ii.i));
-            value_free(ii);
-        }
-        value_free(idx);
-        if (!slot) {
-            value_free(arrv);
-            free(indices);
-            free(dyn_name);
-            return NULL;
-        }
+/* Follow all but the last index of @p p from @p a, turning missing or
+ * null entries into empty arrays. */
+static int lval_descend(struct LvalPath *p, Env *env, Array **a, int *ok_flag) {
+    Array *current = *a;
+    for (int i = 0; i < p->count - 1; i++) {
+        Value tmp;
+        Key k = lval_key(p->indices[i], env, &tmp, ok_flag, 1);
+        if (!*ok_flag) { value_free(tmp); return LVAL_FAILED; }
+        Value *slot = array_slot(current, k);
+        value_free(tmp);
+        if (!slot) return LVAL_FAILED;
 
         if (slot->type == VAL_UNDEFINED || slot->type == VAL_NULL) {
             Value nv = value_array();
             value_free(*slot);
             *slot = nv;
         }
-        if (slot->type != VAL_ARRAY) {
-            *ok_flag = 0;
-            value_free(arrv);
-            free(indices);
-            free(dyn_name);
-            return NULL;
-        }
+        if (slot->type != VAL_ARRAY) return LVAL_NOT_ARRAY;
         current = slot->a;
     }
+    *a = current;
+    return LVAL_OK;
+}
+
+static Value *get_lvalue_ref(AstNode *target, Env *env, int *ok_flag, Value *out_base) {
+    if (target->type == AST_VAR) {
+        return env_get_ref(env, target->var.name);
+    }
+    if (target->type == AST_VAR_DYNAMIC) {
+        char *name = eval_dynamic_name(target->var_dynamic.expr, env, ok_flag);
+        if (!*ok_flag || !name) return NULL;
+        Value *slot = env_get_ref(env, name);
+        free(name);
+        return slot;
+    }
+    struct LvalPath *p = (target->type == AST_INDEX) ? lval_path(target) : NULL;
+    if (!p) {
+        *ok_flag = 0;
+        return NULL;
+    }
 
-    Value last_idx = eval_expr(indices[0], env, ok_flag);
-    if (!*ok_flag) { value_free(arrv); free(indices); free(dyn_name); return NULL; }
+    char *dyn_name = NULL;
+    Value arrv = lval_base(p, env, ok_flag, &dyn_name);
+    free(dyn_name);
+    if (!*ok_flag) return NULL;
+    if (arrv.type != VAL_ARRAY) {
+        *ok_flag = 0;
+        value_free(arrv);
+        return NULL;
+    }
 
-    Value *slot = NULL;
-    if (last_idx.type == VAL_STRING) {
-        slot = array_get_ref(current, key_string(last_idx.s));
-    } else {
-        Value ii = value_to_int(last_idx);
-        slot = array_get_ref(current, key_int(ii.i));
-        value_free(ii);
+    Array *current = arrv.a;
+    int st = lval_descend(p, env, &current, ok_flag);
+    if (st != LVAL_OK) {
+        if (st == LVAL_NOT_ARRAY) *ok_flag = 0;
+        value_free(arrv);
+        return NULL;
     }
-    value_free(last_idx);
+
+    Value tmp;
+    Key k = lval_key(p->indices[p->count - 1], env, &tmp, ok_flag, 1);
+    if (!*ok_flag) { value_free(tmp); value_free(arrv); return NULL; }
+    Value *slot = array_slot(current, k);
+    value_free(tmp);
     if (!slot) {
         value_free(arrv);
-        free(indices);
-        free(dyn_name);
         return NULL;
     }
 
     *out_base = arrv;
-    free(indices);
-    free(dyn_name);
     return slot;
 }
 
@@ -488,6 +668,192 @@ static Value eval_index(Value target, Value index, Env *env, int *ok_flag) {
     return value_undefined();
 }
 
+/*
+ * Type feedback. Binary and index nodes evaluated by the generic path
+ * record the class of their operands. Once a node has seen the same class
+ * QUICKEN_AFTER times in a row it installs a specialized handler in
+ * AstNode::exec. The handler guards its operand types and deoptimizes back
+ * to the generic path on a miss; nodes that deoptimize too often stay
+ * generic.
+ */
+enum {
+    FB_NONE = 0,
+    FB_INT_INT,     /* both VAL_INT */
+    FB_FLOAT,       /* both numeric, at least one VAL_FLOAT */
+    FB_ARRAY_INT,   /* array[int] */
+    FB_ARRAY_STR,   /* array[string] */
+    FB_OTHER
+};
+
+#define QUICKEN_AFTER 8
+#define MAX_DEOPTS 4
+
+static Value quick_binary_int(AstNode *n, Env *env, int *ok_flag);
+static Value quick_binary_float(AstNode *n, Env *env, int *ok_flag);
+static Value quick_index(AstNode *n, Env *env, int *ok_flag);
+
+static int binary_class(Operator op, Value a, Value b) {
+    if (a.type == VAL_INT && b.type == VAL_INT) {
+        switch (op) {
+            case OP_ADD: case OP_SUB: case OP_MUL: case OP_DIV: case OP_MOD:
+            case OP_LT: case OP_LTE: case OP_GT: case OP_GTE:
+            case OP_EQ: case OP_NEQ: case OP_SEQ: case OP_SNEQ:
+                return FB_INT_INT;
+            default:
+                return FB_OTHER;
+        }
+    }
+    if ((a.type == VAL_FLOAT || a.type == VAL_INT) &&
+        (b.type == VAL_FLOAT || b.type == VAL_INT)) {
+        switch (op) {
+            case OP_ADD: case OP_SUB: case OP_MUL: case OP_DIV: case OP_MOD:
+            case OP_LT: case OP_LTE: case OP_GT: case OP_GTE:
+            case OP_EQ: case OP_NEQ:
+                return FB_FLOAT;
+            default:
+                return FB_OTHER;
+        }
+    }
+    return FB_OTHER;
+}
+
+static int record_feedback(AstNode *n, int kind) {
+    if (n->fb_deopts >= MAX_DEOPTS) return 0;
+    if (kind != n->fb_kind) {
+        n->fb_kind = (unsigned char)kind;
+        n->fb_hits = 0;
+    }
+    if (kind == FB_OTHER) return 0;
+    return ++n->fb_hits >= QUICKEN_AFTER;
+}
+
+static void binary_feedback(AstNode *n, Operator op, Value a, Value b) {
+    if (n->exec) return;
+    int kind = binary_class(op, a, b);
+    if (!record_feedback(n, kind)) return;
+    n->exec = (kind == FB_INT_INT) ? quick_binary_int : quick_binary_float;
+}
+
+static void index_feedback(AstNode *n, Value tgt, Value idx) {
+    if (n->exec) return;
+    int kind = FB_OTHER;
+    if (tgt.type == VAL_ARRAY && idx.type == VAL_INT) kind = FB_ARRAY_INT;
+    if (tgt.type == VAL_ARRAY && idx.type == VAL_STRING) kind = FB_ARRAY_STR;
+    if (record_feedback(n, kind)) n->exec = quick_index;
+}
+
+static void deoptimize(AstNode *n) {
+    n->exec = NULL;
+    n->fb_kind = FB_NONE;
+    n->fb_hits = 0;
+    if (n->fb_deopts < MAX_DEOPTS) n->fb_deopts++;
+}
+
+static Value quick_binary_int(AstNode *n, Env *env, int *ok_flag) {
+    Value a = eval_expr(n->binary.left, env, ok_flag);
+    if (!*ok_flag) return value_null();
+    Value b = eval_expr(n->binary.right, env, ok_flag);
+    if (!*ok_flag) { value_free(a); return value_null(); }
+    if (a.type != VAL_INT || b.type != VAL_INT) {
+        deoptimize(n);
+        return eval_binary_values(n, n->binary.op, a, b, ok_flag);
+    }
+    lx_int_t x = a.i, y = b.i;
+    switch (n->binary.op) {
+        case OP_ADD:
+        case OP_SUB:
+        case OP_MUL:
+        case OP_DIV:
+        case OP_MOD:
+            return int_arith(n, n->binary.op, x, y, ok_flag);
+        case OP_LT:   return value_bool(x <  y);
+        case OP_LTE:  return value_bool(x <= y);
+        case OP_GT:   return value_bool(x >  y);
+        case OP_GTE:  return value_bool(x >= y);
+        case OP_EQ:   return value_bool(x == y);
+        case OP_NEQ:  return value_bool(x != y);
+        case OP_SEQ:  return value_bool(x == y);
+        case OP_SNEQ: return value_bool(x != y);
+        default:
+            return eval_binary_values(n, n->binary.op, a, b, ok_flag);
+    }
+}
+
+static Value quick_binary_float(AstNode *n, Env *env, int *ok_flag) {
+    Value a = eval_expr(n->binary.left, env, ok_flag);
+    if (!*ok_flag) return value_null();
+    Value b = eval_expr(n->binary.right, env, ok_flag);
+    if (!*ok_flag) { value_free(a); return value_null(); }
+    if ((a.type != VAL_FLOAT && b.type != VAL_FLOAT) ||
+        (a.type != VAL_FLOAT && a.type != VAL_INT) ||
+        (b.type != VAL_FLOAT && b.type != VAL_INT)) {
+        deoptimize(n);
+        return eval_binary_values(n, n->binary.op, a, b, ok_flag);
+    }
+    double x = (a.type == VAL_FLOAT) ? a.f : (double)a.i;
+    double y = (b.type == VAL_FLOAT) ? b.f : (double)b.i;
+    switch (n->binary.op) {
+        case OP_ADD: return value_float(x + y);
+        case OP_SUB: return value_float(x - y);
+        case OP_MUL: return value_float(x * y);
+        case OP_DIV:
+            if (y == 0.0) {
+                runtime_error(n, LX_ERR_DIV_ZERO, "division by zero");
+                *ok_flag = 0;
+                return value_null();
+            }
+            return value_float(x / y);
+        case OP_MOD:
+            if (y == 0.0) {
+                runtime_error(n, LX_ERR_MOD_ZERO, "modulo by zero");
+                *ok_flag = 0;
+                return value_null();
+            }
+            return value_float(fmod(x, y));
+        case OP_LT:  return value_bool(x <  y);
+        case OP_LTE: return value_bool(x <= y);
+        case OP_GT:  return value_bool(x >  y);
+        case OP_GTE: return value_bool(x >= y);
+        case OP_EQ:  return value_bool(x == y);
+        case OP_NEQ: return value_bool(x != y);
+        default:
+            return eval_binary_values(n, n->binary.op, a, b, ok_flag);
+    }
+}
+
+static Value quick_index(AstNode *n, Env *env, int *ok_flag) {
+    Value tgt = eval_expr(n->index.target, env, ok_flag);
+    if (!*ok_flag) return value_null();
+    Value idx = eval_expr(n->index.index, env, ok_flag);
+    if (!*ok_flag) { value_free(tgt); return value_null(); }
+    Value out;
+    int kind = (tgt.type != VAL_ARRAY) ? FB_OTHER
+             : (idx.type == VAL_INT) ? FB_ARRAY_INT
+             : (idx.type == VAL_STRING) ? FB_ARRAY_STR
+             : FB_OTHER;
+    if (kind == n->fb_kind) {
+        Key k;
+        k.type = (kind == FB_ARRAY_INT) ? KEY_INT : KEY_STRING;
+        if (kind == FB_ARRAY_INT) k.i = idx.i;
+        else k.s = idx.s;
+        Value *slot = (kind == FB_ARRAY_STR && n->index.index->type == AST_LITERAL)
+                    ? array_lookup_cached(tgt.a, k, &n->ic)
+                    : array_lookup(tgt.a, k);
+        out = slot ? value_copy(*slot) : value_undefined();
+    } else {
+        deoptimize(n);
+        out = eval_index(tgt, idx, env, ok_flag);
+    }
+    value_free(tgt);
+    value_free(idx);
+    return out;
+}
+
+Value eval_index_value(Value target, Value index) {
+    int ok_flag = 1;
+    return eval_index(target, index, NULL, &ok_flag);
+}
+
 static Value eval_binary(AstNode *n, Operator op, AstNode *l, AstNode *r, Env *env, int *ok_flag) {
     /* short-circuit for && || handled here by evaluating left first */
     if (op == OP_AND) {
@@ -524,6 +890,11 @@ static Value eval_binary(AstNode *n, Operator op, AstNode *l, AstNode *r, Env *e
     Value b = eval_expr(r, env, ok_flag);
     if (!*ok_flag) { value_free(a); return value_null(); }
 
+    binary_feedback(n, op, a, b);
+    return eval_binary_values(n, op, a, b, ok_flag);
+}
+
+Value eval_binary_values(AstNode *n, Operator op, Value a, Value b, int *ok_flag) {
     Value out = value_null();
 
     switch (op) {
@@ -535,83 +906,18 @@ static Value eval_binary(AstNode *n, Operator op, AstNode *l, AstNode *r, Env *e
         case OP_SUB:
         case OP_MUL:
         case OP_DIV:
-        case OP_MOD: {
-            /* numeric promotion */
-            int a_isf = (a.type==VAL_FLOAT), b_isf = (b.type==VAL_FLOAT);
-            if (a.type==VAL_STRING) { Value t=value_to_float(a); value_free(a); a=t; a_isf=1; }
-            if (b.type==VAL_STRING) { Value t=value_to_float(b); value_free(b); b=t; b_isf=1; }
-            if (a_isf || b_isf) {
-                Value af = value_to_float(a);
-                Value bf = value_to_float(b);
-                double res = 0.0;
-                if (op==OP_ADD) res = af.f + bf.f;
-                if (op==OP_SUB) res = af.f - bf.f;
-                if (op==OP_MUL) res = af.f * bf.f;
-                if (op==OP_DIV) {
-                    if (bf.f == 0.0) {
-                        runtime_error(n, LX_ERR_DIV_ZERO, "division by zero");
-                        *ok_flag = 0;
-                        value_free(a);
-                        value_free(b);
-                        value_free(af);
-                        value_free(bf);
-                        return value_null();
-                    }
-                    res = af.f / bf.f;
-                }
-                if (op==OP_MOD) {
-                    if (bf.f == 0.0) {
-                        runtime_error(n, LX_ERR_MOD_ZERO, "modulo by zero");
-                        *ok_flag = 0;
-                        value_free(a);
-                        value_free(b);
-                        value_free(af);
-                        value_free(bf);
-                        return value_null();
-                    }
-                    res = fmod(af.f, bf.f);
-                }
-                out = value_float(res);
+        case OP_MOD:
+            /* numeric promotion: strings and floats make the result a float */
+            if (a.type == VAL_FLOAT || b.type == VAL_FLOAT ||
+                a.type == VAL_STRING || b.type == VAL_STRING) {
+                out = float_arith(n, op, value_as_double(a), value_as_double(b), ok_flag);
             } else {
-                Value ai = value_to_int(a);
-                Value bi = value_to_int(b);
-                int res = 0;
-                if (op==OP_ADD) res = ai.i + bi.i;
-                if (op==OP_SUB) res = ai.i - bi.i;
-                if (op==OP_MUL) res = ai.i * bi.i;
-                if (op==OP_DIV) {
-                    if (bi.i == 0) {
-                        runtime_error(n, LX_ERR_DIV_ZERO, "division by zero");
-                        *ok_flag = 0;
-                        value_free(a);
-                        value_free(b);
-                        value_free(ai);
-                        value_free(bi);
-                        return value_null();
-                    }
-                    res = ai.i / bi.i;
-                }
-                if (op==OP_MOD) {
-                    if (bi.i == 0) {
-                        runtime_error(n, LX_ERR_MOD_ZERO, "modulo by zero");
-                        *ok_flag = 0;
-                        value_free(a);
-                        value_free(b);
-                        value_free(ai);
-                        value_free(bi);
-                        return value_null();
-                    }
-                    res = ai.i % bi.i;
-                }
-                out = value_int(res);
+                out = int_arith(n, op, value_as_int(a), value_as_int(b), ok_flag);
             }
             break;
-        }
 
         case OP_POW: {
-            Value af = value_to_float(a);
-            Value bf = value_to_float(b);
-            out = value_float(pow(af.f, bf.f));
+            out = value_float(pow(value_as_double(a), value_as_double(b)));
             break;
         }
 
@@ -625,15 +931,21 @@ static Value eval_binary(AstNode *n, Operator op, AstNode *l, AstNode *r, Env *e
         case OP_GT:
         case OP_GTE: {
             /* numeric if possible, else string compare */
-            if ((a.type==VAL_INT||a.type==VAL_FLOAT||a.type==VAL_BOOL) &&
+            if (a.type == VAL_INT && b.type == VAL_INT) {
+                int res = 0;
+                if (op==OP_LT)  res = a.i <  b.i;
+                if (op==OP_LTE) res = a.i <= b.i;
+                if (op==OP_GT)  res = a.i >  b.i;
+                if (op==OP_GTE) res = a.i >= b.i;
+                out = value_bool(res);
+            } else if ((a.type==VAL_INT||a.type==VAL_FLOAT||a.type==VAL_BOOL) &&
                 (b.type==VAL_INT||b.type==VAL_FLOAT||b.type==VAL_BOOL)) {
-                Value af = value_to_float(a);
-                Value bf = value_to_float(b);
+                double x = value_as_double(a), y = value_as_double(b);
                 int res = 0;
-                if (op==OP_LT)  res = af.f <  bf.f;
-                if (op==OP_LTE) res = af.f <= bf.f;
-                if (op==OP_GT)  res = af.f >  bf.f;
-                if (op==OP_GTE) res = af.f >= bf.f;
+                if (op==OP_LT)  res = x <  y;
+                if (op==OP_LTE) res = x <= y;
+                if (op==OP_GT)  res = x >  y;
+                if (op==OP_GTE) res = x >= y;
                 out = value_bool(res);
             } else {
                 Value sa = value_to_string(a);
@@ -655,14 +967,15 @@ static Value eval_binary(AstNode *n, Operator op, AstNode *l, AstNode *r, Env *e
         case OP_BIT_XOR:
         case OP_SHL:
         case OP_SHR: {
-            Value ai = value_to_int(a);
-            Value bi = value_to_int(b);
-            int res = 0;
-            if (op==OP_BIT_AND) res = ai.i & bi.i;
-            if (op==OP_BIT_OR)  res = ai.i | bi.i;
-            if (op==OP_BIT_XOR) res = ai.i ^ bi.i;
-            if (op==OP_SHL)     res = ai.i << bi.i;
-            if (op==OP_SHR)     res = ai.i >> bi.i;
+            lx_int_t x = value_as_int(a), y = value_as_int(b);
+            lx_int_t res = 0;
+            int bits = LX_INT_SIZE * 8;
+            if (op==OP_BIT_AND) res = x & y;
+            if (op==OP_BIT_OR)  res = x | y;
+            if (op==OP_BIT_XOR) res = x ^ y;
+            /* shifts by a negative or too large count saturate */
+            if (op==OP_SHL) res = (y < 0 || y >= bits) ? 0 : (lx_int_t)((lx_uint_t)x << y);
+            if (op==OP_SHR) res = (y < 0 || y >= bits) ? (x < 0 ? -1 : 0) : x >> y;
             out = value_int(res);
             break;
         }
@@ -681,6 +994,10 @@ static Value eval_binary(AstNode *n, Operator op, AstNode *l, AstNode *r, Env *e
 static Value eval_unary(Operator op, AstNode *e, Env *env, int *ok_flag) {
     Value v = eval_expr(e, env, ok_flag);
     if (!*ok_flag) return value_null();
+    return eval_unary_value(op, v, ok_flag);
+}
+
+Value eval_unary_value(Operator op, Value v, int *ok_flag) {
     Value out = value_null();
     switch (op) {
         case OP_NOT:
@@ -688,7 +1005,7 @@ static Value eval_unary(Operator op, AstNode *e, Env *env, int *ok_flag) {
             break;
         case OP_SUB: { /* unary minus reusing OP_SUB in some parsers; if you have OP_NEG, use that */
             if (v.type == VAL_INT) {
-                out = value_int(-v.i);
+                out = (v.i == LX_INT_MIN) ? value_float(-(double)v.i) : value_int(-v.i);
                 break;
             }
             if (v.type == VAL_BOOL) {
@@ -704,8 +1021,7 @@ static Value eval_unary(Operator op, AstNode *e, Env *env, int *ok_flag) {
             break;
         }
         case OP_BIT_NOT: {
-            Value i = value_to_int(v);
-            out = value_int(~i.i);
+            out = value_int(~value_as_int(v));
             break;
         }
         default:
@@ -717,7 +1033,138 @@ static Value eval_unary(Operator op, AstNode *e, Env *env, int *ok_flag) {
     return out;
 }
 
+/* ---------- tail calls ---------- */
+
+/*
+ * `return f(...)` in a function body does not recurse: it evaluates the
+ * arguments, parks the call in g_tail and returns void. The
+ * eval_call_values running the current body finds the parked call when
+ * the body returns and runs it in the same frame: the C stack does not
+ * grow, and the Env is cleared and rebound instead of reallocated.
+ */
+typedef struct {
+    FunctionDef *fn;    /* callee; NULL when no call is parked */
+    AstNode *node;      /* call node, for error locations */
+    Value *argv;        /* owned arguments */
+    int argc;
+} TailCall;
+
+static TailCall g_tail;
+
+static void mark_tail_calls(AstNode **slot, void *ctx) {
+    AstNode *x = *slot;
+    if (x->type == AST_FUNCTION) return;
+    if (x->type == AST_RETURN) x->ret.tail = x->ret.value && x->ret.value->type == AST_CALL;
+    ast_visit_children(x, mark_tail_calls, ctx);
+}
+
+/* @return The user function a tail call through @p call enters, or NULL
+ * when it must be a normal call: natives, undefined functions, and callees
+ * whose result the current frame would still check against a different
+ * declared return type. */
+static FunctionDef *tail_target(AstNode *call) {
+    if (!g_fn_stack || !g_fn_stack->def) return NULL;
+    if (eval_call_native(call)) return NULL;
+    FunctionDef *f = find_user_fn(call->call.name);
+    if (!f) return NULL;
+    TypeHint rt = g_fn_stack->def->ret_type;
+    if (rt != TYPE_ANY && f->ret_type != rt) return NULL;
+    return f;
+}
+
+static void park_tail_call(FunctionDef *f, AstNode *call, Value *argv, int argc) {
+    g_tail.fn = f;
+    g_tail.node = call;
+    g_tail.argv = argv;
+    g_tail.argc = argc;
+}
+
+int eval_tail_call(AstNode *call, Value *argv, int argc) {
+    FunctionDef *f = tail_target(call);
+    if (!f) return 0;
+    Value *own = NULL;
+    if (argc > 0) {
+        own = (Value *)malloc((size_t)argc * sizeof(Value));
+        if (!own) return 0;
+        memcpy(own, argv, (size_t)argc * sizeof(Value));
+    }
+    park_tail_call(f, call, own, argc);
+    return 1;
+}
+
+/* AST_RETURN with ret.tail set. @return 0 when the call was not parked
+ * and the return must evaluate its value normally. */
+static int return_tail_call(AstNode *call, Env *env, int *ok_flag) {
+    FunctionDef *f = tail_target(call);
+    if (!f) return 0;
+    int argc = call->call.argc;
+    Value *argv = NULL;
+    if (argc > 0) {
+        argv = (Value *)calloc((size_t)argc, sizeof(Value));
+        if (!argv) return 0;
+    }
+    for (int i = 0; i < argc; i++) {
+        argv[i] = eval_expr(call->call.args[i], env, ok_flag);
+        if (!*ok_flag) {
+            for (int j = 0; j <= i; j++) value_free(argv[j]);
+            free(argv);
+            return 1;
+        }
+    }
+    park_tail_call(f, call, argv, argc);
+    return 1;
+}
+
+const NativeDef *eval_call_native(AstNode *call) {
+    unsigned gen = natives_generation();
+    if (call->native_gen != gen) {
+        call->native = find_native(call->call.name);
+        call->native_gen = gen;
+    }
+    return call->native;
+}
+
+Value eval_native_call(AstNode *n, const NativeDef *def, Env *env, int *ok_flag) {
+    int argc = n->call.argc;
+    Value inline_args[LX_NATIVE_MAX_ARGS];
+    Value *argv = inline_args;
+    unsigned borrowed = 0; /* bit i: argv[i] is a variable's own value */
+    if (argc > LX_NATIVE_MAX_ARGS) {
+        argv = (Value *)malloc((size_t)argc * sizeof(Value));
+        if (!argv) { *ok_flag = 0; return value_null(); }
+    }
+    for (int i = 0; i < argc; i++) {
+        AstNode *a = n->call.args[i];
+        if (def->typed && a->type == AST_VAR && argv == inline_args) {
+            Value *slot = env_lookup(env, a->var.name, &a->slot_hint);
+            if (slot) {
+                argv[i] = *slot;
+                borrowed |= 1u << i;
+                continue;
+            }
+        }
+        argv[i] = eval_expr(a, env, ok_flag);
+        if (!*ok_flag) {
+            for (int j = 0; j <= i; j++) {
+                if (!(borrowed & (1u << j))) value_free(argv[j]);
+            }
+            if (argv != inline_args) free(argv);
+            return value_null();
+        }
+    }
+
+    Value r = native_call(def, env, argc, argv, n->line, n->col, ok_flag);
+    for (int i = 0; i < argc; i++) {
+        if (!(borrowed & (1u << i))) value_free(argv[i]);
+    }
+    if (argv != inline_args) free(argv);
+    return r;
+}
+
 static Value eval_call(AstNode *n, Env *env, int *ok_flag) {
+    const NativeDef *nd = eval_call_native(n);
+    if (nd) return eval_native_call(n, nd, env, ok_flag);
+
     /* evaluate args */
     int argc = n->call.argc;
     Value *argv = NULL;
@@ -725,21 +1172,58 @@ static Value eval_call(AstNode *n, Env *env, int *ok_flag) {
         argv = (Value*)calloc((size_t)argc, sizeof(Value));
         if (!argv) { *ok_flag=0; return value_null(); }
     }
+    /* earlier arguments are held here while later ones run code */
+    gc_push_roots(argv, argc);
     for (int i=0;i<argc;i++) {
         argv[i] = eval_expr(n->call.args[i], env, ok_flag);
         if (!*ok_flag) {
+            gc_pop_roots(1);
             for (int j=0;j<=i;j++) value_free(argv[j]);
             free(argv);
             return value_null();
         }
     }
+    gc_pop_roots(1);
+
+    Value r = eval_call_values(n, env, argv, argc, ok_flag);
+    free(argv);
+    return r;
+}
 
+/* Bind the parameters of @p uf in @p local from @p argv (borrowed),
+ * defaults and declared types. @return 0 after reporting an error. */
+static int bind_params(AstNode *n, FunctionDef *uf, Env *local, Value *argv, int argc, int *ok_flag) {
+    for (int i=0;i<uf->param_count;i++) {
+        Value v;
+        if (i < argc) {
+            v = value_copy(argv[i]);
+        } else if (uf->param_defaults && uf->param_defaults[i]) {
+            Value dv = eval_expr(uf->param_defaults[i], local, ok_flag);
+            if (!*ok_flag) return 0;
+            v = value_copy(dv);
+            value_free(dv);
+        } else {
+            v = value_null();
+        }
+        TypeHint t = uf->param_types ? uf->param_types[i] : TYPE_ANY;
+        if (!coerce_to_type(t, &v)) {
+            runtime_error(n, LX_ERR_TYPE, "%s(): argument %d ($%s) must be %s, %s given",
+                          uf->name, i + 1, uf->params[i], ast_type_hint_name(t), value_type_name(v));
+            *ok_flag = 0;
+            value_free(v);
+            return 0;
+        }
+        env_set(local, uf->params[i], v);
+    }
+    return 1;
+}
+
+Value eval_call_values(AstNode *n, Env *env, Value *argv, int argc, int *ok_flag) {
     /* native first */
-    NativeFn nf = find_function(n->call.name);
-    if (nf) {
-        Value r = nf(env, argc, argv);
+    const NativeDef *nd = eval_call_native(n);
+    if (nd) {
+        Value r = native_call(nd, env, argc, argv, n->line, n->col, ok_flag);
         for (int i=0;i<argc;i++) value_free(argv[i]);
-        free(argv);
         return r;
     }
 
@@ -747,42 +1231,74 @@ static Value eval_call(AstNode *n, Env *env, int *ok_flag) {
     FunctionDef *uf = find_user_fn(n->call.name);
     if (!uf) {
         for (int i=0;i<argc;i++) value_free(argv[i]);
-        free(argv);
         runtime_error(n, LX_ERR_UNDEFINED_FUNCTION, "undefined function '%s'", n->call.name);
         *ok_flag = 0;
         return value_null();
     }
 
     Env *local = env_new(env); /* lexical chain: local -> caller */
-    push_fn(uf->name);
-    for (int i=0;i<uf->param_count;i++) {
-        Value v;
-        if (i < argc) {
-            v = value_copy(argv[i]);
-        } else if (uf->param_defaults && uf->param_defaults[i]) {
-            Value dv = eval_expr(uf->param_defaults[i], local, ok_flag);
-            if (!*ok_flag) {
-                pop_fn();
-                env_free(local);
-                for (int j=0;j<argc;j++) value_free(argv[j]);
-                free(argv);
-                return value_null();
-            }
-            v = value_copy(dv);
-            value_free(dv);
-        } else {
-            v = value_null();
-        }
-        env_set(local, uf->params[i], v);
+    if (!local) {
+        for (int i=0;i<argc;i++) value_free(argv[i]);
+        /* The pool set the error; report it at the call. */
+        const LxError *err = lx_get_error();
+        runtime_error(n, err->code, "%s", err->message);
+        *ok_flag = 0;
+        return value_null();
     }
+    Value *tail_argv = NULL;
+    EvalResult rr;
+    const struct AstNode *hp_node = lx_heapprof_node;
+    push_fn(uf);
+    for (;;) {
+        int bound = bind_params(n, uf, local, argv, argc, ok_flag);
+        for (int i=0;i<argc;i++) value_free(argv[i]);
+        if (!bound) {
+            pop_fn();
+            lx_heapprof_node = hp_node;
+            env_free(local);
+            free(tail_argv);
+            return value_null();
+        }
 
-    for (int i=0;i<argc;i++) value_free(argv[i]);
-    free(argv);
+        if (!uf->specialized) specialize_typed_body(uf);
+        rr = g_body_runner ? g_body_runner(uf->body, local)
+                           : eval_node(uf->body, local);
+        if (rr.flow != FLOW_RETURN || !g_tail.fn) break;
 
-    EvalResult rr = eval_node(uf->body, local);
+        /* The body ended in `return g(...)`: run g in this frame. */
+        value_free(rr.value);
+        free(tail_argv);
+        uf = g_tail.fn;
+        n = g_tail.node;
+        argv = tail_argv = g_tail.argv;
+        argc = g_tail.argc;
+        g_tail.fn = NULL;
+        env_clear(local);
+        if (g_fn_stack) {
+            g_fn_stack->name = uf->name;
+            g_fn_stack->def = uf;
+        }
+    }
     pop_fn();
+    lx_heapprof_node = hp_node;
     env_free(local);
+    free(tail_argv);
 
+    if (uf->ret_type != TYPE_ANY && rr.flow != FLOW_BREAK && rr.flow != FLOW_CONTINUE &&
+        !lx_has_error()) {
+        if (rr.flow != FLOW_RETURN) {
+            value_free(rr.value);
+            rr.value = value_void();
+        }
+        if (!coerce_to_type(uf->ret_type, &rr.value)) {
+            runtime_error(n, LX_ERR_TYPE, "%s(): return value must be %s, %s given",
+                          uf->name, ast_type_hint_name(uf->ret_type), value_type_name(rr.value));
+            *ok_flag = 0;
+            value_free(rr.value);
+            return value_null();
+        }
+        return rr.value;
+    }
     if (rr.flow == FLOW_RETURN) return rr.value;
     if (rr.flow == FLOW_BREAK || rr.flow == FLOW_CONTINUE) {
         runtime_error(n, LX_ERR_BREAK_CONTINUE, "break/continue outside loop");
@@ -799,34 +1315,20 @@ static Value eval_expr(AstNode *n, Env *env, int *ok_flag) {
         *ok_flag = 0;
         return value_null();
     }
+    if (n->exec) return n->exec(n, env, ok_flag);
     switch (n->type) {
         case AST_LITERAL:
             return literal_to_value(n->literal.token);
 
         case AST_ARRAY_LITERAL: {
-            Value arrv = value_array();
-            lx_int_t next_index = 0;
-            for (int i = 0; i < n->array.count; i++) {
-                Value val = eval_expr(n->array.values[i], env, ok_flag);
-                if (!*ok_flag) { value_free(arrv); return value_null(); }
-
-                if (n->array.keys[i]) {
-                    Value keyv = eval_expr(n->array.keys[i], env, ok_flag);
-                    if (!*ok_flag) { value_free(val); value_free(arrv); return value_null(); }
-                    if (keyv.type == VAL_STRING) {
-                        array_set(arrv.a, key_string(keyv.s), val);
-                    } else {
-                        Value ki = value_to_int(keyv);
-                        array_set(arrv.a, key_int(ki.i), val);
-                        if (ki.i >= next_index) next_index = ki.i + 1;
-                        value_free(ki);
-                    }
-                    value_free(keyv);
-                } else {
-                    array_set(arrv.a, key_int(next_index++), val);
-                }
+            if (!n->array.shared_checked) share_array_literal(n, env);
+            if (n->array.shared) {
+                Value arrv;
+                arrv.type = VAL_ARRAY;
+                arrv.a = array_share(n->array.shared);
+                return arrv;
             }
-            return arrv;
+            return build_array_literal(n, env, ok_flag);
         }
 
         case AST_VAR: {
@@ -843,6 +1345,16 @@ static Value eval_expr(AstNode *n, Env *env, int *ok_flag) {
         case AST_MAGIC_FUNCTION:
             return value_string(current_fn_name());
 
+        case AST_CONST: {
+            const Value *cv = find_constant(n->constant.name);
+            if (!cv) {
+                runtime_error(n, LX_ERR_CONSTANT, "undefined constant '%s'", n->constant.name);
+                *ok_flag = 0;
+                return value_null();
+            }
+            return value_copy(*cv);
+        }
+
         case AST_ASSIGN: {
             Value rhs = eval_expr(n->assign.value, env, ok_flag);
             if (!*ok_flag) return value_null();
@@ -889,114 +1401,925 @@ static Value eval_expr(AstNode *n, Env *env, int *ok_flag) {
             return rhs;
         }
 
-        case AST_UNARY:
-            return eval_unary(n->unary.op, n->unary.expr, env, ok_flag);
+        case AST_UNARY:
+            return eval_unary(n->unary.op, n->unary.expr, env, ok_flag);
+
+        case AST_BINARY:
+            return eval_binary(n, n->binary.op, n->binary.left, n->binary.right, env, ok_flag);
+
+        case AST_CALL:
+            return eval_call(n, env, ok_flag);
+
+        case AST_INDEX: {
+            Value tgt = eval_expr(n->index.target, env, ok_flag);
+            if (!*ok_flag) return value_null();
+            Value idx = eval_expr(n->index.index, env, ok_flag);
+            if (!*ok_flag) { value_free(tgt); return value_null(); }
+            index_feedback(n, tgt, idx);
+            Value out = eval_index(tgt, idx, env, ok_flag);
+            value_free(tgt);
+            value_free(idx);
+            return out;
+        }
+
+        case AST_PRE_INC:
+        case AST_PRE_DEC:
+        case AST_POST_INC:
+        case AST_POST_DEC: {
+            int ok2 = 1;
+            Value base = value_null();
+            Value *slot = get_lvalue_ref(n->incdec.target, env, &ok2, &base);
+            if (!ok2 || !slot) {
+                if (ok_flag) *ok_flag = 0;
+                value_free(base);
+                return value_null();
+            }
+
+            Value oldv = value_copy(*slot);
+            int delta = (n->type == AST_PRE_DEC || n->type == AST_POST_DEC) ? -1 : 1;
+            Value newv = incdec_value(value_copy(*slot), delta);
+            value_free(*slot);
+            *slot = newv;
+
+            if (n->type == AST_PRE_INC || n->type == AST_PRE_DEC) {
+                value_free(oldv);
+                value_free(base);
+                return value_copy(newv);
+            }
+            value_free(newv);
+            value_free(base);
+            return oldv;
+        }
+
+        case AST_TERNARY: {
+            Value c = eval_expr(n->ternary.cond, env, ok_flag);
+            if (!*ok_flag) return value_null();
+            int t = value_is_true(c);
+            value_free(c);
+            if (t) {
+                return eval_expr(n->ternary.then_expr, env, ok_flag);
+            }
+            return eval_expr(n->ternary.else_expr, env, ok_flag);
+        }
+        case AST_NULL_COALESCE: {
+            Value left = eval_expr(n->null_coalesce.left, env, ok_flag);
+            if (!*ok_flag) return value_null();
+            if (left.type != VAL_UNDEFINED && left.type != VAL_NULL) {
+                return left;
+            }
+            value_free(left);
+            return eval_expr(n->null_coalesce.right, env, ok_flag);
+        }
+
+        default:
+            *ok_flag = 0;
+            return value_null();
+    }
+}
+
+static EvalResult eval_block_like(AstNode *n, Env *env) {
+    if (!n || n->block.count <= 0 || !n->block.items) {
+        return ok(value_null());
+    }
+
+    if (n->block.count == 1) {
+        EvalResult r = eval_node(n->block.items[0], env);
+        if (lx_has_error()) {
+            value_free(r.value);
+            return ok(value_null());
+        }
+        if (r.flow != FLOW_NORMAL) return r;
+        value_free(r.value);
+        return ok(value_null());
+    }
+
+    for (int i = 0; i < n->block.count; i++) {
+        if (!n->block.items[i]) {
+            runtime_error(n, LX_ERR_INTERNAL, "null block statement");
+            return ok(value_null());
+        }
+        EvalResult r = eval_node(n->block.items[i], env);
+        if (lx_has_error()) {
+            value_free(r.value);
+            return ok(value_null());
+        }
+        if (r.flow != FLOW_NORMAL) return r;
+        value_free(r.value);
+#if !defined(LX_TARGET_LXSH) || !LX_TARGET_LXSH
+        gc_maybe_collect(env);
+#endif
+    }
+    return ok(value_null());
+}
+
+/* Run a for loop from its condition check (the initializer has run). */
+static EvalResult eval_for_loop(AstNode *n, Env *env) {
+    int ok_flag = 1;
+    for (;;) {
+        if (n->for_stmt.cond) {
+            Value c = eval_expr(n->for_stmt.cond, env, &ok_flag);
+            if (!ok_flag) { value_free(c); return ok(value_null()); }
+            int t = value_is_true(c);
+            value_free(c);
+            if (!t) break;
+        }
+        EvalResult rb = eval_node(n->for_stmt.body, env);
+        if (rb.flow == FLOW_RETURN) return rb;
+        if (rb.flow == FLOW_BREAK) { value_free(rb.value); break; }
+        if (rb.flow == FLOW_CONTINUE) {
+            value_free(rb.value);
+            if (n->for_stmt.step) {
+                EvalResult rs = eval_node(n->for_stmt.step, env);
+                if (rs.flow == FLOW_RETURN) return rs;
+                if (rs.flow == FLOW_BREAK || rs.flow == FLOW_CONTINUE) {
+                    value_free(rs.value);
+                    return ok(value_null());
+                }
+                value_free(rs.value);
+            }
+            continue;
+        }
+        value_free(rb.value);
+
+        if (n->for_stmt.step) {
+            EvalResult rs = eval_node(n->for_stmt.step, env);
+            if (rs.flow == FLOW_RETURN) return rs;
+            if (rs.flow == FLOW_BREAK || rs.flow == FLOW_CONTINUE) {
+                value_free(rs.value);
+                return ok(value_null());
+            }
+            value_free(rs.value);
+        }
+    }
+    return ok(value_null());
+}
+
+/* ---------- counted for loops ---------- */
+
+/*
+ * `for ($i = a; $i < b; $i++)` with an int induction variable, a bound
+ * that is an int literal or a variable, and a constant int step runs on a
+ * native counter. The counter is stored into $i before each iteration
+ * only when the body can observe it (CL_OBSERVED); otherwise $i is written
+ * once when the loop ends. A bound variable the body cannot touch is read
+ * once (CL_FIXED_BOUND). Whenever a guard fails (non-int values, body
+ * rebinding $i, overflow) the loop continues on the generic path.
+ */
+enum {
+    CL_GENERIC = -1,
+    CL_COUNTED = 1,
+    CL_OBSERVED = 2,
+    CL_FIXED_BOUND = 4
+};
+
+typedef struct {
+    const char *name;
+    int found;
+} MentionCtx;
+
+/* Conservatively decide whether a subtree may read or write m->name:
+ * calls, dynamic variables and global declarations count as mentions. */
+static void mention_visit(AstNode **slot, void *ctx) {
+    MentionCtx *m = (MentionCtx *)ctx;
+    AstNode *x = *slot;
+    const char *nm = NULL;
+
+    if (m->found) return;
+    switch (x->type) {
+        case AST_VAR: nm = x->var.name; break;
+        case AST_ASSIGN: nm = x->assign.name; break;
+        case AST_FOREACH:
+            if ((x->foreach_stmt.key_name && !strcmp(x->foreach_stmt.key_name, m->name)) ||
+                !strcmp(x->foreach_stmt.value_name, m->name)) {
+                m->found = 1;
+            }
+            break;
+        case AST_CALL:
+        case AST_VAR_DYNAMIC:
+        case AST_ASSIGN_DYNAMIC:
+        case AST_GLOBAL:
+        case AST_MAGIC_FUNCTION:
+            m->found = 1;
+            break;
+        default:
+            break;
+    }
+    if (nm && !strcmp(nm, m->name)) m->found = 1;
+    if (!m->found) ast_visit_children(x, mention_visit, ctx);
+}
+
+static int body_mentions(AstNode *body, const char *name) {
+    MentionCtx m = { name, 0 };
+    AstNode *slot = body;
+    mention_visit(&slot, &m);
+    return m.found;
+}
+
+static int is_var_named(const AstNode *x, const char *name) {
+    return x && x->type == AST_VAR && !strcmp(x->var.name, name);
+}
+
+static int counted_loop_flags(AstNode *n) {
+    AstNode *init = n->for_stmt.init;
+    AstNode *cond = n->for_stmt.cond;
+    AstNode *step = n->for_stmt.step;
+    if (!init || !cond || !step) return CL_GENERIC;
+    if (init->type != AST_ASSIGN || init->assign.is_compound) return CL_GENERIC;
+    const char *iv = init->assign.name;
+
+    if (cond->type != AST_BINARY || !is_var_named(cond->binary.left, iv)) return CL_GENERIC;
+    switch (cond->binary.op) {
+        case OP_LT: case OP_LTE: case OP_GT: case OP_GTE: case OP_NEQ: break;
+        default: return CL_GENERIC;
+    }
+    AstNode *bound = cond->binary.right;
+    int is_lit = bound->type == AST_LITERAL && bound->literal.token.type == TOK_INT;
+    if (!is_lit && (bound->type != AST_VAR || !strcmp(bound->var.name, iv))) return CL_GENERIC;
+
+    if (step->type == AST_ASSIGN) {
+        if (!step->assign.is_compound || strcmp(step->assign.name, iv)) return CL_GENERIC;
+        if (step->assign.op != OP_ADD && step->assign.op != OP_SUB) return CL_GENERIC;
+        if (step->assign.value->type != AST_LITERAL ||
+            step->assign.value->literal.token.type != TOK_INT) return CL_GENERIC;
+    } else if (step->type == AST_PRE_INC || step->type == AST_POST_INC ||
+               step->type == AST_PRE_DEC || step->type == AST_POST_DEC) {
+        if (!is_var_named(step->incdec.target, iv)) return CL_GENERIC;
+    } else {
+        return CL_GENERIC;
+    }
+
+    int flags = CL_COUNTED;
+    if (body_mentions(n->for_stmt.body, iv)) flags |= CL_OBSERVED;
+    if (is_lit || !body_mentions(n->for_stmt.body, bound->var.name)) flags |= CL_FIXED_BOUND;
+    return flags;
+}
+
+static lx_int_t counted_step(const AstNode *step) {
+    switch (step->type) {
+        case AST_PRE_INC: case AST_POST_INC: return 1;
+        case AST_PRE_DEC: case AST_POST_DEC: return -1;
+        default: {
+            lx_int_t k = step->assign.value->literal.token.int_val;
+            return step->assign.op == OP_SUB ? -k : k;
+        }
+    }
+}
+
+static int counted_bound(AstNode *bound, Env *env, lx_int_t *out) {
+    if (bound->type == AST_LITERAL) {
+        *out = bound->literal.token.int_val;
+        return 1;
+    }
+    Value *v = env_lookup(env, bound->var.name, &bound->slot_hint);
+    if (!v || v->type != VAL_INT) return 0;
+    *out = v->i;
+    return 1;
+}
+
+static void counted_store(AstNode *n, Env *env, const char *iv, lx_int_t i) {
+    Value *slot = env_lookup(env, iv, &n->slot_hint);
+    if (slot) {
+        value_free(*slot);
+        *slot = value_int(i);
+    } else {
+        env_set(env, iv, value_int(i));
+    }
+}
+
+/* Finish the loop generically from the step clause. */
+static EvalResult counted_bail(AstNode *n, Env *env) {
+    EvalResult rs = eval_node(n->for_stmt.step, env);
+    if (rs.flow == FLOW_RETURN) return rs;
+    value_free(rs.value);
+    if (rs.flow != FLOW_NORMAL || lx_has_error()) return ok(value_null());
+    return eval_for_loop(n, env);
+}
+
+static EvalResult eval_counted_for(AstNode *n, Env *env) {
+    const char *iv = n->for_stmt.init->assign.name;
+    AstNode *bound = n->for_stmt.cond->binary.right;
+    Operator op = n->for_stmt.cond->binary.op;
+    int observed = n->for_stmt.counted & CL_OBSERVED;
+    int fixed = n->for_stmt.counted & CL_FIXED_BOUND;
+    lx_int_t delta = counted_step(n->for_stmt.step);
+    lx_int_t i, lim;
+
+    EvalResult r0 = eval_node(n->for_stmt.init, env);
+    value_free(r0.value);
+    if (lx_has_error()) return ok(value_null());
+
+    Value *slot = env_lookup(env, iv, &n->slot_hint);
+    if (!slot || slot->type != VAL_INT || !counted_bound(bound, env, &lim)) {
+        return eval_for_loop(n, env);
+    }
+    i = slot->i;
+
+    for (;;) {
+        if (!fixed && !counted_bound(bound, env, &lim)) {
+            counted_store(n, env, iv, i);
+            return eval_for_loop(n, env);
+        }
+        int t;
+        switch (op) {
+            case OP_LT:  t = i <  lim; break;
+            case OP_LTE: t = i <= lim; break;
+            case OP_GT:  t = i >  lim; break;
+            case OP_GTE: t = i >= lim; break;
+            default:     t = i != lim; break;
+        }
+        if (!t) break;
+
+        if (observed) counted_store(n, env, iv, i);
+        EvalResult rb = eval_node(n->for_stmt.body, env);
+        if (observed) {
+            slot = env_lookup(env, iv, &n->slot_hint);
+            if (rb.flow == FLOW_RETURN) return rb;
+            value_free(rb.value);
+            if (rb.flow == FLOW_BREAK || lx_has_error()) return ok(value_null());
+            if (!slot || slot->type != VAL_INT) return counted_bail(n, env);
+            i = slot->i;
+        } else {
+            if (rb.flow == FLOW_RETURN) {
+                counted_store(n, env, iv, i);
+                return rb;
+            }
+            value_free(rb.value);
+            if (rb.flow == FLOW_BREAK || lx_has_error()) {
+                counted_store(n, env, iv, i);
+                return ok(value_null());
+            }
+        }
+
+        lx_int_t next;
+        if (lx_add_overflow(i, delta, &next)) {
+            counted_store(n, env, iv, i);
+            return counted_bail(n, env);
+        }
+        i = next;
+    }
+    counted_store(n, env, iv, i);
+    return ok(value_null());
+}
+
+/* ---------- type hints ---------- */
+
+static int numeric_string(const char *s, double *out);
+
+/* Convert *v in place to the declared type @p t. Scalars convert the usual
+ * way, but only without loss: a float must be integral to become an int
+ * and a string must be numeric to become a number. @return 0 (leaving *v
+ * as it was) when the value does not fit the type. */
+static int coerce_to_type(TypeHint t, Value *v) {
+    Value in = *v;
+    int scalar = in.type == VAL_INT || in.type == VAL_FLOAT ||
+                 in.type == VAL_BOOL || in.type == VAL_BYTE;
+    double d;
+    switch (t) {
+        case TYPE_ANY:
+            return 1;
+        case TYPE_INT:
+            if (in.type == VAL_INT) return 1;
+            if (in.type == VAL_FLOAT) {
+                if (in.f != floor(in.f) || in.f < (double)LX_INT_MIN || in.f >= -(double)LX_INT_MIN) return 0;
+                *v = value_int((lx_int_t)in.f);
+                return 1;
+            }
+            if (scalar) {
+                *v = value_to_int(in);
+                return 1;
+            }
+            if (in.type == VAL_STRING && in.s && *in.s && numeric_string(in.s, &d) &&
+                d == floor(d) && d >= (double)LX_INT_MIN && d < -(double)LX_INT_MIN) {
+                *v = value_to_int(in);
+                value_free(in);
+                return 1;
+            }
+            return 0;
+        case TYPE_FLOAT:
+            if (in.type == VAL_FLOAT) return 1;
+            if (scalar) {
+                *v = value_to_float(in);
+                return 1;
+            }
+            if (in.type == VAL_STRING && in.s && *in.s && numeric_string(in.s, &d)) {
+                *v = value_float(d);
+                value_free(in);
+                return 1;
+            }
+            return 0;
+        case TYPE_BOOL:
+            if (in.type == VAL_BOOL) return 1;
+            if (scalar || in.type == VAL_STRING) {
+                *v = value_bool(value_is_true(in));
+                value_free(in);
+                return 1;
+            }
+            return 0;
+        case TYPE_STRING:
+            if (in.type == VAL_STRING) return 1;
+            if (scalar) {
+                *v = value_to_string(in);
+                return 1;
+            }
+            return 0;
+        case TYPE_ARRAY:
+            return in.type == VAL_ARRAY;
+        case TYPE_BLOB:
+            return in.type == VAL_BLOB;
+    }
+    return 0;
+}
+
+/*
+ * Declared types seed the type feedback of the binary nodes in the body,
+ * so arithmetic on typed values starts on quick_binary_int/float instead
+ * of waiting for QUICKEN_AFTER observations. An int or float parameter
+ * the body never rebinds keeps its declared type (it was coerced at
+ * entry). Floats also propagate: a local (or float parameter) whose every
+ * assignment stores a float expression, or combines a number into it with
+ * an arithmetic compound assignment, is a float too. Int locals are not
+ * inferred, because int arithmetic overflows into floats. The quick
+ * handlers keep their guards, so a wrong guess (e.g. a read before the
+ * first assignment) only costs a deoptimization.
+ */
+typedef struct {
+    const char **names;
+    TypeHint *types;
+    int count;
+} TypedCtx;
 
-        case AST_BINARY:
-            return eval_binary(n, n->binary.op, n->binary.left, n->binary.right, env, ok_flag);
+typedef struct {
+    const char *name;
+    const TypedCtx *tc; /* when set, float assignments do not count */
+    int found;
+} RebindCtx;
 
-        case AST_CALL:
-            return eval_call(n, env, ok_flag);
+static TypeHint static_type(const TypedCtx *tc, const AstNode *x);
 
-        case AST_INDEX: {
-            Value tgt = eval_expr(n->index.target, env, ok_flag);
-            if (!*ok_flag) return value_null();
-            Value idx = eval_expr(n->index.index, env, ok_flag);
-            if (!*ok_flag) { value_free(tgt); return value_null(); }
-            Value out = eval_index(tgt, idx, env, ok_flag);
-            value_free(tgt);
-            value_free(idx);
-            return out;
-        }
+static int lval_root_named(const AstNode *x, const char *name) {
+    while (x && x->type == AST_INDEX) x = x->index.target;
+    return is_var_named(x, name);
+}
 
+static int float_assign(const TypedCtx *tc, const AstNode *x) {
+    TypeHint t = static_type(tc, x->assign.value);
+    if (!x->assign.is_compound) return t == TYPE_FLOAT;
+    switch (x->assign.op) {
+        case OP_ADD: case OP_SUB: case OP_MUL: case OP_DIV: case OP_MOD:
+            return t == TYPE_FLOAT || t == TYPE_INT;
+        default:
+            return 0;
+    }
+}
+
+/* Like mention_visit, but only rebinding counts: assignment, foreach,
+ * ++/--, unset, global and dynamic variables. Nested functions are skipped. */
+static void rebind_visit(AstNode **slot, void *ctx) {
+    RebindCtx *m = (RebindCtx *)ctx;
+    AstNode *x = *slot;
+
+    if (m->found) return;
+    switch (x->type) {
+        case AST_FUNCTION:
+            return;
+        case AST_ASSIGN:
+            if (!strcmp(x->assign.name, m->name) && !(m->tc && float_assign(m->tc, x))) m->found = 1;
+            break;
+        case AST_FOREACH:
+            if ((x->foreach_stmt.key_name && !strcmp(x->foreach_stmt.key_name, m->name)) ||
+                !strcmp(x->foreach_stmt.value_name, m->name)) {
+                m->found = 1;
+            }
+            break;
         case AST_PRE_INC:
         case AST_PRE_DEC:
         case AST_POST_INC:
-        case AST_POST_DEC: {
-            int ok2 = 1;
-            Value base = value_null();
-            Value *slot = get_lvalue_ref(n->incdec.target, env, &ok2, &base);
-            if (!ok2 || !slot) {
-                if (ok_flag) *ok_flag = 0;
-                value_free(base);
-                return value_null();
+        case AST_POST_DEC:
+            if (lval_root_named(x->incdec.target, m->name)) m->found = 1;
+            break;
+        case AST_UNSET:
+            if (lval_root_named(x->unset.target, m->name)) m->found = 1;
+            break;
+        case AST_INDEX_ASSIGN:
+            if (lval_root_named(x->index_assign.target, m->name)) m->found = 1;
+            break;
+        case AST_INDEX_APPEND:
+            if (lval_root_named(x->index_append.target, m->name)) m->found = 1;
+            break;
+        case AST_DESTRUCT_ASSIGN:
+            for (int i = 0; i < x->destruct_assign.target_count; i++) {
+                if (lval_root_named(x->destruct_assign.targets[i], m->name)) m->found = 1;
+            }
+            break;
+        case AST_GLOBAL:
+            for (int i = 0; i < x->global_stmt.count; i++) {
+                if (!strcmp(x->global_stmt.names[i], m->name)) m->found = 1;
             }
+            break;
+        case AST_VAR_DYNAMIC:
+        case AST_ASSIGN_DYNAMIC:
+            m->found = 1;
+            break;
+        default:
+            break;
+    }
+    if (!m->found) ast_visit_children(x, rebind_visit, ctx);
+}
 
-            Value oldv = value_copy(*slot);
-            int delta = (n->type == AST_PRE_DEC || n->type == AST_POST_DEC) ? -1 : 1;
-            Value newv = incdec_value(value_copy(*slot), delta);
-            value_free(*slot);
-            *slot = newv;
+static int body_rebinds(AstNode *body, const char *name, const TypedCtx *tc) {
+    RebindCtx m = { name, tc, 0 };
+    AstNode *slot = body;
+    rebind_visit(&slot, &m);
+    return m.found;
+}
 
-            if (n->type == AST_PRE_INC || n->type == AST_PRE_DEC) {
-                value_free(oldv);
-                value_free(base);
-                return value_copy(newv);
+/* @return The value type @p x always has in the body, or TYPE_ANY. */
+static TypeHint static_type(const TypedCtx *tc, const AstNode *x) {
+    switch (x->type) {
+        case AST_LITERAL:
+            if (x->literal.token.type == TOK_INT) return TYPE_INT;
+            if (x->literal.token.type == TOK_FLOAT) return TYPE_FLOAT;
+            return TYPE_ANY;
+        case AST_VAR:
+            for (int i = 0; i < tc->count; i++) {
+                if (!strcmp(tc->names[i], x->var.name)) return tc->types[i];
             }
-            value_free(newv);
-            value_free(base);
-            return oldv;
+            return TYPE_ANY;
+        case AST_UNARY:
+            if (x->unary.op == OP_SUB && static_type(tc, x->unary.expr) == TYPE_FLOAT) return TYPE_FLOAT;
+            return TYPE_ANY;
+        case AST_BINARY: {
+            /* Arithmetic with a float operand always yields a float (see
+             * eval_binary_values); int op int may overflow into one, so
+             * only float results are known. */
+            Operator op = x->binary.op;
+            if (op != OP_ADD && op != OP_SUB && op != OP_MUL && op != OP_DIV && op != OP_MOD) return TYPE_ANY;
+            if (static_type(tc, x->binary.left) == TYPE_FLOAT ||
+                static_type(tc, x->binary.right) == TYPE_FLOAT) {
+                return TYPE_FLOAT;
+            }
+            return TYPE_ANY;
         }
+        default:
+            return TYPE_ANY;
+    }
+}
 
-        case AST_TERNARY: {
-            Value c = eval_expr(n->ternary.cond, env, ok_flag);
-            if (!*ok_flag) return value_null();
-            int t = value_is_true(c);
-            value_free(c);
-            if (t) {
-                return eval_expr(n->ternary.then_expr, env, ok_flag);
-            }
-            return eval_expr(n->ternary.else_expr, env, ok_flag);
+static void collect_assigned(AstNode **slot, void *ctx) {
+    TypedCtx *tc = (TypedCtx *)ctx;
+    AstNode *x = *slot;
+    if (x->type == AST_FUNCTION) return;
+    if (x->type == AST_ASSIGN) {
+        int seen = 0;
+        for (int i = 0; i < tc->count && !seen; i++) seen = !strcmp(tc->names[i], x->assign.name);
+        if (!seen) {
+            const char **nn = (const char **)realloc(tc->names, (size_t)(tc->count + 1) * sizeof(char *));
+            TypeHint *nt = nn ? (TypeHint *)realloc(tc->types, (size_t)(tc->count + 1) * sizeof(TypeHint)) : NULL;
+            if (nn) tc->names = nn;
+            if (!nt) return;
+            tc->types = nt;
+            tc->names[tc->count] = x->assign.name;
+            tc->types[tc->count] = TYPE_FLOAT; /* optimistic; refuted below */
+            tc->count++;
         }
-        case AST_NULL_COALESCE: {
-            Value left = eval_expr(n->null_coalesce.left, env, ok_flag);
-            if (!*ok_flag) return value_null();
-            if (left.type != VAL_UNDEFINED && left.type != VAL_NULL) {
-                return left;
-            }
-            value_free(left);
-            return eval_expr(n->null_coalesce.right, env, ok_flag);
+    }
+    ast_visit_children(x, collect_assigned, ctx);
+}
+
+static Value typed_sample(TypeHint t) {
+    return t == TYPE_INT ? value_int(0) : t == TYPE_FLOAT ? value_float(0.0) : value_null();
+}
+
+static void specialize_visit(AstNode **slot, void *ctx) {
+    TypedCtx *tc = (TypedCtx *)ctx;
+    AstNode *x = *slot;
+    if (x->type == AST_FUNCTION) return;
+    if (x->type == AST_BINARY) {
+        int kind = binary_class(x->binary.op, typed_sample(static_type(tc, x->binary.left)),
+                                typed_sample(static_type(tc, x->binary.right)));
+        if (kind != FB_OTHER) {
+            x->fb_kind = (unsigned char)kind;
+            x->fb_hits = QUICKEN_AFTER;
+            x->exec = (kind == FB_INT_INT) ? quick_binary_int : quick_binary_float;
         }
+    }
+    ast_visit_children(x, specialize_visit, ctx);
+}
 
-        default:
-            *ok_flag = 0;
-            return value_null();
+static void specialize_typed_body(FunctionDef *f) {
+    f->specialized = 1;
+    if (!f->param_types || !f->body) return;
+    TypedCtx tc = { NULL, NULL, 0 };
+    tc.names = (const char **)calloc((size_t)f->param_count, sizeof(char *));
+    tc.types = (TypeHint *)calloc((size_t)f->param_count, sizeof(TypeHint));
+    if (!tc.names || !tc.types) goto done;
+    for (int i = 0; i < f->param_count; i++) {
+        TypeHint t = f->param_types[i];
+        tc.names[i] = f->params[i];
+        tc.types[i] = (t == TYPE_FLOAT || (t == TYPE_INT && !body_rebinds(f->body, f->params[i], NULL)))
+                    ? t : TYPE_ANY;
+    }
+    tc.count = f->param_count;
+    AstNode *slot = f->body;
+    collect_assigned(&slot, &tc);
+
+    /* Drop float candidates until every remaining one is only ever
+     * assigned floats, given the others. */
+    for (int changed = 1; changed; ) {
+        changed = 0;
+        for (int i = 0; i < tc.count; i++) {
+            if (tc.types[i] != TYPE_FLOAT || !body_rebinds(f->body, tc.names[i], &tc)) continue;
+            tc.types[i] = TYPE_ANY;
+            changed = 1;
+        }
+    }
+    for (int i = 0; i < tc.count; i++) {
+        if (tc.types[i] != TYPE_ANY) {
+            specialize_visit(&slot, &tc);
+            break;
+        }
     }
+done:
+    free(tc.names);
+    free(tc.types);
 }
 
-static EvalResult eval_block_like(AstNode *n, Env *env) {
-    if (!n || n->block.count <= 0 || !n->block.items) {
-        return ok(value_null());
+/* ---------- switch jump tables ---------- */
+
+/*
+ * Switches whose case labels are all int or string literals look the
+ * subject up in an open-addressing table instead of comparing it with
+ * every label. Labels are indexed by string and by numeric value (numeric
+ * strings included, as weak_equal parses them with strtod), so the probe
+ * yields a superset of the matching cases; each candidate is confirmed
+ * with weak_equal/strict_equal and the lowest case index wins, which keeps
+ * first-match, fallthrough and default semantics unchanged.
+ */
+#define SWITCH_JUMP_MIN 4
+
+typedef struct {
+    int idx;            /* case index, -1 for an empty slot */
+    int is_str;         /* string key (else numeric key) */
+    unsigned hash;
+    double num;
+    const char *str;    /* borrowed from the case literal */
+} SwitchSlot;
+
+struct SwitchJump {
+    unsigned mask;
+    int default_idx;
+    int has_int;        /* an int label exists (string subjects may match it) */
+    SwitchSlot slots[];
+};
+
+static unsigned hash_num(double d) {
+    unsigned long long bits;
+    if (d == 0.0) d = 0.0; /* -0.0 == 0.0 */
+    memcpy(&bits, &d, sizeof(bits));
+    bits ^= bits >> 33;
+    bits *= 0xff51afd7ed558ccdULL;
+    bits ^= bits >> 33;
+    return (unsigned)bits;
+}
+
+static unsigned hash_str(const char *s) {
+    unsigned h = 2166136261u;
+    for (; *s; s++) h = (h ^ (unsigned char)*s) * 16777619u;
+    return h;
+}
+
+/* weak_equal's notion of a numeric string. */
+static int numeric_string(const char *s, double *out) {
+    char *end;
+    *out = strtod(s, &end);
+    return *end == '\0';
+}
+
+static void jump_insert(struct SwitchJump *t, int idx, int is_str, double num, const char *str) {
+    unsigned h = is_str ? hash_str(str) : hash_num(num);
+    unsigned i = h & t->mask;
+    while (t->slots[i].idx >= 0) i = (i + 1) & t->mask;
+    t->slots[i].idx = idx;
+    t->slots[i].is_str = is_str;
+    t->slots[i].hash = h;
+    t->slots[i].num = num;
+    t->slots[i].str = str;
+}
+
+static void switch_jump_build(AstNode *n) {
+    int count = n->switch_stmt.case_count;
+    int labels = 0, keys = 0;
+    n->switch_stmt.jump_checked = 1;
+
+    for (int i = 0; i < count; i++) {
+        AstNode *ce = n->switch_stmt.case_exprs[i];
+        if (!ce) continue;
+        if (ce->type != AST_LITERAL) return;
+        if (ce->literal.token.type == TOK_STRING) keys += 2;
+        else if (ce->literal.token.type == TOK_INT) keys++;
+        else return;
+        labels++;
+    }
+    if (labels < SWITCH_JUMP_MIN) return;
+
+    unsigned cap = 8;
+    while (cap < (unsigned)keys * 2) cap <<= 1;
+    struct SwitchJump *t = (struct SwitchJump *)malloc(sizeof(*t) + cap * sizeof(SwitchSlot));
+    if (!t) return;
+    t->mask = cap - 1;
+    t->default_idx = -1;
+    t->has_int = 0;
+    for (unsigned i = 0; i < cap; i++) t->slots[i].idx = -1;
+
+    for (int i = 0; i < count; i++) {
+        AstNode *ce = n->switch_stmt.case_exprs[i];
+        if (!ce) { t->default_idx = i; continue; }
+        const Token *tok = &ce->literal.token;
+        if (tok->type == TOK_INT) {
+            jump_insert(t, i, 0, (double)tok->int_val, NULL);
+            t->has_int = 1;
+        } else {
+            const char *str = tok->string_val ? tok->string_val : "";
+            double d;
+            jump_insert(t, i, 1, 0.0, str);
+            if (numeric_string(str, &d)) jump_insert(t, i, 0, d, NULL);
+        }
     }
+    n->switch_stmt.jump = t;
+}
 
-    if (n->block.count == 1) {
-        EvalResult r = eval_node(n->block.items[0], env);
-        if (lx_has_error()) {
-            value_free(r.value);
-            return ok(value_null());
+/* Borrowed value of a literal case label (not to be freed). */
+static Value case_label(AstNode *ce) {
+    Value v;
+    if (ce->literal.token.type == TOK_INT) return value_int(ce->literal.token.int_val);
+    v.type = VAL_STRING;
+    v.s = ce->literal.token.string_val;
+    return v;
+}
+
+static int jump_probe(AstNode *n, Value sv, int strict, int is_str, double num,
+                      const char *str, int best) {
+    struct SwitchJump *t = n->switch_stmt.jump;
+    unsigned h = is_str ? hash_str(str) : hash_num(num);
+    for (unsigned i = h & t->mask; t->slots[i].idx >= 0; i = (i + 1) & t->mask) {
+        SwitchSlot *e = &t->slots[i];
+        if (e->hash != h || e->is_str != is_str) continue;
+        if (best >= 0 && e->idx >= best) continue;
+        if (is_str ? strcmp(e->str, str) != 0 : e->num != num) continue;
+        Value cv = case_label(n->switch_stmt.case_exprs[e->idx]);
+        if (strict ? strict_equal(sv, cv) : weak_equal(sv, cv)) best = e->idx;
+    }
+    return best;
+}
+
+/* @return The first matching case index, or -1. */
+static int switch_jump_lookup(AstNode *n, Value sv, int strict) {
+    double d;
+    if (value_is_number(sv)) {
+        d = value_as_double(sv);
+        if (d != d) return -1;
+        return jump_probe(n, sv, strict, 0, d, NULL, -1);
+    }
+    if (sv.type == VAL_STRING) {
+        const char *s = sv.s ? sv.s : "";
+        int best = jump_probe(n, sv, strict, 1, 0.0, s, -1);
+        if (!strict && n->switch_stmt.jump->has_int && numeric_string(s, &d) && d == d) {
+            best = jump_probe(n, sv, strict, 0, d, NULL, best);
         }
-        if (r.flow != FLOW_NORMAL) return r;
+        return best;
+    }
+    return -1;
+}
+
+/* ---------- foreach ---------- */
+
+/*
+ * Loop variables are rebound in place: a string element or key is copied
+ * into the buffer the variable already owns, so after the first few
+ * iterations the loop no longer allocates. Elements of an array that only
+ * the loop can see (a temporary such as a call result) are moved out
+ * instead of copied. With `&$v` the variable's value is stored back into
+ * the element after every iteration, including the one a break or return
+ * leaves.
+ */
+static void foreach_bind_key(Env *env, const char *name, const ArrayEntry *e) {
+    Value *slot = env_get_ref(env, name);
+    if (!slot) return;
+    if (e->key.type == KEY_STRING) {
+        value_assign_string_n(slot, e->key.s, strlen(e->key.s));
+    } else {
+        value_free(*slot);
+        *slot = value_int(e->key.i);
+    }
+}
+
+static void foreach_bind_value(Env *env, const char *name, ArrayEntry *e, int move) {
+    Value *slot = env_get_ref(env, name);
+    if (!slot) return;
+    if (move) {
+        value_free(*slot);
+        *slot = e->value;
+        e->value = value_null();
+    } else if (e->value.type == VAL_STRING && e->value.s) {
+        value_assign_string_n(slot, e->value.s, strlen(e->value.s));
+    } else {
+        Value v = value_copy(e->value);
+        value_free(*slot);
+        *slot = v;
+    }
+}
+
+/* Store $v back into the element bound at position @p i. The body may
+ * have added or removed entries, so the key is checked before writing. */
+static void foreach_store_back(AstNode *n, Env *env, Array *a, size_t i, const Key *k) {
+    int hint = -1;
+    Value *src = env_lookup(env, n->foreach_stmt.value_name, &hint);
+    Value *dst = NULL;
+    if (!src) return;
+    array_own(a);
+    if (i < a->size && a->entries[i].key.type == k->type &&
+        (k->type == KEY_STRING ? !strcmp(a->entries[i].key.s, k->s)
+                               : a->entries[i].key.i == k->i)) {
+        dst = &a->entries[i].value;
+    } else {
+        dst = array_lookup(a, *k);
+    }
+    if (!dst) return;
+    if (src->type == VAL_ARRAY && array_contains(src->a, a)) {
+        runtime_error(n, LX_ERR_CYCLE, "cyclic array reference");
+        return;
+    }
+    Value v = value_copy(*src);
+    value_free(*dst);
+    *dst = v;
+}
+
+static EvalResult eval_foreach_array(AstNode *n, Env *env, Array *a) {
+    const char *key_name = n->foreach_stmt.key_name;
+    const char *value_name = n->foreach_stmt.value_name;
+    int by_ref = n->foreach_stmt.by_ref;
+    int move = !by_ref && a->refcount == 1 && !a->shared;
+
+    for (size_t i = 0; i < a->size; i++) {
+        ArrayEntry *e = &a->entries[i];
+        Key k = e->key;
+        if (by_ref && k.type == KEY_STRING) k.s = strdup(k.s);
+        if (key_name) foreach_bind_key(env, key_name, e);
+        foreach_bind_value(env, value_name, e, move);
+
+        EvalResult r = eval_node(n->foreach_stmt.body, env);
+        if (by_ref) {
+            if (!lx_has_error()) foreach_store_back(n, env, a, i, &k);
+            if (k.type == KEY_STRING) free(k.s);
+        }
+        if (r.flow == FLOW_RETURN) return r;
         value_free(r.value);
-        return ok(value_null());
+        if (r.flow == FLOW_BREAK) break;
     }
+    return ok(value_null());
+}
 
-    for (int i = 0; i < n->block.count; i++) {
-        if (!n->block.items[i]) {
-            runtime_error(n, LX_ERR_INTERNAL, "null block statement");
-            return ok(value_null());
+static EvalResult eval_foreach(AstNode *n, Env *env) {
+    int ok_flag = 1;
+    Value it = eval_expr(n->foreach_stmt.iterable, env, &ok_flag);
+    if (!ok_flag) { value_free(it); return ok(value_null()); }
+
+    const char *key_name = n->foreach_stmt.key_name;
+    const char *value_name = n->foreach_stmt.value_name;
+    EvalResult res = ok(value_null());
+
+    gc_push_root(&it);
+    if (it.type == VAL_ARRAY && it.a) {
+        res = eval_foreach_array(n, env, it.a);
+    } else if (n->foreach_stmt.by_ref && (it.type == VAL_STRING || it.type == VAL_BLOB)) {
+        runtime_error(n, LX_ERR_RUNTIME, "foreach by reference requires an array");
+    } else if (it.type == VAL_STRING && it.s) {
+        size_t len = strlen(it.s);
+        for (size_t i = 0; i < len; i++) {
+            if (key_name) env_set(env, key_name, value_int((lx_int_t)i));
+            Value *slot = env_get_ref(env, value_name);
+            if (slot) value_assign_string_n(slot, &it.s[i], 1);
+
+            EvalResult r = eval_node(n->foreach_stmt.body, env);
+            if (r.flow == FLOW_RETURN) { res = r; break; }
+            value_free(r.value);
+            if (r.flow == FLOW_BREAK) break;
         }
-        EvalResult r = eval_node(n->block.items[i], env);
-        if (lx_has_error()) {
+    } else if (it.type == VAL_BLOB && it.blob) {
+        for (size_t i = 0; i < it.blob->len; i++) {
+            if (key_name) env_set(env, key_name, value_int((lx_int_t)i));
+            env_set(env, value_name, value_byte(it.blob->data[i]));
+
+            EvalResult r = eval_node(n->foreach_stmt.body, env);
+            if (r.flow == FLOW_RETURN) { res = r; break; }
             value_free(r.value);
-            return ok(value_null());
+            if (r.flow == FLOW_BREAK) break;
         }
-        if (r.flow != FLOW_NORMAL) return r;
-        value_free(r.value);
-#if !defined(LX_TARGET_LXSH) || !LX_TARGET_LXSH
-        gc_maybe_collect(env);
-#endif
     }
-    return ok(value_null());
+    gc_pop_roots(1);
+
+    value_free(it);
+    return res;
 }
 
 EvalResult eval_node(AstNode *n, Env *env) {
@@ -1008,6 +2331,7 @@ EvalResult eval_node(AstNode *n, Env *env) {
     }
 #endif
     int ok_flag = 1;
+    lx_heapprof_node = n;
 
     switch (n->type) {
         case AST_PROGRAM:
@@ -1063,7 +2387,7 @@ EvalResult eval_node(AstNode *n, Env *env) {
                         value_free(sv);
                         value_free(arrv);
                         free(dyn_name);
-                        runtime_error(n, LX_ERR_INTERNAL, "string append allocation failed");
+                        if (!lx_has_error()) runtime_error(n, LX_ERR_INTERNAL, "string append allocation failed");
                         return ok(value_null());
                     }
                     if (base_len) memcpy(buf, arrv.s, base_len);
@@ -1125,7 +2449,7 @@ EvalResult eval_node(AstNode *n, Env *env) {
                             value_free(val);
                             value_free(arrv);
                             free(dyn_name);
-                            runtime_error(n, LX_ERR_INTERNAL, "blob append allocation failed");
+                            if (!lx_has_error()) runtime_error(n, LX_ERR_INTERNAL, "blob append allocation failed");
                             return ok(value_null());
                         }
                         memcpy(arrv.blob->data + arrv.blob->len, src, src_len);
@@ -1148,61 +2472,35 @@ EvalResult eval_node(AstNode *n, Env *env) {
                 Value val = eval_expr(n->index_assign.value, env, &ok2);
                 if (!ok2) { value_free(arrv); free(dyn_name); return ok(value_null()); }
 
-                lx_int_t idx = array_next_index(arrv.a);
-                array_set(arrv.a, key_int(idx), value_copy(val));
+                array_push(arrv.a, value_copy(val));
                 value_free(val);
                 value_free(arrv);
                 free(dyn_name);
                 return ok(value_null());
             }
 
-            AstNode *cur = ix;
-            AstNode **indices = NULL;
-            int index_count = 0;
-
-            while (cur && cur->type == AST_INDEX) {
-                indices = realloc(indices, sizeof(AstNode *) * (index_count + 1));
-                indices[index_count++] = cur->index.index;
-                cur = cur->index.target;
-            }
-
-            if (!cur || (cur->type != AST_VAR && cur->type != AST_VAR_DYNAMIC)) {
-                free(indices);
+            struct LvalPath *p = lval_path(ix);
+            if (!p) {
                 runtime_error(n, LX_ERR_INDEX_ASSIGN, "index assignment only supports $var[index]");
                 return ok(value_null());
             }
             char *dyn_name = NULL;
-            const char *varname = NULL;
-            if (cur->type == AST_VAR_DYNAMIC) {
-                dyn_name = eval_dynamic_name(cur->var_dynamic.expr, env, &ok2);
-                if (!ok2 || !dyn_name) {
-                    free(indices);
-                    return ok(value_null());
-                }
-                varname = dyn_name;
-            } else {
-                varname = cur->var.name;
-            }
-
-            Value arrv = env_get(env, varname);
-            if (arrv.type == VAL_UNDEFINED || arrv.type == VAL_NULL) {
-                arrv = value_array();
-                env_set(env, varname, value_copy(arrv));
-            }
+            Value arrv = lval_base(p, env, &ok2, &dyn_name);
+            if (!ok2) { free(dyn_name); return ok(value_null()); }
+            const char *varname = dyn_name ? dyn_name : p->base->var.name;
 
-            if ((arrv.type == VAL_STRING || arrv.type == VAL_BLOB) && index_count == 1) {
+            if ((arrv.type == VAL_STRING || arrv.type == VAL_BLOB) && p->count == 1) {
                 if (n->index_assign.is_compound) {
                     value_free(arrv);
-                    free(indices);
                     free(dyn_name);
                     runtime_error(n, LX_ERR_INDEX_ASSIGN, "compound index assignment on non-array");
                     return ok(value_null());
                 }
 
-                Value last_idx = eval_expr(indices[0], env, &ok2);
-                if (!ok2) { value_free(arrv); free(indices); free(dyn_name); return ok(value_null()); }
+                Value last_idx = eval_expr(p->indices[0], env, &ok2);
+                if (!ok2) { value_free(arrv); free(dyn_name); return ok(value_null()); }
                 Value val = eval_expr(n->index_assign.value, env, &ok2);
-                if (!ok2) { value_free(arrv); value_free(last_idx); free(indices); free(dyn_name); return ok(value_null()); }
+                if (!ok2) { value_free(arrv); value_free(last_idx); free(dyn_name); return ok(value_null()); }
 
                 Value ii = value_to_int(last_idx);
                 lx_int_t idx = ii.i;
@@ -1212,7 +2510,6 @@ EvalResult eval_node(AstNode *n, Env *env) {
                 if (idx < 0) {
                     value_free(val);
                     value_free(arrv);
-                    free(indices);
                     free(dyn_name);
                     runtime_error(n, LX_ERR_INDEX_ASSIGN, "index assignment requires non-negative index");
                     return ok(value_null());
@@ -1222,7 +2519,6 @@ EvalResult eval_node(AstNode *n, Env *env) {
                 if (!value_to_byte(val, &byte)) {
                     value_free(val);
                     value_free(arrv);
-                    free(indices);
                     free(dyn_name);
                     runtime_error(n, LX_ERR_INDEX_ASSIGN, "index assignment requires byte-compatible value");
                     return ok(value_null());
@@ -1232,7 +2528,6 @@ EvalResult eval_node(AstNode *n, Env *env) {
                 if (arrv.type == VAL_STRING) {
                     if (!arrv.s) {
                         value_free(arrv);
-                        free(indices);
                         free(dyn_name);
                         runtime_error(n, LX_ERR_INDEX_ASSIGN, "index assignment on empty string");
                         return ok(value_null());
@@ -1240,28 +2535,24 @@ EvalResult eval_node(AstNode *n, Env *env) {
                     int len = (int)strlen(arrv.s);
                     if (idx >= len) {
                         value_free(arrv);
-                        free(indices);
                         free(dyn_name);
                         runtime_error(n, LX_ERR_INDEX_ASSIGN, "string index out of range");
                         return ok(value_null());
                     }
                     arrv.s[idx] = (char)byte;
                     env_set(env, varname, arrv);
-                    free(indices);
                     free(dyn_name);
                     return ok(value_null());
                 }
 
                 if (!arrv.blob) {
                     value_free(arrv);
-                    free(indices);
                     free(dyn_name);
                     runtime_error(n, LX_ERR_INDEX_ASSIGN, "index assignment on invalid blob");
                     return ok(value_null());
                 }
                 if ((size_t)idx > arrv.blob->len) {
                     value_free(arrv);
-                    free(indices);
                     free(dyn_name);
                     runtime_error(n, LX_ERR_INDEX_ASSIGN, "blob index out of range");
                     return ok(value_null());
@@ -1269,9 +2560,8 @@ EvalResult eval_node(AstNode *n, Env *env) {
                 if ((size_t)idx == arrv.blob->len) {
                     if (!blob_reserve(arrv.blob, arrv.blob->len + 1)) {
                         value_free(arrv);
-                        free(indices);
                         free(dyn_name);
-                        runtime_error(n, LX_ERR_INTERNAL, "blob allocation failed");
+                        if (!lx_has_error()) runtime_error(n, LX_ERR_INTERNAL, "blob allocation failed");
                         return ok(value_null());
                     }
                     arrv.blob->data[arrv.blob->len] = byte;
@@ -1280,95 +2570,63 @@ EvalResult eval_node(AstNode *n, Env *env) {
                     arrv.blob->data[idx] = byte;
                 }
                 env_set(env, varname, arrv);
-                free(indices);
                 free(dyn_name);
                 return ok(value_null());
             }
 
             if (arrv.type != VAL_ARRAY) {
                 value_free(arrv);
-                free(indices);
                 free(dyn_name);
                 runtime_error(n, LX_ERR_INDEX_ASSIGN, "index assignment on non-array");
                 return ok(value_null());
             }
+            free(dyn_name);
 
             Array *current = arrv.a;
-
-            for (int i = index_count - 1; i > 0; i--) {
-                Value idx = eval_expr(indices[i], env, &ok2);
-                if (!ok2) { value_free(arrv); free(indices); free(dyn_name); return ok(value_null()); }
-
-                Value *slot = NULL;
-                if (idx.type == VAL_STRING) {
-                    slot = array_get_ref(current, key_string(idx.s));
-                } else {
-                    Value ii = value_to_int(idx);
-                    slot = array_get_ref(current, key_int(ii.i));
-                    value_free(ii);
-                }
-                value_free(idx);
-                if (!slot) {
-                    value_free(arrv);
-                    free(indices);
-                    free(dyn_name);
-                    return ok(value_null());
-                }
-
-                if (slot->type == VAL_UNDEFINED || slot->type == VAL_NULL) {
-                    Value nv = value_array();
-                    value_free(*slot);
-                    *slot = nv;
-                }
-
-                if (slot->type != VAL_ARRAY) {
-                    value_free(arrv);
-                    free(indices);
-                    free(dyn_name);
+            int st = lval_descend(p, env, &current, &ok2);
+            if (st != LVAL_OK) {
+                value_free(arrv);
+                if (st == LVAL_NOT_ARRAY) {
                     runtime_error(n, LX_ERR_INDEX_ASSIGN, "index assignment on non-array");
-                    return ok(value_null());
                 }
-
-                current = slot->a;
+                return ok(value_null());
             }
 
-            Value last_idx = eval_expr(indices[0], env, &ok2);
-            if (!ok2) { value_free(arrv); free(indices); free(dyn_name); return ok(value_null()); }
+            /* The last key is read before the value is evaluated, so it may
+             * only borrow an index variable the value cannot rebind. */
+            AstNode *last = p->indices[p->count - 1];
+            if (p->borrow_last < 0) {
+                p->borrow_last = last->type == AST_VAR &&
+                                 !body_mentions(n->index_assign.value, last->var.name);
+            }
+            Value last_idx;
+            Key k = lval_key(last, env, &last_idx, &ok2, p->borrow_last);
+            if (!ok2) { value_free(arrv); value_free(last_idx); return ok(value_null()); }
 
             Value val = eval_expr(n->index_assign.value, env, &ok2);
-            if (!ok2) { value_free(arrv); value_free(last_idx); free(indices); free(dyn_name); return ok(value_null()); }
+            if (!ok2) { value_free(arrv); value_free(last_idx); return ok(value_null()); }
 
             if (val.type == VAL_ARRAY && val.a) {
                 if (array_contains(val.a, current)) {
                     value_free(val);
                     value_free(last_idx);
                     value_free(arrv);
-                    free(indices);
-                    free(dyn_name);
                     runtime_error(n, LX_ERR_CYCLE, "cyclic array reference");
                     return ok(value_null());
                 }
             }
 
-            Value *slot = NULL;
-            if (last_idx.type == VAL_STRING) {
-                slot = array_get_ref(current, key_string(last_idx.s));
-            } else {
-                Value ii = value_to_int(last_idx);
-                slot = array_get_ref(current, key_int(ii.i));
-                value_free(ii);
-            }
+            Value *slot = array_slot(current, k);
+            value_free(last_idx);
             if (!slot) {
                 value_free(val);
-                value_free(last_idx);
                 value_free(arrv);
-                free(indices);
-                free(dyn_name);
                 return ok(value_null());
             }
 
             if (n->index_assign.is_compound) {
-                Value lhs = value_copy(*slot);
+                Value lhs = *slot;
+                *slot = value_undefined();
                 if (lhs.type == VAL_UNDEFINED || lhs.type == VAL_NULL) {
                     if (n->index_assign.op == OP_CONCAT) {
                         lhs = value_string("");
@@ -1376,19 +2634,13 @@ EvalResult eval_node(AstNode *n, Env *env) {
                         lhs = value_int(0);
                     }
                 }
-                Value out = apply_assign_op(n, n->index_assign.op, lhs, value_copy(val));
-                value_free(*slot);
-                *slot = out;
+                *slot = apply_assign_op(n, n->index_assign.op, lhs, val);
             } else {
                 value_free(*slot);
-                *slot = value_copy(val);
+                *slot = val;
             }
 
-            value_free(val);
-            value_free(last_idx);
             value_free(arrv);
-            free(indices);
-            free(dyn_name);
             return ok(value_null());
         }
 
@@ -1475,6 +2727,8 @@ EvalResult eval_node(AstNode *n, Env *env) {
         }
 
         case AST_FOR: {
+            if (n->for_stmt.counted == 0) n->for_stmt.counted = counted_loop_flags(n);
+            if (n->for_stmt.counted > 0) return eval_counted_for(n, env);
             if (n->for_stmt.init) {
                 EvalResult r0 = eval_node(n->for_stmt.init, env);
                 if (r0.flow == FLOW_RETURN) return r0;
@@ -1484,101 +2738,11 @@ EvalResult eval_node(AstNode *n, Env *env) {
                 }
                 value_free(r0.value);
             }
-            for (;;) {
-                if (n->for_stmt.cond) {
-                    Value c = eval_expr(n->for_stmt.cond, env, &ok_flag);
-                    if (!ok_flag) { value_free(c); return ok(value_null()); }
-                    int t = value_is_true(c);
-                    value_free(c);
-                    if (!t) break;
-                }
-                EvalResult rb = eval_node(n->for_stmt.body, env);
-                if (rb.flow == FLOW_RETURN) return rb;
-                if (rb.flow == FLOW_BREAK) { value_free(rb.value); break; }
-                if (rb.flow == FLOW_CONTINUE) {
-                    value_free(rb.value);
-                    if (n->for_stmt.step) {
-                        EvalResult rs = eval_node(n->for_stmt.step, env);
-                        if (rs.flow == FLOW_RETURN) return rs;
-                        if (rs.flow == FLOW_BREAK || rs.flow == FLOW_CONTINUE) {
-                            value_free(rs.value);
-                            return ok(value_null());
-                        }
-                        value_free(rs.value);
-                    }
-                    continue;
-                }
-                value_free(rb.value);
-
-                if (n->for_stmt.step) {
-                    EvalResult rs = eval_node(n->for_stmt.step, env);
-                    if (rs.flow == FLOW_RETURN) return rs;
-                    if (rs.flow == FLOW_BREAK || rs.flow == FLOW_CONTINUE) {
-                        value_free(rs.value);
-                        return ok(value_null());
-                    }
-                    value_free(rs.value);
-                }
-            }
-            return ok(value_null());
+            return eval_for_loop(n, env);
         }
 
-        case AST_FOREACH: {
-            Value it = eval_expr(n->foreach_stmt.iterable, env, &ok_flag);
-            if (!ok_flag) { value_free(it); return ok(value_null()); }
-
-            if (it.type == VAL_ARRAY && it.a) {
-                for (size_t i = 0; i < it.a->size; i++) {
-                    ArrayEntry *e = &it.a->entries[i];
-                    if (n->foreach_stmt.key_name) {
-                        Value kv = (e->key.type == KEY_STRING)
-                            ? value_string(e->key.s)
-                            : value_int(e->key.i);
-                        env_set(env, n->foreach_stmt.key_name, kv);
-                    }
-                    Value vv = value_copy(e->value);
-                    env_set(env, n->foreach_stmt.value_name, vv);
-
-                    EvalResult r = eval_node(n->foreach_stmt.body, env);
-                    if (r.flow == FLOW_RETURN) { value_free(it); return r; }
-                    if (r.flow == FLOW_BREAK) { value_free(r.value); break; }
-                    if (r.flow == FLOW_CONTINUE) { value_free(r.value); continue; }
-                    value_free(r.value);
-                }
-            } else if (it.type == VAL_STRING && it.s) {
-                size_t len = strlen(it.s);
-                for (size_t i = 0; i < len; i++) {
-                    if (n->foreach_stmt.key_name) {
-                        env_set(env, n->foreach_stmt.key_name, value_int((lx_int_t)i));
-                    }
-                    Value vv = value_string_n(&it.s[i], 1);
-                    env_set(env, n->foreach_stmt.value_name, vv);
-
-                    EvalResult r = eval_node(n->foreach_stmt.body, env);
-                    if (r.flow == FLOW_RETURN) { value_free(it); return r; }
-                    if (r.flow == FLOW_BREAK) { value_free(r.value); break; }
-                    if (r.flow == FLOW_CONTINUE) { value_free(r.value); continue; }
-                    value_free(r.value);
-                }
-            } else if (it.type == VAL_BLOB && it.blob) {
-                for (size_t i = 0; i < it.blob->len; i++) {
-                    if (n->foreach_stmt.key_name) {
-                        env_set(env, n->foreach_stmt.key_name, value_int((lx_int_t)i));
-                    }
-                    Value vv = value_byte(it.blob->data[i]);
-                    env_set(env, n->foreach_stmt.value_name, vv);
-
-                    EvalResult r = eval_node(n->foreach_stmt.body, env);
-                    if (r.flow == FLOW_RETURN) { value_free(it); return r; }
-                    if (r.flow == FLOW_BREAK) { value_free(r.value); break; }
-                    if (r.flow == FLOW_CONTINUE) { value_free(r.value); continue; }
-                    value_free(r.value);
-                }
-            }
-
-            value_free(it);
-            return ok(value_null());
-        }
+        case AST_FOREACH:
+            return eval_foreach(n, env);
 
         case AST_SWITCH: {
             Value sv = eval_expr(n->switch_stmt.expr, env, &ok_flag);
@@ -1593,14 +2757,20 @@ EvalResult eval_node(AstNode *n, Env *env) {
 
             int start = -1;
             int default_idx = -1;
-            for (int i = 0; i < n->switch_stmt.case_count; i++) {
-                AstNode *ce = n->switch_stmt.case_exprs[i];
-                if (!ce) { default_idx = i; continue; }
-                Value cv = eval_expr(ce, env, &ok_flag);
-                if (!ok_flag) { value_free(sv); value_free(cv); return ok(value_null()); }
-                int eq = strict ? strict_equal(sv, cv) : weak_equal(sv, cv);
-                value_free(cv);
-                if (eq) { start = i; break; }
+            if (!n->switch_stmt.jump_checked) switch_jump_build(n);
+            if (n->switch_stmt.jump) {
+                start = switch_jump_lookup(n, sv, strict);
+                default_idx = n->switch_stmt.jump->default_idx;
+            } else {
+                for (int i = 0; i < n->switch_stmt.case_count; i++) {
+                    AstNode *ce = n->switch_stmt.case_exprs[i];
+                    if (!ce) { default_idx = i; continue; }
+                    Value cv = eval_expr(ce, env, &ok_flag);
+                    if (!ok_flag) { value_free(sv); value_free(cv); return ok(value_null()); }
+                    int eq = strict ? strict_equal(sv, cv) : weak_equal(sv, cv);
+                    value_free(cv);
+                    if (eq) { start = i; break; }
+                }
             }
 
             if (start < 0) start = default_idx;
@@ -1626,6 +2796,27 @@ EvalResult eval_node(AstNode *n, Env *env) {
             return ok(value_null());
         }
 
+        case AST_CONST_DECL: {
+            const char *name = n->const_decl.name;
+            Value v = eval_expr(n->const_decl.value, env, &ok_flag);
+            if (!ok_flag) { value_free(v); return ok(value_null()); }
+            const Value *prev = find_constant(name);
+            if (prev) {
+                /* A declaration that runs again (in a function or a loop)
+                 * with the same value leaves the constant as it is. */
+                int same = same_constant(*prev, v);
+                value_free(v);
+                if (!same) runtime_error(n, LX_ERR_CONSTANT, "constant '%s' already defined", name);
+                return ok(value_null());
+            }
+            const char *type = value_type_name(v);
+            if (!define_constant(name, v)) {
+                runtime_error(n, LX_ERR_CONSTANT, "constant '%s' must be a scalar, %s given",
+                              name, type);
+            }
+            return ok(value_null());
+        }
+
         case AST_FUNCTION:
             register_user_fn(n);
             return ok(value_null());
@@ -1634,6 +2825,9 @@ EvalResult eval_node(AstNode *n, Env *env) {
             if (!n->ret.value) {
                 return ret(value_void());
             }
+            if (n->ret.tail && return_tail_call(n->ret.value, env, &ok_flag)) {
+                return ret(ok_flag ? value_void() : value_null());
+            }
             Value v = eval_expr(n->ret.value, env, &ok_flag);
             if (!ok_flag) { value_free(v); return ret(value_null()); }
             return ret(v);
@@ -1718,3 +2912,11 @@ EvalResult eval_node(AstNode *n, Env *env) {
 EvalResult eval_program(AstNode *program, Env *env) {
     return eval_node(program, env);
 }
+
+Value eval_expr_value(AstNode *n, Env *env, int *ok_flag) {
+    return eval_expr(n, env, ok_flag);
+}
+
+void eval_set_body_runner(EvalBodyFn fn) {
+    g_body_runner = fn;
+}
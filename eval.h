@@ -29,4 +29,68 @@ EvalResult eval_node(AstNode *n, Env *env);
 /** Execute a program or block node. */
 EvalResult eval_program(AstNode *program, Env *env);
 
+/** Evaluate an expression node; clears @p ok_flag on failure. */
+Value eval_expr_value(AstNode *n, Env *env, int *ok_flag);
+
+/** Convert a literal token to a runtime value. */
+Value eval_literal(const Token *t);
+
+/**
+ * Apply a non short-circuit binary operator. Consumes @p a and @p b;
+ * @p n is used for error locations.
+ */
+Value eval_binary_values(AstNode *n, Operator op, Value a, Value b, int *ok_flag);
+
+/** Apply a unary operator. Consumes @p v. */
+Value eval_unary_value(Operator op, Value v, int *ok_flag);
+
+/** Apply a compound assignment operator (+=, -=, ...). Consumes both operands. */
+Value eval_assign_op(AstNode *n, Operator op, Value lhs, Value rhs);
+
+/** Read @p target[@p index] without consuming either value. */
+Value eval_index_value(Value target, Value index);
+
+/**
+ * Call the function named by call node @p n with already evaluated
+ * arguments. Consumes the values in @p argv but not the array itself.
+ */
+Value eval_call_values(AstNode *n, Env *env, Value *argv, int argc, int *ok_flag);
+
+/**
+ * @return The native called by call node @p call, or NULL when it names a
+ *         user function. Resolved once per registry generation and cached
+ *         on the node.
+ */
+const NativeDef *eval_call_native(AstNode *call);
+
+/**
+ * Evaluate the arguments of call node @p n and call native @p def with
+ * them. Arguments of a typed native that are plain variables are passed
+ * borrowed instead of copied.
+ */
+Value eval_native_call(AstNode *n, const NativeDef *def, Env *env, int *ok_flag);
+
+/**
+ * Hand call node @p call, with already evaluated arguments, back to the
+ * running user function's caller, which then runs it in place of the
+ * current frame. Used for `return f(...)`; the caller of this function
+ * must return void right away.
+ * @return Non-zero when the tail call was taken (the values in @p argv are
+ *         consumed, not the array); zero when it must be a normal call.
+ */
+int eval_tail_call(AstNode *call, Value *argv, int argc);
+
+/**
+ * @return The name of the running user function ("" at top level). When
+ *         @p file is not NULL it receives the file the function was
+ *         defined in, if recorded (see lx_heapprof_file()), else NULL.
+ */
+const char *eval_current_function(const char **file);
+
+/** Runner used to execute user function bodies. */
+typedef EvalResult (*EvalBodyFn)(AstNode *body, Env *env);
+
+/** Install a user function body runner (NULL restores the tree walker). */
+void eval_set_body_runner(EvalBodyFn fn);
+
 #endif
@@ -4,6 +4,7 @@
  */
 #include "lx_ext.h"
 #include "array.h"
+#include "region.h"
 #include <errno.h>
 #include <fcntl.h>
 #include <stdlib.h>
@@ -19,16 +20,16 @@
 
 static void array_clear(Array *a) {
     if (!a) return;
+    array_own(a);
     for (size_t i = 0; i < a->size; i++) {
-        if (a->entries[i].key.type == KEY_STRING) {
-            free(a->entries[i].key.s);
-        }
+        key_free(a->entries[i].key);
         value_free(a->entries[i].value);
     }
-    free(a->entries);
+    lx_region_free(a->entries);
     a->entries = NULL;
     a->size = 0;
     a->capacity = 0;
+    a->next_index = 0;
 }
 
 static int append_buf(char **buf, size_t *len, size_t *cap, const char *data, size_t n) {
@@ -125,10 +125,20 @@ static int json_encode_value(StrBuf *b, Value v) {
     }
 }
 
+/* Objects at the same nesting depth usually share their keys (rows of a
+ * list), so each depth keeps the shape of the last object parsed there. */
+#define JSON_SHAPE_DEPTH 8
+
 typedef struct {
     const char *cur;
+    int depth;
+    ArrayShape *shapes[JSON_SHAPE_DEPTH];
 } JsonParser;
 
+static void json_parser_release(JsonParser *p) {
+    for (int i = 0; i < JSON_SHAPE_DEPTH; i++) array_shape_release(p->shapes[i]);
+}
+
 static void json_skip_ws(JsonParser *p) {
     while (*p->cur && isspace((unsigned char)*p->cur)) p->cur++;
 }
@@ -230,7 +240,7 @@ static Value json_parse_array(JsonParser *p, int *ok) {
     while (*p->cur) {
         Value v = json_parse_value(p, ok);
         if (!*ok) { value_free(out); return value_undefined(); }
-        array_set(out.a, key_int(idx++), v);
+        array_append(out.a, key_int(idx++), v);
         json_skip_ws(p);
         if (*p->cur == ',') { p->cur++; json_skip_ws(p); continue; }
         if (*p->cur == ']') { p->cur++; return out; }
@@ -260,7 +270,11 @@ static Value json_parse_object(JsonParser *p, int *ok) {
         value_free(key);
         json_skip_ws(p);
         if (*p->cur == ',') { p->cur++; json_skip_ws(p); continue; }
-        if (*p->cur == '}') { p->cur++; return out; }
+        if (*p->cur == '}') {
+            p->cur++;
+            if (p->depth < JSON_SHAPE_DEPTH) array_adopt_shape(out.a, &p->shapes[p->depth]);
+            return out;
+        }
         break;
     }
     *ok = 0;
@@ -271,8 +285,12 @@ static Value json_parse_object(JsonParser *p, int *ok) {
 static Value json_parse_value(JsonParser *p, int *ok) {
     json_skip_ws(p);
     if (*p->cur == '"') return json_parse_string(p, ok);
-    if (*p->cur == '{') return json_parse_object(p, ok);
-    if (*p->cur == '[') return json_parse_array(p, ok);
+    if (*p->cur == '{' || *p->cur == '[') {
+        p->depth++;
+        Value v = (*p->cur == '{') ? json_parse_object(p, ok) : json_parse_array(p, ok);
+        p->depth--;
+        return v;
+    }
     if (*p->cur == '-' || isdigit((unsigned char)*p->cur)) return json_parse_number(p, ok);
     if (json_match(p, "true")) return value_bool(1);
     if (json_match(p, "false")) return value_bool(0);
@@ -297,9 +315,10 @@ static Value n_json_encode(Env *env, int argc, Value *argv){
 static Value n_json_decode(Env *env, int argc, Value *argv){
     (void)env;
     if (argc != 1 || argv[0].type != VAL_STRING) return value_undefined();
-    JsonParser p = { argv[0].s ? argv[0].s : "" };
+    JsonParser p = { argv[0].s ? argv[0].s : "", 0, {0} };
     int ok = 1;
     Value out = json_parse_value(&p, &ok);
+    json_parser_release(&p);
     json_skip_ws(&p);
     if (!ok || *p.cur != '\0') {
         value_free(out);
@@ -311,9 +330,10 @@ static Value n_json_decode(Env *env, int argc, Value *argv){
 static Value n_is_json(Env *env, int argc, Value *argv){
     (void)env;
     if (argc != 1 || argv[0].type != VAL_STRING) return value_bool(0);
-    JsonParser p = { argv[0].s ? argv[0].s : "" };
+    JsonParser p = { argv[0].s ? argv[0].s : "", 0, {0} };
     int ok = 1;
     Value out = json_parse_value(&p, &ok);
+    json_parser_release(&p);
     value_free(out);
     json_skip_ws(&p);
     if (!ok || *p.cur != '\0') return value_bool(0);
@@ -6,6 +6,7 @@
 #include "lxsh_exec.h"
 #include "value.h"
 #include "array.h"
+#include "region.h"
 #include <stdlib.h>
 #include <string.h>
 
@@ -14,16 +15,16 @@ static void array_clear(Array* a)
     if (!a) {
         return;
     }
+    array_own(a);
     for (size_t i = 0; i < a->size; i++) {
-        if (a->entries[i].key.type == KEY_STRING) {
-            free(a->entries[i].key.s);
-        }
+        key_free(a->entries[i].key);
         value_free(a->entries[i].value);
     }
-    free(a->entries);
+    lx_region_free(a->entries);
     a->entries = NULL;
     a->size = 0;
     a->capacity = 0;
+    a->next_index = 0;
 }
 
 static void array_push_line(Array* out, const char* line, size_t len, int stream_id)
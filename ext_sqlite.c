@@ -22,6 +22,7 @@ typedef struct {
     int done;
     int has_row;
     Value row_cache;
+    ArrayShape *shape; /* key layout of the rows fetched so far */
 } StmtHandle;
 
 static DbHandle *g_dbs = NULL;
@@ -85,6 +86,7 @@ static int stmt_handle_add(sqlite3_stmt *stmt, int db_id) {
             g_stmts[i].done = 0;
             g_stmts[i].has_row = 0;
             g_stmts[i].row_cache = value_null();
+            g_stmts[i].shape = NULL;
             return i + 1;
         }
     }
@@ -101,6 +103,7 @@ static int stmt_handle_add(sqlite3_stmt *stmt, int db_id) {
     g_stmts[g_stmt_count].done = 0;
     g_stmts[g_stmt_count].has_row = 0;
     g_stmts[g_stmt_count].row_cache = value_null();
+    g_stmts[g_stmt_count].shape = NULL;
     g_stmt_count++;
     return g_stmt_count;
 }
@@ -117,12 +120,15 @@ static void stmt_handle_close(int id) {
     if (!h->in_use) return;
     stmt_clear_cache(h);
     sqlite3_finalize(h->stmt);
+    array_shape_release(h->shape);
+    h->shape = NULL;
     h->stmt = NULL;
     h->in_use = 0;
     h->done = 1;
 }
 
-static Value row_from_stmt(sqlite3_stmt *stmt) {
+/* Rows of one statement share their column names through @p shape. */
+static Value row_from_stmt(sqlite3_stmt *stmt, ArrayShape **shape) {
     int cols = sqlite3_column_count(stmt);
     Value row = value_array();
     for (int i = 0; i < cols; i++) {
@@ -153,6 +159,7 @@ static Value row_from_stmt(sqlite3_stmt *stmt) {
         }
         array_set(row.a, key, v);
     }
+    array_adopt_shape(row.a, shape);
     return row;
 }
 
@@ -231,19 +238,22 @@ static Value n_pdo_query(Env *env, int argc, Value *argv){
     if (sqlite3_prepare_v2(db, sql, -1, &stmt, NULL) != SQLITE_OK) return value_undefined();
 
     Value out = value_array();
+    ArrayShape *shape = NULL;
     int row_idx = 0;
     for (;;) {
         int rc = sqlite3_step(stmt);
         if (rc == SQLITE_ROW) {
-            Value row = row_from_stmt(stmt);
-            array_set(out.a, key_int(row_idx++), row);
+            Value row = row_from_stmt(stmt, &shape);
+            array_append(out.a, key_int(row_idx++), row);
             continue;
         }
         if (rc == SQLITE_DONE) break;
+        array_shape_release(shape);
         value_free(out);
         sqlite3_finalize(stmt);
         return value_undefined();
     }
+    array_shape_release(shape);
     sqlite3_finalize(stmt);
     return out;
 }
@@ -284,7 +294,7 @@ static Value n_pdo_execute(Env *env, int argc, Value *argv){
 
     int rc = sqlite3_step(stmt);
     if (rc == SQLITE_ROW) {
-        h->row_cache = row_from_stmt(stmt);
+        h->row_cache = row_from_stmt(stmt, &h->shape);
         h->has_row = 1;
         return value_bool(1);
     }
@@ -308,7 +318,7 @@ static Value n_pdo_fetch(Env *env, int argc, Value *argv){
     if (h->done) return value_undefined();
     int rc = sqlite3_step(h->stmt);
     if (rc == SQLITE_ROW) {
-        return row_from_stmt(h->stmt);
+        return row_from_stmt(h->stmt, &h->shape);
     }
     if (rc == SQLITE_DONE) {
         h->done = 1;
@@ -325,14 +335,14 @@ static Value n_pdo_fetch_all(Env *env, int argc, Value *argv){
     Value out = value_array();
     int row_idx = 0;
     if (h->has_row) {
-        array_set(out.a, key_int(row_idx++), value_copy(h->row_cache));
+        array_append(out.a, key_int(row_idx++), value_copy(h->row_cache));
         stmt_clear_cache(h);
     }
     while (!h->done) {
         int rc = sqlite3_step(h->stmt);
         if (rc == SQLITE_ROW) {
-            Value row = row_from_stmt(h->stmt);
-            array_set(out.a, key_int(row_idx++), row);
+            Value row = row_from_stmt(h->stmt, &h->shape);
+            array_append(out.a, key_int(row_idx++), row);
             continue;
         }
         if (rc == SQLITE_DONE) {
@@ -378,7 +388,14 @@ static void sqlite_module_init(Env *global){
     (void)global;
 }
 
+/* Finalize every statement and close every database the script left open. */
+static void sqlite_shutdown(void) {
+    for (int i = 1; i <= g_stmt_count; i++) stmt_handle_close(i);
+    for (int i = 1; i <= g_db_count; i++) db_handle_close(i);
+}
+
 void register_sqlite_module(void) {
     lx_register_extension("sqlite");
     lx_register_module(sqlite_module_init);
+    lx_register_shutdown(sqlite_shutdown);
 }
@@ -1,114 +1,1037 @@
 /**
  * @file gc.c
- * @brief Mark-and-sweep collector for arrays.
+ * @brief Cycle collection for reference-counted arrays.
+ *
+ * Arrays are reference counted, so the collector only has to find arrays
+ * kept alive by other unreachable arrays. Two strategies are available
+ * (gc_set_mode()).
+ *
+ * The default is synchronous trial deletion (Bacon and Rajan). An array
+ * whose count drops to a nonzero value is buffered as a candidate root. At
+ * a safepoint with enough candidates, the subgraphs under them are painted
+ * gray while the references from inside the subgraph are subtracted from
+ * a scratch copy of each count. Arrays left with a positive count are
+ * referenced from outside and are repainted black with everything they
+ * reach; the remaining white arrays are garbage. The work is proportional
+ * to the candidate subgraphs, not to the heap.
+ *
+ * The fallback, kept for debugging, is an incremental tri-color
+ * mark-and-sweep. Tracked arrays sit on one of two intrusive doubly-linked
+ * lists, so registering, unregistering and shading are O(1). Between
+ * cycles every array is black. Starting a cycle flips the meaning of the
+ * mark, which turns the black list into the white list at once; shading an
+ * array moves it back to the black list and pushes it on the grey stack.
+ * Each safepoint then does a bounded amount of marking or sweeping.
+ * Roots are the environment chain of the safepoint and the value slots
+ * pushed with gc_push_roots(). Stores into arrays during marking go
+ * through gc_write_barrier(), and arrays created during a cycle are black.
+ * When marking ends, every array still white is checked against its
+ * reference count: one referenced from anywhere but another white array
+ * (a C temporary, a cached database row, a store the barrier did not see)
+ * is live, and is marked with everything it holds. Only the rest is swept.
+ *
+ * Both strategies free garbage the same way: it is moved to the white
+ * list, detached from the live arrays it holds, and swept.
+ *
+ * Arrays created while a region is open (region.h) are forgotten in one
+ * step when the region is released: in cycles mode they all sit in front
+ * of a placeholder linked into the black list when the region opened.
+ *
+ * When to collect is tuned at run time (gc_set_tuning()). The trigger
+ * follows the work of the last collection times the growth factor, and
+ * doubles while collecting takes more than GC_MAX_OVERHEAD of the time
+ * between collections, i.e. when the program allocates faster than the
+ * trigger assumed. With a pause budget, trial deletion caps the candidates
+ * it buffers by what the last pause took per candidate, and incremental
+ * steps cap their work by the measured marking or sweeping speed.
+ * Incremental steps are also paced by allocation: each array created since
+ * the last step adds GC_PACE_ENTRIES to the next step.
+ *
+ * Marking a large heap (GcTuning.parallel_mark_arrays live arrays) is
+ * spread over GcTuning.mark_threads threads while the script waits. Each
+ * marker works off a private stack and publishes GC_SHARE arrays at a time
+ * to a locked deque when its own deque is empty; a marker that runs dry
+ * takes back its deque or steals half of another one, and marking ends
+ * when every marker is idle. Markers only claim arrays, by flipping the
+ * mark with compare-and-swap; the lists are fixed up afterwards by one
+ * pass over the white list. Sweeping stays on the script's thread, since
+ * it frees into the pools and the region.
  */
+#if !defined(_POSIX_C_SOURCE) && !defined(_GNU_SOURCE)
+#define _POSIX_C_SOURCE 200112L
+#endif
 #include "gc.h"
 #include "array.h"
+#include "config.h"
 #include "env.h"
+#include "heapprof.h"
+#include "pool.h"
+#include "region.h"
 #include "value.h"
+#include <limits.h>
+#include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <time.h>
 
-static Array *g_gc_head = NULL;
+#ifndef LX_GC_MARK_THREADS
+#define LX_GC_MARK_THREADS 0
+#endif
+#ifndef LX_GC_PARALLEL_MARK_ARRAYS
+#define LX_GC_PARALLEL_MARK_ARRAYS 1048576
+#endif
+#if LX_GC_MARK_THREADS > 1
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#define GC_PARALLEL 1
+#define GC_DEFAULT_MARK_THREADS LX_GC_MARK_THREADS
+#else
+#define GC_PARALLEL 0
+#define GC_DEFAULT_MARK_THREADS 1
+#endif
+
+#ifndef LX_GC_THRESHOLD
+#define LX_GC_THRESHOLD 1024
+#endif
+#ifndef LX_GC_GROWTH
+#define LX_GC_GROWTH 2.0
+#endif
+#ifndef LX_GC_PAUSE_BUDGET_MS
+#define LX_GC_PAUSE_BUDGET_MS 0.0
+#endif
+
+/* Work per safepoint, in array entries scanned or freed. */
+#define GC_STEP_BUDGET 4096
+/* Extra work of the next step per array created since the last one. */
+#define GC_PACE_ENTRIES 4
+/* Smallest step and candidate buffer a pause budget can impose. */
+#define GC_MIN_STEP 256
+#define GC_MIN_CANDIDATES 64
+/* Share of the run time above which the trigger is raised. */
+#define GC_MAX_OVERHEAD 0.25
+/* Parallel marking: most threads, and arrays moved between markers at once. */
+#define GC_MAX_MARK_THREADS 64
+#define GC_SHARE 128
+
+enum { GC_IDLE, GC_MARK, GC_SWEEP };
+
+typedef struct {
+    Value *slots;
+    int count;
+} GcRoot;
+
+static Array *g_gc_black = NULL; /* reached this cycle, or created since it began */
+static Array *g_gc_white = NULL; /* not reached yet; garbage while sweeping */
 static int g_gc_count = 0;
-static int g_gc_threshold = 1024;
+static int g_gc_threshold = LX_GC_THRESHOLD;
+static int g_gc_phase = GC_IDLE;
+static int g_gc_black_mark = 1;  /* gc_mark of black arrays (1 or 2; 0: untracked) */
+
+static Array **g_gc_grey = NULL;
+static int g_gc_grey_count = 0;
+static int g_gc_grey_cap = 0;
+static int g_gc_grey_lost = 0;   /* a shaded array could not be pushed */
+
+/* trial deletion */
+static GcMode g_gc_mode = GC_MODE_CYCLES;
+static Array **g_gc_cand = NULL;  /* candidate roots */
+static int g_gc_cand_count = 0;
+static int g_gc_cand_cap = 0;
+static int g_gc_cand_threshold = LX_GC_THRESHOLD;
+static int g_gc_cand_limit = INT_MAX; /* cap from the pause budget */
+static Array **g_gc_work = NULL;  /* traversal stack */
+static int g_gc_work_count = 0;
+static int g_gc_work_cap = 0;
+static unsigned g_gc_epoch = 0;   /* trial colors from other epochs read as black */
+
+static GcRoot *g_gc_roots = NULL;
+static int g_gc_root_count = 0;
+static int g_gc_root_cap = 0;
+static int g_gc_root_dropped = 0; /* pushes that did not fit */
+
+/* regions */
+static int g_gc_in_region = 0;
+static int g_gc_region_arrays = 0; /* tracked arrays that live in the region */
+static Array g_gc_region_floor;    /* cycles mode: region arrays are in front of it */
+
+/* tuning and statistics */
+static GcTuning g_gc_tuning = { 1, LX_GC_THRESHOLD, LX_GC_GROWTH, LX_GC_PAUSE_BUDGET_MS,
+                                GC_DEFAULT_MARK_THREADS, LX_GC_PARALLEL_MARK_ARRAYS };
+static int g_gc_threads_capped = 0; /* mark_threads was checked against the processors */
+static GcStats g_gc_stats;
+static int g_gc_trace = 0;
+static double g_gc_last_end = -1.0; /* when the last collection ended (ms) */
+static int g_gc_step_allocs = 0;    /* arrays created since the last step */
+static double g_gc_step_rate = 0.0; /* entries per ms measured by the last step */
+static double g_gc_cycle_ms = 0.0;  /* incremental cycle in progress */
+static double g_gc_cycle_max_ms = 0.0;
+static int g_gc_cycle_steps = 0;
+static unsigned long g_gc_cycle_freed = 0;
+static unsigned long long g_gc_cycle_bytes = 0;
+
+/* ---------- lists ---------- */
+
+static void gc_link(Array **list, Array *a) {
+    a->gc_prev = NULL;
+    a->gc_next = *list;
+    if (*list) (*list)->gc_prev = a;
+    *list = a;
+}
+
+static void gc_unlink(Array **list, Array *a) {
+    if (a->gc_prev) a->gc_prev->gc_next = a->gc_next;
+    else *list = a->gc_next;
+    if (a->gc_next) a->gc_next->gc_prev = a->gc_prev;
+    a->gc_prev = NULL;
+    a->gc_next = NULL;
+}
+
+static int gc_is_white(const Array *a) {
+    return a->gc_mark && a->gc_mark != g_gc_black_mark;
+}
 
 void gc_register_array(Array *a) {
     if (!a) return;
-    a->gc_next = g_gc_head;
-    g_gc_head = a;
+    a->gc_mark = g_gc_black_mark;
+    a->gc_grey = 0;
+    if (g_gc_in_region && !lx_region_owns(a) && g_gc_region_floor.gc_mark) {
+        /* a heap array (see value_export()) goes behind the placeholder */
+        Array *f = &g_gc_region_floor;
+        a->gc_prev = f;
+        a->gc_next = f->gc_next;
+        if (f->gc_next) f->gc_next->gc_prev = a;
+        f->gc_next = a;
+    } else {
+        gc_link(&g_gc_black, a);
+    }
+    if (g_gc_in_region && lx_region_owns(a)) g_gc_region_arrays++;
     g_gc_count++;
+    if (g_gc_phase != GC_IDLE) g_gc_step_allocs++;
 }
 
 void gc_unregister_array(Array *a) {
-    if (!a) return;
-    Array *prev = NULL;
-    Array *cur = g_gc_head;
-    while (cur) {
-        if (cur == a) {
-            if (prev) prev->gc_next = cur->gc_next;
-            else g_gc_head = cur->gc_next;
-            a->gc_next = NULL;
-            g_gc_count--;
+    if (!a || !a->gc_mark) return;
+    if (a->gc_grey) g_gc_grey[a->gc_grey - 1] = NULL;
+    if (a->gc_cand) {
+        /* keep the buffer dense: the last candidate takes the slot */
+        Array *last = g_gc_cand[--g_gc_cand_count];
+        g_gc_cand[a->gc_cand - 1] = last;
+        last->gc_cand = a->gc_cand;
+        a->gc_cand = 0;
+    }
+    gc_unlink(gc_is_white(a) ? &g_gc_white : &g_gc_black, a);
+    a->gc_mark = 0;
+    a->gc_grey = 0;
+    if (g_gc_in_region && lx_region_owns(a)) g_gc_region_arrays--;
+    g_gc_count--;
+}
+
+/* ---------- roots ---------- */
+
+void gc_push_roots(Value *slots, int count) {
+    if (g_gc_root_count == g_gc_root_cap) {
+        int cap = g_gc_root_cap ? g_gc_root_cap * 2 : 64;
+        GcRoot *nr = (GcRoot *)realloc(g_gc_roots, (size_t)cap * sizeof(GcRoot));
+        if (!nr) {
+            /* the reference-count check at the end of marking still
+             * finds whatever these slots hold */
+            g_gc_root_dropped++;
             return;
         }
-        prev = cur;
-        cur = cur->gc_next;
+        g_gc_roots = nr;
+        g_gc_root_cap = cap;
     }
+    g_gc_roots[g_gc_root_count].slots = slots;
+    g_gc_roots[g_gc_root_count].count = count;
+    g_gc_root_count++;
 }
 
-static void gc_mark_array(Array *a) {
-    if (!a || a->gc_mark) return;
-    a->gc_mark = 1;
-    for (size_t i = 0; i < a->size; i++) {
-        Value v = a->entries[i].value;
-        if (v.type == VAL_ARRAY && v.a) gc_mark_array(v.a);
+void gc_push_root(Value *slot) {
+    gc_push_roots(slot, 1);
+}
+
+void gc_pop_roots(int n) {
+    while (n-- > 0) {
+        if (g_gc_root_dropped > 0) g_gc_root_dropped--;
+        else if (g_gc_root_count > 0) g_gc_root_count--;
     }
 }
 
-static void gc_mark_value(Value v) {
-    if (v.type == VAL_ARRAY && v.a) gc_mark_array(v.a);
+/* ---------- marking ---------- */
+
+static void gc_shade(Array *a) {
+    if (!a || !gc_is_white(a)) return;
+    gc_unlink(&g_gc_white, a);
+    a->gc_mark = g_gc_black_mark;
+    gc_link(&g_gc_black, a);
+    if (g_gc_grey_count == g_gc_grey_cap) {
+        int cap = g_gc_grey_cap ? g_gc_grey_cap * 2 : 256;
+        Array **ng = (Array **)realloc(g_gc_grey, (size_t)cap * sizeof(Array *));
+        if (!ng) {
+            g_gc_grey_lost = 1;
+            return;
+        }
+        g_gc_grey = ng;
+        g_gc_grey_cap = cap;
+    }
+    g_gc_grey[g_gc_grey_count++] = a;
+    a->gc_grey = g_gc_grey_count;
+}
+
+static void gc_shade_value(Value v) {
+    if (v.type == VAL_ARRAY) gc_shade(v.a);
 }
 
-static void gc_mark_binding(const char *name, Value *val, void *ctx) {
+static void gc_shade_binding(const char *name, Value *val, void *ctx) {
     (void)name;
     (void)ctx;
-    if (!val) return;
-    gc_mark_value(*val);
+    if (val) gc_shade_value(*val);
+}
+
+static void gc_shade_roots(Env *root) {
+    if (root) env_visit(root, gc_shade_binding, NULL);
+    for (int i = 0; i < g_gc_root_count; i++) {
+        for (int j = 0; j < g_gc_roots[i].count; j++) gc_shade_value(g_gc_roots[i].slots[j]);
+    }
+}
+
+void gc_write_barrier(Value v) {
+    if (g_gc_phase == GC_MARK && v.type == VAL_ARRAY) gc_shade(v.a);
+}
+
+/* Scan grey arrays until none are left (return 1) or @p budget entries
+ * have been scanned (return 0). A negative budget has no limit. */
+static int gc_drain(long budget) {
+    long work = 0;
+    while (g_gc_grey_count > 0) {
+        if (budget >= 0 && work >= budget) return 0;
+        Array *a = g_gc_grey[--g_gc_grey_count];
+        if (!a) continue;
+        a->gc_grey = 0;
+        for (size_t i = 0; i < a->size; i++) gc_shade_value(a->entries[i].value);
+        work += (long)a->size + 1;
+    }
+    return 1;
+}
+
+/* ---------- parallel marking ---------- */
+
+#if GC_PARALLEL
+typedef struct {
+    Array **items;        /* private stack */
+    size_t count;
+    size_t cap;
+    Array **shared;       /* published arrays, under lock */
+    size_t shared_count;
+    pthread_mutex_t lock;
+    pthread_t thread;
+} GcMarker;
+
+static GcMarker *g_gc_markers = NULL;
+static int g_gc_marker_count = 0;
+static int g_gc_markers_idle = 0;
+static int g_gc_marker_white = 0; /* white mark of the cycle being marked */
+
+static void gc_par_push(GcMarker *m, Array *a) {
+    if (m->count == m->cap) {
+        size_t cap = m->cap * 2;
+        Array **ni = (Array **)realloc(m->items, cap * sizeof(Array *));
+        if (!ni) {
+            /* the array is marked but not scanned; gc_rescue() finds
+             * what it holds by reference count */
+            __atomic_store_n(&g_gc_grey_lost, 1, __ATOMIC_RELAXED);
+            return;
+        }
+        m->items = ni;
+        m->cap = cap;
+    }
+    m->items[m->count++] = a;
+}
+
+/* Move the top GC_SHARE arrays of the private stack to the deque. */
+static void gc_par_publish(GcMarker *m) {
+    pthread_mutex_lock(&m->lock);
+    if (m->shared_count == 0) {
+        m->count -= GC_SHARE;
+        memcpy(m->shared, m->items + m->count, GC_SHARE * sizeof(Array *));
+        __atomic_store_n(&m->shared_count, (size_t)GC_SHARE, __ATOMIC_RELAXED);
+    }
+    pthread_mutex_unlock(&m->lock);
 }
 
-static void gc_key_free(Key k) {
-    if (k.type == KEY_STRING) free(k.s);
+/* Refill the empty private stack of @p m from its own deque, or steal
+ * half of another marker's. @return 0 if every deque was empty. */
+static int gc_par_take(GcMarker *m) {
+    int self = (int)(m - g_gc_markers);
+    for (int k = 0; k < g_gc_marker_count; k++) {
+        GcMarker *v = &g_gc_markers[(self + k) % g_gc_marker_count];
+        if (!__atomic_load_n(&v->shared_count, __ATOMIC_RELAXED)) continue;
+        pthread_mutex_lock(&v->lock);
+        size_t n = v->shared_count;
+        size_t take = k == 0 ? n : (n + 1) / 2;
+        memcpy(m->items, v->shared + (n - take), take * sizeof(Array *));
+        m->count = take;
+        __atomic_store_n(&v->shared_count, n - take, __ATOMIC_RELAXED);
+        pthread_mutex_unlock(&v->lock);
+        if (take) return 1;
+    }
+    return 0;
+}
+
+static int gc_par_has_work(void) {
+    for (int i = 0; i < g_gc_marker_count; i++) {
+        if (__atomic_load_n(&g_gc_markers[i].shared_count, __ATOMIC_RELAXED)) return 1;
+    }
+    return 0;
 }
 
-static void gc_release_value(Value v) {
-    if (v.type == VAL_STRING) {
-        free(v.s);
-    } else if (v.type == VAL_ARRAY && v.a) {
-        if (v.a->refcount > 0) v.a->refcount--;
+static void *gc_par_mark(void *arg) {
+    GcMarker *m = (GcMarker *)arg;
+    int white = g_gc_marker_white;
+    int black = g_gc_black_mark;
+    for (;;) {
+        while (m->count > 0) {
+            Array *a = m->items[--m->count];
+            for (size_t i = 0; i < a->size; i++) {
+                Value v = a->entries[i].value;
+                if (v.type != VAL_ARRAY || !v.a) continue;
+                int expect = white;
+                if (__atomic_load_n(&v.a->gc_mark, __ATOMIC_RELAXED) == white &&
+                    __atomic_compare_exchange_n(&v.a->gc_mark, &expect, black, 0,
+                                                __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+                    gc_par_push(m, v.a);
+                }
+            }
+            if (m->count >= 2 * GC_SHARE && !__atomic_load_n(&m->shared_count, __ATOMIC_RELAXED)) {
+                gc_par_publish(m);
+            }
+        }
+        if (gc_par_take(m)) continue;
+        /* idle until another marker publishes, or all are idle */
+        __atomic_add_fetch(&g_gc_markers_idle, 1, __ATOMIC_SEQ_CST);
+        for (;;) {
+            if (__atomic_load_n(&g_gc_markers_idle, __ATOMIC_SEQ_CST) == g_gc_marker_count) return NULL;
+            if (gc_par_has_work()) {
+                __atomic_sub_fetch(&g_gc_markers_idle, 1, __ATOMIC_SEQ_CST);
+                break;
+            }
+            sched_yield();
+        }
     }
 }
 
+/* Cap the built-in marker count (LX_GC_MARK_THREADS) at one per
+ * processor, once. A count set with gc_set_tuning() is used as given. */
+static void gc_par_cap_default(void) {
+    if (g_gc_threads_capped) return;
+    g_gc_threads_capped = 1;
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    if (cpus > 0 && g_gc_tuning.mark_threads > cpus) g_gc_tuning.mark_threads = (int)cpus;
+}
+
+/* Drain the grey stack on several threads. @return 0 if the markers
+ * could not be set up (nothing was done). */
+static int gc_par_drain(void) {
+    int n = g_gc_tuning.mark_threads;
+    if (n < 2) return 0;
+    GcMarker *ms = (GcMarker *)calloc((size_t)n, sizeof(GcMarker));
+    if (!ms) return 0;
+    int ready = 0;
+    for (; ready < n; ready++) {
+        GcMarker *m = &ms[ready];
+        m->cap = 4 * GC_SHARE;
+        m->items = (Array **)malloc(m->cap * sizeof(Array *));
+        m->shared = (Array **)malloc(GC_SHARE * sizeof(Array *));
+        if (!m->items || !m->shared || pthread_mutex_init(&m->lock, NULL) != 0) {
+            free(m->items);
+            free(m->shared);
+            break;
+        }
+    }
+    if (ready < n) {
+        for (int i = 0; i < ready; i++) {
+            free(ms[i].items);
+            free(ms[i].shared);
+            pthread_mutex_destroy(&ms[i].lock);
+        }
+        free(ms);
+        return 0;
+    }
+
+    /* deal the grey arrays out; they are black already */
+    int k = 0;
+    while (g_gc_grey_count > 0) {
+        Array *a = g_gc_grey[--g_gc_grey_count];
+        if (!a) continue;
+        a->gc_grey = 0;
+        gc_par_push(&ms[k], a);
+        k = (k + 1) % n;
+    }
+    g_gc_markers = ms;
+    g_gc_marker_count = n;
+    g_gc_markers_idle = 0;
+    g_gc_marker_white = g_gc_black_mark == 1 ? 2 : 1;
+    int started[GC_MAX_MARK_THREADS] = { 0 };
+    for (int i = 1; i < n; i++) {
+        if (pthread_create(&ms[i].thread, NULL, gc_par_mark, &ms[i]) == 0) {
+            started[i] = 1;
+            continue;
+        }
+        /* the script's thread takes over this marker's arrays */
+        while (ms[i].count > 0) gc_par_push(&ms[0], ms[i].items[--ms[i].count]);
+        __atomic_add_fetch(&g_gc_markers_idle, 1, __ATOMIC_SEQ_CST);
+    }
+    gc_par_mark(&ms[0]);
+    for (int i = 0; i < n; i++) {
+        if (started[i]) pthread_join(ms[i].thread, NULL);
+        free(ms[i].items);
+        free(ms[i].shared);
+        pthread_mutex_destroy(&ms[i].lock);
+    }
+    free(ms);
+    g_gc_markers = NULL;
+    g_gc_marker_count = 0;
+
+    /* move what the markers claimed to the black list */
+    Array *a = g_gc_white;
+    while (a) {
+        Array *next = a->gc_next;
+        if (a->gc_mark == g_gc_black_mark) {
+            gc_unlink(&g_gc_white, a);
+            gc_link(&g_gc_black, a);
+        }
+        a = next;
+    }
+    g_gc_stats.parallel_marks++;
+    return 1;
+}
+
+/* @return Non-zero if the heap is large enough for parallel marking. */
+static int gc_par_wanted(void) {
+    gc_par_cap_default();
+    return g_gc_tuning.mark_threads > 1 && g_gc_count >= g_gc_tuning.parallel_mark_arrays;
+}
+#else
+static void gc_par_cap_default(void) {
+}
+
+static int gc_par_wanted(void) {
+    return 0;
+}
+#endif
+
+/* Scan grey arrays until none are left, on several threads when the heap
+ * is large enough. */
+static void gc_drain_all(void) {
+#if GC_PARALLEL
+    if (g_gc_grey_count > 0 && gc_par_wanted() && gc_par_drain()) return;
+#endif
+    gc_drain(-1);
+}
+
+/* Mark every white array that is referenced from outside the white set,
+ * and what it holds. Repeats while shaded arrays could not be pushed. */
+static void gc_rescue(void) {
+    do {
+        g_gc_grey_lost = 0;
+        for (Array *a = g_gc_white; a; a = a->gc_next) a->gc_refs = a->refcount;
+        for (Array *a = g_gc_white; a; a = a->gc_next) {
+            if (a->shared) continue;
+            for (size_t i = 0; i < a->size; i++) {
+                Value v = a->entries[i].value;
+                if (v.type == VAL_ARRAY && v.a && gc_is_white(v.a)) v.a->gc_refs--;
+            }
+        }
+        Array *a = g_gc_white;
+        while (a) {
+            Array *next = a->gc_next;
+            if (a->gc_refs > 0) gc_shade(a);
+            a = next;
+        }
+        gc_drain_all();
+    } while (g_gc_grey_lost);
+}
+
+/* Drop the references white arrays hold to other arrays. White ones are
+ * freed by the sweep itself; the rest only lose a reference. */
+static void gc_detach_garbage(void) {
+    for (Array *a = g_gc_white; a; a = a->gc_next) {
+        if (a->shared) continue;
+        for (size_t i = 0; i < a->size; i++) {
+            Value *v = &a->entries[i].value;
+            if (v->type != VAL_ARRAY) continue;
+            if (v->a && !gc_is_white(v->a)) value_free(*v);
+            *v = value_null();
+        }
+    }
+}
+
+static void gc_finish_mark(Env *root) {
+    gc_shade_roots(root);
+    gc_drain_all();
+    gc_rescue();
+    gc_detach_garbage();
+    g_gc_phase = GC_SWEEP;
+}
+
+/* ---------- sweeping ---------- */
+
 static void gc_free_array(Array *a) {
-    if (!a) return;
+    if (lx_region_dead(a)) return;
+    LX_HEAPPROF_FREE(a);
+    if (a->shared) {
+        /* constant arrays are not collected and hold no arrays */
+        array_free(a->shared);
+        lx_pool_free(a, sizeof(Array));
+        return;
+    }
     for (size_t i = 0; i < a->size; i++) {
-        gc_key_free(a->entries[i].key);
-        gc_release_value(a->entries[i].value);
+        if (!a->shape) key_free(a->entries[i].key);
+        value_free(a->entries[i].value);
     }
-    free(a->entries);
-    free(a);
+    array_shape_release(a->shape);
+    lx_region_free(a->entries);
+    lx_pool_free(a, sizeof(Array));
 }
 
-void gc_collect(Env *root) {
-    for (Array *cur = g_gc_head; cur; cur = cur->gc_next) {
-        cur->gc_mark = 0;
+/* Free white arrays until none are left (return 1) or @p budget entries
+ * have been released (return 0). A negative budget has no limit. */
+static int gc_sweep(long budget) {
+    long work = 0;
+    while (g_gc_white) {
+        if (budget >= 0 && work >= budget) return 0;
+        Array *a = g_gc_white;
+        work += (long)a->size + 1;
+        g_gc_cycle_freed++;
+        g_gc_cycle_bytes += sizeof(Array) + (a->shared ? 0 : a->capacity * sizeof(ArrayEntry));
+        gc_unregister_array(a);
+        gc_free_array(a);
     }
+    return 1;
+}
+
+/* ---------- statistics ---------- */
+
+static double gc_now_ms(void) {
+    struct timespec ts;
+    if (clock_gettime(CLOCK_MONOTONIC, &ts) != 0) return 0.0;
+    return (double)ts.tv_sec * 1e3 + (double)ts.tv_nsec / 1e6;
+}
+
+static void gc_record_pause(double ms) {
+    g_gc_stats.pause_total_ms += ms;
+    g_gc_stats.pause_last_ms = ms;
+    if (ms > g_gc_stats.pause_max_ms) g_gc_stats.pause_max_ms = ms;
+}
+
+/* Count a finished collection. @return The share of the time since the
+ * previous one that went into collecting (@p ms). */
+static double gc_record_collection(double ms) {
+    double now = gc_now_ms();
+    double since = g_gc_last_end >= 0.0 ? now - g_gc_last_end : 0.0;
+    g_gc_last_end = now;
+    g_gc_stats.collections++;
+    g_gc_stats.arrays_freed += g_gc_cycle_freed;
+    g_gc_stats.bytes_freed += g_gc_cycle_bytes;
+    return since > 0.0 ? ms / since : 0.0;
+}
+
+static int gc_clamp_threshold(double t) {
+    return t >= (double)(INT_MAX / 2) ? INT_MAX / 2 : (int)t;
+}
+
+/* ---------- tracing ---------- */
+
+static void gc_begin(Env *root) {
+    g_gc_cycle_ms = 0.0;
+    g_gc_cycle_max_ms = 0.0;
+    g_gc_cycle_steps = 0;
+    g_gc_cycle_freed = 0;
+    g_gc_cycle_bytes = 0;
+    g_gc_step_allocs = 0;
+    g_gc_white = g_gc_black;
+    g_gc_black = NULL;
+    g_gc_black_mark = g_gc_black_mark == 1 ? 2 : 1;
+    g_gc_phase = GC_MARK;
+    gc_shade_roots(root);
+}
+
+static void gc_step(Env *root, long budget) {
+    if (g_gc_phase == GC_MARK) {
+        /* without a pause budget, a heap large enough for parallel marking
+         * is marked in one step */
+        if (g_gc_tuning.pause_budget_ms <= 0.0 && gc_par_wanted()) budget = -1;
+        if (budget < 0 || gc_drain(budget)) gc_finish_mark(root);
+    } else if (g_gc_phase == GC_SWEEP && gc_sweep(budget)) {
+        g_gc_phase = GC_IDLE;
+    }
+}
+
+/* Entries the next incremental step may handle: the base budget plus
+ * pacing for the arrays created since the last step, capped by what fits
+ * the pause budget at the last measured speed. */
+static long gc_step_budget(void) {
+    long budget = GC_STEP_BUDGET + (long)GC_PACE_ENTRIES * g_gc_step_allocs;
+    g_gc_step_allocs = 0;
+    if (g_gc_tuning.pause_budget_ms > 0.0 && g_gc_step_rate > 0.0) {
+        double cap = g_gc_step_rate * g_gc_tuning.pause_budget_ms;
+        if (cap < GC_MIN_STEP) cap = GC_MIN_STEP;
+        if ((double)budget > cap) budget = (long)cap;
+    }
+    return budget;
+}
 
-    if (root) env_visit(root, gc_mark_binding, NULL);
+/* Run one incremental step, timing it; close the cycle when it ends. */
+static void gc_timed_step(Env *root, long budget) {
+    double t0 = gc_now_ms();
+    gc_step(root, budget);
+    double ms = gc_now_ms() - t0;
+    if (budget > 0 && ms > 0.0) g_gc_step_rate = (double)budget / ms;
+    gc_record_pause(ms);
+    g_gc_cycle_ms += ms;
+    g_gc_cycle_steps++;
+    if (ms > g_gc_cycle_max_ms) g_gc_cycle_max_ms = ms;
+    if (g_gc_phase != GC_IDLE) return;
 
-    Array *prev = NULL;
-    Array *cur = g_gc_head;
-    while (cur) {
-        Array *next = cur->gc_next;
-        if (!cur->gc_mark) {
-            if (prev) prev->gc_next = next;
-            else g_gc_head = next;
-            g_gc_count--;
-            cur->gc_next = NULL;
-            gc_free_array(cur);
-        } else {
-            prev = cur;
+    double overhead = gc_record_collection(g_gc_cycle_ms);
+    /* next cycle once the live set has grown by the growth factor, later
+     * if collecting keeps taking too much of the run time */
+    double next = (double)g_gc_count * g_gc_tuning.growth;
+    if (overhead > GC_MAX_OVERHEAD && next < (double)g_gc_threshold * 2) next = (double)g_gc_threshold * 2;
+    if (next < g_gc_tuning.threshold) next = g_gc_tuning.threshold;
+    g_gc_threshold = gc_clamp_threshold(next);
+    if (g_gc_trace) {
+        fprintf(stderr, "gc: trace #%lu: %.3f ms in %d steps (longest %.3f ms), "
+                "%lu arrays freed (%llu bytes), %d live, next at %d arrays\n",
+                g_gc_stats.collections, g_gc_cycle_ms, g_gc_cycle_steps, g_gc_cycle_max_ms,
+                g_gc_cycle_freed, g_gc_cycle_bytes, g_gc_count, g_gc_threshold);
+    }
+}
+
+/* ---------- trial deletion ---------- */
+
+enum { GC_BLACK, GC_GRAY, GC_WHITE, GC_GARBAGE };
+
+static int gc_color(const Array *a) {
+    return (a->gc_color >> 2) == g_gc_epoch ? (int)(a->gc_color & 3) : GC_BLACK;
+}
+
+static void gc_paint(Array *a, int color) {
+    a->gc_color = (g_gc_epoch << 2) | (unsigned)color;
+}
+
+static int gc_work_push(Array *a) {
+    if (g_gc_work_count == g_gc_work_cap) {
+        int cap = g_gc_work_cap ? g_gc_work_cap * 2 : 256;
+        Array **nw = (Array **)realloc(g_gc_work, (size_t)cap * sizeof(Array *));
+        if (!nw) return 0;
+        g_gc_work = nw;
+        g_gc_work_cap = cap;
+    }
+    g_gc_work[g_gc_work_count++] = a;
+    return 1;
+}
+
+void gc_possible_cycle(Array *a) {
+    if (g_gc_mode != GC_MODE_CYCLES || a->gc_cand || !a->gc_mark) return;
+    if (g_gc_cand_count == g_gc_cand_cap) {
+        int cap = g_gc_cand_cap ? g_gc_cand_cap * 2 : 256;
+        Array **nc = (Array **)realloc(g_gc_cand, (size_t)cap * sizeof(Array *));
+        if (!nc) return;
+        g_gc_cand = nc;
+        g_gc_cand_cap = cap;
+    }
+    g_gc_cand[g_gc_cand_count++] = a;
+    a->gc_cand = g_gc_cand_count;
+}
+
+/* Paint everything under the candidates gray. gc_refs ends up holding
+ * the references each array gets from outside the gray subgraph.
+ * @return Entries scanned, or -1 if the traversal stack could not grow. */
+static long gc_trial_mark(void) {
+    long scanned = 0;
+    for (int i = 0; i < g_gc_cand_count; i++) {
+        Array *c = g_gc_cand[i];
+        if (gc_color(c) == GC_GRAY) continue;
+        gc_paint(c, GC_GRAY);
+        c->gc_refs = c->refcount;
+        if (!gc_work_push(c)) return -1;
+        while (g_gc_work_count > 0) {
+            Array *s = g_gc_work[--g_gc_work_count];
+            if (s->shared) continue;
+            scanned += (long)s->size;
+            for (size_t j = 0; j < s->size; j++) {
+                Value v = s->entries[j].value;
+                if (v.type != VAL_ARRAY || !v.a || !v.a->gc_mark) continue;
+                Array *t = v.a;
+                if (gc_color(t) != GC_GRAY) {
+                    gc_paint(t, GC_GRAY);
+                    t->gc_refs = t->refcount;
+                    if (!gc_work_push(t)) return -1;
+                }
+                t->gc_refs--;
+            }
         }
-        cur = next;
     }
+    return scanned;
+}
 
-    if (g_gc_count > g_gc_threshold) g_gc_threshold = g_gc_count * 2;
-    if (g_gc_threshold < 1024) g_gc_threshold = 1024;
+/* Repaint @p a and every gray or white array it reaches black. Uses the
+ * stack above its current top. */
+static int gc_trial_blacken(Array *a) {
+    int base = g_gc_work_count;
+    gc_paint(a, GC_BLACK);
+    if (!gc_work_push(a)) return 0;
+    while (g_gc_work_count > base) {
+        Array *s = g_gc_work[--g_gc_work_count];
+        if (s->shared) continue;
+        for (size_t j = 0; j < s->size; j++) {
+            Value v = s->entries[j].value;
+            if (v.type != VAL_ARRAY || !v.a || !v.a->gc_mark) continue;
+            int c = gc_color(v.a);
+            if (c != GC_GRAY && c != GC_WHITE) continue;
+            gc_paint(v.a, GC_BLACK);
+            if (!gc_work_push(v.a)) return 0;
+        }
+    }
+    return 1;
+}
+
+/* Gray arrays referenced from outside the subgraph are live, with all
+ * they reach; the other gray arrays turn white. */
+static int gc_trial_scan(void) {
+    for (int i = 0; i < g_gc_cand_count; i++) {
+        if (!gc_work_push(g_gc_cand[i])) return 0;
+        while (g_gc_work_count > 0) {
+            Array *s = g_gc_work[--g_gc_work_count];
+            if (gc_color(s) != GC_GRAY) continue;
+            if (s->gc_refs > 0) {
+                if (!gc_trial_blacken(s)) return 0;
+                continue;
+            }
+            gc_paint(s, GC_WHITE);
+            if (s->shared) continue;
+            for (size_t j = 0; j < s->size; j++) {
+                Value v = s->entries[j].value;
+                if (v.type == VAL_ARRAY && v.a && gc_color(v.a) == GC_GRAY) {
+                    if (!gc_work_push(v.a)) return 0;
+                }
+            }
+        }
+    }
+    return 1;
+}
+
+/* Move the white arrays to the white list for gc_detach_garbage() and
+ * gc_sweep(). Stopping early only leaves some garbage for later. */
+static void gc_trial_collect(void) {
+    int white_mark = g_gc_black_mark == 1 ? 2 : 1;
+    for (int i = 0; i < g_gc_cand_count; i++) {
+        if (gc_color(g_gc_cand[i]) == GC_WHITE && !gc_work_push(g_gc_cand[i])) return;
+        while (g_gc_work_count > 0) {
+            Array *s = g_gc_work[--g_gc_work_count];
+            if (gc_color(s) != GC_WHITE) continue;
+            gc_paint(s, GC_GARBAGE);
+            gc_unlink(&g_gc_black, s);
+            s->gc_mark = white_mark;
+            gc_link(&g_gc_white, s);
+            if (s->shared) continue;
+            for (size_t j = 0; j < s->size; j++) {
+                Value v = s->entries[j].value;
+                if (v.type == VAL_ARRAY && v.a && gc_color(v.a) == GC_WHITE) {
+                    if (!gc_work_push(v.a)) return;
+                }
+            }
+        }
+    }
+}
+
+/* Candidates to buffer before the next trial deletion, after one that
+ * scanned @p scanned entries from @p candidates roots in @p ms. */
+static void gc_cycles_retune(long scanned, int candidates, double ms, double overhead) {
+    /* keep the scan work per buffered candidate bounded when the same
+     * large live arrays keep turning up */
+    double next = (double)scanned / 8.0 * g_gc_tuning.growth;
+    if (overhead > GC_MAX_OVERHEAD && next < (double)g_gc_cand_threshold * 2) {
+        next = (double)g_gc_cand_threshold * 2;
+    }
+    if (next < g_gc_tuning.threshold) next = g_gc_tuning.threshold;
+    if (g_gc_tuning.pause_budget_ms > 0.0 && candidates > 0) {
+        if (ms > g_gc_tuning.pause_budget_ms) {
+            double cap = (double)candidates * g_gc_tuning.pause_budget_ms / ms;
+            g_gc_cand_limit = cap < GC_MIN_CANDIDATES ? GC_MIN_CANDIDATES : (int)cap;
+        } else if (ms < g_gc_tuning.pause_budget_ms / 2 && g_gc_cand_limit < INT_MAX / 2) {
+            g_gc_cand_limit *= 2;
+        }
+        if (next > g_gc_cand_limit) next = g_gc_cand_limit;
+    }
+    g_gc_cand_threshold = gc_clamp_threshold(next);
+}
+
+void gc_collect_cycles(void) {
+    double t0 = gc_now_ms();
+    int candidates = g_gc_cand_count;
+    g_gc_cycle_freed = 0;
+    g_gc_cycle_bytes = 0;
+    g_gc_epoch = (g_gc_epoch + 1) & (~0u >> 2);
+    g_gc_work_count = 0;
+    long scanned = gc_trial_mark();
+    if (scanned < 0 || !gc_trial_scan()) {
+        /* out of memory: keep the candidates for the next attempt; the
+         * new epoch makes the partial colors read as black */
+        g_gc_work_count = 0;
+        return;
+    }
+    gc_trial_collect();
+    g_gc_work_count = 0;
+    for (int i = 0; i < g_gc_cand_count; i++) g_gc_cand[i]->gc_cand = 0;
+    g_gc_cand_count = 0;
+    gc_detach_garbage();
+    gc_sweep(-1);
+    double ms = gc_now_ms() - t0;
+    gc_record_pause(ms);
+    gc_cycles_retune(scanned, candidates, ms, gc_record_collection(ms));
+    if (g_gc_trace) {
+        fprintf(stderr, "gc: cycles #%lu: %.3f ms, %d candidates, %ld entries scanned, "
+                "%lu arrays freed (%llu bytes), %d live, next at %d candidates\n",
+                g_gc_stats.collections, ms, candidates, scanned, g_gc_cycle_freed,
+                g_gc_cycle_bytes, g_gc_count, g_gc_cand_threshold);
+    }
+}
+
+/* ---------- regions ---------- */
+
+void gc_region_begin(void) {
+    g_gc_in_region = 1;
+    g_gc_region_arrays = 0;
+    if (g_gc_mode != GC_MODE_CYCLES) return;
+    memset(&g_gc_region_floor, 0, sizeof(g_gc_region_floor));
+    g_gc_region_floor.gc_mark = g_gc_black_mark;
+    gc_link(&g_gc_black, &g_gc_region_floor);
+}
+
+void gc_region_release(void) {
+    if (!g_gc_in_region) return;
+    int n = 0;
+    for (int i = 0; i < g_gc_cand_count; i++) {
+        Array *a = g_gc_cand[i];
+        if (lx_region_owns(a)) continue;
+        g_gc_cand[n++] = a;
+        a->gc_cand = n;
+    }
+    g_gc_cand_count = n;
+    if (g_gc_region_floor.gc_mark) {
+        /* cut the black list at the placeholder */
+        g_gc_black = g_gc_region_floor.gc_next;
+        if (g_gc_black) g_gc_black->gc_prev = NULL;
+        memset(&g_gc_region_floor, 0, sizeof(g_gc_region_floor));
+    } else {
+        /* mark-and-sweep moves arrays between the lists: finish a sweep
+         * (region arrays are skipped), abandon a mark and keep the heap
+         * arrays, all black */
+        if (g_gc_phase == GC_SWEEP) gc_sweep(-1);
+        Array *lists[2] = { g_gc_black, g_gc_white };
+        g_gc_black = NULL;
+        g_gc_white = NULL;
+        for (int l = 0; l < 2; l++) {
+            Array *a = lists[l];
+            while (a) {
+                Array *next = a->gc_next;
+                if (!lx_region_owns(a)) {
+                    a->gc_mark = g_gc_black_mark;
+                    a->gc_grey = 0;
+                    gc_link(&g_gc_black, a);
+                }
+                a = next;
+            }
+        }
+        g_gc_grey_count = 0;
+        g_gc_grey_lost = 0;
+        g_gc_phase = GC_IDLE;
+    }
+    g_gc_count -= g_gc_region_arrays;
+    g_gc_region_arrays = 0;
+    g_gc_in_region = 0;
+}
+
+/* ---------- entry points ---------- */
+
+void gc_set_mode(GcMode mode) {
+    g_gc_mode = mode;
+}
+
+GcMode gc_mode(void) {
+    return g_gc_mode;
+}
+
+void gc_collect(Env *root) {
+    if (g_gc_mode == GC_MODE_CYCLES) {
+        gc_collect_cycles();
+        return;
+    }
+    while (g_gc_phase != GC_IDLE) gc_timed_step(root, -1);
+    gc_begin(root);
+    while (g_gc_phase != GC_IDLE) gc_timed_step(root, -1);
 }
 
 void gc_maybe_collect(Env *root) {
-    if (g_gc_count > g_gc_threshold) gc_collect(root);
+    if (array_free_pending) array_free_step();
+    if (!g_gc_tuning.enabled) return;
+    if (g_gc_mode == GC_MODE_CYCLES) {
+        if (g_gc_cand_count > g_gc_cand_threshold) gc_collect_cycles();
+        return;
+    }
+    if (g_gc_phase == GC_IDLE) {
+        if (g_gc_count <= g_gc_threshold) return;
+        gc_begin(root);
+    }
+    gc_timed_step(root, gc_step_budget());
 }
 
 int gc_array_count(void) {
     return g_gc_count;
 }
+
+void gc_stats(GcStats *out) {
+    if (!out) return;
+    *out = g_gc_stats;
+    out->live_arrays = g_gc_count;
+    out->candidates = g_gc_cand_count;
+    out->threshold = g_gc_mode == GC_MODE_CYCLES ? g_gc_cand_threshold : g_gc_threshold;
+}
+
+void gc_get_tuning(GcTuning *out) {
+    gc_par_cap_default();
+    if (out) *out = g_gc_tuning;
+}
+
+void gc_set_tuning(const GcTuning *t) {
+    if (!t) return;
+    g_gc_tuning.enabled = t->enabled != 0;
+    g_gc_tuning.threshold = t->threshold > 1 ? t->threshold : 1;
+    g_gc_tuning.growth = t->growth >= 1.0 ? t->growth : 1.0;
+    g_gc_tuning.pause_budget_ms = t->pause_budget_ms > 0.0 ? t->pause_budget_ms : 0.0;
+    g_gc_tuning.mark_threads = t->mark_threads < 1 ? 1 :
+                               t->mark_threads > GC_MAX_MARK_THREADS ? GC_MAX_MARK_THREADS : t->mark_threads;
+    if (!GC_PARALLEL) g_gc_tuning.mark_threads = 1;
+    g_gc_threads_capped = 1;
+    g_gc_tuning.parallel_mark_arrays = t->parallel_mark_arrays > 1 ? t->parallel_mark_arrays : 1;
+    g_gc_threshold = g_gc_tuning.threshold;
+    g_gc_cand_threshold = g_gc_tuning.threshold;
+    g_gc_cand_limit = INT_MAX;
+    g_gc_step_rate = 0.0;
+}
+
+void gc_set_trace(int on) {
+    g_gc_trace = on;
+}
+
+void gc_each_array(void (*fn)(Array *a, void *ctx), void *ctx) {
+    Array *lists[2] = { g_gc_black, g_gc_white };
+    for (int i = 0; i < 2; i++) {
+        for (Array *a = lists[i]; a; a = a->gc_next) {
+            if (a != &g_gc_region_floor) fn(a, ctx);
+        }
+    }
+}
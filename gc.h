@@ -1,23 +1,124 @@
 /**
  * @file gc.h
- * @brief Mark-and-sweep collector for arrays.
+ * @brief Cycle collection for reference-counted arrays.
  */
 #ifndef GC_H
 #define GC_H
 
 #include "env.h"
 
-/** Register a newly created array with the GC. */
+/** Collection strategies (see gc_set_mode()). */
+typedef enum {
+    GC_MODE_CYCLES = 0, /**< Trial deletion from buffered candidate roots (default). */
+    GC_MODE_TRACE       /**< Incremental mark-and-sweep from the roots (debugging fallback). */
+} GcMode;
+
+/** Select the collection strategy. Call before the script starts running. */
+void gc_set_mode(GcMode mode);
+/** @return The current collection strategy. */
+GcMode gc_mode(void);
+
+/** Register a newly created array with the GC (O(1)). */
 void gc_register_array(Array *a);
-/** Unregister a destroyed array from the GC. */
+/** Unregister a destroyed array from the GC (O(1); no-op if not registered). */
 void gc_unregister_array(Array *a);
 
-/** Run a full GC collection using @p root as the environment root. */
+/**
+ * Buffer @p a as a possible root of a garbage cycle. array_free() calls
+ * this when a reference count drops to a nonzero value.
+ */
+void gc_possible_cycle(Array *a);
+/** Run trial deletion over the buffered candidates now. */
+void gc_collect_cycles(void);
+
+/**
+ * Treat the @p count values at @p slots as roots until the matching
+ * gc_pop_roots(). Pushes and pops nest. Natives and extensions that keep
+ * arrays in C variables while script code runs push them here; the slots
+ * are read at collection time, so they must stay valid (or hold a
+ * non-array value) until popped.
+ */
+void gc_push_roots(Value *slots, int count);
+/** Push a single root slot (see gc_push_roots()). */
+void gc_push_root(Value *slot);
+/** Pop the @p n most recently pushed roots. */
+void gc_pop_roots(int n);
+
+/**
+ * Write barrier: call with a value just stored into an array (array_set,
+ * array_push and array_append already do). While marking is in progress,
+ * an array stored this way is marked live.
+ */
+void gc_write_barrier(Value v);
+
+/**
+ * Run a full collection with the current strategy. For mark-and-sweep, any
+ * collection in progress is finished first and @p root is the environment
+ * root.
+ */
 void gc_collect(Env *root);
-/** Trigger GC when thresholds are exceeded. */
+/**
+ * Safepoint: start a collection when thresholds are exceeded, and advance
+ * one in progress by a bounded amount of work. Also frees a slice of the
+ * arrays queued by array_free() (see array_defer_frees()).
+ */
 void gc_maybe_collect(Env *root);
 
+/** Called by lx_region_begin(): arrays created from now on may live in the region. */
+void gc_region_begin(void);
+/**
+ * Called by lx_region_release() while the region's memory is still
+ * readable: forget every tracked array that lives in it.
+ */
+void gc_region_release(void);
+
 /** @return Number of arrays currently tracked by the GC. */
 int gc_array_count(void);
 
+/** Collector counters (see gc_stats()). Times are in milliseconds. */
+typedef struct {
+    unsigned long collections;      /**< Completed collections. */
+    double pause_total_ms;          /**< Time spent collecting. */
+    double pause_max_ms;            /**< Longest pause. */
+    double pause_last_ms;           /**< Most recent pause. */
+    unsigned long arrays_freed;     /**< Arrays freed by the collector. */
+    unsigned long long bytes_freed; /**< Headers and entry storage of those arrays. */
+    int live_arrays;                /**< Arrays currently tracked. */
+    int candidates;                 /**< Buffered candidate roots (cycles mode). */
+    int threshold;                  /**< Candidates (cycles) or live arrays (trace) that start the next collection. */
+    unsigned long parallel_marks;   /**< Markings spread over several threads (trace). */
+} GcStats;
+
+/** Collector settings (see gc_set_tuning()). */
+typedef struct {
+    int enabled;            /**< Zero: safepoints never collect. */
+    int threshold;          /**< Smallest trigger, in candidates or live arrays. */
+    double growth;          /**< Growth of the trigger with the last collection's work (>= 1). */
+    double pause_budget_ms; /**< Target for the longest pause; 0 = none (throughput). */
+    int mark_threads;       /**< Threads marking a large heap (trace); 1 = serial. */
+    int parallel_mark_arrays; /**< Live arrays from which marking uses those threads. */
+} GcTuning;
+
+/** Fill @p out with the current counters. */
+void gc_stats(GcStats *out);
+/** Fill @p out with the current settings. */
+void gc_get_tuning(GcTuning *out);
+/**
+ * Apply @p t (values out of range are clamped). The next collection starts
+ * at the new threshold; later ones follow the heuristics: the trigger grows
+ * with the live set and is raised while collections take more than a
+ * quarter of the run time, and with a pause budget, trial deletion buffers
+ * fewer candidates and incremental steps do less work so pauses fit it.
+ * With at least @c parallel_mark_arrays live arrays, mark-and-sweep marks
+ * on @c mark_threads threads (the built-in count is capped at one per
+ * processor; a count set here is used as given), and
+ * without a pause budget it marks the whole heap in the first step.
+ */
+void gc_set_tuning(const GcTuning *t);
+/** Print one line per collection to stderr when @p on (LX_GC_TRACE). */
+void gc_set_trace(int on);
+
+/** Call @p fn on every array tracked by the GC (for reports; @p fn must not free). */
+void gc_each_array(void (*fn)(Array *a, void *ctx), void *ctx);
+
 #endif
@@ -0,0 +1,417 @@
+/**
+ * @file heapprof.c
+ * @brief Sampling heap profiler for script values.
+ *
+ * The value layer reports every allocation of a string, array or blob
+ * (creation and growth) with LX_HEAPPROF_ALLOC(). Bytes are counted
+ * exactly per value type; in addition, about one allocation per
+ * LX_HEAP_PROFILE_SAMPLE_BYTES is sampled, the distance to the next sample
+ * being drawn from an exponential distribution so every byte has the same
+ * chance to be picked. A sample of n bytes stands for n / (1 - e^(-n/rate))
+ * bytes, which is unbiased for any size.
+ *
+ * A sample is charged to its site: the file and line of the statement
+ * being executed (lx_heapprof_node) and the user function running it.
+ * Sampled values are remembered by address until they are freed, so each
+ * site also reports an estimate of its live bytes; the growth of a value
+ * that is already sampled stays live at the site of its first sample.
+ * When profiling is off the hooks cost one test of lx_heapprof_enabled.
+ */
+#include "heapprof.h"
+#include "array.h"
+#include "ast.h"
+#include "config.h"
+#include "eval.h"
+#include "gc.h"
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#if !defined(LX_TARGET_LXSH) || !LX_TARGET_LXSH
+#include <unistd.h>
+#endif
+
+#ifndef LX_HEAP_PROFILE_SAMPLE_BYTES
+#define LX_HEAP_PROFILE_SAMPLE_BYTES 524288
+#endif
+
+/* Arrays listed in the "largest arrays" section. */
+#define HEAPPROF_TOP_ARRAYS 10
+
+int lx_heapprof_enabled = 0;
+const struct AstNode *lx_heapprof_node = NULL;
+
+typedef struct {
+    const char *file;     /* interned, or NULL */
+    const char *function; /* interned, "" at top level */
+    int line;
+    LxHeapKind kind;
+    unsigned long samples;
+    double alloc_bytes;
+    double live_bytes;
+} HeapSite;
+
+typedef struct {
+    const void *obj; /* NULL marks an empty slot */
+    int site;
+    double bytes;
+} HeapObj;
+
+typedef struct HeapName {
+    struct HeapName *next;
+    char name[];
+} HeapName;
+
+static const char *g_hp_kind_names[LX_HEAP_KINDS] = { "string", "array", "blob" };
+
+static char *g_hp_path = NULL;
+static const char *g_hp_file = NULL;
+static HeapName *g_hp_names = NULL;
+static long long g_hp_countdown = 0;
+static uint64_t g_hp_rng = 0x9E3779B97F4A7C15ull;
+static double g_hp_total[LX_HEAP_KINDS];
+static unsigned long g_hp_samples = 0;
+
+static HeapSite *g_hp_sites = NULL;
+static int g_hp_site_count = 0;
+static int g_hp_site_cap = 0;
+static int *g_hp_site_index = NULL; /* open-addressed, -1 marks an empty slot */
+static size_t g_hp_site_index_cap = 0;
+
+static HeapObj *g_hp_objs = NULL;
+static size_t g_hp_obj_cap = 0;
+static size_t g_hp_obj_count = 0;
+
+/* ---------- names ---------- */
+
+static const char *hp_intern(const char *s) {
+    if (!s) return NULL;
+    for (HeapName *n = g_hp_names; n; n = n->next) {
+        if (!strcmp(n->name, s)) return n->name;
+    }
+    size_t len = strlen(s);
+    HeapName *n = (HeapName *)malloc(sizeof(HeapName) + len + 1);
+    if (!n) return NULL;
+    memcpy(n->name, s, len + 1);
+    n->next = g_hp_names;
+    g_hp_names = n;
+    return n->name;
+}
+
+const char *lx_heapprof_set_file(const char *file) {
+    const char *prev = g_hp_file;
+    if (lx_heapprof_enabled) g_hp_file = hp_intern(file);
+    return prev;
+}
+
+const char *lx_heapprof_file(void) {
+    return lx_heapprof_enabled ? g_hp_file : NULL;
+}
+
+/* ---------- sampling ---------- */
+
+/* Bytes until the next sample, exponentially distributed around the rate. */
+static long long hp_next_interval(void) {
+    g_hp_rng ^= g_hp_rng << 13;
+    g_hp_rng ^= g_hp_rng >> 7;
+    g_hp_rng ^= g_hp_rng << 17;
+    double u = ((double)(g_hp_rng >> 11) + 1.0) / 9007199254740993.0; /* (0, 1] */
+    return (long long)(-log(u) * LX_HEAP_PROFILE_SAMPLE_BYTES) + 1;
+}
+
+static size_t hp_hash_ptr(const void *p, size_t cap) {
+    uint64_t h = (uint64_t)(uintptr_t)p * 0x9E3779B97F4A7C15ull;
+    return (size_t)(h >> 32) & (cap - 1);
+}
+
+static size_t hp_hash_site(const HeapSite *s, size_t cap) {
+    uint64_t h = (uint64_t)(uintptr_t)s->file * 31u + (uint64_t)(uintptr_t)s->function;
+    h = h * 31u + (uint64_t)s->line * 4u + (uint64_t)s->kind;
+    return hp_hash_ptr((const void *)(uintptr_t)h, cap);
+}
+
+static int hp_site_same(const HeapSite *a, const HeapSite *b) {
+    return a->file == b->file && a->function == b->function &&
+           a->line == b->line && a->kind == b->kind;
+}
+
+static int hp_site_index_grow(void) {
+    if ((size_t)(g_hp_site_count + 1) * 2 <= g_hp_site_index_cap) return 1;
+    size_t cap = g_hp_site_index_cap ? g_hp_site_index_cap * 2 : 64;
+    int *index = (int *)malloc(cap * sizeof(int));
+    if (!index) return 0;
+    for (size_t i = 0; i < cap; i++) index[i] = -1;
+    for (int s = 0; s < g_hp_site_count; s++) {
+        size_t i = hp_hash_site(&g_hp_sites[s], cap);
+        while (index[i] >= 0) i = (i + 1) & (cap - 1);
+        index[i] = s;
+    }
+    free(g_hp_site_index);
+    g_hp_site_index = index;
+    g_hp_site_index_cap = cap;
+    return 1;
+}
+
+/* @return The index of the site matching @p key, added if new, or -1. */
+static int hp_site(const HeapSite *key) {
+    if (!hp_site_index_grow()) return -1;
+    size_t i = hp_hash_site(key, g_hp_site_index_cap);
+    while (g_hp_site_index[i] >= 0) {
+        if (hp_site_same(&g_hp_sites[g_hp_site_index[i]], key)) return g_hp_site_index[i];
+        i = (i + 1) & (g_hp_site_index_cap - 1);
+    }
+    if (g_hp_site_count == g_hp_site_cap) {
+        int cap = g_hp_site_cap ? g_hp_site_cap * 2 : 64;
+        HeapSite *sites = (HeapSite *)realloc(g_hp_sites, (size_t)cap * sizeof(HeapSite));
+        if (!sites) return -1;
+        g_hp_sites = sites;
+        g_hp_site_cap = cap;
+    }
+    g_hp_sites[g_hp_site_count] = *key;
+    g_hp_site_index[i] = g_hp_site_count;
+    return g_hp_site_count++;
+}
+
+static HeapObj *hp_obj_find(const void *obj) {
+    if (!g_hp_obj_count) return NULL;
+    size_t i = hp_hash_ptr(obj, g_hp_obj_cap);
+    while (g_hp_objs[i].obj) {
+        if (g_hp_objs[i].obj == obj) return &g_hp_objs[i];
+        i = (i + 1) & (g_hp_obj_cap - 1);
+    }
+    return NULL;
+}
+
+static void hp_obj_put(HeapObj o) {
+    size_t i = hp_hash_ptr(o.obj, g_hp_obj_cap);
+    while (g_hp_objs[i].obj) i = (i + 1) & (g_hp_obj_cap - 1);
+    g_hp_objs[i] = o;
+    g_hp_obj_count++;
+}
+
+static int hp_obj_grow(void) {
+    if ((g_hp_obj_count + 1) * 2 <= g_hp_obj_cap) return 1;
+    size_t cap = g_hp_obj_cap ? g_hp_obj_cap * 2 : 256;
+    HeapObj *old = g_hp_objs;
+    size_t old_cap = g_hp_obj_cap;
+    HeapObj *objs = (HeapObj *)calloc(cap, sizeof(HeapObj));
+    if (!objs) return 0;
+    g_hp_objs = objs;
+    g_hp_obj_cap = cap;
+    g_hp_obj_count = 0;
+    for (size_t i = 0; i < old_cap; i++) {
+        if (old[i].obj) hp_obj_put(old[i]);
+    }
+    free(old);
+    return 1;
+}
+
+/* Remove @p o from the table, shifting later entries of its probe run back. */
+static void hp_obj_del(HeapObj *o) {
+    size_t mask = g_hp_obj_cap - 1;
+    size_t i = (size_t)(o - g_hp_objs);
+    g_hp_objs[i].obj = NULL;
+    g_hp_obj_count--;
+    for (size_t j = (i + 1) & mask; g_hp_objs[j].obj; j = (j + 1) & mask) {
+        size_t home = hp_hash_ptr(g_hp_objs[j].obj, g_hp_obj_cap);
+        if (((j - home) & mask) >= ((j - i) & mask)) {
+            g_hp_objs[i] = g_hp_objs[j];
+            g_hp_objs[j].obj = NULL;
+            i = j;
+        }
+    }
+}
+
+static void hp_sample(LxHeapKind kind, const void *obj, size_t bytes) {
+    double n = (double)bytes;
+    double est = n / (1.0 - exp(-n / LX_HEAP_PROFILE_SAMPLE_BYTES));
+    HeapSite key;
+    memset(&key, 0, sizeof(key));
+    const char *fn_file = NULL;
+    key.function = hp_intern(eval_current_function(&fn_file));
+    key.file = fn_file ? fn_file : g_hp_file;
+    key.line = lx_heapprof_node ? lx_heapprof_node->line : 0;
+    key.kind = kind;
+    int s = hp_site(&key);
+    if (s < 0) return;
+    g_hp_samples++;
+    g_hp_sites[s].samples++;
+    g_hp_sites[s].alloc_bytes += est;
+    HeapObj *o = hp_obj_find(obj);
+    if (o) {
+        o->bytes += est;
+        g_hp_sites[o->site].live_bytes += est;
+        return;
+    }
+    if (!hp_obj_grow()) return;
+    HeapObj rec = { obj, s, est };
+    hp_obj_put(rec);
+    g_hp_sites[s].live_bytes += est;
+}
+
+void lx_heapprof_alloc(LxHeapKind kind, const void *obj, size_t bytes) {
+    if (!obj || !bytes) return;
+    g_hp_total[kind] += (double)bytes;
+    g_hp_countdown -= (long long)bytes;
+    if (g_hp_countdown > 0) return;
+    while (g_hp_countdown <= 0) g_hp_countdown += hp_next_interval();
+    hp_sample(kind, obj, bytes);
+}
+
+void lx_heapprof_move(const void *from, const void *to) {
+    HeapObj *o = hp_obj_find(from);
+    if (!o) return;
+    HeapObj rec = *o;
+    hp_obj_del(o);
+    rec.obj = to;
+    hp_obj_put(rec);
+}
+
+void lx_heapprof_free(const void *obj) {
+    HeapObj *o = hp_obj_find(obj);
+    if (!o) return;
+    g_hp_sites[o->site].live_bytes -= o->bytes;
+    hp_obj_del(o);
+}
+
+/* ---------- report ---------- */
+
+typedef struct {
+    Array *arrays[HEAPPROF_TOP_ARRAYS];
+    size_t bytes[HEAPPROF_TOP_ARRAYS];
+    int count;
+} HeapTopArrays;
+
+static size_t hp_array_bytes(const Array *a) {
+    return sizeof(Array) + (a->shared ? 0 : a->capacity * sizeof(ArrayEntry));
+}
+
+static void hp_top_array(Array *a, void *ctx) {
+    HeapTopArrays *top = (HeapTopArrays *)ctx;
+    size_t bytes = hp_array_bytes(a);
+    int i = top->count;
+    if (i == HEAPPROF_TOP_ARRAYS) {
+        if (bytes <= top->bytes[i - 1]) return;
+        i--;
+    } else {
+        top->count++;
+    }
+    while (i > 0 && top->bytes[i - 1] < bytes) {
+        top->arrays[i] = top->arrays[i - 1];
+        top->bytes[i] = top->bytes[i - 1];
+        i--;
+    }
+    top->arrays[i] = a;
+    top->bytes[i] = bytes;
+}
+
+/* Live estimates are sums of +/- weights; keep rounding from printing -0. */
+static double hp_round(double bytes) {
+    return bytes < 0.5 ? 0.0 : bytes;
+}
+
+static void hp_print_site(FILE *f, const HeapSite *s) {
+    fprintf(f, "%s:%d", s->file ? s->file : "-", s->line);
+    if (s->function && *s->function) fprintf(f, " in %s()", s->function);
+    fputc('\n', f);
+}
+
+static int hp_site_cmp(const void *pa, const void *pb) {
+    const HeapSite *a = (const HeapSite *)pa;
+    const HeapSite *b = (const HeapSite *)pb;
+    if (a->live_bytes != b->live_bytes) return a->live_bytes < b->live_bytes ? 1 : -1;
+    if (a->alloc_bytes != b->alloc_bytes) return a->alloc_bytes < b->alloc_bytes ? 1 : -1;
+    return 0;
+}
+
+static void hp_report(FILE *f) {
+    double live[LX_HEAP_KINDS] = { 0 };
+    for (int s = 0; s < g_hp_site_count; s++) live[g_hp_sites[s].kind] += g_hp_sites[s].live_bytes;
+
+    fprintf(f, "lx heap profile\n");
+    fprintf(f, "sampling: one allocation per %ld bytes on average, %lu samples\n\n",
+            (long)LX_HEAP_PROFILE_SAMPLE_BYTES, g_hp_samples);
+
+    fprintf(f, "by type (allocated: exact; live at exit: estimated)\n");
+    fprintf(f, "  %-8s %14s %14s\n", "type", "allocated", "live");
+    for (int k = 0; k < LX_HEAP_KINDS; k++) {
+        fprintf(f, "  %-8s %14.0f %14.0f\n", g_hp_kind_names[k], g_hp_total[k], hp_round(live[k]));
+    }
+
+    /* The largest arrays are looked up before the sites are reordered. */
+    HeapTopArrays top;
+    top.count = 0;
+    gc_each_array(hp_top_array, &top);
+    fprintf(f, "\nlargest arrays at exit\n");
+    fprintf(f, "  %10s %14s  %s\n", "entries", "bytes", "site");
+    for (int i = 0; i < top.count; i++) {
+        const HeapObj *o = hp_obj_find(top.arrays[i]);
+        fprintf(f, "  %10lu %14lu  ", (unsigned long)top.arrays[i]->size, (unsigned long)top.bytes[i]);
+        if (o) hp_print_site(f, &g_hp_sites[o->site]);
+        else fprintf(f, "(not sampled)\n");
+    }
+
+    if (g_hp_site_count) qsort(g_hp_sites, (size_t)g_hp_site_count, sizeof(HeapSite), hp_site_cmp);
+    fprintf(f, "\nby site (estimated bytes, by live then allocated)\n");
+    fprintf(f, "  %14s %14s %8s  %-7s %s\n", "live", "allocated", "samples", "type", "site");
+    for (int s = 0; s < g_hp_site_count; s++) {
+        const HeapSite *site = &g_hp_sites[s];
+        fprintf(f, "  %14.0f %14.0f %8lu  %-7s ", hp_round(site->live_bytes), site->alloc_bytes,
+                site->samples, g_hp_kind_names[site->kind]);
+        hp_print_site(f, site);
+    }
+}
+
+/* ---------- lifetime ---------- */
+
+int lx_heapprof_start(const char *path) {
+    if (lx_heapprof_enabled || !path || !*path) return 0;
+    const char *mark = strstr(path, "%p");
+    size_t len = strlen(path) + 24;
+    g_hp_path = (char *)malloc(len);
+    if (!g_hp_path) return 0;
+    if (mark) {
+        long pid = 0;
+#if !defined(LX_TARGET_LXSH) || !LX_TARGET_LXSH
+        pid = (long)getpid();
+#endif
+        snprintf(g_hp_path, len, "%.*s%ld%s", (int)(mark - path), path, pid, mark + 2);
+    } else {
+        memcpy(g_hp_path, path, strlen(path) + 1);
+    }
+    memset(g_hp_total, 0, sizeof(g_hp_total));
+    g_hp_samples = 0;
+    g_hp_countdown = hp_next_interval();
+    lx_heapprof_enabled = 1;
+    return 1;
+}
+
+int lx_heapprof_stop(void) {
+    if (!lx_heapprof_enabled) return 0;
+    lx_heapprof_enabled = 0;
+    int ok = 0;
+    FILE *f = fopen(g_hp_path, "w");
+    if (f) {
+        hp_report(f);
+        ok = fclose(f) == 0;
+    }
+    free(g_hp_path);
+    g_hp_path = NULL;
+    free(g_hp_sites);
+    g_hp_sites = NULL;
+    g_hp_site_count = g_hp_site_cap = 0;
+    free(g_hp_site_index);
+    g_hp_site_index = NULL;
+    g_hp_site_index_cap = 0;
+    free(g_hp_objs);
+    g_hp_objs = NULL;
+    g_hp_obj_cap = g_hp_obj_count = 0;
+    while (g_hp_names) {
+        HeapName *next = g_hp_names->next;
+        free(g_hp_names);
+        g_hp_names = next;
+    }
+    g_hp_file = NULL;
+    return ok;
+}
@@ -0,0 +1,64 @@
+/**
+ * @file heapprof.h
+ * @brief Sampling heap profiler for script values.
+ */
+#ifndef HEAPPROF_H
+#define HEAPPROF_H
+
+#include <stddef.h>
+
+struct AstNode;
+
+/** Kinds of profiled values. */
+typedef enum {
+    LX_HEAP_STRING = 0,
+    LX_HEAP_ARRAY,
+    LX_HEAP_BLOB,
+    LX_HEAP_KINDS
+} LxHeapKind;
+
+/** Non-zero while a profile is being recorded; read by the hooks below. */
+extern int lx_heapprof_enabled;
+/**
+ * Statement being executed, set by the engines; allocations are
+ * attributed to its line.
+ */
+extern const struct AstNode *lx_heapprof_node;
+
+/**
+ * Start recording. The report goes to @p path ("%p" is replaced by the
+ * process id) when lx_heapprof_stop() is called. About one allocation
+ * per LX_HEAP_PROFILE_SAMPLE_BYTES allocated is sampled.
+ * @return 0 if a profile is already running or @p path is empty.
+ */
+int lx_heapprof_start(const char *path);
+/**
+ * Write the report (by value type, by site, largest arrays) and stop
+ * recording. Call before the host tears the script's values down.
+ * @return 0 if the report could not be written.
+ */
+int lx_heapprof_stop(void);
+
+/**
+ * Set the file that top-level code runs from and @return the previous
+ * one, to be restored when an include ends. The name is copied.
+ */
+const char *lx_heapprof_set_file(const char *file);
+/** @return The current file (a stable copy), or NULL when not profiling. */
+const char *lx_heapprof_file(void);
+
+/** Account @p bytes allocated for value @p obj of kind @p kind. */
+void lx_heapprof_alloc(LxHeapKind kind, const void *obj, size_t bytes);
+/** Value @p from now lives at @p to (string realloc). */
+void lx_heapprof_move(const void *from, const void *to);
+/** Value @p obj was freed. */
+void lx_heapprof_free(const void *obj);
+
+#define LX_HEAPPROF_ALLOC(kind, obj, bytes) \
+    do { if (lx_heapprof_enabled) lx_heapprof_alloc((kind), (obj), (bytes)); } while (0)
+#define LX_HEAPPROF_MOVE(from, to) \
+    do { if (lx_heapprof_enabled && (from) != (to)) lx_heapprof_move((from), (to)); } while (0)
+#define LX_HEAPPROF_FREE(obj) \
+    do { if (lx_heapprof_enabled) lx_heapprof_free((obj)); } while (0)
+
+#endif
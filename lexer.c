@@ -6,6 +6,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <ctype.h>
+#include <errno.h>
 #include <limits.h>
 #include <float.h>
 #include <stdint.h>
@@ -247,8 +248,17 @@ static Token number(Lexer *l) {
         }
     }
 
+    /* Decimal literals too large for lx_int_t become floats. */
+    errno = 0;
+    long long v = strtoll(start, NULL, 10);
+    if (errno == ERANGE || v > (long long)LX_INT_MAX) {
+        Token tok = make_token(l, TOK_FLOAT);
+        tok.float_val = strtod(start, NULL);
+        return tok;
+    }
+
     Token tok = make_token(l, TOK_INT);
-    tok.int_val = (lx_int_t)strtoll(start, NULL, 10);
+    tok.int_val = (lx_int_t)v;
     return tok;
 }
 
@@ -428,6 +438,7 @@ static Token identifier(Lexer *l, int is_var) {
         KW("default", TOK_DEFAULT);
         KW("function", TOK_FUNCTION);
         KW("global", TOK_GLOBAL);
+        KW("const", TOK_CONST);
         KW("return", TOK_RETURN);
         KW("break", TOK_BREAK);
         KW("continue", TOK_CONTINUE);
@@ -35,6 +35,7 @@ typedef enum {
     TOK_DEFAULT,
     TOK_FUNCTION,
     TOK_GLOBAL,
+    TOK_CONST,
     TOK_RETURN,
     TOK_BREAK,
     TOK_CONTINUE,
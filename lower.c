@@ -0,0 +1,333 @@
+/**
+ * @file lower.c
+ * @brief Closure-compilation pass installing pre-resolved node handlers.
+ *
+ * Each handler is specialized for one node shape (variable read, int
+ * literal, a given binary operator, native call, constant-key index, ...)
+ * so evaluation no longer re-switches on the node type or operator.
+ * Handlers fall back to the generic helpers in eval.c whenever operand
+ * types leave their fast path.
+ */
+#include "lower.h"
+#include "eval.h"
+#include "array.h"
+#include "lx_error.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+/* Evaluate a child node, going straight to its handler when it has one. */
+static Value sub(AstNode *n, Env *env, int *ok_flag) {
+    if (n->exec && !lx_has_error()) return n->exec(n, env, ok_flag);
+    return eval_expr_value(n, env, ok_flag);
+}
+
+static Value x_int(AstNode *n, Env *env, int *ok_flag) {
+    (void)env;
+    (void)ok_flag;
+    return value_int(n->literal.token.int_val);
+}
+
+static Value x_literal(AstNode *n, Env *env, int *ok_flag) {
+    (void)env;
+    (void)ok_flag;
+    return eval_literal(&n->literal.token);
+}
+
+static Value x_var(AstNode *n, Env *env, int *ok_flag) {
+    (void)ok_flag;
+    Value *slot = env_lookup(env, n->var.name, &n->slot_hint);
+    return slot ? value_copy(*slot) : value_undefined();
+}
+
+static Value x_assign(AstNode *n, Env *env, int *ok_flag) {
+    Value rhs = sub(n->assign.value, env, ok_flag);
+    if (!*ok_flag) return value_null();
+    Value *slot = env_lookup(env, n->assign.name, &n->slot_hint);
+    if (slot) {
+        value_free(*slot);
+        *slot = value_copy(rhs);
+    } else {
+        env_set(env, n->assign.name, value_copy(rhs));
+    }
+    return rhs;
+}
+
+static Value x_assign_op(AstNode *n, Env *env, int *ok_flag) {
+    Value rhs = sub(n->assign.value, env, ok_flag);
+    if (!*ok_flag) return value_null();
+    Value *slot = env_lookup(env, n->assign.name, &n->slot_hint);
+    Operator op = n->assign.op;
+    if (slot && slot->type == VAL_INT && rhs.type == VAL_INT &&
+        (op == OP_ADD || op == OP_SUB || op == OP_MUL)) {
+        lx_int_t r;
+        int over = (op == OP_ADD) ? lx_add_overflow(slot->i, rhs.i, &r)
+                 : (op == OP_SUB) ? lx_sub_overflow(slot->i, rhs.i, &r)
+                 : lx_mul_overflow(slot->i, rhs.i, &r);
+        if (!over) {
+            slot->i = r;
+            return value_int(r);
+        }
+    }
+    Value lhs = slot ? value_copy(*slot) : value_undefined();
+    if (lhs.type == VAL_UNDEFINED || lhs.type == VAL_NULL) {
+        lhs = (op == OP_CONCAT) ? value_string("") : value_int(0);
+    }
+    Value out = eval_assign_op(n, op, lhs, value_copy(rhs));
+    value_free(rhs);
+    slot = env_lookup(env, n->assign.name, &n->slot_hint);
+    if (slot) {
+        value_free(*slot);
+        *slot = value_copy(out);
+    } else {
+        env_set(env, n->assign.name, value_copy(out));
+    }
+    return out;
+}
+
+/* ---------- binary operators ---------- */
+
+static int operands(AstNode *n, Env *env, int *ok_flag, Value *a, Value *b) {
+    *a = sub(n->binary.left, env, ok_flag);
+    if (!*ok_flag) return 0;
+    *b = sub(n->binary.right, env, ok_flag);
+    if (!*ok_flag) { value_free(*a); return 0; }
+    return 1;
+}
+
+#define INT_BINOP(fn, OP, expr)                                        \
+    static Value fn(AstNode *n, Env *env, int *ok_flag) {              \
+        Value a, b;                                                    \
+        if (!operands(n, env, ok_flag, &a, &b)) return value_null();   \
+        if (a.type == VAL_INT && b.type == VAL_INT) return (expr);     \
+        return eval_binary_values(n, OP, a, b, ok_flag);               \
+    }
+
+/* Checked arithmetic: on overflow the generic path promotes to float. */
+#define INT_ARITH(fn, OP, check)                                       \
+    static Value fn(AstNode *n, Env *env, int *ok_flag) {              \
+        Value a, b;                                                    \
+        lx_int_t r;                                                    \
+        if (!operands(n, env, ok_flag, &a, &b)) return value_null();   \
+        if (a.type == VAL_INT && b.type == VAL_INT && !check(a.i, b.i, &r)) \
+            return value_int(r);                                       \
+        return eval_binary_values(n, OP, a, b, ok_flag);               \
+    }
+
+INT_ARITH(x_add_int, OP_ADD, lx_add_overflow)
+INT_ARITH(x_sub_int, OP_SUB, lx_sub_overflow)
+INT_ARITH(x_mul_int, OP_MUL, lx_mul_overflow)
+
+#undef INT_ARITH
+
+INT_BINOP(x_lt_int,  OP_LT,  value_bool(a.i <  b.i))
+INT_BINOP(x_lte_int, OP_LTE, value_bool(a.i <= b.i))
+INT_BINOP(x_gt_int,  OP_GT,  value_bool(a.i >  b.i))
+INT_BINOP(x_gte_int, OP_GTE, value_bool(a.i >= b.i))
+INT_BINOP(x_eq_int,  OP_EQ,  value_bool(a.i == b.i))
+INT_BINOP(x_neq_int, OP_NEQ, value_bool(a.i != b.i))
+INT_BINOP(x_seq_int, OP_SEQ, value_bool(a.i == b.i))
+INT_BINOP(x_sneq_int, OP_SNEQ, value_bool(a.i != b.i))
+
+#undef INT_BINOP
+
+static Value x_binary(AstNode *n, Env *env, int *ok_flag) {
+    Value a, b;
+    if (!operands(n, env, ok_flag, &a, &b)) return value_null();
+    return eval_binary_values(n, n->binary.op, a, b, ok_flag);
+}
+
+static Value x_and(AstNode *n, Env *env, int *ok_flag) {
+    Value lv = sub(n->binary.left, env, ok_flag);
+    if (!*ok_flag) return value_null();
+    int t = value_is_true(lv);
+    value_free(lv);
+    if (!t) return value_bool(0);
+    Value rv = sub(n->binary.right, env, ok_flag);
+    if (!*ok_flag) return value_null();
+    t = value_is_true(rv);
+    value_free(rv);
+    return value_bool(t);
+}
+
+static Value x_or(AstNode *n, Env *env, int *ok_flag) {
+    Value lv = sub(n->binary.left, env, ok_flag);
+    if (!*ok_flag) return value_null();
+    int t = value_is_true(lv);
+    value_free(lv);
+    if (t) return value_bool(1);
+    Value rv = sub(n->binary.right, env, ok_flag);
+    if (!*ok_flag) return value_null();
+    t = value_is_true(rv);
+    value_free(rv);
+    return value_bool(t);
+}
+
+static AstExecFn binary_handler(Operator op) {
+    switch (op) {
+        case OP_ADD:  return x_add_int;
+        case OP_SUB:  return x_sub_int;
+        case OP_MUL:  return x_mul_int;
+        case OP_LT:   return x_lt_int;
+        case OP_LTE:  return x_lte_int;
+        case OP_GT:   return x_gt_int;
+        case OP_GTE:  return x_gte_int;
+        case OP_EQ:   return x_eq_int;
+        case OP_NEQ:  return x_neq_int;
+        case OP_SEQ:  return x_seq_int;
+        case OP_SNEQ: return x_sneq_int;
+        case OP_AND:  return x_and;
+        case OP_OR:   return x_or;
+        default:      return x_binary;
+    }
+}
+
+/* ---------- calls ---------- */
+
+#define CALL_INLINE_ARGS 8
+
+static Value x_call(AstNode *n, Env *env, int *ok_flag) {
+    const NativeDef *nd = eval_call_native(n);
+    if (nd) return eval_native_call(n, nd, env, ok_flag);
+
+    int argc = n->call.argc;
+    Value inline_args[CALL_INLINE_ARGS];
+    Value *argv = inline_args;
+    if (argc > CALL_INLINE_ARGS) {
+        argv = (Value *)malloc(sizeof(Value) * (size_t)argc);
+        if (!argv) {
+            lx_set_error(LX_ERR_INTERNAL, n->line, n->col, "call argument allocation failed");
+            *ok_flag = 0;
+            return value_null();
+        }
+    }
+    for (int i = 0; i < argc; i++) {
+        argv[i] = sub(n->call.args[i], env, ok_flag);
+        if (!*ok_flag) {
+            for (int j = 0; j <= i; j++) value_free(argv[j]);
+            if (argv != inline_args) free(argv);
+            return value_null();
+        }
+    }
+
+    Value r = eval_call_values(n, env, argv, argc, ok_flag);
+    if (argv != inline_args) free(argv);
+    return r;
+}
+
+/* ---------- indexing ---------- */
+
+/* $var[...] and expr[...] with a constant string key. */
+static Value x_index_str(AstNode *n, Env *env, int *ok_flag) {
+    AstNode *t = n->index.target;
+    const char *s = n->index.index->literal.token.string_val;
+    Value owned = value_null();
+    Value *tv;
+    if (t->type == AST_VAR) {
+        tv = env_lookup(env, t->var.name, &t->slot_hint);
+        if (!tv) return value_undefined();
+    } else {
+        owned = sub(t, env, ok_flag);
+        if (!*ok_flag) return value_null();
+        tv = &owned;
+    }
+
+    Value out;
+    if (tv->type == VAL_ARRAY) {
+        Key k;
+        k.type = KEY_STRING;
+        k.s = (char *)(s ? s : "");
+        Value *slot = array_lookup_cached(tv->a, k, &n->ic);
+        out = slot ? value_copy(*slot) : value_undefined();
+    } else {
+        Value key = eval_literal(&n->index.index->literal.token);
+        out = eval_index_value(*tv, key);
+        value_free(key);
+    }
+    value_free(owned);
+    return out;
+}
+
+/* $var[$i] / $var[3]: the index is side-effect free, so the target can be borrowed. */
+static Value x_index_var(AstNode *n, Env *env, int *ok_flag) {
+    AstNode *t = n->index.target;
+    Value idx = sub(n->index.index, env, ok_flag);
+    if (!*ok_flag) return value_null();
+    Value *tv = env_lookup(env, t->var.name, &t->slot_hint);
+    Value out;
+    if (!tv) {
+        out = value_undefined();
+    } else if (tv->type == VAL_ARRAY && idx.type == VAL_INT) {
+        Value *slot = array_lookup(tv->a, key_int(idx.i));
+        out = slot ? value_copy(*slot) : value_undefined();
+    } else {
+        out = eval_index_value(*tv, idx);
+    }
+    value_free(idx);
+    return out;
+}
+
+static AstExecFn index_handler(AstNode *n) {
+    AstNode *ix = n->index.index;
+    if (ix->type == AST_LITERAL && ix->literal.token.type == TOK_STRING) return x_index_str;
+    if (n->index.target->type == AST_VAR &&
+        (ix->type == AST_VAR ||
+         (ix->type == AST_LITERAL && ix->literal.token.type == TOK_INT))) {
+        return x_index_var;
+    }
+    return NULL;
+}
+
+/* ---------- pass ---------- */
+
+static void lower_slot(AstNode **slot, void *ctx);
+
+static void lower_node(AstNode *n) {
+    switch (n->type) {
+        case AST_LITERAL:
+            switch (n->literal.token.type) {
+                case TOK_INT:
+                    n->exec = x_int;
+                    break;
+                case TOK_FLOAT:
+                case TOK_STRING:
+                case TOK_NULL:
+                case TOK_UNDEFINED:
+                case TOK_VOID:
+                case TOK_TRUE:
+                case TOK_FALSE:
+                    n->exec = x_literal;
+                    break;
+                default:
+                    break;
+            }
+            break;
+        case AST_VAR:
+            n->exec = x_var;
+            break;
+        case AST_ASSIGN:
+            n->exec = n->assign.is_compound ? x_assign_op : x_assign;
+            break;
+        case AST_BINARY:
+            n->exec = binary_handler(n->binary.op);
+            break;
+        case AST_CALL:
+            n->exec = x_call;
+            break;
+        case AST_INDEX:
+            n->exec = index_handler(n);
+            break;
+        default:
+            break;
+    }
+    ast_visit_children(n, lower_slot, NULL);
+}
+
+static void lower_slot(AstNode **slot, void *ctx) {
+    (void)ctx;
+    lower_node(*slot);
+}
+
+void ast_lower(AstNode *root) {
+    if (root) lower_node(root);
+}
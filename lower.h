@@ -0,0 +1,17 @@
+/**
+ * @file lower.h
+ * @brief Closure-compilation pass installing pre-resolved node handlers.
+ */
+#ifndef LOWER_H
+#define LOWER_H
+
+#include "ast.h"
+
+/**
+ * Install specialized expression handlers on every node below @p root.
+ * Lowered nodes are evaluated through AstNode::exec instead of the
+ * generic switch in eval.c; semantics are unchanged.
+ */
+void ast_lower(AstNode *root);
+
+#endif
@@ -18,9 +18,14 @@
 #include "parser.h"
 #include "ast.h"
 #include "eval.h"
+#include "optimize.h"
 #include "env.h"
 #include "natives.h"
 #include "array.h"
+#include "gc.h"
+#include "region.h"
+#include "memguard.h"
+#include "heapprof.h"
 #include "lx_ext.h"
 #include "lx_error.h"
 #include "config.h"
@@ -1260,6 +1265,24 @@ static void install_std_env(Env *global) {
     env_set_array(global, "_COOKIE", cookies);
 }
 
+/* Release what the script left behind. With LX_CGI_FAST_EXIT only its
+ * databases are closed: the process ends once the response is written. */
+static void script_teardown(Value result, Env *global, AstNode *program) {
+    lx_run_shutdown();
+#if LX_CGI_FAST_EXIT
+    (void)result;
+    (void)global;
+    (void)program;
+#else
+    lx_region_end();
+    array_defer_frees(0);
+    value_free(result);
+    env_free(global);
+    ast_free(program);
+    lx_region_release();
+#endif
+}
+
 static int run_script(const char *source, const char *filename) {
     Parser parser;
     lexer_init(&parser.lexer, source, filename);
@@ -1275,7 +1298,26 @@ static int run_script(const char *source, const char *filename) {
         return 1;
     }
 
+    /* LX_HEAP_PROFILE=/tmp/lx-heap-%p.txt writes one profile per request. */
+    const char *heap_profile = getenv("LX_HEAP_PROFILE");
+    if (heap_profile && *heap_profile && lx_heapprof_start(heap_profile)) {
+        lx_heapprof_set_file(filename);
+    }
+#if LX_CGI_REGION
+    lx_region_begin();
+#endif
     Env *global = env_new(NULL);
+    if (!global) {
+        /* a memory limit too small for the first allocation */
+        lx_set_memory_limit(0);
+        FILE *out = LX_CGI_DISPLAY_ERRORS ? lx_get_output() : stderr;
+        lx_print_error(out);
+        if (lx_heapprof_enabled) lx_heapprof_stop();
+        lx_region_end();
+        ast_free(program);
+        lx_region_release();
+        return 1;
+    }
     install_stdlib();
     register_function("header", n_header);
     register_function("write_blob", n_write_blob);
@@ -1327,13 +1369,21 @@ static int run_script(const char *source, const char *filename) {
     lx_init_modules(global);
     install_std_env(global);
 
+    ast_optimize(program);
+    array_defer_frees(1);
     EvalResult r = eval_program(program, global);
+    /* the limit applies to the script, not to saving the session */
+    lx_set_memory_limit(0);
+    if (lx_heapprof_enabled && !lx_heapprof_stop()) {
+        fprintf(stderr, "lx_cgi: cannot write heap profile '%s'\n", heap_profile);
+    }
     if (lx_has_error()) {
         FILE *out = LX_CGI_DISPLAY_ERRORS ? lx_get_output() : stderr;
         lx_print_error(out);
-        value_free(r.value);
-        env_free(global);
-        ast_free(program);
+#if LX_ENABLE_BLAKE2B && LX_ENABLE_SERIALIZER
+        g_session.data = value_export(g_session.data);
+#endif
+        script_teardown(r.value, global, program);
         return 1;
     }
 #if LX_ENABLE_BLAKE2B && LX_ENABLE_SERIALIZER
@@ -1352,10 +1402,10 @@ static int run_script(const char *source, const char *filename) {
             session_set_cookie(g_session.id, 0);
         }
     }
+    /* session_reset() runs after the region is gone */
+    g_session.data = value_export(g_session.data);
 #endif
-    value_free(r.value);
-    env_free(global);
-    ast_free(program);
+    script_teardown(r.value, global, program);
     return 0;
 }
 
@@ -1454,6 +1504,21 @@ int main(void) {
         return 0;
     }
 
+    size_t memory_limit = LX_CGI_MEMORY_LIMIT;
+    const char *limit_env = getenv("LX_MEMORY_LIMIT");
+    if (limit_env && *limit_env && !lx_parse_mem_size(limit_env, &memory_limit)) {
+        fprintf(stderr, "lx_cgi: invalid LX_MEMORY_LIMIT '%s'\n", limit_env);
+    }
+    lx_set_memory_limit(memory_limit);
+
+    /* requests want short collector pauses more than throughput */
+    GcTuning tuning;
+    gc_get_tuning(&tuning);
+    tuning.pause_budget_ms = LX_CGI_GC_PAUSE_BUDGET_MS;
+    gc_set_tuning(&tuning);
+    const char *gc_trace = getenv("LX_GC_TRACE");
+    if (gc_trace && *gc_trace && strcmp(gc_trace, "0") != 0) gc_set_trace(1);
+
     headers_reset();
 
     FILE *body = tmpfile();
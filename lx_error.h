@@ -19,6 +19,9 @@ typedef enum {
     LX_ERR_UNSET_TARGET = 2005,
     LX_ERR_BREAK_CONTINUE = 2006,
     LX_ERR_CYCLE = 2007,
+    LX_ERR_TYPE = 2008,
+    LX_ERR_CONSTANT = 2009,
+    LX_ERR_MEMORY_LIMIT = 2010,
     LX_ERR_INTERNAL = 9000
 } LxErrorCode;
 
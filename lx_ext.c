@@ -10,6 +10,10 @@ static LxModuleInit *g_mods = NULL;
 static int g_mod_count = 0;
 static int g_mod_cap = 0;
 
+static LxModuleShutdown *g_shutdowns = NULL;
+static int g_shutdown_count = 0;
+static int g_shutdown_cap = 0;
+
 static char **g_ext_names = NULL;
 static int g_ext_count = 0;
 static int g_ext_cap = 0;
@@ -71,6 +75,11 @@ void lx_reset_extensions(void) {
     g_mods = NULL;
     g_mod_count = 0;
     g_mod_cap = 0;
+
+    free(g_shutdowns);
+    g_shutdowns = NULL;
+    g_shutdown_count = 0;
+    g_shutdown_cap = 0;
 }
 
 void lx_init_modules(Env *global) {
@@ -83,12 +92,35 @@ void lx_register_function(const char *name, NativeFn fn) {
     register_function(name, fn);
 }
 
+int lx_register_typed_function(const char *name, LxTypedFn fn, const char *sig) {
+    return register_typed_function(name, fn, sig);
+}
+
 void lx_register_constant(Env *global, const char *name, Value v) {
-    if (!global || !name) { value_free(v); return; }
-    env_set(global, name, v);
+    (void)global;
+    define_constant(name, v);
 }
 
 void lx_register_variable(Env *global, const char *name, Value v) {
     if (!global || !name) { value_free(v); return; }
     env_set(global, name, v);
 }
+
+void lx_register_shutdown(LxModuleShutdown fn) {
+    if (!fn) return;
+    for (int i = 0; i < g_shutdown_count; i++) {
+        if (g_shutdowns[i] == fn) return;
+    }
+    if (g_shutdown_count == g_shutdown_cap) {
+        int cap = g_shutdown_cap ? g_shutdown_cap * 2 : 8;
+        LxModuleShutdown *ns = (LxModuleShutdown *)realloc(g_shutdowns, (size_t)cap * sizeof(LxModuleShutdown));
+        if (!ns) return;
+        g_shutdowns = ns;
+        g_shutdown_cap = cap;
+    }
+    g_shutdowns[g_shutdown_count++] = fn;
+}
+
+void lx_run_shutdown(void) {
+    while (g_shutdown_count > 0) g_shutdowns[--g_shutdown_count]();
+}
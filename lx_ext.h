@@ -10,6 +10,8 @@
 
 /** Extension module initializer. */
 typedef void (*LxModuleInit)(Env *global);
+/** Extension shutdown hook (see lx_register_shutdown()). */
+typedef void (*LxModuleShutdown)(void);
 
 /** Register an extension name for introspection. */
 void lx_register_extension(const char *name);
@@ -24,18 +26,33 @@ void lx_register_module(LxModuleInit init);
 void lx_reset_extensions(void);
 /** Invoke all registered modules with the global environment. */
 void lx_init_modules(Env *global);
+/**
+ * Register a hook that releases what a module holds outside script values
+ * (open databases, files) when the script has finished.
+ */
+void lx_register_shutdown(LxModuleShutdown fn);
+/**
+ * Run the shutdown hooks, last registered first, and forget them. Hosts
+ * call this after the script, before tearing down or exiting.
+ */
+void lx_run_shutdown(void);
 
 /** Register a native function (extension-friendly wrapper). */
 void lx_register_function(const char *name, NativeFn fn);
 /**
- * Register a global constant value.
- * Note: constants are not enforced by the language at runtime.
+ * Register a typed native function. The interpreter checks the arity and
+ * argument types declared by @p sig (see register_typed_function()) before
+ * calling @p fn with converted, borrowed arguments.
+ * @return 0 if @p sig is malformed.
  */
-void lx_register_constant(Env *global, const char *name, Value v);
+int lx_register_typed_function(const char *name, LxTypedFn fn, const char *sig);
 /**
- * Register a global variable value.
- * Note: this uses the same binding mechanism as constants.
+ * Register a constant (see define_constant()). Scripts read it as a bare
+ * name, which is replaced by its value before the program runs.
+ * @p global is unused and kept for source compatibility.
  */
+void lx_register_constant(Env *global, const char *name, Value v);
+/** Register a global variable value. */
 void lx_register_variable(Env *global, const char *name, Value v);
 
 #endif
@@ -30,4 +30,34 @@ typedef unsigned int lx_uint_t;
 
 #define LX_INT_SIZE ((int)sizeof(lx_int_t))
 
+/*
+ * Checked lx_int_t arithmetic: store the wrapped result in *r and return
+ * non-zero when the exact result does not fit. Callers promote to float
+ * on overflow.
+ */
+#if (defined(__GNUC__) && __GNUC__ >= 5) || defined(__clang__)
+#define lx_add_overflow(a, b, r) __builtin_add_overflow((a), (b), (r))
+#define lx_sub_overflow(a, b, r) __builtin_sub_overflow((a), (b), (r))
+#define lx_mul_overflow(a, b, r) __builtin_mul_overflow((a), (b), (r))
+#else
+static inline int lx_add_overflow(lx_int_t a, lx_int_t b, lx_int_t *r) {
+    *r = (lx_int_t)((lx_uint_t)a + (lx_uint_t)b);
+    return (b > 0 && a > LX_INT_MAX - b) || (b < 0 && a < LX_INT_MIN - b);
+}
+
+static inline int lx_sub_overflow(lx_int_t a, lx_int_t b, lx_int_t *r) {
+    *r = (lx_int_t)((lx_uint_t)a - (lx_uint_t)b);
+    return (b < 0 && a > LX_INT_MAX + b) || (b > 0 && a < LX_INT_MIN + b);
+}
+
+static inline int lx_mul_overflow(lx_int_t a, lx_int_t b, lx_int_t *r) {
+    *r = (lx_int_t)((lx_uint_t)a * (lx_uint_t)b);
+    if (a == 0 || b == 0) return 0;
+    if (a == -1) return b == LX_INT_MIN;
+    if (b == -1) return a == LX_INT_MIN;
+    return a > 0 ? (b > 0 ? a > LX_INT_MAX / b : b < LX_INT_MIN / a)
+                 : (b > 0 ? a < LX_INT_MIN / b : a < LX_INT_MAX / b);
+}
+#endif
+
 #endif
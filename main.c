@@ -12,9 +12,16 @@
 #include "ast.h"
 #include "parser.h"
 #include "eval.h"
+#include "vm.h"
+#include "lower.h"
+#include "optimize.h"
 #include "env.h"
 #include "natives.h"
 #include "array.h"
+#include "gc.h"
+#include "region.h"
+#include "memguard.h"
+#include "heapprof.h"
 #include "lx_ext.h"
 #include "lx_error.h"
 #include "lx_version.h"
@@ -94,6 +101,13 @@ static void install_argv(Env *global, int argc, char **argv) {
     env_set(global, "argv", arr);
 }
 
+/* Execution engines selectable with --engine=. */
+typedef enum {
+    ENGINE_AST = 0,
+    ENGINE_CLOSURE,
+    ENGINE_VM
+} Engine;
+
 static char *resolve_path(const char *path) {
     if (!path || !*path) return strdup("");
     char *real = realpath(path, NULL);
@@ -105,12 +119,78 @@ int main(int argc, char **argv) {
 
     char *source = NULL;
     char *filename = NULL;
+    Engine engine = ENGINE_AST;
+    int optimize = 1;
+    int dump_ast = 0;
+    int region = 0;
+    const char *fast_env = getenv("LX_FAST_EXIT");
+    int fast_exit = fast_env && *fast_env && strcmp(fast_env, "0") != 0;
+    const char *memory_limit = getenv("LX_MEMORY_LIMIT");
+    const char *heap_profile = getenv("LX_HEAP_PROFILE");
 
     if (argc >= 2 && (!strcmp(argv[1], "-v") || !strcmp(argv[1], "--version"))) {
         printf("Lx %s\n", LX_VERSION_STRING);
         return 0;
     }
 
+    /* Interpreter options precede the script and are hidden from it. */
+    while (argc >= 2 && (!strncmp(argv[1], "--engine=", 9) ||
+                         !strncmp(argv[1], "--gc=", 5) ||
+                         !strcmp(argv[1], "--dump-ast") ||
+                         !strcmp(argv[1], "--no-optimize") ||
+                         !strcmp(argv[1], "--region") ||
+                         !strcmp(argv[1], "--fast-exit") ||
+                         !strncmp(argv[1], "--memory-limit=", 15) ||
+                         !strncmp(argv[1], "--heap-profile=", 15))) {
+        const char *name = argv[1] + 9;
+        if (!strcmp(argv[1], "--dump-ast")) {
+            dump_ast = 1;
+        } else if (!strcmp(argv[1], "--no-optimize")) {
+            optimize = 0;
+        } else if (!strcmp(argv[1], "--region")) {
+            region = 1;
+        } else if (!strcmp(argv[1], "--fast-exit")) {
+            fast_exit = 1;
+        } else if (!strncmp(argv[1], "--memory-limit=", 15)) {
+            memory_limit = argv[1] + 15;
+        } else if (!strncmp(argv[1], "--heap-profile=", 15)) {
+            heap_profile = argv[1] + 15;
+        } else if (!strncmp(argv[1], "--gc=", 5)) {
+            const char *mode = argv[1] + 5;
+            if (!strcmp(mode, "cycles")) {
+                gc_set_mode(GC_MODE_CYCLES);
+            } else if (!strcmp(mode, "trace")) {
+                gc_set_mode(GC_MODE_TRACE);
+            } else {
+                fprintf(stderr, "error: unknown collector '%s' (expected cycles or trace)\n", mode);
+                return 1;
+            }
+        } else if (!strcmp(name, "vm")) {
+            engine = ENGINE_VM;
+        } else if (!strcmp(name, "closure")) {
+            engine = ENGINE_CLOSURE;
+        } else if (!strcmp(name, "ast")) {
+            engine = ENGINE_AST;
+        } else {
+            fprintf(stderr, "error: unknown engine '%s' (expected ast, closure or vm)\n", name);
+            return 1;
+        }
+        argv[1] = argv[0];
+        argv++;
+        argc--;
+    }
+
+    if (memory_limit && *memory_limit) {
+        size_t limit;
+        if (!lx_parse_mem_size(memory_limit, &limit)) {
+            fprintf(stderr, "error: invalid memory limit '%s' (expected bytes, or K, M or G)\n", memory_limit);
+            return 1;
+        }
+        lx_set_memory_limit(limit);
+    }
+    const char *gc_trace = getenv("LX_GC_TRACE");
+    if (gc_trace && *gc_trace && strcmp(gc_trace, "0") != 0) gc_set_trace(1);
+
     if (!isatty(STDIN_FILENO)) {
         /* Read the script from stdin. */
         source = read_stream(stdin);
@@ -165,8 +245,25 @@ int main(int argc, char **argv) {
         return 1;
     }
 
-    /* Create the global environment. */
+    if (heap_profile && *heap_profile && lx_heapprof_start(heap_profile)) {
+        lx_heapprof_set_file(filename);
+    }
+
+    /* Create the global environment; with --region, everything the run
+     * allocates from here on is dropped at once at the end. */
+    if (region) lx_region_begin();
     Env *global = env_new(NULL);
+    if (!global) {
+        /* a memory limit too small for the first allocation */
+        lx_print_error(stderr);
+        if (lx_heapprof_enabled) lx_heapprof_stop();
+        lx_region_end();
+        ast_free(program);
+        lx_region_release();
+        free(source);
+        free(filename);
+        return 1;
+    }
     install_argv(global, argc, argv);
 
     /* Install the standard library. */
@@ -213,24 +310,57 @@ int main(int argc, char **argv) {
     /* Run extension initializers. */
     lx_init_modules(global);
 
-    /* Execute. */
-    EvalResult r = eval_program(program, global);
-    if (lx_has_error()) {
-        lx_print_error(stderr);
-        value_free(r.value);
+    /* Optimize once every native is registered. */
+    if (optimize) ast_optimize(program);
+    if (dump_ast) {
+        ast_dump(program, stdout);
+        lx_heapprof_stop();
+        lx_region_end();
         env_free(global);
         ast_free(program);
+        lx_region_release();
         free(source);
         free(filename);
-        return 1;
+        return 0;
+    }
+
+    /* Execute. Large arrays the script drops are freed in slices. */
+    array_defer_frees(1);
+    EvalResult r;
+    if (engine == ENGINE_VM) {
+        vm_enable(1);
+        r = vm_run(program, global);
+    } else if (engine == ENGINE_CLOSURE) {
+        ast_lower(program);
+        r = eval_program(program, global);
+    } else {
+        r = eval_program(program, global);
+    }
+    /* The profile lists what is still live, so it is written before teardown. */
+    if (lx_heapprof_enabled && !lx_heapprof_stop()) {
+        fprintf(stderr, "warning: cannot write heap profile '%s'\n", heap_profile);
+    }
+    int rc = 0;
+    if (lx_has_error()) {
+        lx_print_error(stderr);
+        rc = 1;
+    }
+    lx_run_shutdown();
+    if (fast_exit) {
+        /* the values die with the process; only output needs settling */
+        fflush(NULL);
+        return rc;
     }
 
     /* Cleanup. */
+    lx_region_end();
+    array_defer_frees(0);
     value_free(r.value);
     env_free(global);
     ast_free(program);
+    lx_region_release();
 
     free(source);
     free(filename);
-    return 0;
+    return rc;
 }
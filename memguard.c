@@ -0,0 +1,163 @@
+/**
+ * @file memguard.c
+ * @brief Memory accounting, the memory limit and the platform heap guard.
+ *
+ * The allocators of the value layer report what they take from the heap:
+ * pools per block, the region per chunk, and everything else through
+ * lx_mem_alloc(), which keeps the size of each block in a header word so
+ * frees can be accounted without asking the C library. That makes the
+ * live byte count, and with it the memory limit, an O(1) check.
+ *
+ * The platform heap (lx_platform_free_heap(), a heap walk on some
+ * targets) is queried only when the accounted usage has grown by
+ * LX_MEMGUARD_POLL_BYTES since the last query, or when the last answer
+ * minus that growth comes close to the reserve.
+ */
+#include "memguard.h"
+#include "config.h"
+#include "lx_error.h"
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef LX_MEMGUARD_POLL_BYTES
+#define LX_MEMGUARD_POLL_BYTES 65536
+#endif
+
+/* Block header of lx_mem_alloc(); the union keeps the payload aligned
+ * for any value the runtime stores. */
+typedef union {
+    size_t size;
+    long long ll;
+    double d;
+    void *p;
+} MemHeader;
+
+static size_t g_mem_reserve = 0;
+static size_t g_mem_limit = 0;
+static size_t g_mem_usage = 0;
+static size_t g_mem_peak = 0;
+static size_t g_mem_heap_free = 0;  /* last lx_platform_free_heap() answer */
+static size_t g_mem_heap_usage = 0; /* g_mem_usage when it was taken */
+static int g_mem_heap_polled = 0;
+
+__attribute__((weak)) size_t lx_platform_free_heap(void) {
+    return (size_t)-1;
+}
+
+void lx_set_mem_reserve(size_t bytes) {
+    g_mem_reserve = bytes;
+    g_mem_heap_polled = 0;
+}
+
+size_t lx_get_mem_reserve(void) {
+    return g_mem_reserve;
+}
+
+void lx_set_memory_limit(size_t bytes) {
+    g_mem_limit = bytes;
+}
+
+size_t lx_get_memory_limit(void) {
+    return g_mem_limit;
+}
+
+int lx_parse_mem_size(const char *s, size_t *out) {
+    if (!s || !out) return 0;
+    if (!strcmp(s, "-1")) {
+        *out = 0;
+        return 1;
+    }
+    if (!isdigit((unsigned char)*s)) return 0;
+    char *end = NULL;
+    unsigned long long n = strtoull(s, &end, 10);
+    unsigned long long unit = 1;
+    switch (*end) {
+        case 'k': case 'K': unit = 1024ull; end++; break;
+        case 'm': case 'M': unit = 1024ull * 1024; end++; break;
+        case 'g': case 'G': unit = 1024ull * 1024 * 1024; end++; break;
+        default: break;
+    }
+    if (*end || n > (unsigned long long)(size_t)-1 / unit) return 0;
+    *out = (size_t)(n * unit);
+    return 1;
+}
+
+/* ---------- accounting ---------- */
+
+size_t lx_mem_usage(void) {
+    return g_mem_usage;
+}
+
+size_t lx_mem_peak_usage(void) {
+    return g_mem_peak;
+}
+
+void lx_mem_charge(size_t bytes) {
+    g_mem_usage += bytes;
+    if (g_mem_usage > g_mem_peak) g_mem_peak = g_mem_usage;
+}
+
+void lx_mem_uncharge(size_t bytes) {
+    g_mem_usage = bytes < g_mem_usage ? g_mem_usage - bytes : 0;
+}
+
+void *lx_mem_alloc(size_t n) {
+    MemHeader *h = (MemHeader *)malloc(sizeof(MemHeader) + n);
+    if (!h) return NULL;
+    h->size = n;
+    lx_mem_charge(sizeof(MemHeader) + n);
+    return h + 1;
+}
+
+void *lx_mem_realloc(void *p, size_t n) {
+    if (!p) return lx_mem_alloc(n);
+    MemHeader *h = (MemHeader *)p - 1;
+    size_t old = h->size;
+    MemHeader *nh = (MemHeader *)realloc(h, sizeof(MemHeader) + n);
+    if (!nh) return NULL;
+    nh->size = n;
+    lx_mem_uncharge(old);
+    lx_mem_charge(n);
+    return nh + 1;
+}
+
+void lx_mem_free(void *p) {
+    if (!p) return;
+    MemHeader *h = (MemHeader *)p - 1;
+    lx_mem_uncharge(sizeof(MemHeader) + h->size);
+    free(h);
+}
+
+/* ---------- guard ---------- */
+
+/* Check the platform heap, reusing the last answer while the usage grew
+ * by less than LX_MEMGUARD_POLL_BYTES and the estimate stays clear of
+ * the reserve. */
+static int memguard_heap_check(size_t want_bytes) {
+    size_t grown = g_mem_usage > g_mem_heap_usage ? g_mem_usage - g_mem_heap_usage : 0;
+    if (g_mem_heap_polled && g_mem_heap_free == (size_t)-1) return 1;
+    if (!g_mem_heap_polled || grown >= LX_MEMGUARD_POLL_BYTES ||
+        g_mem_heap_free <= grown + g_mem_reserve + want_bytes + LX_MEMGUARD_POLL_BYTES) {
+        g_mem_heap_free = lx_platform_free_heap();
+        g_mem_heap_usage = g_mem_usage;
+        g_mem_heap_polled = 1;
+        grown = 0;
+        if (g_mem_heap_free == (size_t)-1) return 1;
+    }
+    if (g_mem_heap_free <= grown + g_mem_reserve + want_bytes) {
+        lx_set_error(LX_ERR_INTERNAL, 0, 0, "out of memory");
+        return 0;
+    }
+    return 1;
+}
+
+int lx_memguard_check(size_t want_bytes) {
+    if (g_mem_limit && (g_mem_usage > g_mem_limit || want_bytes > g_mem_limit - g_mem_usage)) {
+        lx_set_error(LX_ERR_MEMORY_LIMIT, 0, 0,
+                     "allowed memory size of %zu bytes exhausted (tried to allocate %zu bytes)",
+                     g_mem_limit, want_bytes);
+        return 0;
+    }
+    return memguard_heap_check(want_bytes);
+}
@@ -14,8 +14,44 @@ extern "C" {
 size_t lx_platform_free_heap(void);
 void lx_set_mem_reserve(size_t bytes);
 size_t lx_get_mem_reserve(void);
+/**
+ * @return Non-zero if @p want_bytes more may be allocated. Fails with
+ * LX_ERR_MEMORY_LIMIT past the memory limit, or with "out of memory" when
+ * the platform heap would drop below the reserve. The heap is only queried
+ * again after LX_MEMGUARD_POLL_BYTES of growth or near the reserve.
+ */
 int lx_memguard_check(size_t want_bytes);
 
+/** Set the memory limit in bytes (0 = unlimited). */
+void lx_set_memory_limit(size_t bytes);
+/** @return The memory limit in bytes (0 = unlimited). */
+size_t lx_get_memory_limit(void);
+/**
+ * Parse a size such as "64M": digits with an optional K, M or G suffix.
+ * "-1" means unlimited and is stored as 0. @return 0 if @p s is malformed.
+ */
+int lx_parse_mem_size(const char *s, size_t *out);
+
+/** @return Bytes currently accounted to the interpreter. */
+size_t lx_mem_usage(void);
+/** @return Largest value of lx_mem_usage() so far. */
+size_t lx_mem_peak_usage(void);
+/** Account @p bytes taken from the heap by an allocator of the value layer. */
+void lx_mem_charge(size_t bytes);
+/** Account @p bytes returned to the heap (see lx_mem_charge()). */
+void lx_mem_uncharge(size_t bytes);
+
+/**
+ * Accounted malloc: the block remembers its size so lx_mem_free() can
+ * uncharge it. Blocks must be resized with lx_mem_realloc() and freed
+ * with lx_mem_free(), never with the C library.
+ */
+void *lx_mem_alloc(size_t n);
+/** Resize a block from lx_mem_alloc() (NULL allocates). */
+void *lx_mem_realloc(void *p, size_t n);
+/** Free a block from lx_mem_alloc() (NULL is ignored). */
+void lx_mem_free(void *p);
+
 #ifdef __cplusplus
 }
 #endif
@@ -5,6 +5,10 @@
 #include "natives.h"
 #include "env.h"
 #include "gc.h"
+#include "pool.h"
+#include "region.h"
+#include "memguard.h"
+#include "heapprof.h"
 #include "array.h"
 #include "lx_ext.h"
 #include "lx_error.h"
@@ -20,17 +24,13 @@
 #include <string.h>
 #include <stdio.h>
 #include <math.h>
+#include <limits.h>
 #include <time.h>
 #include <ctype.h>
 #include <stdint.h>
 #include <stdarg.h>
 
-typedef struct {
-    char *name;
-    NativeFn fn;
-} NativeEntry;
-
-static NativeEntry *g_fns = NULL;
+static NativeDef *g_fns = NULL;
 static int g_count = 0;
 static int g_cap = 0;
 static FILE *g_output = NULL;
@@ -65,7 +65,7 @@ static void ensure(int need){
     if (g_cap >= need) return;
     int cap = g_cap ? g_cap : 32;
     while (cap < need) cap *= 2;
-    NativeEntry *ne = (NativeEntry*)realloc(g_fns, cap*sizeof(NativeEntry));
+    NativeDef *ne = (NativeDef*)realloc(g_fns, cap*sizeof(NativeDef));
     if (!ne) return;
     g_fns = ne; g_cap = cap;
 }
@@ -82,26 +82,209 @@ void lx_set_output_cb(LxOutputFn fn) {
     g_output_cb = fn;
 }
 
-void register_function(const char *name, NativeFn fn){
+static unsigned g_generation = 1;
+
+/* @return The entry named @p name, appended (zeroed) if missing. */
+static NativeDef *entry_for(const char *name){
     for (int i=0;i<g_count;i++){
-        if (strcmp(g_fns[i].name, name)==0){
-            g_fns[i].fn = fn;
-            return;
-        }
+        if (strcmp(g_fns[i].name, name)==0) return &g_fns[i];
     }
     ensure(g_count+1);
-    g_fns[g_count].name = strdup(name);
-    g_fns[g_count].fn = fn;
+    if (g_cap < g_count+1) return NULL;
+    NativeDef *d = &g_fns[g_count];
+    memset(d, 0, sizeof(*d));
+    d->name = strdup(name);
     g_count++;
+    return d;
+}
+
+void register_function(const char *name, NativeFn fn){
+    g_generation++;
+    NativeDef *d = entry_for(name);
+    if (!d) return;
+    d->fn = fn;
+    d->typed = NULL;
+    d->sig[0] = '\0';
+}
+
+int register_typed_function(const char *name, LxTypedFn fn, const char *sig){
+    char letters[LX_NATIVE_MAX_ARGS + 1];
+    int n = 0, min = -1;
+    for (const char *p = sig ? sig : ""; *p; p++) {
+        if (*p == '|') {
+            if (min >= 0) return 0;
+            min = n;
+            continue;
+        }
+        if (!strchr("idsbavDS", *p) || n == LX_NATIVE_MAX_ARGS) return 0;
+        letters[n++] = *p;
+    }
+    letters[n] = '\0';
+
+    g_generation++;
+    NativeDef *d = entry_for(name);
+    if (!d) return 0;
+    d->fn = NULL;
+    d->typed = fn;
+    memcpy(d->sig, letters, (size_t)n + 1);
+    d->min_args = min >= 0 ? min : n;
+    d->max_args = n;
+    d->lenient = n > 0 && strspn(letters, "DS") == (size_t)n;
+    return 1;
 }
 
 NativeFn find_function(const char *name){
+    const NativeDef *d = find_native(name);
+    return d ? d->fn : NULL;
+}
+
+const NativeDef *find_native(const char *name){
     for (int i=0;i<g_count;i++){
-        if (strcmp(g_fns[i].name, name)==0) return g_fns[i].fn;
+        if (strcmp(g_fns[i].name, name)==0) return &g_fns[i];
+    }
+    return NULL;
+}
+
+typedef struct {
+    char *name;
+    Value value;
+} ConstEntry;
+
+static ConstEntry *g_consts = NULL;
+static int g_const_count = 0;
+static int g_const_cap = 0;
+
+int define_constant(const char *name, Value v){
+    int scalar = v.type == VAL_NULL || v.type == VAL_BOOL || v.type == VAL_INT ||
+                 v.type == VAL_FLOAT || v.type == VAL_BYTE || v.type == VAL_STRING;
+    if (!name || !scalar || find_constant(name)) {
+        value_free(v);
+        return 0;
+    }
+    v = value_export(v);
+    if (g_const_count == g_const_cap) {
+        int cap = g_const_cap ? g_const_cap * 2 : 16;
+        ConstEntry *ne = (ConstEntry *)realloc(g_consts, (size_t)cap * sizeof(ConstEntry));
+        if (!ne) { value_free(v); return 0; }
+        g_consts = ne;
+        g_const_cap = cap;
+    }
+    g_consts[g_const_count].name = strdup(name);
+    g_consts[g_const_count].value = v;
+    g_const_count++;
+    return 1;
+}
+
+const Value *find_constant(const char *name){
+    for (int i = 0; i < g_const_count; i++) {
+        if (strcmp(g_consts[i].name, name) == 0) return &g_consts[i].value;
     }
     return NULL;
 }
 
+static const char *sig_type_name(char c){
+    switch (c) {
+        case 'i': return "int";
+        case 'd': return "float";
+        case 's': return "string";
+        case 'b': return "blob";
+        case 'a': return "array";
+        default:  return "mixed";
+    }
+}
+
+/* Convert @p v for parameter letter @p c into @p out. Strings made from
+ * other scalars are stored in @p tmp for the caller to free.
+ * @return 0 if @p v cannot be passed as @p c. */
+static int typed_arg(char c, Value v, LxArg *out, Value *tmp){
+    int scalar = v.type != VAL_ARRAY && v.type != VAL_BLOB;
+    switch (c) {
+        case 'i':
+            out->i = value_as_int(v);
+            return scalar;
+        case 'd':
+            out->d = value_as_double(v);
+            return scalar;
+        case 'D':
+            out->d = value_as_double(v);
+            return 1;
+        case 's':
+            if (!scalar) return 0;
+            if (v.type != VAL_STRING) {
+                *tmp = value_to_string(v);
+                v = *tmp;
+            }
+            out->str.s = v.s ? v.s : "";
+            out->str.len = strlen(out->str.s);
+            return 1;
+        case 'S':
+            if (v.type != VAL_STRING) {
+                *tmp = value_to_string(v);
+                v = *tmp;
+            }
+            out->str.s = v.s ? v.s : "";
+            out->str.len = strlen(out->str.s);
+            return 1;
+        case 'b':
+            if (v.type == VAL_BLOB) {
+                out->blob.data = v.blob ? v.blob->data : NULL;
+                out->blob.len = v.blob ? v.blob->len : 0;
+                return 1;
+            }
+            if (v.type != VAL_STRING) return 0;
+            out->blob.data = (const unsigned char *)(v.s ? v.s : "");
+            out->blob.len = strlen((const char *)out->blob.data);
+            return 1;
+        case 'a':
+            out->a = v.a;
+            return v.type == VAL_ARRAY;
+        default:
+            out->v = v;
+            return 1;
+    }
+}
+
+Value native_call(const NativeDef *def, Env *env, int argc, Value *argv,
+                  int line, int col, int *ok_flag){
+    if (!def->typed) return def->fn(env, argc, argv);
+
+    if (!def->lenient && (argc < def->min_args || argc > def->max_args)) {
+        if (def->min_args == def->max_args) {
+            lx_set_error(LX_ERR_TYPE, line, col, "%s(): expects %d argument%s, %d given",
+                         def->name, def->max_args, def->max_args == 1 ? "" : "s", argc);
+        } else {
+            lx_set_error(LX_ERR_TYPE, line, col, "%s(): expects %d to %d arguments, %d given",
+                         def->name, def->min_args, def->max_args, argc);
+        }
+        *ok_flag = 0;
+        return value_null();
+    }
+
+    LxArg args[LX_NATIVE_MAX_ARGS];
+    Value tmp[LX_NATIVE_MAX_ARGS];
+    /* a lenient native may get more arguments than letters; it checks argc */
+    int n = argc < def->max_args ? argc : def->max_args;
+    int i;
+    for (i = 0; i < n; i++) {
+        tmp[i] = value_null();
+        if (!typed_arg(def->sig[i], argv[i], &args[i], &tmp[i])) {
+            lx_set_error(LX_ERR_TYPE, line, col, "%s(): argument %d must be %s, %s given",
+                         def->name, i + 1, sig_type_name(def->sig[i]), value_type_name(argv[i]));
+            *ok_flag = 0;
+            break;
+        }
+    }
+    Value r = value_null();
+    if (i == n) r = def->typed(env, argc, args);
+    else i++;
+    while (i-- > 0) value_free(tmp[i]);
+    return r;
+}
+
+unsigned natives_generation(void){
+    return g_generation;
+}
+
 static Value n_print(Env *env, int argc, Value *argv){
     (void)env;
     FILE *out = g_output ? g_output : stdout;
@@ -492,13 +675,10 @@ static Value n_print_r(Env *env, int argc, Value *argv){
     return value_void();
 }
 
-static Value n_strlen(Env *env, int argc, Value *argv){
+static Value n_strlen(Env *env, int argc, const LxArg *args){
     (void)env;
     if (argc != 1) return value_int(0);
-    Value sv = value_to_string(argv[0]);
-    int len = sv.s ? (int)strlen(sv.s) : 0;
-    value_free(sv);
-    return value_int(len);
+    return value_int((lx_int_t)args[0].str.len);
 }
 
 static Value n_blob_size(Env *env, int argc, Value *argv){
@@ -831,31 +1011,20 @@ static int is_trim_space(int c) {
 }
 
 static void key_free_local(Key k) {
-    if (k.type == KEY_STRING) free(k.s);
+    key_free(k);
 }
 
 static Key key_copy_local(Key k) {
     Key out;
     out.type = k.type;
     if (k.type == KEY_STRING) {
-        out.s = strdup(k.s ? k.s : "");
+        out.s = lx_region_strdup(k.s ? k.s : "");
     } else {
         out.i = k.i;
     }
     return out;
 }
 
-lx_int_t array_next_index(Array *a) {
-    lx_int_t next = 0;
-    if (!a) return 0;
-    for (size_t i = 0; i < a->size; i++) {
-        if (a->entries[i].key.type == KEY_INT && a->entries[i].key.i >= next) {
-            next = a->entries[i].key.i + 1;
-        }
-    }
-    return next;
-}
-
 static void reindex_numeric_keys(Array *a) {
     if (!a) return;
     lx_int_t next = 0;
@@ -864,6 +1033,7 @@ static void reindex_numeric_keys(Array *a) {
             a->entries[i].key.i = next++;
         }
     }
+    a->next_index = next;
 }
 
 #if LX_ENABLE_INCLUDE
@@ -958,7 +1128,12 @@ static Value run_include(Env *env, const char *path) {
         return value_bool(0);
     }
 
+    /* Heap profile sites of the included code name its file. */
+    const char *hp_file = lx_heapprof_set_file(resolved);
+    const struct AstNode *hp_node = lx_heapprof_node;
     EvalResult r = eval_program(program, env);
+    lx_heapprof_set_file(hp_file);
+    lx_heapprof_node = hp_node;
     value_free(r.value);
     ast_free(program);
     free(source);
@@ -1075,69 +1250,64 @@ static Value n_ceil(Env *env, int argc, Value *argv){
     return value_float(ceil(v));
 }
 
-static Value n_sqrt(Env *env, int argc, Value *argv){
+static Value n_sqrt(Env *env, int argc, const LxArg *args){
     (void)env;
     if (argc != 1) return value_float(0.0);
-    double v = value_as_double(argv[0]);
-    return value_float(sqrt(v));
+    return value_float(sqrt(args[0].d));
 }
 
-static Value n_exp(Env *env, int argc, Value *argv){
+static Value n_exp(Env *env, int argc, const LxArg *args){
     (void)env;
     if (argc != 1) return value_float(0.0);
-    double v = value_as_double(argv[0]);
-    return value_float(exp(v));
+    return value_float(exp(args[0].d));
 }
 
-static Value n_log(Env *env, int argc, Value *argv){
+static Value n_log(Env *env, int argc, const LxArg *args){
     (void)env;
     if (argc != 1) return value_float(0.0);
-    double v = value_as_double(argv[0]);
-    return value_float(log(v));
+    return value_float(log(args[0].d));
 }
 
-static Value n_sin(Env *env, int argc, Value *argv){
+static Value n_sin(Env *env, int argc, const LxArg *args){
     (void)env;
     if (argc != 1) return value_float(0.0);
-    return value_float(sin(value_as_double(argv[0])));
+    return value_float(sin(args[0].d));
 }
 
-static Value n_cos(Env *env, int argc, Value *argv){
+static Value n_cos(Env *env, int argc, const LxArg *args){
     (void)env;
     if (argc != 1) return value_float(0.0);
-    return value_float(cos(value_as_double(argv[0])));
+    return value_float(cos(args[0].d));
 }
 
-static Value n_tan(Env *env, int argc, Value *argv){
+static Value n_tan(Env *env, int argc, const LxArg *args){
     (void)env;
     if (argc != 1) return value_float(0.0);
-    return value_float(tan(value_as_double(argv[0])));
+    return value_float(tan(args[0].d));
 }
 
-static Value n_asin(Env *env, int argc, Value *argv){
+static Value n_asin(Env *env, int argc, const LxArg *args){
     (void)env;
     if (argc != 1) return value_float(0.0);
-    return value_float(asin(value_as_double(argv[0])));
+    return value_float(asin(args[0].d));
 }
 
-static Value n_acos(Env *env, int argc, Value *argv){
+static Value n_acos(Env *env, int argc, const LxArg *args){
     (void)env;
     if (argc != 1) return value_float(0.0);
-    return value_float(acos(value_as_double(argv[0])));
+    return value_float(acos(args[0].d));
 }
 
-static Value n_atan(Env *env, int argc, Value *argv){
+static Value n_atan(Env *env, int argc, const LxArg *args){
     (void)env;
     if (argc != 1) return value_float(0.0);
-    return value_float(atan(value_as_double(argv[0])));
+    return value_float(atan(args[0].d));
 }
 
-static Value n_atan2(Env *env, int argc, Value *argv){
+static Value n_atan2(Env *env, int argc, const LxArg *args){
     (void)env;
     if (argc != 2) return value_float(0.0);
-    double y = value_as_double(argv[0]);
-    double x = value_as_double(argv[1]);
-    return value_float(atan2(y, x));
+    return value_float(atan2(args[0].d, args[1].d));
 }
 
 static Value n_rand(Env *env, int argc, Value *argv){
@@ -1208,18 +1378,16 @@ static Value n_sign(Env *env, int argc, Value *argv){
     return value_int(0);
 }
 
-static Value n_deg2rad(Env *env, int argc, Value *argv){
+static Value n_deg2rad(Env *env, int argc, const LxArg *args){
     (void)env;
     if (argc != 1) return value_float(0.0);
-    double v = value_as_double(argv[0]);
-    return value_float(v * (3.14159265358979323846 / 180.0));
+    return value_float(args[0].d * (3.14159265358979323846 / 180.0));
 }
 
-static Value n_rad2deg(Env *env, int argc, Value *argv){
+static Value n_rad2deg(Env *env, int argc, const LxArg *args){
     (void)env;
     if (argc != 1) return value_float(0.0);
-    double v = value_as_double(argv[0]);
-    return value_float(v * (180.0 / 3.14159265358979323846));
+    return value_float(args[0].d * (180.0 / 3.14159265358979323846));
 }
 
 static Value n_key_exists(Env *env, int argc, Value *argv){
@@ -1289,10 +1457,12 @@ static Value n_pop(Env *env, int argc, Value *argv){
     (void)env;
     if (argc != 1 || argv[0].type != VAL_ARRAY || !argv[0].a) return value_undefined();
     Array *a = argv[0].a;
+    array_own(a);
     if (a->size == 0) return value_undefined();
     Value out = a->entries[a->size - 1].value;
     key_free_local(a->entries[a->size - 1].key);
     a->size--;
+    array_keys_changed(a);
     return out;
 }
 
@@ -1308,6 +1478,7 @@ static Value n_shift(Env *env, int argc, Value *argv){
     (void)env;
     if (argc != 1 || argv[0].type != VAL_ARRAY || !argv[0].a) return value_undefined();
     Array *a = argv[0].a;
+    array_own(a);
     if (a->size == 0) return value_undefined();
     Value out = a->entries[0].value;
     key_free_local(a->entries[0].key);
@@ -1323,11 +1494,13 @@ static Value n_unshift(Env *env, int argc, Value *argv){
     (void)env;
     if (argc != 2 || argv[0].type != VAL_ARRAY || !argv[0].a) return value_int(0);
     Array *a = argv[0].a;
+    array_own(a);
     if (a->capacity < a->size + 1) {
         size_t cap = a->capacity ? a->capacity : 8;
         while (cap < a->size + 1) cap *= 2;
-        ArrayEntry *ne = (ArrayEntry*)realloc(a->entries, cap * sizeof(ArrayEntry));
+        ArrayEntry *ne = (ArrayEntry*)lx_region_realloc(a->entries, cap * sizeof(ArrayEntry));
         if (!ne) return value_int((lx_int_t)a->size);
+        LX_HEAPPROF_ALLOC(LX_HEAP_ARRAY, a, (cap - a->capacity) * sizeof(ArrayEntry));
         a->entries = ne;
         a->capacity = cap;
     }
@@ -1399,6 +1572,7 @@ static Value n_splice(Env *env, int argc, Value *argv){
     Value removed = value_array();
     if (argc < 2 || argv[0].type != VAL_ARRAY || !argv[0].a) return removed;
     Array *a = argv[0].a;
+    array_own(a);
     size_t count = a->size;
     lx_int_t start = value_to_int(argv[1]).i;
     lx_int_t len = (argc >= 3) ? value_to_int(argv[2]).i : ((lx_int_t)count - start);
@@ -1444,12 +1618,13 @@ static Value n_splice(Env *env, int argc, Value *argv){
         key_free_local(a->entries[i].key);
         value_free(a->entries[i].value);
     }
-    free(a->entries);
+    lx_region_free(a->entries);
     a->entries = temp.a->entries;
     a->size = temp.a->size;
     a->capacity = temp.a->capacity;
+    a->next_index = temp.a->next_index;
     gc_unregister_array(temp.a);
-    free(temp.a);
+    lx_pool_free(temp.a, sizeof(Array));
     return removed;
 }
 
@@ -1582,6 +1757,7 @@ static Value n_sort_common(Env *env, int argc, Value *argv, int by_key, int desc
     (void)env;
     if (argc != 1 || argv[0].type != VAL_ARRAY || !argv[0].a) return value_bool(0);
     Array *a = argv[0].a;
+    array_own(a);
     size_t count = a->size;
     if (count <= 1) return value_bool(1);
 
@@ -1600,10 +1776,11 @@ static Value n_sort_common(Env *env, int argc, Value *argv, int by_key, int desc
         key_free_local(a->entries[i].key);
         value_free(a->entries[i].value);
     }
-    free(a->entries);
+    lx_region_free(a->entries);
     a->entries = NULL;
     a->size = 0;
     a->capacity = 0;
+    a->next_index = 0;
 
     for (size_t i = 0; i < count; i++) {
         Key k;
@@ -1715,7 +1892,8 @@ static Value n_multisort(Env *env, int argc, Value *argv){
 
     for (int s = 0; s < spec_count; s++) {
         Array *a = specs[s].arr;
-        ArrayEntry *entries = (ArrayEntry *)calloc(count, sizeof(ArrayEntry));
+        array_own(a);
+        ArrayEntry *entries = (ArrayEntry *)lx_region_calloc(count * sizeof(ArrayEntry));
         if (!entries) { free(indices); free(specs); return value_bool(0); }
         for (size_t k = 0; k < count; k++) {
             entries[k].key = key_int((lx_int_t)k);
@@ -1725,10 +1903,11 @@ static Value n_multisort(Env *env, int argc, Value *argv){
             key_free_local(a->entries[k].key);
             value_free(a->entries[k].value);
         }
-        free(a->entries);
+        lx_region_free(a->entries);
         a->entries = entries;
         a->size = count;
         a->capacity = count;
+        a->next_index = (lx_int_t)count;
     }
 
     free(indices);
@@ -2116,22 +2295,111 @@ static Value n_lx_info(Env *env, int argc, Value *argv){
     return out;
 }
 
+static Value n_pool_stats(Env *env, int argc, Value *argv){
+    (void)env;
+    (void)argc;
+    (void)argv;
+    LxPoolStats st;
+    lx_pool_stats(&st);
+    Value out = value_array();
+    if (!out.a) return value_null();
+    array_set(out.a, key_string("allocs"), value_int((lx_int_t)st.allocs));
+    array_set(out.a, key_string("hits"), value_int((lx_int_t)st.hits));
+    array_set(out.a, key_string("frees"), value_int((lx_int_t)st.frees));
+    array_set(out.a, key_string("fallback"), value_int((lx_int_t)st.fallback));
+    array_set(out.a, key_string("chunks"), value_int((lx_int_t)st.chunks));
+    array_set(out.a, key_string("chunk_bytes"), value_int((lx_int_t)st.chunk_bytes));
+    array_set(out.a, key_string("hit_rate"),
+              value_float(st.allocs ? (double)st.hits / (double)st.allocs : 0.0));
+    return out;
+}
+
+static Value n_memory_get_usage(Env *env, int argc, Value *argv){
+    (void)env;
+    (void)argc;
+    (void)argv;
+    return value_int((lx_int_t)lx_mem_usage());
+}
+
+static Value n_memory_get_peak_usage(Env *env, int argc, Value *argv){
+    (void)env;
+    (void)argc;
+    (void)argv;
+    return value_int((lx_int_t)lx_mem_peak_usage());
+}
+
+static Value n_gc_stats(Env *env, int argc, Value *argv){
+    (void)env;
+    (void)argc;
+    (void)argv;
+    GcStats st;
+    gc_stats(&st);
+    Value out = value_array();
+    if (!out.a) return value_null();
+    array_set(out.a, key_string("mode"), value_string(gc_mode() == GC_MODE_TRACE ? "trace" : "cycles"));
+    array_set(out.a, key_string("collections"), value_int((lx_int_t)st.collections));
+    array_set(out.a, key_string("pause_total_ms"), value_float(st.pause_total_ms));
+    array_set(out.a, key_string("pause_max_ms"), value_float(st.pause_max_ms));
+    array_set(out.a, key_string("pause_last_ms"), value_float(st.pause_last_ms));
+    array_set(out.a, key_string("arrays_freed"), value_int((lx_int_t)st.arrays_freed));
+    array_set(out.a, key_string("bytes_freed"), value_int((lx_int_t)st.bytes_freed));
+    array_set(out.a, key_string("live_arrays"), value_int((lx_int_t)st.live_arrays));
+    array_set(out.a, key_string("candidates"), value_int((lx_int_t)st.candidates));
+    array_set(out.a, key_string("threshold"), value_int((lx_int_t)st.threshold));
+    array_set(out.a, key_string("parallel_marks"), value_int((lx_int_t)st.parallel_marks));
+    return out;
+}
+
+static Value gc_tuning_value(const GcTuning *t){
+    Value out = value_array();
+    if (!out.a) return value_null();
+    array_set(out.a, key_string("enabled"), value_bool(t->enabled));
+    array_set(out.a, key_string("threshold"), value_int((lx_int_t)t->threshold));
+    array_set(out.a, key_string("growth"), value_float(t->growth));
+    array_set(out.a, key_string("pause_budget_ms"), value_float(t->pause_budget_ms));
+    array_set(out.a, key_string("mark_threads"), value_int((lx_int_t)t->mark_threads));
+    array_set(out.a, key_string("parallel_mark_arrays"), value_int((lx_int_t)t->parallel_mark_arrays));
+    return out;
+}
+
+/* gc_tune([settings]): apply the given settings and return the previous
+ * ones; false (and nothing applied) on an unknown key or a bad value. */
+static Value n_gc_tune(Env *env, int argc, Value *argv){
+    (void)env;
+    GcTuning old;
+    gc_get_tuning(&old);
+    if (argc == 0) return gc_tuning_value(&old);
+    if (argc != 1 || argv[0].type != VAL_ARRAY || !argv[0].a) return value_bool(0);
+    GcTuning t = old;
+    Array *a = argv[0].a;
+    for (size_t i = 0; i < a->size; i++) {
+        Key k = a->entries[i].key;
+        Value v = a->entries[i].value;
+        if (k.type != KEY_STRING) return value_bool(0);
+        if (!strcmp(k.s, "enabled") && (v.type == VAL_BOOL || v.type == VAL_INT)) {
+            t.enabled = value_is_true(v);
+        } else if (!strcmp(k.s, "threshold") && v.type == VAL_INT && v.i >= 1 && v.i <= INT_MAX / 2) {
+            t.threshold = (int)v.i;
+        } else if (!strcmp(k.s, "growth") && (v.type == VAL_INT || v.type == VAL_FLOAT) && value_as_double(v) >= 1.0) {
+            t.growth = value_as_double(v);
+        } else if (!strcmp(k.s, "pause_budget_ms") && (v.type == VAL_INT || v.type == VAL_FLOAT) && value_as_double(v) >= 0.0) {
+            t.pause_budget_ms = value_as_double(v);
+        } else if (!strcmp(k.s, "mark_threads") && v.type == VAL_INT && v.i >= 1 && v.i <= 64) {
+            t.mark_threads = (int)v.i;
+        } else if (!strcmp(k.s, "parallel_mark_arrays") && v.type == VAL_INT && v.i >= 1 && v.i <= INT_MAX / 2) {
+            t.parallel_mark_arrays = (int)v.i;
+        } else {
+            return value_bool(0);
+        }
+    }
+    gc_set_tuning(&t);
+    return gc_tuning_value(&old);
+}
+
 static Value n_get_type(Env *env, int argc, Value *argv){
     (void)env;
     if (argc != 1) return value_string("undefined");
-    switch (argv[0].type){
-        case VAL_UNDEFINED: return value_string("undefined");
-        case VAL_VOID:      return value_string("void");
-        case VAL_NULL:      return value_string("null");
-        case VAL_BOOL:      return value_string("bool");
-        case VAL_INT:       return value_string("int");
-        case VAL_FLOAT:     return value_string("float");
-        case VAL_BYTE:      return value_string("byte");
-        case VAL_STRING:    return value_string("string");
-        case VAL_BLOB:      return value_string("blob");
-        case VAL_ARRAY:     return value_string("array");
-        default:            return value_string("undefined");
-    }
+    return value_string(value_type_name(argv[0]));
 }
 
 static Value make_is(ValueType t, int argc, Value *argv){
@@ -2656,7 +2924,7 @@ void install_stdlib(void){
     register_function("round",   n_round);
     register_function("floor",   n_floor);
     register_function("ceil",    n_ceil);
-    register_function("strlen",  n_strlen);
+    register_typed_function("strlen", n_strlen, "S");
     register_function("blob_size",  n_blob_size);
     register_function("base64_encode", n_base64_encode);
     register_function("base64_decode", n_base64_decode);
@@ -2686,6 +2954,11 @@ void install_stdlib(void){
     register_function("starts_with", n_starts_with);
     register_function("ends_with", n_ends_with);
     register_function("lxinfo", n_lx_info);
+    register_function("pool_stats", n_pool_stats);
+    register_function("memory_get_usage", n_memory_get_usage);
+    register_function("memory_get_peak_usage", n_memory_get_peak_usage);
+    register_function("gc_stats", n_gc_stats);
+    register_function("gc_tune", n_gc_tune);
     register_function("type",n_get_type);
 
     register_function("is_null",   n_is_null);
@@ -2700,23 +2973,23 @@ void install_stdlib(void){
     register_function("is_void",      n_is_void);
 
     register_function("pow", n_pow);
-    register_function("sqrt", n_sqrt);
-    register_function("exp", n_exp);
-    register_function("log", n_log);
-    register_function("sin", n_sin);
-    register_function("cos", n_cos);
-    register_function("tan", n_tan);
-    register_function("asin", n_asin);
-    register_function("acos", n_acos);
-    register_function("atan", n_atan);
-    register_function("atan2", n_atan2);
+    register_typed_function("sqrt", n_sqrt, "D");
+    register_typed_function("exp", n_exp, "D");
+    register_typed_function("log", n_log, "D");
+    register_typed_function("sin", n_sin, "D");
+    register_typed_function("cos", n_cos, "D");
+    register_typed_function("tan", n_tan, "D");
+    register_typed_function("asin", n_asin, "D");
+    register_typed_function("acos", n_acos, "D");
+    register_typed_function("atan", n_atan, "D");
+    register_typed_function("atan2", n_atan2, "DD");
     register_function("rand", n_rand);
     register_function("srand", n_srand);
     register_function("clamp", n_clamp);
     register_function("pi", n_pi);
     register_function("sign", n_sign);
-    register_function("deg2rad", n_deg2rad);
-    register_function("rad2deg", n_rad2deg);
+    register_typed_function("deg2rad", n_deg2rad, "D");
+    register_typed_function("rad2deg", n_rad2deg, "D");
     register_function("ord", n_ord);
     register_function("chr", n_chr);
     register_function("sprintf", n_sprintf);
@@ -15,10 +15,85 @@
 typedef Value (*NativeFn)(Env *env, int argc, Value *argv);
 typedef void (*LxOutputFn)(const char *data, size_t len);
 
+/** Most parameters a typed native can declare. */
+#define LX_NATIVE_MAX_ARGS 8
+
+/**
+ * Argument passed to a typed native, already converted according to the
+ * parameter's signature letter. Views and borrowed values are only valid
+ * for the duration of the call.
+ */
+typedef union {
+    lx_int_t i;         /**< 'i': integer (scalars are converted). */
+    double d;           /**< 'd': float (scalars are converted); 'D': any value converted. */
+    struct {
+        const char *s;  /**< NUL-terminated bytes. */
+        size_t len;
+    } str;              /**< 's': string view (scalars are converted); 'S': any value converted. */
+    struct {
+        const unsigned char *data;
+        size_t len;
+    } blob;             /**< 'b': bytes of a blob or string. */
+    Array *a;           /**< 'a': borrowed array. */
+    Value v;            /**< 'v': borrowed value of any type. */
+} LxArg;
+
+/**
+ * Typed native signature. @p argc is the number of arguments given, which
+ * lies between the declared minimum and maximum arity. A lenient native
+ * (see register_typed_function()) gets any @p argc and checks it itself;
+ * only the first @c max_args entries of @p args are set.
+ */
+typedef Value (*LxTypedFn)(Env *env, int argc, const LxArg *args);
+
+/** Native registry entry. Exactly one of @c fn and @c typed is set. */
+typedef struct NativeDef {
+    char *name;
+    NativeFn fn;
+    LxTypedFn typed;
+    char sig[LX_NATIVE_MAX_ARGS + 1]; /**< Parameter letters of a typed native. */
+    int min_args;
+    int max_args;
+    int lenient;                      /**< Only lenient letters: arity is not checked. */
+} NativeDef;
+
 /** Register or replace a native function. */
 void     register_function(const char *name, NativeFn fn);
-/** Look up a native function by name. */
+/**
+ * Register or replace a typed native. @p sig has one letter per parameter
+ * (`i` int, `d` float, `s` string, `b` blob, `a` array, `v` any); the
+ * parameters after an optional `|` may be omitted, e.g. `"s|ii"`. The
+ * lenient letters `D` (float) and `S` (string) convert any value, arrays
+ * and blobs included, the way untyped natives do; a signature made of
+ * them only leaves the arity check to the native.
+ * @return 0 if @p sig is malformed (nothing is registered).
+ */
+int      register_typed_function(const char *name, LxTypedFn fn, const char *sig);
+/** Look up an untyped native function by name (NULL for typed natives). */
 NativeFn find_function(const char *name);
+/**
+ * Look up a native by name. The entry stays valid until the registry
+ * changes (see natives_generation()).
+ */
+const NativeDef *find_native(const char *name);
+/**
+ * Call @p def with @p argv (borrowed). For a typed native the arity and
+ * argument types are checked and converted first; a mismatch reports an
+ * LX_ERR_TYPE error at @p line:@p col and clears @p ok_flag.
+ */
+Value    native_call(const NativeDef *def, Env *env, int argc, Value *argv,
+                     int line, int col, int *ok_flag);
+/** @return Counter bumped whenever the registry changes (for call-site caches). */
+unsigned natives_generation(void);
+
+/**
+ * Define constant @p name as @p v (consumed). Constants hold scalars and
+ * cannot be redefined.
+ * @return 0 if @p name is already defined or @p v is not a scalar (@p v is freed).
+ */
+int      define_constant(const char *name, Value v);
+/** @return The value of constant @p name (borrowed), or NULL if undefined. */
+const Value *find_constant(const char *name);
 
 /** Override the output stream used by print/printf/var_dump/print_r. */
 void lx_set_output(FILE *f);
@@ -0,0 +1,347 @@
+/**
+ * @file optimize.c
+ * @brief AST optimization pass run between parsing and evaluation.
+ *
+ * The pass works bottom-up so that folded children expose new literal
+ * operands to their parents. Every fold reuses the evaluator's own helpers
+ * (eval_binary_values, eval_unary_value, the native implementations), so
+ * a folded expression produces exactly the value it would have produced at
+ * run time. Expressions that raise an error are left in place so the error
+ * is still reported when (and if) the code actually runs. Constant
+ * references become literals once their value is known.
+ */
+#include "optimize.h"
+#include "eval.h"
+#include "natives.h"
+#include "lx_error.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+/* Natives without side effects whose result depends only on their
+ * arguments; calls with literal arguments are evaluated once here. */
+static const char *const pure_natives[] = {
+    "abs", "min", "max", "round", "floor", "ceil", "pow", "sqrt",
+    "strlen", "substr", "trim", "ltrim", "rtrim", "ucfirst",
+    "strtolower", "strtoupper", "strpos", "strcmp", "ord", "chr",
+    NULL
+};
+
+static void optimize_slot(AstNode **slot, void *ctx);
+
+/* Constants declared by the top-level `const` statements visited so far.
+ * A top-level declaration runs before every statement that follows it, so
+ * references in those statements can take its value. */
+typedef struct {
+    const char *name;     /* borrowed from the declaration */
+    const AstNode *value; /* literal, borrowed from the declaration */
+} ScriptConst;
+
+static ScriptConst *g_script_consts = NULL;
+static int g_script_const_count = 0;
+
+static int is_literal(const AstNode *n) {
+    return n && n->type == AST_LITERAL &&
+           n->literal.token.type != TOK_ARRAY;
+}
+
+static int is_string_literal(const AstNode *n) {
+    return n && n->type == AST_LITERAL &&
+           n->literal.token.type == TOK_STRING;
+}
+
+static int is_pure_native(const char *name) {
+    for (int i = 0; pure_natives[i]; i++) {
+        if (strcmp(pure_natives[i], name) == 0) return 1;
+    }
+    return 0;
+}
+
+static AstNode *new_node(AstType type, const AstNode *at) {
+    AstNode *n = (AstNode *)calloc(1, sizeof(AstNode));
+    if (!n) return NULL;
+    n->type = type;
+    n->line = at->line;
+    n->col = at->col;
+    return n;
+}
+
+/* Build a literal node for @p v (consumed), or NULL when @p v has no
+ * literal form (arrays, blobs, bytes). */
+static AstNode *literal_from_value(Value v, const AstNode *at) {
+    Token t;
+    memset(&t, 0, sizeof(t));
+    t.line = at->line;
+    t.col = at->col;
+
+    switch (v.type) {
+        case VAL_INT:   t.type = TOK_INT; t.int_val = v.i; break;
+        case VAL_FLOAT: t.type = TOK_FLOAT; t.float_val = v.f; break;
+        case VAL_BOOL:  t.type = v.b ? TOK_TRUE : TOK_FALSE; break;
+        case VAL_NULL:  t.type = TOK_NULL; break;
+        case VAL_STRING:
+            t.type = TOK_STRING;
+            t.string_val = strdup(v.s ? v.s : "");
+            if (!t.string_val) { value_free(v); return NULL; }
+            break;
+        default:
+            value_free(v);
+            return NULL;
+    }
+    value_free(v);
+
+    AstNode *n = new_node(AST_LITERAL, at);
+    if (!n) {
+        if (t.type == TOK_STRING) free(t.string_val);
+        return NULL;
+    }
+    n->literal.token = t;
+    return n;
+}
+
+/* Replace *slot with @p repl (when non-NULL) and free the old subtree. */
+static void replace(AstNode **slot, AstNode *repl) {
+    if (!repl) return;
+    ast_free(*slot);
+    *slot = repl;
+}
+
+/* Replace *slot with one of its own children, detaching it first. */
+static void hoist(AstNode **slot, AstNode **child) {
+    AstNode *keep = *child;
+    *child = NULL;
+    ast_free(*slot);
+    *slot = keep;
+}
+
+/* Fold a computed value into *slot unless evaluation raised an error. */
+static void fold_value(AstNode **slot, Value v, int ok_flag) {
+    if (!ok_flag || lx_has_error()) {
+        lx_error_clear();
+        value_free(v);
+        return;
+    }
+    replace(slot, literal_from_value(v, *slot));
+}
+
+static int literal_truth(const AstNode *n) {
+    Value v = eval_literal(&n->literal.token);
+    int t = value_is_true(v);
+    value_free(v);
+    return t;
+}
+
+static AstNode *empty_block(const AstNode *at) {
+    return new_node(AST_BLOCK, at);
+}
+
+static void fold_binary(AstNode **slot) {
+    AstNode *n = *slot;
+    AstNode *l = n->binary.left;
+    AstNode *r = n->binary.right;
+    Operator op = n->binary.op;
+
+    if (op == OP_AND || op == OP_OR) {
+        /* The right operand is skipped whenever the left one decides. */
+        if (!is_literal(l)) return;
+        int lt = literal_truth(l);
+        if (op == OP_AND && !lt) {
+            replace(slot, literal_from_value(value_bool(0), n));
+        } else if (op == OP_OR && lt) {
+            replace(slot, literal_from_value(value_bool(1), n));
+        } else if (is_literal(r)) {
+            replace(slot, literal_from_value(value_bool(literal_truth(r)), n));
+        }
+        return;
+    }
+
+    if (is_literal(l) && is_literal(r)) {
+        int ok_flag = 1;
+        Value v = eval_binary_values(n, op,
+                                     eval_literal(&l->literal.token),
+                                     eval_literal(&r->literal.token),
+                                     &ok_flag);
+        fold_value(slot, v, ok_flag);
+        return;
+    }
+
+    /* (e . "a") . "b"  ->  e . "ab" */
+    if (op == OP_CONCAT && is_string_literal(r) &&
+        l->type == AST_BINARY && l->binary.op == OP_CONCAT &&
+        is_string_literal(l->binary.right)) {
+        AstNode *mid = l->binary.right;
+        int ok_flag = 1;
+        Value v = eval_binary_values(n, OP_CONCAT,
+                                     eval_literal(&mid->literal.token),
+                                     eval_literal(&r->literal.token),
+                                     &ok_flag);
+        if (!ok_flag || lx_has_error()) {
+            lx_error_clear();
+            value_free(v);
+            return;
+        }
+        AstNode *merged = literal_from_value(v, mid);
+        if (!merged) return;
+        n->binary.left = l->binary.left;
+        l->binary.left = NULL;
+        ast_free(l);
+        ast_free(r);
+        n->binary.right = merged;
+    }
+}
+
+static void fold_unary(AstNode **slot) {
+    AstNode *n = *slot;
+    if (!is_literal(n->unary.expr)) return;
+    int ok_flag = 1;
+    Value v = eval_unary_value(n->unary.op,
+                               eval_literal(&n->unary.expr->literal.token),
+                               &ok_flag);
+    fold_value(slot, v, ok_flag);
+}
+
+static void fold_call(AstNode **slot) {
+    AstNode *n = *slot;
+    Value argv[8];
+    int argc = n->call.argc;
+
+    if (!n->call.name || argc > (int)(sizeof(argv) / sizeof(argv[0]))) return;
+    if (!is_pure_native(n->call.name)) return;
+    const NativeDef *def = find_native(n->call.name);
+    if (!def) return;
+    for (int i = 0; i < argc; i++) {
+        if (!is_literal(n->call.args[i])) return;
+    }
+
+    for (int i = 0; i < argc; i++) {
+        argv[i] = eval_literal(&n->call.args[i]->literal.token);
+    }
+    int ok_flag = 1;
+    Value v = native_call(def, NULL, argc, argv, n->line, n->col, &ok_flag);
+    for (int i = 0; i < argc; i++) value_free(argv[i]);
+    fold_value(slot, v, ok_flag);
+}
+
+/* Replace a constant reference by its value: registered constants first
+ * (a script declaration of the same name fails at run time), then the
+ * script's own top-level declarations. */
+static void fold_const(AstNode **slot) {
+    AstNode *n = *slot;
+    const Value *v = find_constant(n->constant.name);
+    if (v) {
+        replace(slot, literal_from_value(value_copy(*v), n));
+        return;
+    }
+    for (int i = 0; i < g_script_const_count; i++) {
+        if (strcmp(g_script_consts[i].name, n->constant.name) == 0) {
+            replace(slot, literal_from_value(eval_literal(&g_script_consts[i].value->literal.token), n));
+            return;
+        }
+    }
+}
+
+static void note_script_const(const AstNode *n) {
+    if (!n || n->type != AST_CONST_DECL || !is_literal(n->const_decl.value)) return;
+    ScriptConst *nc = (ScriptConst *)realloc(g_script_consts,
+        sizeof(ScriptConst) * (size_t)(g_script_const_count + 1));
+    if (!nc) return;
+    g_script_consts = nc;
+    g_script_consts[g_script_const_count].name = n->const_decl.name;
+    g_script_consts[g_script_const_count].value = n->const_decl.value;
+    g_script_const_count++;
+}
+
+/* Drop statements following an unconditional return, break or continue. */
+static void trim_block(AstNode *n) {
+    for (int i = 0; i < n->block.count; i++) {
+        AstType t = n->block.items[i]->type;
+        if (t != AST_RETURN && t != AST_BREAK && t != AST_CONTINUE) continue;
+        for (int j = i + 1; j < n->block.count; j++) {
+            ast_free(n->block.items[j]);
+            n->block.items[j] = NULL;
+        }
+        n->block.count = i + 1;
+        return;
+    }
+}
+
+static void optimize_node(AstNode **slot) {
+    AstNode *n = *slot;
+    ast_visit_children(n, optimize_slot, NULL);
+
+    switch (n->type) {
+        case AST_PROGRAM:
+        case AST_BLOCK:
+            trim_block(n);
+            break;
+        case AST_BINARY:
+            fold_binary(slot);
+            break;
+        case AST_UNARY:
+            fold_unary(slot);
+            break;
+        case AST_CALL:
+            fold_call(slot);
+            break;
+        case AST_CONST:
+            fold_const(slot);
+            break;
+        case AST_TERNARY:
+            if (is_literal(n->ternary.cond)) {
+                hoist(slot, literal_truth(n->ternary.cond) ? &n->ternary.then_expr
+                                                          : &n->ternary.else_expr);
+            }
+            break;
+        case AST_IF:
+            if (!is_literal(n->if_stmt.cond)) break;
+            if (literal_truth(n->if_stmt.cond)) {
+                hoist(slot, &n->if_stmt.then_branch);
+            } else if (n->if_stmt.else_branch) {
+                hoist(slot, &n->if_stmt.else_branch);
+            } else {
+                replace(slot, empty_block(n));
+            }
+            break;
+        case AST_WHILE:
+            if (is_literal(n->while_stmt.cond) && !literal_truth(n->while_stmt.cond)) {
+                replace(slot, empty_block(n));
+            }
+            break;
+        case AST_FOR:
+            /* The initializer still runs once when the condition is false. */
+            if (is_literal(n->for_stmt.cond) && !literal_truth(n->for_stmt.cond)) {
+                if (n->for_stmt.init) {
+                    hoist(slot, &n->for_stmt.init);
+                } else {
+                    replace(slot, empty_block(n));
+                }
+            }
+            break;
+        default:
+            break;
+    }
+}
+
+static void optimize_slot(AstNode **slot, void *ctx) {
+    (void)ctx;
+    optimize_node(slot);
+}
+
+void ast_optimize(AstNode *root) {
+    if (!root) return;
+    /* The root is owned by the caller and must keep its address. */
+    if (root->type == AST_PROGRAM) {
+        for (int i = 0; i < root->block.count; i++) {
+            if (!root->block.items[i]) continue;
+            optimize_slot(&root->block.items[i], NULL);
+            note_script_const(root->block.items[i]);
+        }
+    } else {
+        ast_visit_children(root, optimize_slot, NULL);
+    }
+    if (root->type == AST_PROGRAM || root->type == AST_BLOCK) trim_block(root);
+
+    free(g_script_consts);
+    g_script_consts = NULL;
+    g_script_const_count = 0;
+}
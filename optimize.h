@@ -0,0 +1,20 @@
+/**
+ * @file optimize.h
+ * @brief AST optimization pass run between parsing and evaluation.
+ */
+#ifndef OPTIMIZE_H
+#define OPTIMIZE_H
+
+#include "ast.h"
+
+/**
+ * Rewrite the tree below @p root in place: fold operators and pure native
+ * calls whose operands are literals, merge adjacent string literals in
+ * concatenation chains and drop branches, loop bodies and statements that
+ * can never run. References to registered constants and to constants
+ * declared by earlier top-level `const` statements become literals.
+ * Natives and constants must be registered before this is called.
+ */
+void ast_optimize(AstNode *root);
+
+#endif
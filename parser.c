@@ -34,6 +34,7 @@ static const char *token_name(TokenType t) {
         case TOK_DEFAULT: return "default";
         case TOK_FUNCTION: return "function";
         case TOK_GLOBAL: return "global";
+        case TOK_CONST: return "const";
         case TOK_RETURN: return "return";
         case TOK_BREAK: return "break";
         case TOK_CONTINUE: return "continue";
@@ -383,12 +384,21 @@ static int is_ident_char(char c) {
     return isalnum((unsigned char)c) || c == '_';
 }
 
+static void free_token_string(Token *t) {
+    if (t->type == TOK_IDENT || t->type == TOK_VAR ||
+        t->type == TOK_STRING || t->type == TOK_DSTRING) {
+        free(t->string_val);
+    }
+}
+
 static char *normalize_interp_expr(const char *s, size_t n) {
     Lexer lx;
     lexer_init(&lx, s, NULL);
     Token t1 = lexer_next(&lx);
+    free_token_string(&t1);
     if (t1.type != TOK_IDENT) return dup_range(s, n);
     Token t2 = lexer_next(&lx);
+    free_token_string(&t2);
     if (t2.type == TOK_LPAREN) return dup_range(s, n);
     char *out = (char *)malloc(n + 2);
     if (!out) return NULL;
@@ -432,18 +442,12 @@ static AstNode *parse_interp_expression(Parser *p, const char *s, size_t n) {
     char *unesc = unescape_interp_expr(s, n, &ulen);
     if (!unesc) return NULL;
 
-    lx_error_clear();
-    AstNode *expr = parse_interp_with(unesc, p->lexer.filename);
-    if (expr) {
-        free(unesc);
-        return expr;
-    }
-
+    /* ${name...} names a variable, not a constant */
     lx_error_clear();
     char *expr_src = normalize_interp_expr(unesc, ulen);
     free(unesc);
     if (!expr_src) return NULL;
-    expr = parse_interp_with(expr_src, p->lexer.filename);
+    AstNode *expr = parse_interp_with(expr_src, p->lexer.filename);
     free(expr_src);
     if (!expr) {
         parse_error(p, "invalid interpolation expression");
@@ -739,9 +743,10 @@ static AstNode *parse_primary(Parser *p) {
             RETURN_IF_ERROR(p);
             return n;
         }
-        /* bare identifier not allowed */
-        parse_error(p, "unexpected identifier");
-        RETURN_IF_ERROR(p);
+        /* bare identifier → constant */
+        AstNode *n = node(p, AST_CONST);
+        n->constant.name = name;
+        return n;
     }
 
     /* grouping */
@@ -964,6 +969,15 @@ static AstNode *parse_statement_or_block(Parser *p) {
     return parse_statement(p);
 }
 
+/* @return The type named by identifier @p s, or TYPE_ANY when it names none. */
+static TypeHint type_hint_named(const char *s) {
+    static const TypeHint types[] = { TYPE_INT, TYPE_FLOAT, TYPE_BOOL, TYPE_STRING, TYPE_ARRAY, TYPE_BLOB };
+    for (size_t i = 0; i < sizeof(types) / sizeof(types[0]); i++) {
+        if (s && !strcmp(s, ast_type_hint_name(types[i]))) return types[i];
+    }
+    return TYPE_ANY;
+}
+
 static AstNode *parse_statement(Parser *p) {
     RETURN_IF_ERROR(p);
     /* function */
@@ -979,8 +993,10 @@ static AstNode *parse_statement(Parser *p) {
         RETURN_IF_ERROR(p);
         char **params = NULL;
         AstNode **param_defaults = NULL;
+        TypeHint *param_types = NULL;
         int param_count = 0;
         int saw_default = 0;
+        int saw_type = 0;
         if (!check(p, TOK_RPAREN)) {
             do {
                 if (!check(p, TOK_VAR) && !check(p, TOK_IDENT)) {
@@ -988,10 +1004,23 @@ static AstNode *parse_statement(Parser *p) {
                     RETURN_IF_ERROR(p);
                 }
                 advance(p);
+                /* `int $x`: a type name is only a type when a name follows it. */
+                TypeHint type = TYPE_ANY;
+                if (p->previous.type == TOK_IDENT && (check(p, TOK_VAR) || check(p, TOK_IDENT))) {
+                    type = type_hint_named(p->previous.string_val);
+                    if (type == TYPE_ANY) {
+                        parse_error(p, "unknown parameter type");
+                        RETURN_IF_ERROR(p);
+                    }
+                    advance(p);
+                    saw_type = 1;
+                }
                 params = realloc(params, sizeof(char *) * (param_count + 1));
                 params[param_count++] = strdup(p->previous.string_val);
                 param_defaults = realloc(param_defaults, sizeof(AstNode *) * param_count);
                 param_defaults[param_count - 1] = NULL;
+                param_types = realloc(param_types, sizeof(TypeHint) * param_count);
+                param_types[param_count - 1] = type;
 
                 if (match(p, TOK_ASSIGN)) {
                     AstNode *def = parse_expression(p, PREC_ASSIGN);
@@ -1007,14 +1036,30 @@ static AstNode *parse_statement(Parser *p) {
         expect(p, TOK_RPAREN, ")");
         RETURN_IF_ERROR(p);
 
+        TypeHint ret_type = TYPE_ANY;
+        if (match(p, TOK_COLON)) {
+            if (!check(p, TOK_IDENT) || type_hint_named(p->current.string_val) == TYPE_ANY) {
+                parse_error(p, "return type expected");
+                RETURN_IF_ERROR(p);
+            }
+            ret_type = type_hint_named(p->current.string_val);
+            advance(p);
+        }
+
         AstNode *body = parse_statement_or_block(p);
         RETURN_IF_ERROR(p);
 
+        if (!saw_type) {
+            free(param_types);
+            param_types = NULL;
+        }
         AstNode *n = node(p, AST_FUNCTION);
         n->func.name = name;
         n->func.params = params;
         n->func.param_defaults = param_defaults;
+        n->func.param_types = param_types;
         n->func.param_count = param_count;
+        n->func.ret_type = ret_type;
         n->func.body = body;
         return n;
     }
@@ -1062,6 +1107,27 @@ static AstNode *parse_statement(Parser *p) {
         return n;
     }
 
+    /* const NAME = expr; */
+    if (match(p, TOK_CONST)) {
+        if (!check(p, TOK_IDENT)) {
+            parse_error(p, "constant name expected");
+            RETURN_IF_ERROR(p);
+        }
+        advance(p);
+        char *name = strdup(p->previous.string_val);
+        expect(p, TOK_ASSIGN, "=");
+        if (lx_has_error()) { free(name); return NULL; }
+        AstNode *v = parse_expression(p, PREC_ASSIGN);
+        if (lx_has_error()) { free(name); ast_free(v); return NULL; }
+        expect(p, TOK_SEMI, ";");
+        if (lx_has_error()) { free(name); ast_free(v); return NULL; }
+
+        AstNode *n = node(p, AST_CONST_DECL);
+        n->const_decl.name = name;
+        n->const_decl.value = v;
+        return n;
+    }
+
     /* break */
     if (match(p, TOK_BREAK)) {
         expect(p, TOK_SEMI, ";");
@@ -1147,6 +1213,7 @@ static AstNode *parse_statement(Parser *p) {
         expect(p, TOK_AS, "as");
         RETURN_IF_ERROR(p);
 
+        int by_ref = match(p, TOK_BIT_AND);
         if (!check(p, TOK_VAR)) {
             parse_error(p, "foreach expects a variable after 'as'");
             RETURN_IF_ERROR(p);
@@ -1157,8 +1224,9 @@ static AstNode *parse_statement(Parser *p) {
         char *key_name = NULL;
         char *value_name = NULL;
 
-        if (match(p, TOK_ARROW)) {
+        if (!by_ref && match(p, TOK_ARROW)) {
             key_name = first;
+            by_ref = match(p, TOK_BIT_AND);
             if (!check(p, TOK_VAR)) {
                 parse_error(p, "foreach expects a value variable");
                 RETURN_IF_ERROR(p);
@@ -1179,6 +1247,7 @@ static AstNode *parse_statement(Parser *p) {
         n->foreach_stmt.key_name = key_name;
         n->foreach_stmt.value_name = value_name;
         n->foreach_stmt.body = body;
+        n->foreach_stmt.by_ref = by_ref;
         return n;
     }
 
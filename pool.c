@@ -0,0 +1,207 @@
+/**
+ * @file pool.c
+ * @brief Size-class pools for small fixed-size runtime objects.
+ *
+ * Array, Blob and Env headers are allocated and freed millions of times by
+ * a busy script, each only a few dozen bytes, and so are the buffers of
+ * short strings and small tables. Requests up to
+ * LX_POOL_MAX_SIZE are rounded up to a multiple of LX_POOL_GRANULE and
+ * served from a free list per size class. An empty list is refilled from
+ * the current chunk of that class; a new chunk of LX_POOL_CHUNK_BYTES is
+ * taken from the heap only after lx_memguard_check() allows it, so the
+ * lxsh memory budget still applies. Freed blocks go back to their list and
+ * chunks are kept until exit. Blocks are charged to the memory accounting
+ * (memguard.h) while they are in use. While a region is open (region.h),
+ * requests are served from the region instead.
+ *
+ * The sized buffers (lx_pool_buf_alloc()) behind region.c's heap path keep
+ * their length in a header word, so they can be freed and resized without
+ * the caller passing the size; those that fit LX_POOL_MAX_SIZE with their
+ * header come from the same classes, larger ones from lx_mem_alloc().
+ */
+#include "pool.h"
+#include "config.h"
+#include "memguard.h"
+#include "region.h"
+#include "lx_error.h"
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef LX_POOL_CHUNK_BYTES
+#define LX_POOL_CHUNK_BYTES 65536
+#endif
+
+#define POOL_CLASSES (LX_POOL_MAX_SIZE / LX_POOL_GRANULE)
+/* A chunk size too small for two of the largest blocks (such as 0)
+ * turns the pools off; every request then goes to calloc/free. */
+#define POOL_ENABLED (LX_POOL_CHUNK_BYTES >= 2 * LX_POOL_MAX_SIZE)
+
+typedef struct PoolBlock {
+    struct PoolBlock *next;
+} PoolBlock;
+
+/* Chunks are linked through their first granule so they stay reachable. */
+typedef struct PoolChunk {
+    struct PoolChunk *next;
+} PoolChunk;
+
+typedef struct {
+    PoolBlock *free; /* recycled blocks */
+    char *bump;      /* unused tail of the current chunk */
+    size_t left;     /* bytes left at bump */
+} PoolClass;
+
+static PoolClass g_pool[POOL_CLASSES];
+static PoolChunk *g_pool_chunks = NULL;
+static LxPoolStats g_pool_stats;
+
+/* Start a new chunk for class @p c. @return 0 if the heap refused. */
+static int pool_refill(PoolClass *c) {
+    size_t bytes = LX_POOL_CHUNK_BYTES;
+    if (!lx_memguard_check(bytes)) return 0;
+    PoolChunk *chunk = (PoolChunk *)malloc(bytes);
+    if (!chunk) return 0;
+    chunk->next = g_pool_chunks;
+    g_pool_chunks = chunk;
+    c->bump = (char *)chunk + LX_POOL_GRANULE;
+    c->left = bytes - LX_POOL_GRANULE;
+    g_pool_stats.chunks++;
+    g_pool_stats.chunk_bytes += bytes;
+    return 1;
+}
+
+/* @return NULL, making sure the caller finds an error to report. */
+static void *pool_failed(void) {
+    if (!lx_has_error()) lx_set_error(LX_ERR_INTERNAL, 0, 0, "out of memory");
+    return NULL;
+}
+
+/* @return A block of class @p idx, charged but not cleared, or NULL if
+ * a new chunk was refused. */
+static void *pool_take(size_t idx) {
+    size_t block = (idx + 1) * LX_POOL_GRANULE;
+    PoolClass *c = &g_pool[idx];
+    void *p;
+    if (c->free) {
+        p = c->free;
+        c->free = c->free->next;
+        g_pool_stats.hits++;
+    } else {
+        if (c->left < block && !pool_refill(c)) return NULL;
+        p = c->bump;
+        c->bump += block;
+        c->left -= block;
+    }
+    g_pool_stats.allocs++;
+    lx_mem_charge(block);
+    return p;
+}
+
+/* Put block @p p of class @p idx back on its free list. */
+static void pool_give(void *p, size_t idx) {
+    PoolClass *c = &g_pool[idx];
+    lx_mem_uncharge((idx + 1) * LX_POOL_GRANULE);
+    PoolBlock *b = (PoolBlock *)p;
+    b->next = c->free;
+    c->free = b;
+    g_pool_stats.frees++;
+}
+
+void *lx_pool_alloc(size_t size) {
+    if (lx_region_active()) {
+        void *p = lx_region_calloc(size);
+        return p ? p : pool_failed();
+    }
+    if (!POOL_ENABLED || size == 0 || size > LX_POOL_MAX_SIZE) {
+        void *p = calloc(1, size ? size : 1);
+        if (!p) return pool_failed();
+        g_pool_stats.fallback++;
+        lx_mem_charge(size);
+        return p;
+    }
+    size_t idx = (size - 1) / LX_POOL_GRANULE;
+    void *p = pool_take(idx);
+    if (!p) return pool_failed();
+    memset(p, 0, (idx + 1) * LX_POOL_GRANULE);
+    return p;
+}
+
+void lx_pool_free(void *p, size_t size) {
+    if (!p) return;
+    if (lx_region_owns(p)) {
+        lx_region_free(p);
+        return;
+    }
+    if (!POOL_ENABLED || size == 0 || size > LX_POOL_MAX_SIZE) {
+        lx_mem_uncharge(size);
+        free(p);
+        return;
+    }
+    pool_give(p, (size - 1) / LX_POOL_GRANULE);
+}
+
+/* ---------- sized buffers ---------- */
+
+/* Size word in front of each buffer; the union keeps the payload aligned
+ * like lx_mem_alloc() does. */
+typedef union {
+    size_t size;
+    long long ll;
+    double d;
+    void *p;
+} PoolBufHeader;
+
+/* @return Whether a buffer of @p n bytes, with its header, fits a class. */
+static int buf_pooled(size_t n) {
+    return POOL_ENABLED && n <= LX_POOL_MAX_SIZE - sizeof(PoolBufHeader);
+}
+
+static size_t buf_class(size_t n) {
+    return (sizeof(PoolBufHeader) + n - 1) / LX_POOL_GRANULE;
+}
+
+void *lx_pool_buf_alloc(size_t n) {
+    PoolBufHeader *h;
+    if (buf_pooled(n)) {
+        h = (PoolBufHeader *)pool_take(buf_class(n));
+    } else {
+        h = (PoolBufHeader *)lx_mem_alloc(sizeof(PoolBufHeader) + n);
+        if (h) g_pool_stats.fallback++;
+    }
+    if (!h) return NULL;
+    h->size = n;
+    return h + 1;
+}
+
+void *lx_pool_buf_realloc(void *p, size_t n) {
+    if (!p) return lx_pool_buf_alloc(n);
+    PoolBufHeader *h = (PoolBufHeader *)p - 1;
+    size_t old = h->size;
+    int was_pooled = buf_pooled(old);
+    if (was_pooled && buf_pooled(n) && buf_class(old) == buf_class(n)) {
+        h->size = n;
+        return p;
+    }
+    if (!was_pooled && !buf_pooled(n)) {
+        h = (PoolBufHeader *)lx_mem_realloc(h, sizeof(PoolBufHeader) + n);
+        if (!h) return NULL;
+        h->size = n;
+        return h + 1;
+    }
+    void *np = lx_pool_buf_alloc(n);
+    if (!np) return NULL;
+    memcpy(np, p, old < n ? old : n);
+    lx_pool_buf_free(p);
+    return np;
+}
+
+void lx_pool_buf_free(void *p) {
+    if (!p) return;
+    PoolBufHeader *h = (PoolBufHeader *)p - 1;
+    if (buf_pooled(h->size)) pool_give(h, buf_class(h->size));
+    else lx_mem_free(h);
+}
+
+void lx_pool_stats(LxPoolStats *out) {
+    if (out) *out = g_pool_stats;
+}
@@ -0,0 +1,51 @@
+/**
+ * @file pool.h
+ * @brief Size-class pools for small runtime objects and buffers.
+ */
+#ifndef POOL_H
+#define POOL_H
+
+#include <stddef.h>
+
+/** Largest request served from a pool; bigger ones go to calloc. */
+#define LX_POOL_MAX_SIZE 256
+/** Pool sizes are multiples of this many bytes. */
+#define LX_POOL_GRANULE 16
+
+/** Allocation counters (see lx_pool_stats()). */
+typedef struct {
+    unsigned long allocs;   /**< Pooled allocations. */
+    unsigned long hits;     /**< Allocations served from a free list. */
+    unsigned long frees;    /**< Blocks returned to a free list. */
+    unsigned long fallback; /**< Requests passed to the heap (too large, or pools disabled). */
+    unsigned long chunks;   /**< Chunks taken from the heap. */
+    size_t chunk_bytes;     /**< Bytes held in chunks. */
+} LxPoolStats;
+
+/**
+ * @return @p size zeroed bytes, or NULL with an error set: LX_ERR_MEMORY_LIMIT
+ * when lx_memguard_check() refuses a new chunk, "out of memory" when the
+ * heap does. Callers must check for NULL. Blocks are recycled
+ * per size class. Free with lx_pool_free() and the same @p size.
+ * Pools are not thread-safe; they are only used by the interpreter thread.
+ */
+void *lx_pool_alloc(size_t size);
+/** Return @p p, allocated by lx_pool_alloc(@p size), to its pool. */
+void lx_pool_free(void *p, size_t size);
+/**
+ * @return @p n uninitialised bytes that remember their size, or NULL (no
+ * error set) when the heap or a memory limit refuses. Buffers that fit a
+ * size class with their size word are pooled; larger ones come from
+ * lx_mem_alloc(). Used by region.c for string, key and table storage
+ * outside a region; free with lx_pool_buf_free().
+ */
+void *lx_pool_buf_alloc(size_t n);
+/** Resize buffer @p p (NULL allocates) to @p n bytes, keeping its contents
+ *  up to the smaller size. @return The buffer, or NULL with @p p intact. */
+void *lx_pool_buf_realloc(void *p, size_t n);
+/** Free a buffer from lx_pool_buf_alloc(); NULL is ignored. */
+void lx_pool_buf_free(void *p);
+/** Copy the allocation counters into @p out. */
+void lx_pool_stats(LxPoolStats *out);
+
+#endif
@@ -0,0 +1,306 @@
+/**
+ * @file region.c
+ * @brief Request-scoped region for the memory behind script values.
+ *
+ * A script run ends with the host freeing its global environment and AST.
+ * With millions of live values that teardown visits and frees every one
+ * of them. While a region is open, the allocations of the value layer
+ * (value.c, array.c, env.c, pool.c) come from chunks of
+ * LX_REGION_CHUNK_BYTES instead, so the whole heap of the run can be
+ * dropped at once.
+ *
+ * Blocks up to an eighth of a chunk are carved from the current chunk in
+ * multiples of REGION_GRANULE, behind a one-word header holding the block
+ * size; freed blocks go on a free list per size, so a loop that keeps
+ * replacing a value does not grow the region. Larger blocks get a chunk of
+ * their own and go straight back to the heap when freed. Chunks are
+ * aligned to their size and recorded in a hash set of chunk addresses, so
+ * whether a pointer belongs to the region is one mask and one probe.
+ * Chunks are charged to the memory accounting (memguard.h) as a whole;
+ * without an open region, blocks are pool buffers (lx_pool_buf_alloc()),
+ * so short strings share the size classes of pool.h.
+ *
+ * After lx_region_end(), frees of region memory are no-ops and the value
+ * layer does not walk region arrays, blobs or environments, which makes
+ * the host's teardown independent of the size of the script's data.
+ * lx_region_release() then frees the chunks.
+ */
+#if !defined(_POSIX_C_SOURCE) && !defined(_GNU_SOURCE)
+#define _POSIX_C_SOURCE 200112L
+#endif
+#include "region.h"
+#include "config.h"
+#include "gc.h"
+#include "memguard.h"
+#include "pool.h"
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef LX_REGION_CHUNK_BYTES
+#define LX_REGION_CHUNK_BYTES 1048576
+#endif
+
+/* Chunks must be a power of two; 0 (or anything too small) turns regions off. */
+#if LX_REGION_CHUNK_BYTES >= 4096
+#define REGION_ENABLED 1
+#define REGION_CHUNK LX_REGION_CHUNK_BYTES
+#else
+#define REGION_ENABLED 0
+#define REGION_CHUNK 4096
+#endif
+
+#define REGION_GRANULE 16
+#define REGION_MAX_BLOCK (REGION_CHUNK / 8)
+#define REGION_CLASSES (REGION_MAX_BLOCK / REGION_GRANULE)
+/* Large blocks start this far into their chunk; the size word sits just
+ * before the payload, as for small blocks. */
+#define REGION_LARGE_HEADER REGION_GRANULE
+
+enum { REGION_OFF, REGION_OPEN, REGION_ENDED };
+
+typedef struct RegionBlock {
+    struct RegionBlock *next;
+} RegionBlock;
+
+static int g_region_state = REGION_OFF;
+static int g_region_suspended = 0;
+static RegionBlock *g_region_free[REGION_CLASSES + 1]; /* recycled payloads per size */
+static char *g_region_bump = NULL; /* unused tail of the current chunk */
+static size_t g_region_left = 0;
+static LxRegionStats g_region_stats;
+
+/* Open-addressed set of chunk addresses (0 marks an empty slot). */
+static uintptr_t *g_region_set = NULL;
+static size_t g_region_set_cap = 0;
+static size_t g_region_set_count = 0;
+
+/* ---------- chunk set ---------- */
+
+static size_t region_slot(uintptr_t base) {
+    uint64_t h = (uint64_t)(base / REGION_CHUNK) * 0x9E3779B97F4A7C15ull;
+    return (size_t)(h >> 32) & (g_region_set_cap - 1);
+}
+
+static void region_set_put(uintptr_t base) {
+    size_t i = region_slot(base);
+    while (g_region_set[i]) i = (i + 1) & (g_region_set_cap - 1);
+    g_region_set[i] = base;
+    g_region_set_count++;
+}
+
+static int region_set_grow(void) {
+    if ((g_region_set_count + 1) * 2 <= g_region_set_cap) return 1;
+    size_t cap = g_region_set_cap ? g_region_set_cap * 2 : 64;
+    uintptr_t *old = g_region_set;
+    size_t old_cap = g_region_set_cap;
+    uintptr_t *set = (uintptr_t *)calloc(cap, sizeof(uintptr_t));
+    if (!set) return 0;
+    g_region_set = set;
+    g_region_set_cap = cap;
+    g_region_set_count = 0;
+    for (size_t i = 0; i < old_cap; i++) {
+        if (old[i]) region_set_put(old[i]);
+    }
+    free(old);
+    return 1;
+}
+
+static int region_set_has(uintptr_t base) {
+    size_t i = region_slot(base);
+    while (g_region_set[i]) {
+        if (g_region_set[i] == base) return 1;
+        i = (i + 1) & (g_region_set_cap - 1);
+    }
+    return 0;
+}
+
+/* Remove @p base, shifting later entries of its probe run back. */
+static void region_set_del(uintptr_t base) {
+    size_t mask = g_region_set_cap - 1;
+    size_t i = region_slot(base);
+    while (g_region_set[i] != base) i = (i + 1) & mask;
+    g_region_set[i] = 0;
+    g_region_set_count--;
+    for (size_t j = (i + 1) & mask; g_region_set[j]; j = (j + 1) & mask) {
+        size_t home = region_slot(g_region_set[j]);
+        /* move j to the hole if its home is not in (i, j] */
+        if (((j - home) & mask) >= ((j - i) & mask)) {
+            g_region_set[i] = g_region_set[j];
+            g_region_set[j] = 0;
+            i = j;
+        }
+    }
+}
+
+/* @return A chunk of @p bytes aligned to REGION_CHUNK, recorded
+ * in the set, or NULL. */
+static void *region_chunk(size_t bytes) {
+    void *p = NULL;
+    if (!lx_memguard_check(bytes)) return NULL;
+    if (!region_set_grow()) return NULL;
+    if (posix_memalign(&p, REGION_CHUNK, bytes) != 0) return NULL;
+    region_set_put((uintptr_t)p);
+    lx_mem_charge(bytes);
+    g_region_stats.chunks++;
+    g_region_stats.bytes += bytes;
+    if (g_region_stats.bytes > g_region_stats.peak_bytes) {
+        g_region_stats.peak_bytes = g_region_stats.bytes;
+    }
+    return p;
+}
+
+/* ---------- blocks ---------- */
+
+static size_t *region_header(void *p) {
+    return (size_t *)p - 1;
+}
+
+static void *region_block(size_t n) {
+    size_t need = (n + sizeof(size_t) + REGION_GRANULE - 1) & ~(size_t)(REGION_GRANULE - 1);
+    if (need > REGION_MAX_BLOCK) {
+        size_t bytes = need + REGION_LARGE_HEADER;
+        char *chunk = (char *)region_chunk(bytes);
+        if (!chunk) return NULL;
+        g_region_stats.large++;
+        char *p = chunk + REGION_LARGE_HEADER;
+        *region_header(p) = need;
+        return p;
+    }
+    RegionBlock **list = &g_region_free[need / REGION_GRANULE];
+    if (*list) {
+        RegionBlock *b = *list;
+        *list = b->next;
+        return b;
+    }
+    if (g_region_left < need) {
+        /* the tail of the old chunk (under REGION_MAX_BLOCK) is abandoned */
+        char *chunk = (char *)region_chunk(REGION_CHUNK);
+        if (!chunk) return NULL;
+        g_region_bump = chunk;
+        g_region_left = REGION_CHUNK;
+    }
+    char *p = g_region_bump + sizeof(size_t);
+    *region_header(p) = need;
+    g_region_bump += need;
+    g_region_left -= need;
+    return p;
+}
+
+static void region_block_free(void *p) {
+    size_t need = *region_header(p);
+    if (need > REGION_MAX_BLOCK) {
+        char *chunk = (char *)p - REGION_LARGE_HEADER;
+        region_set_del((uintptr_t)chunk);
+        g_region_stats.chunks--;
+        g_region_stats.bytes -= need + REGION_LARGE_HEADER;
+        g_region_stats.large--;
+        lx_mem_uncharge(need + REGION_LARGE_HEADER);
+        free(chunk);
+        return;
+    }
+    RegionBlock *b = (RegionBlock *)p;
+    b->next = g_region_free[need / REGION_GRANULE];
+    g_region_free[need / REGION_GRANULE] = b;
+}
+
+/* ---------- lifetime ---------- */
+
+void lx_region_begin(void) {
+    if (!REGION_ENABLED || g_region_state != REGION_OFF) return;
+    g_region_state = REGION_OPEN;
+    gc_region_begin();
+}
+
+void lx_region_end(void) {
+    if (g_region_state == REGION_OPEN) g_region_state = REGION_ENDED;
+}
+
+void lx_region_release(void) {
+    if (g_region_state == REGION_OFF) return;
+    g_region_state = REGION_ENDED;
+    gc_region_release();
+    lx_mem_uncharge(g_region_stats.bytes);
+    for (size_t i = 0; i < g_region_set_cap; i++) {
+        if (g_region_set[i]) free((void *)g_region_set[i]);
+    }
+    free(g_region_set);
+    g_region_set = NULL;
+    g_region_set_cap = 0;
+    g_region_set_count = 0;
+    memset(g_region_free, 0, sizeof(g_region_free));
+    g_region_bump = NULL;
+    g_region_left = 0;
+    memset(&g_region_stats, 0, sizeof(g_region_stats));
+    g_region_suspended = 0;
+    g_region_state = REGION_OFF;
+}
+
+int lx_region_active(void) {
+    return g_region_state == REGION_OPEN && !g_region_suspended;
+}
+
+void lx_region_suspend(void) {
+    g_region_suspended++;
+}
+
+void lx_region_resume(void) {
+    if (g_region_suspended > 0) g_region_suspended--;
+}
+
+int lx_region_owns(const void *p) {
+    if (!g_region_set_count || !p) return 0;
+    return region_set_has((uintptr_t)p & ~(uintptr_t)(REGION_CHUNK - 1));
+}
+
+int lx_region_dead(const void *p) {
+    return g_region_state == REGION_ENDED && lx_region_owns(p);
+}
+
+/* ---------- allocation ---------- */
+
+void *lx_region_alloc(size_t n) {
+    if (!lx_region_active()) return lx_pool_buf_alloc(n);
+    return region_block(n);
+}
+
+void *lx_region_calloc(size_t n) {
+    void *p = lx_region_alloc(n);
+    if (p) memset(p, 0, n);
+    return p;
+}
+
+void *lx_region_realloc(void *p, size_t n) {
+    if (!lx_region_owns(p)) {
+        if (!p) return lx_region_alloc(n);
+        return lx_pool_buf_realloc(p, n);
+    }
+    size_t have = *region_header(p) - sizeof(size_t);
+    if (n <= have) return p;
+    void *np = lx_region_alloc(n);
+    if (!np) return NULL;
+    memcpy(np, p, have);
+    lx_region_free(p);
+    return np;
+}
+
+char *lx_region_strdup(const char *s) {
+    size_t n = strlen(s) + 1;
+    char *p = (char *)lx_region_alloc(n);
+    if (p) memcpy(p, s, n);
+    return p;
+}
+
+void lx_region_free(void *p) {
+    if (!p) return;
+    if (!lx_region_owns(p)) {
+        lx_pool_buf_free(p);
+        return;
+    }
+    if (g_region_state == REGION_ENDED) return;
+    region_block_free(p);
+}
+
+void lx_region_stats(LxRegionStats *out) {
+    if (out) *out = g_region_stats;
+}
@@ -0,0 +1,71 @@
+/**
+ * @file region.h
+ * @brief Request-scoped region for the memory behind script values.
+ */
+#ifndef REGION_H
+#define REGION_H
+
+#include <stddef.h>
+
+/** Region counters (see lx_region_stats()). */
+typedef struct {
+    unsigned long chunks; /**< Chunks held, including blocks too large for a chunk. */
+    size_t bytes;         /**< Bytes held in chunks. */
+    size_t peak_bytes;    /**< Largest value of @c bytes since the region began. */
+    unsigned long large;  /**< Live blocks with a chunk of their own. */
+} LxRegionStats;
+
+/**
+ * Open a region (no-op if one is open or LX_REGION_CHUNK_BYTES is 0).
+ * Until lx_region_end(), array, blob and environment headers, array
+ * entries, binding tables, keys and string and blob buffers come from the
+ * region. Blocks freed in the meantime are reused by later allocations.
+ */
+void lx_region_begin(void);
+/**
+ * Stop allocating from the region. Until lx_region_release(), freeing
+ * region memory is a no-op, and arrays, blobs and environments that live
+ * in it are not walked when released, so the host can tear down the
+ * global environment and the AST in time proportional to what it owns.
+ */
+void lx_region_end(void);
+/** Return every chunk to the heap at once and forget the region's arrays. */
+void lx_region_release(void);
+/** @return Non-zero between lx_region_begin() and lx_region_end(). */
+int lx_region_active(void);
+
+/**
+ * Allocate from the heap instead of the open region until the matching
+ * lx_region_resume(); used for values that outlive the run (see
+ * value_export()). Calls nest.
+ */
+void lx_region_suspend(void);
+/** Undo one lx_region_suspend(). */
+void lx_region_resume(void);
+
+/** @return Non-zero if @p p was returned by the region (O(1)). */
+int lx_region_owns(const void *p);
+/**
+ * @return Non-zero if @p p lives in a region that has ended: it must not
+ * be freed or walked, only dropped.
+ */
+int lx_region_dead(const void *p);
+
+/**
+ * @return @p n bytes from the open region, or from lx_pool_buf_alloc()
+ * without one. Blocks from here must only be resized and freed below.
+ */
+void *lx_region_alloc(size_t n);
+/** @return @p n zeroed bytes (see lx_region_alloc()). */
+void *lx_region_calloc(size_t n);
+/** Resize @p p, from lx_region_alloc() whether or not a region was open. */
+void *lx_region_realloc(void *p, size_t n);
+/** @return A copy of @p s (see lx_region_alloc()). */
+char *lx_region_strdup(const char *s);
+/** Free @p p, from lx_region_alloc() whether or not a region was open. */
+void lx_region_free(void *p);
+
+/** Copy the region counters into @p out. */
+void lx_region_stats(LxRegionStats *out);
+
+#endif
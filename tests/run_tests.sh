@@ -1,6 +1,7 @@
 #!/bin/sh
 
 LX=../lx
+LXFLAGS=${LXFLAGS:-}
 FAIL=0
 CONFIG_H=../config.h
 
@@ -20,7 +21,7 @@ for t in $(find . -name "*.lx"); do
     case "$t" in
         ./core/include.lx) ext_key="LX_ENABLE_INCLUDE" ;;
         ./ext/files.lx|./ext/pwd.lx) ext_key="LX_ENABLE_FS" ;;
-        ./ext/json.lx) ext_key="LX_ENABLE_JSON" ;;
+        ./ext/json.lx|./ext/json_rows.lx) ext_key="LX_ENABLE_JSON" ;;
         ./ext/serializer.lx) ext_key="LX_ENABLE_SERIALIZER" ;;
         ./ext/hex.lx) ext_key="LX_ENABLE_HEX" ;;
         ./ext/blake2b.lx) ext_key="LX_ENABLE_BLAKE2B" ;;
@@ -44,7 +45,7 @@ for t in $(find . -name "*.lx"); do
         continue
     fi
 
-    res=$($LX "$t" 2>&1)
+    res=$($LX $LXFLAGS "$t" 2>&1)
 
     if [ "$res" = "$(cat "$out")" ]; then
         echo "OK"
@@ -58,4 +59,95 @@ for t in $(find . -name "*.lx"); do
     fi
 done
 
+# The heap profiler writes a report instead of output; check its sections.
+printf "TEST %-40s " "heap profile"
+hp_dir=$(mktemp -d)
+cat > "$hp_dir/profile.lx" <<'EOF'
+function build($n) {
+    $rows = [];
+    for ($i = 0; $i < $n; $i++) {
+        $rows[] = ["id" => $i, "name" => "row " . $i];
+    }
+    return $rows;
+}
+$keep = build(20000);
+print(count($keep), "\n");
+EOF
+res=$($LX $LXFLAGS --heap-profile="$hp_dir/report.txt" "$hp_dir/profile.lx" 2>&1)
+missing=""
+[ "$res" = "20000" ] || missing="$missing output"
+awk '/^by type/ {t=1} t && ($1=="string" || $1=="array") && $2>0 {n++} /^$/ {t=0}
+     END {exit n!=2}' "$hp_dir/report.txt" 2>/dev/null || missing="$missing by-type"
+grep -Eq "array +[^ ]*profile\.lx:4 in build\(\)" "$hp_dir/report.txt" 2>/dev/null || missing="$missing site"
+awk '/^largest arrays at exit/ {t=1} t && $1==20000 {f=1} /^$/ {t=0}
+     END {exit !f}' "$hp_dir/report.txt" 2>/dev/null || missing="$missing largest-arrays"
+if [ -z "$missing" ]; then
+    echo "OK"
+else
+    echo "FAIL"
+    echo "---- missing:$missing ----"
+    echo "$res"
+    cat "$hp_dir/report.txt" 2>/dev/null
+    FAIL=1
+fi
+rm -rf "$hp_dir"
+
+# Past the memory limit a script stops with error 2010 instead of crashing:
+# in a function call (the call's environment), and before it starts.
+printf "TEST %-40s " "memory limit"
+ml_dir=$(mktemp -d)
+cat > "$ml_dir/calls.lx" <<'EOF'
+function depth($n) {
+    return $n == 0 ? 0 : depth($n - 1) + 1;
+}
+print(depth(100000), "\n");
+EOF
+echo 'print("started\n");' > "$ml_dir/startup.lx"
+missing=""
+calls=$($LX $LXFLAGS --memory-limit=400K "$ml_dir/calls.lx" 2>&1)
+[ $? -eq 1 ] || missing="$missing calls-status"
+case "$calls" in "error 2010 line 2:"*|"error 2010: "*) ;; *) missing="$missing calls" ;; esac
+startup=$($LX $LXFLAGS --memory-limit=1 "$ml_dir/startup.lx" 2>&1)
+[ $? -eq 1 ] || missing="$missing startup-status"
+case "$startup" in "error 2010: "*) ;; *) missing="$missing startup" ;; esac
+if [ -z "$missing" ]; then
+    echo "OK"
+else
+    echo "FAIL"
+    echo "---- missing:$missing ----"
+    echo "$calls"
+    echo "$startup"
+    FAIL=1
+fi
+rm -rf "$ml_dir"
+
+# Parallel marking (--gc=trace) only starts on a large heap; force it with
+# gc_tune() and check that what the markers found is intact.
+printf "TEST %-40s " "parallel mark"
+pm_dir=$(mktemp -d)
+cat > "$pm_dir/mark.lx" <<'EOF'
+gc_tune(["mark_threads" => 2, "parallel_mark_arrays" => 1, "threshold" => 256]);
+$rows = [];
+for ($i = 0; $i < 20000; $i++) {
+    $rows[] = ["id" => $i, "tags" => [$i % 7, [$i]]];
+    $tmp = [[$i], [$i + 1]];
+}
+$sum = 0;
+foreach ($rows as $r) {
+    $sum += $r["id"] + $r["tags"][0] + $r["tags"][1][0];
+}
+$s = gc_stats();
+print($sum, " ", $s["mode"], " ", $s["collections"] > 0 ? "collected" : "idle", " ",
+      ($s["parallel_marks"] > 0 || gc_tune()["mark_threads"] == 1) ? "parallel" : "serial", "\n");
+EOF
+res=$($LX $LXFLAGS --gc=trace "$pm_dir/mark.lx" 2>&1)
+if [ "$res" = "400039997 trace collected parallel" ]; then
+    echo "OK"
+else
+    echo "FAIL"
+    echo "$res"
+    FAIL=1
+fi
+rm -rf "$pm_dir"
+
 exit $FAIL
@@ -4,7 +4,10 @@
  */
 #include "value.h"
 #include "array.h"
+#include "heapprof.h"
 #include "memguard.h"
+#include "pool.h"
+#include "region.h"
 #include "lx_error.h"
 #include <stdlib.h>
 #include <string.h>
@@ -25,13 +28,20 @@ Value value_string(const char *s){
 }
 Value value_string_n(const char *s, size_t n){
     if (!lx_memguard_check(n + 1)) {
-        Value v; v.type = VAL_NULL; return v;
+        /* Callers read the result as a string; hand out an empty one
+         * (outside the guard) and let the error stop the script. */
+        Value v; v.type = VAL_STRING;
+        v.s = (char*)lx_region_alloc(1);
+        if (!v.s) { v.type = VAL_NULL; return v; }
+        v.s[0] = 0;
+        return v;
     }
     Value v; v.type=VAL_STRING;
-    v.s = (char*)malloc(n+1);
+    v.s = (char*)lx_region_alloc(n+1);
     if (!v.s) { v.type=VAL_NULL; return v; }
-    memcpy(v.s, s, n);
+    if (s) memcpy(v.s, s, n);
     v.s[n]=0;
+    LX_HEAPPROF_ALLOC(LX_HEAP_STRING, v.s, n + 1);
     return v;
 }
 Value value_blob_n(const unsigned char *data, size_t n){
@@ -50,7 +60,7 @@ Blob *blob_new(size_t n){
     if (n > 0 && !lx_memguard_check(n)) {
         return NULL;
     }
-    Blob *b = (Blob *)malloc(sizeof(Blob));
+    Blob *b = (Blob *)lx_pool_alloc(sizeof(Blob));
     if (!b) return NULL;
     b->len = n;
     b->cap = n;
@@ -59,9 +69,10 @@ Blob *blob_new(size_t n){
         b->data = NULL;
         return b;
     }
-    b->data = (unsigned char *)malloc(n);
-    if (!b->data) { free(b); return NULL; }
+    b->data = (unsigned char *)lx_region_alloc(n);
+    if (!b->data) { lx_pool_free(b, sizeof(Blob)); return NULL; }
     memset(b->data, 0, n);
+    LX_HEAPPROF_ALLOC(LX_HEAP_BLOB, b, sizeof(Blob) + n);
     return b;
 }
 
@@ -77,10 +88,11 @@ void blob_retain(Blob *b){
 }
 
 void blob_free(Blob *b){
-    if (!b) return;
+    if (!b || lx_region_dead(b)) return;
     if (--b->refcount > 0) return;
-    free(b->data);
-    free(b);
+    LX_HEAPPROF_FREE(b);
+    lx_region_free(b->data);
+    lx_pool_free(b, sizeof(Blob));
 }
 
 int blob_reserve(Blob *b, size_t cap){
@@ -91,39 +103,14 @@ int blob_reserve(Blob *b, size_t cap){
     if (!lx_memguard_check(ncap)) {
         return 0;
     }
-    unsigned char *ndata = (unsigned char *)realloc(b->data, ncap);
+    unsigned char *ndata = (unsigned char *)lx_region_realloc(b->data, ncap);
     if (!ndata) return 0;
+    LX_HEAPPROF_ALLOC(LX_HEAP_BLOB, b, ncap - b->cap);
     b->data = ndata;
     b->cap = ncap;
     return 1;
 }
 
-static size_t g_mem_reserve = 0;
-
-__attribute__((weak)) size_t lx_platform_free_heap(void) {
-    return (size_t)-1;
-}
-
-void lx_set_mem_reserve(size_t bytes) {
-    g_mem_reserve = bytes;
-}
-
-size_t lx_get_mem_reserve(void) {
-    return g_mem_reserve;
-}
-
-int lx_memguard_check(size_t want_bytes) {
-    size_t free = lx_platform_free_heap();
-    if (free == (size_t)-1) {
-        return 1;
-    }
-    if (free <= g_mem_reserve + want_bytes) {
-        lx_set_error(LX_ERR_INTERNAL, 0, 0, "out of memory");
-        return 0;
-    }
-    return 1;
-}
-
 int value_is_number(Value v){
     return v.type==VAL_INT || v.type==VAL_FLOAT || v.type==VAL_BOOL || v.type==VAL_BYTE;
 }
@@ -164,13 +151,72 @@ Value value_copy(Value v){
 
 void value_free(Value v){
     switch (v.type){
-        case VAL_STRING: free(v.s); break;
+        case VAL_STRING:
+            LX_HEAPPROF_FREE(v.s);
+            lx_region_free(v.s);
+            break;
         case VAL_BLOB:  blob_free(v.blob); break;
         case VAL_ARRAY:  array_free(v.a); break;
         default: break;
     }
 }
 
+static Value value_export_copy(Value v){
+    switch (v.type){
+        case VAL_STRING: return value_string(v.s);
+        case VAL_BLOB:
+            return value_blob_n(v.blob ? v.blob->data : NULL, v.blob ? v.blob->len : 0);
+        case VAL_ARRAY: {
+            Value out = value_array();
+            if (!out.a || !v.a) return out;
+            for (size_t i = 0; i < v.a->size; i++) {
+                ArrayEntry *e = &v.a->entries[i];
+                Key k = e->key.type == KEY_STRING ? key_string(e->key.s) : e->key;
+                array_append(out.a, k, value_export_copy(e->value));
+            }
+            return out;
+        }
+        default: return v;
+    }
+}
+
+Value value_export(Value v){
+    if (!lx_region_active()) return v;
+    lx_region_suspend();
+    Value out = value_export_copy(v);
+    lx_region_resume();
+    value_free(v);
+    return out;
+}
+
+void value_assign_string_n(Value *dst, const char *s, size_t n){
+    if (dst->type != VAL_STRING || !dst->s) {
+        value_free(*dst);
+        *dst = value_string_n(s, n);
+        return;
+    }
+    /* strlen is a lower bound of the allocation, so shorter strings fit. */
+    size_t have = strlen(dst->s);
+    if (have < n) {
+        if (!lx_memguard_check(n + 1)) {
+            value_free(*dst);
+            *dst = value_null();
+            return;
+        }
+        char *ns = (char*)lx_region_realloc(dst->s, n + 1);
+        if (!ns) {
+            value_free(*dst);
+            *dst = value_null();
+            return;
+        }
+        LX_HEAPPROF_MOVE(dst->s, ns);
+        LX_HEAPPROF_ALLOC(LX_HEAP_STRING, ns, n - have);
+        dst->s = ns;
+    }
+    memmove(dst->s, s, n);
+    dst->s[n] = 0;
+}
+
 static Value float_to_string(double f) {
     char tmp[128];
     if (isnan(f)) return value_string("nan");
@@ -202,6 +248,22 @@ static Value float_to_string(double f) {
     return value_string(tmp);
 }
 
+const char *value_type_name(Value v){
+    switch (v.type){
+        case VAL_UNDEFINED: return "undefined";
+        case VAL_VOID:      return "void";
+        case VAL_NULL:      return "null";
+        case VAL_BOOL:      return "bool";
+        case VAL_INT:       return "int";
+        case VAL_FLOAT:     return "float";
+        case VAL_BYTE:      return "byte";
+        case VAL_STRING:    return "string";
+        case VAL_BLOB:      return "blob";
+        case VAL_ARRAY:     return "array";
+        default:            return "undefined";
+    }
+}
+
 Value value_to_string(Value v){
     char tmp[128];
     switch (v.type){
@@ -227,24 +289,8 @@ Value value_to_string(Value v){
 }
 
 Value value_to_int(Value v){
-    switch (v.type){
-        case VAL_INT: return v;
-        case VAL_BOOL: return value_int(v.b ? 1 : 0);
-        case VAL_FLOAT: return value_int((lx_int_t)v.f);
-        case VAL_BYTE: return value_int((int)v.byte);
-        case VAL_STRING: {
-            if (!v.s) return value_int(0);
-            char *end = NULL;
-            long long n = strtoll(v.s, &end, 10);
-            if (end && end != v.s) return value_int((lx_int_t)n);
-            return value_int(0);
-        }
-        case VAL_NULL:
-        case VAL_VOID:
-        case VAL_UNDEFINED: return value_int(0);
-        case VAL_BLOB: return value_int(0);
-        default: return value_int(0);
-    }
+    if (v.type == VAL_INT) return v;
+    return value_int(value_as_int(v));
 }
 Value value_to_float(Value v){
     switch (v.type){
@@ -261,6 +307,29 @@ Value value_to_float(Value v){
     }
 }
 
+lx_int_t value_as_int(Value v)
+{
+    switch (v.type) {
+        case VAL_INT:   return v.i;
+        case VAL_BOOL:  return v.b ? 1 : 0;
+        case VAL_FLOAT: return (lx_int_t)v.f;
+        case VAL_BYTE:  return (lx_int_t)v.byte;
+        case VAL_STRING: {
+            if (!v.s) return 0;
+            char *end = NULL;
+            long long n = strtoll(v.s, &end, 10);
+            if (end && end != v.s) return (lx_int_t)n;
+            return 0;
+        }
+        case VAL_NULL:
+        case VAL_VOID:
+        case VAL_UNDEFINED:
+        case VAL_BLOB:
+        default:
+            return 0;
+    }
+}
+
 double value_as_double(Value v)
 {
     switch (v.type) {
@@ -64,7 +64,7 @@ Value value_bool(int b);
 Value value_byte(unsigned char b);
 /** @return A VAL_STRING value (copying @p s). */
 Value value_string(const char *s);
-/** @return A VAL_STRING value copying exactly @p n bytes. */
+/** @return A VAL_STRING value copying exactly @p n bytes (uninitialized if @p s is NULL). */
 Value value_string_n(const char *s, size_t n);
 /** @return A VAL_BLOB value copying exactly @p n bytes. */
 Value value_blob_n(const unsigned char *data, size_t n);
@@ -91,13 +91,29 @@ int   value_is_number(Value v);
 Value value_copy(Value v);
 /** Release resources owned by @p v. */
 void  value_free(Value v);
+/**
+ * Move @p v out of an open region (region.h) for a registry or the host
+ * to keep after the run: strings, blobs and arrays are copied, deeply,
+ * to the heap and @p v is released. Without an open region @p v is
+ * returned as is.
+ */
+Value value_export(Value v);
+/**
+ * Overwrite @p *dst with a string copying @p n bytes of @p s. The buffer
+ * already owned by @p *dst is reused (or grown) when it holds a string.
+ */
+void  value_assign_string_n(Value *dst, const char *s, size_t n);
 
+/** @return The name of @p v's type as reported by type() ("int", "string", ...). */
+const char *value_type_name(Value v);
 /** @return A VAL_STRING representation (caller owns the string). */
 Value value_to_string(Value v);
 /** @return Best-effort integer conversion. */
 Value value_to_int(Value v);
 /** @return Best-effort float conversion. */
 Value value_to_float(Value v);
+/** @return Best-effort integer conversion, without building a Value. */
+lx_int_t value_as_int(Value v);
 /** @return Best-effort double conversion. */
 double value_as_double(Value v);
 
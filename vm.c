@@ -0,0 +1,1116 @@
+/**
+ * @file vm.c
+ * @brief Bytecode compiler and register virtual machine.
+ *
+ * Code is compiled per statement tree (the main program and each user
+ * function body). Expressions are evaluated into numbered registers that
+ * hold owned Values; an instruction that reads a register consumes it and
+ * leaves VAL_NULL behind, so every exit path can release the frame by
+ * freeing all registers.
+ *
+ * Constructs without a dedicated opcode are executed by the tree walker
+ * through VM_EVAL (expressions) and VM_EXEC (statements), which keeps the
+ * two engines semantically identical.
+ */
+#include "vm.h"
+#include "array.h"
+#include "gc.h"
+#include "heapprof.h"
+#include "region.h"
+#include "memguard.h"
+#include "lx_error.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__GNUC__)
+#define VM_COMPUTED_GOTO 1
+#endif
+
+typedef enum {
+    VM_LOADK,       /* R[a] = K[b] */
+    VM_LOADVAR,     /* R[a] = $name */
+    VM_STOREVAR,    /* $name = R[a]; c != 0 keeps R[a] */
+    VM_ASSIGNOP,    /* $name op= R[a] (op in c); d != 0 keeps the result in R[a] */
+    VM_ADDI_VAR,    /* $name += c */
+    VM_INCDEC,      /* R[a] = $name++ / ++$name; c = delta, d = prefix; a < 0 discards */
+    VM_BINARY,      /* R[a] = R[b] op R[c] (op in d) */
+    VM_UNARY,       /* R[a] = op R[b] (op in c) */
+    VM_JMP,         /* goto a */
+    VM_JMPF,        /* if (!R[b]) goto a; consumes R[b] */
+    VM_JMPT,        /* if (R[b]) goto a; consumes R[b] */
+    VM_JMPNN,       /* if (R[b] is not null/undefined) goto a; keeps R[b] */
+    VM_JCMP_VK,     /* if (!($name op K[b])) goto a (op in c) */
+    VM_CALL,        /* R[a] = name(R[b] .. R[b+c-1]) */
+    VM_TAILCALL,    /* return name(R[b] .. R[b+c-1]) in the caller's frame, else as VM_CALL */
+    VM_INDEX,       /* R[a] = R[b][R[c]] */
+    VM_INDEX_VAR,   /* R[a] = $name[R[c]] */
+    VM_INDEX_VK,    /* R[a] = $name[K[c]] */
+    VM_JNOTARR,     /* if ($name is not an array) goto a */
+    VM_APPEND_VAR,  /* $name[] = R[a] */
+    VM_ITER,        /* foreach step over R[b] at position R[c]; done: goto a */
+    VM_EVAL,        /* R[a] = tree-walker evaluation of node */
+    VM_EXEC,        /* tree-walker execution of node; break -> a, continue -> b */
+    VM_SAFEPOINT,   /* GC safepoint between statements */
+    VM_CLEAR,       /* free R[a] */
+    VM_RET,         /* return R[a] */
+    VM_RETV,        /* return void */
+    VM_FLOW,        /* propagate break (a = FLOW_BREAK) or continue */
+    VM_END,         /* fall off the end */
+    VM_OP_COUNT
+} VmOp;
+
+typedef struct {
+    int op;
+    int a, b, c, d;
+    int hint;           /* env slot cache for name */
+    int hint2;          /* second env slot cache (foreach keys) */
+    const char *name;   /* variable or function name, borrowed from the AST */
+    AstNode *node;      /* source node, for errors and fallbacks */
+} VmInsn;
+
+struct VmCode {
+    VmInsn *code;
+    int count;
+    int cap;
+    Value *consts;
+    int nconsts;
+    int kcap;
+    int nregs;
+};
+
+/* ---------- compiler ---------- */
+
+typedef struct {
+    int *sites;   /* (insn index << 1) | field, field 0 = a, 1 = b */
+    int count;
+    int cap;
+} VmPatchList;
+
+typedef struct VmLoop {
+    VmPatchList breaks;
+    VmPatchList conts;
+} VmLoop;
+
+typedef struct {
+    VmCode *code;
+    int nreg;
+    VmLoop *loop;
+} VmCompiler;
+
+static void compile_stmt(VmCompiler *c, AstNode *n);
+static void compile_expr(VmCompiler *c, AstNode *n, int dst);
+
+static int emit(VmCompiler *c, int op, int a, int b, int cc, int d,
+                const char *name, AstNode *node) {
+    VmCode *code = c->code;
+    if (code->count >= code->cap) {
+        int cap = code->cap ? code->cap * 2 : 32;
+        VmInsn *ni = (VmInsn *)realloc(code->code, (size_t)cap * sizeof(VmInsn));
+        if (!ni) return -1;
+        code->code = ni;
+        code->cap = cap;
+    }
+    VmInsn *in = &code->code[code->count];
+    in->op = op;
+    in->a = a;
+    in->b = b;
+    in->c = cc;
+    in->d = d;
+    in->hint = -1;
+    in->hint2 = -1;
+    in->name = name;
+    in->node = node;
+    return code->count++;
+}
+
+static int add_const(VmCompiler *c, Value v) {
+    VmCode *code = c->code;
+    if (code->nconsts >= code->kcap) {
+        int cap = code->kcap ? code->kcap * 2 : 8;
+        Value *nk = (Value *)realloc(code->consts, (size_t)cap * sizeof(Value));
+        if (!nk) { value_free(v); return 0; }
+        code->consts = nk;
+        code->kcap = cap;
+    }
+    code->consts[code->nconsts] = v;
+    return code->nconsts++;
+}
+
+static int reg_alloc(VmCompiler *c) {
+    int r = c->nreg++;
+    if (c->nreg > c->code->nregs) c->code->nregs = c->nreg;
+    return r;
+}
+
+static int here(VmCompiler *c) {
+    return c->code->count;
+}
+
+static void patch(VmCompiler *c, int site, int target) {
+    if (site < 0) return;
+    VmInsn *in = &c->code->code[site >> 1];
+    if (site & 1) in->b = target;
+    else in->a = target;
+}
+
+static void patch_list_add(VmPatchList *l, int site) {
+    if (l->count >= l->cap) {
+        int cap = l->cap ? l->cap * 2 : 4;
+        int *ns = (int *)realloc(l->sites, (size_t)cap * sizeof(int));
+        if (!ns) return;
+        l->sites = ns;
+        l->cap = cap;
+    }
+    l->sites[l->count++] = site;
+}
+
+static void patch_list_resolve(VmCompiler *c, VmPatchList *l, int target) {
+    for (int i = 0; i < l->count; i++) patch(c, l->sites[i], target);
+    free(l->sites);
+    l->sites = NULL;
+    l->count = l->cap = 0;
+}
+
+static int is_literal_const(AstNode *n) {
+    if (!n || n->type != AST_LITERAL) return 0;
+    switch (n->literal.token.type) {
+        case TOK_INT:
+        case TOK_FLOAT:
+        case TOK_STRING:
+        case TOK_NULL:
+        case TOK_UNDEFINED:
+        case TOK_VOID:
+        case TOK_TRUE:
+        case TOK_FALSE:
+            return 1;
+        default:
+            return 0;
+    }
+}
+
+static int is_int_literal(AstNode *n) {
+    return n && n->type == AST_LITERAL && n->literal.token.type == TOK_INT;
+}
+
+/*
+ * Side-effect free expressions built from variables, literals and operators.
+ * Superinstructions that read a variable before evaluating another operand
+ * require the operand to be simple so evaluation order is unobservable.
+ */
+static int is_simple_expr(AstNode *n) {
+    if (!n) return 0;
+    switch (n->type) {
+        case AST_LITERAL:
+        case AST_VAR:
+            return 1;
+        case AST_UNARY:
+            return is_simple_expr(n->unary.expr);
+        case AST_BINARY:
+            return is_simple_expr(n->binary.left) && is_simple_expr(n->binary.right);
+        case AST_INDEX:
+            return is_simple_expr(n->index.target) && is_simple_expr(n->index.index);
+        default:
+            return 0;
+    }
+}
+
+static int mentions_var(AstNode *n, const char *name) {
+    if (!n) return 0;
+    switch (n->type) {
+        case AST_VAR:
+            return strcmp(n->var.name, name) == 0;
+        case AST_UNARY:
+            return mentions_var(n->unary.expr, name);
+        case AST_BINARY:
+            return mentions_var(n->binary.left, name) || mentions_var(n->binary.right, name);
+        case AST_INDEX:
+            return mentions_var(n->index.target, name) || mentions_var(n->index.index, name);
+        default:
+            return 0;
+    }
+}
+
+static int const_index(VmCompiler *c, AstNode *lit) {
+    return add_const(c, eval_literal(&lit->literal.token));
+}
+
+static void compile_expr(VmCompiler *c, AstNode *n, int dst) {
+    switch (n->type) {
+        case AST_LITERAL:
+            if (is_literal_const(n)) {
+                emit(c, VM_LOADK, dst, const_index(c, n), 0, 0, NULL, n);
+                return;
+            }
+            break;
+
+        case AST_VAR:
+            emit(c, VM_LOADVAR, dst, 0, 0, 0, n->var.name, n);
+            return;
+
+        case AST_ASSIGN:
+            compile_expr(c, n->assign.value, dst);
+            if (n->assign.is_compound) {
+                emit(c, VM_ASSIGNOP, dst, 0, (int)n->assign.op, 1, n->assign.name, n);
+            } else {
+                emit(c, VM_STOREVAR, dst, 0, 1, 0, n->assign.name, n);
+            }
+            return;
+
+        case AST_PRE_INC:
+        case AST_PRE_DEC:
+        case AST_POST_INC:
+        case AST_POST_DEC:
+            if (n->incdec.target->type == AST_VAR) {
+                int delta = (n->type == AST_PRE_INC || n->type == AST_POST_INC) ? 1 : -1;
+                int prefix = (n->type == AST_PRE_INC || n->type == AST_PRE_DEC);
+                emit(c, VM_INCDEC, dst, 0, delta, prefix, n->incdec.target->var.name, n);
+                return;
+            }
+            break;
+
+        case AST_UNARY:
+            compile_expr(c, n->unary.expr, dst);
+            emit(c, VM_UNARY, dst, dst, (int)n->unary.op, 0, NULL, n);
+            return;
+
+        case AST_BINARY: {
+            Operator op = n->binary.op;
+            if (op == OP_AND || op == OP_OR) {
+                int jop = (op == OP_AND) ? VM_JMPF : VM_JMPT;
+                compile_expr(c, n->binary.left, dst);
+                int j1 = emit(c, jop, -1, dst, 0, 0, NULL, n);
+                compile_expr(c, n->binary.right, dst);
+                int j2 = emit(c, jop, -1, dst, 0, 0, NULL, n);
+                emit(c, VM_LOADK, dst, add_const(c, value_bool(op == OP_AND)), 0, 0, NULL, n);
+                int jend = emit(c, VM_JMP, -1, 0, 0, 0, NULL, n);
+                patch(c, j1 << 1, here(c));
+                patch(c, j2 << 1, here(c));
+                emit(c, VM_LOADK, dst, add_const(c, value_bool(op != OP_AND)), 0, 0, NULL, n);
+                patch(c, jend << 1, here(c));
+                return;
+            }
+            int save = c->nreg;
+            compile_expr(c, n->binary.left, dst);
+            int r = reg_alloc(c);
+            compile_expr(c, n->binary.right, r);
+            emit(c, VM_BINARY, dst, dst, r, (int)op, NULL, n);
+            c->nreg = save;
+            return;
+        }
+
+        case AST_CALL: {
+            int save = c->nreg;
+            int base = c->nreg;
+            for (int i = 0; i < n->call.argc; i++) reg_alloc(c);
+            for (int i = 0; i < n->call.argc; i++) {
+                compile_expr(c, n->call.args[i], base + i);
+            }
+            emit(c, VM_CALL, dst, base, n->call.argc, 0, n->call.name, n);
+            c->nreg = save;
+            return;
+        }
+
+        case AST_INDEX: {
+            AstNode *t = n->index.target;
+            AstNode *ix = n->index.index;
+            if (t->type == AST_VAR && is_literal_const(ix)) {
+                emit(c, VM_INDEX_VK, dst, 0, const_index(c, ix), 0, t->var.name, n);
+                return;
+            }
+            if (t->type == AST_VAR && is_simple_expr(ix)) {
+                compile_expr(c, ix, dst);
+                emit(c, VM_INDEX_VAR, dst, 0, dst, 0, t->var.name, n);
+                return;
+            }
+            int save = c->nreg;
+            compile_expr(c, t, dst);
+            int r = reg_alloc(c);
+            compile_expr(c, ix, r);
+            emit(c, VM_INDEX, dst, dst, r, 0, NULL, n);
+            c->nreg = save;
+            return;
+        }
+
+        case AST_TERNARY: {
+            compile_expr(c, n->ternary.cond, dst);
+            int jf = emit(c, VM_JMPF, -1, dst, 0, 0, NULL, n);
+            compile_expr(c, n->ternary.then_expr, dst);
+            int jend = emit(c, VM_JMP, -1, 0, 0, 0, NULL, n);
+            patch(c, jf << 1, here(c));
+            compile_expr(c, n->ternary.else_expr, dst);
+            patch(c, jend << 1, here(c));
+            return;
+        }
+
+        case AST_NULL_COALESCE: {
+            compile_expr(c, n->null_coalesce.left, dst);
+            int jnn = emit(c, VM_JMPNN, -1, dst, 0, 0, NULL, n);
+            emit(c, VM_CLEAR, dst, 0, 0, 0, NULL, n);
+            compile_expr(c, n->null_coalesce.right, dst);
+            patch(c, jnn << 1, here(c));
+            return;
+        }
+
+        default:
+            break;
+    }
+    emit(c, VM_EVAL, dst, 0, 0, 0, NULL, n);
+}
+
+/* Evaluate an expression for its side effects only. */
+static void compile_effect(VmCompiler *c, AstNode *e) {
+    if (e->type == AST_ASSIGN) {
+        if (e->assign.is_compound && is_int_literal(e->assign.value) &&
+            (e->assign.op == OP_ADD || e->assign.op == OP_SUB)) {
+            lx_int_t k = e->assign.value->literal.token.int_val;
+            if (e->assign.op == OP_SUB) k = -k;
+            if (k >= -65536 && k <= 65536) {
+                emit(c, VM_ADDI_VAR, 0, 0, (int)k, 0, e->assign.name, e);
+                return;
+            }
+        }
+        int save = c->nreg;
+        int r = reg_alloc(c);
+        compile_expr(c, e->assign.value, r);
+        if (e->assign.is_compound) {
+            emit(c, VM_ASSIGNOP, r, 0, (int)e->assign.op, 0, e->assign.name, e);
+        } else {
+            emit(c, VM_STOREVAR, r, 0, 0, 0, e->assign.name, e);
+        }
+        c->nreg = save;
+        return;
+    }
+    if ((e->type == AST_PRE_INC || e->type == AST_PRE_DEC ||
+         e->type == AST_POST_INC || e->type == AST_POST_DEC) &&
+        e->incdec.target->type == AST_VAR) {
+        int delta = (e->type == AST_PRE_INC || e->type == AST_POST_INC) ? 1 : -1;
+        emit(c, VM_INCDEC, -1, 0, delta, 1, e->incdec.target->var.name, e);
+        return;
+    }
+    int save = c->nreg;
+    int r = reg_alloc(c);
+    compile_expr(c, e, r);
+    emit(c, VM_CLEAR, r, 0, 0, 0, NULL, e);
+    c->nreg = save;
+}
+
+/* Emit a jump taken when @p cond is false; returns its patch site. */
+static int compile_jump_if_false(VmCompiler *c, AstNode *cond) {
+    if (cond->type == AST_BINARY && cond->binary.left->type == AST_VAR &&
+        is_int_literal(cond->binary.right)) {
+        switch (cond->binary.op) {
+            case OP_LT: case OP_LTE: case OP_GT: case OP_GTE:
+            case OP_EQ: case OP_NEQ: {
+                int k = const_index(c, cond->binary.right);
+                int j = emit(c, VM_JCMP_VK, -1, k, (int)cond->binary.op, 0,
+                             cond->binary.left->var.name, cond);
+                return j << 1;
+            }
+            default:
+                break;
+        }
+    }
+    int save = c->nreg;
+    int r = reg_alloc(c);
+    compile_expr(c, cond, r);
+    int j = emit(c, VM_JMPF, -1, r, 0, 0, NULL, cond);
+    c->nreg = save;
+    return j << 1;
+}
+
+static void compile_loop_body(VmCompiler *c, AstNode *body, VmLoop *loop) {
+    VmLoop *outer = c->loop;
+    c->loop = loop;
+    compile_stmt(c, body);
+    c->loop = outer;
+}
+
+/* $var[] = expr where $var is already an array and expr cannot touch $var. */
+static int is_fast_append(AstNode *n) {
+    AstNode *ix = n->index_assign.target;
+    if (n->index_assign.is_compound || ix->type != AST_INDEX_APPEND) return 0;
+    AstNode *t = ix->index_append.target;
+    if (!t || t->type != AST_VAR) return 0;
+    AstNode *v = n->index_assign.value;
+    if (v->type == AST_ARRAY_LITERAL || v->type == AST_CALL) return 0;
+    return is_simple_expr(v) && !mentions_var(v, t->var.name);
+}
+
+static void compile_exec(VmCompiler *c, AstNode *n) {
+    int at = emit(c, VM_EXEC, -1, -1, 0, 0, NULL, n);
+    if (c->loop) {
+        patch_list_add(&c->loop->breaks, at << 1);
+        patch_list_add(&c->loop->conts, (at << 1) | 1);
+    }
+}
+
+static void compile_stmt(VmCompiler *c, AstNode *n) {
+    if (!n) return;
+    switch (n->type) {
+        case AST_PROGRAM:
+        case AST_BLOCK:
+            for (int i = 0; i < n->block.count; i++) {
+                if (!n->block.items[i]) {
+                    compile_exec(c, n);
+                    return;
+                }
+            }
+            for (int i = 0; i < n->block.count; i++) {
+                /* ahead of the statement, so it also tells the heap
+                 * profiler which line is running */
+                if (n->block.count > 1) emit(c, VM_SAFEPOINT, 0, 0, 0, 0, NULL, n->block.items[i]);
+                compile_stmt(c, n->block.items[i]);
+            }
+            return;
+
+        case AST_EXPR_STMT:
+            compile_effect(c, n->expr_stmt.expr);
+            return;
+
+        case AST_IF: {
+            int jf = compile_jump_if_false(c, n->if_stmt.cond);
+            compile_stmt(c, n->if_stmt.then_branch);
+            if (n->if_stmt.else_branch) {
+                int jend = emit(c, VM_JMP, -1, 0, 0, 0, NULL, n);
+                patch(c, jf, here(c));
+                compile_stmt(c, n->if_stmt.else_branch);
+                patch(c, jend << 1, here(c));
+            } else {
+                patch(c, jf, here(c));
+            }
+            return;
+        }
+
+        case AST_WHILE: {
+            VmLoop loop = {{0}, {0}};
+            int top = here(c);
+            int jf = compile_jump_if_false(c, n->while_stmt.cond);
+            compile_loop_body(c, n->while_stmt.body, &loop);
+            emit(c, VM_JMP, top, 0, 0, 0, NULL, n);
+            patch(c, jf, here(c));
+            patch_list_resolve(c, &loop.breaks, here(c));
+            patch_list_resolve(c, &loop.conts, top);
+            return;
+        }
+
+        case AST_DO_WHILE: {
+            VmLoop loop = {{0}, {0}};
+            int top = here(c);
+            compile_loop_body(c, n->do_while_stmt.body, &loop);
+            patch_list_resolve(c, &loop.conts, here(c));
+            int jf = compile_jump_if_false(c, n->do_while_stmt.cond);
+            emit(c, VM_JMP, top, 0, 0, 0, NULL, n);
+            patch(c, jf, here(c));
+            patch_list_resolve(c, &loop.breaks, here(c));
+            return;
+        }
+
+        case AST_FOR: {
+            VmLoop loop = {{0}, {0}};
+            if (n->for_stmt.init) {
+                VmLoop *outer = c->loop;
+                c->loop = NULL;
+                compile_stmt(c, n->for_stmt.init);
+                c->loop = outer;
+            }
+            int top = here(c);
+            int jf = -1;
+            if (n->for_stmt.cond) jf = compile_jump_if_false(c, n->for_stmt.cond);
+            compile_loop_body(c, n->for_stmt.body, &loop);
+            patch_list_resolve(c, &loop.conts, here(c));
+            if (n->for_stmt.step) compile_stmt(c, n->for_stmt.step);
+            emit(c, VM_JMP, top, 0, 0, 0, NULL, n);
+            patch(c, jf, here(c));
+            patch_list_resolve(c, &loop.breaks, here(c));
+            return;
+        }
+
+        case AST_FOREACH: {
+            if (n->foreach_stmt.by_ref) {
+                /* element write-back lives in the evaluator */
+                compile_exec(c, n);
+                return;
+            }
+            VmLoop loop = {{0}, {0}};
+            int save = c->nreg;
+            int it = reg_alloc(c);
+            int pos = reg_alloc(c);
+            compile_expr(c, n->foreach_stmt.iterable, it);
+            emit(c, VM_LOADK, pos, add_const(c, value_int(0)), 0, 0, NULL, n);
+            int top = emit(c, VM_ITER, -1, it, pos, 0, NULL, n);
+            compile_loop_body(c, n->foreach_stmt.body, &loop);
+            emit(c, VM_JMP, top, 0, 0, 0, NULL, n);
+            patch(c, top << 1, here(c));
+            patch_list_resolve(c, &loop.breaks, here(c));
+            patch_list_resolve(c, &loop.conts, top);
+            emit(c, VM_CLEAR, it, 0, 0, 0, NULL, n);
+            c->nreg = save;
+            return;
+        }
+
+        case AST_BREAK:
+        case AST_CONTINUE: {
+            int flow = (n->type == AST_BREAK) ? FLOW_BREAK : FLOW_CONTINUE;
+            if (c->loop) {
+                int j = emit(c, VM_JMP, -1, 0, 0, 0, NULL, n);
+                patch_list_add(flow == FLOW_BREAK ? &c->loop->breaks : &c->loop->conts, j << 1);
+            } else {
+                emit(c, VM_FLOW, flow, 0, 0, 0, NULL, n);
+            }
+            return;
+        }
+
+        case AST_RETURN: {
+            if (!n->ret.value) {
+                emit(c, VM_RETV, 0, 0, 0, 0, NULL, n);
+                return;
+            }
+            int save = c->nreg;
+            int r = reg_alloc(c);
+            if (n->ret.tail) {
+                AstNode *call = n->ret.value;
+                int base = c->nreg;
+                for (int i = 0; i < call->call.argc; i++) reg_alloc(c);
+                for (int i = 0; i < call->call.argc; i++) {
+                    compile_expr(c, call->call.args[i], base + i);
+                }
+                emit(c, VM_TAILCALL, r, base, call->call.argc, 0, call->call.name, call);
+            } else {
+                compile_expr(c, n->ret.value, r);
+            }
+            emit(c, VM_RET, r, 0, 0, 0, NULL, n);
+            c->nreg = save;
+            return;
+        }
+
+        case AST_INDEX_ASSIGN:
+            if (is_fast_append(n)) {
+                const char *name = n->index_assign.target->index_append.target->var.name;
+                int jslow = emit(c, VM_JNOTARR, -1, 0, 0, 0, name, n);
+                int save = c->nreg;
+                int r = reg_alloc(c);
+                compile_expr(c, n->index_assign.value, r);
+                emit(c, VM_APPEND_VAR, r, 0, 0, 0, name, n);
+                c->nreg = save;
+                int jend = emit(c, VM_JMP, -1, 0, 0, 0, NULL, n);
+                patch(c, jslow << 1, here(c));
+                compile_exec(c, n);
+                patch(c, jend << 1, here(c));
+                return;
+            }
+            compile_exec(c, n);
+            return;
+
+        case AST_GLOBAL:
+        case AST_CONST_DECL:
+        case AST_FUNCTION:
+        case AST_UNSET:
+        case AST_SWITCH:
+        case AST_DESTRUCT_ASSIGN:
+        case AST_ASSIGN_DYNAMIC:
+            compile_exec(c, n);
+            return;
+
+        default:
+            /* expression used as a statement (for-clause steps) */
+            compile_effect(c, n);
+            return;
+    }
+}
+
+VmCode *vm_compile(AstNode *n) {
+    VmCode *code = (VmCode *)calloc(1, sizeof(VmCode));
+    if (!code) return NULL;
+    VmCompiler c;
+    c.code = code;
+    c.nreg = 0;
+    c.loop = NULL;
+    compile_stmt(&c, n);
+    emit(&c, VM_END, 0, 0, 0, 0, NULL, n);
+    return code;
+}
+
+void vm_code_free(VmCode *code) {
+    if (!code) return;
+    for (int i = 0; i < code->nconsts; i++) value_free(code->consts[i]);
+    free(code->consts);
+    free(code->code);
+    free(code);
+}
+
+/* ---------- interpreter ---------- */
+
+static EvalResult vm_result(EvalFlow flow, Value v) {
+    EvalResult r;
+    r.flow = flow;
+    r.value = v;
+    return r;
+}
+
+static Value *var_slot(Env *env, VmInsn *in) {
+    return env_lookup(env, in->name, &in->hint);
+}
+
+static void var_store(Env *env, VmInsn *in, Value v) {
+    Value *slot = env_lookup(env, in->name, &in->hint);
+    if (slot) {
+        value_free(*slot);
+        *slot = v;
+    } else {
+        env_set(env, in->name, v);
+    }
+}
+
+static int is_nullish(Value v) {
+    return v.type == VAL_UNDEFINED || v.type == VAL_NULL;
+}
+
+/* $name .= rhs on a string binding, appending in place. */
+static int concat_in_place(Value *slot, Value rhs) {
+    Value rs = (rhs.type == VAL_STRING) ? rhs : value_to_string(rhs);
+    size_t la = strlen(slot->s);
+    size_t lb = strlen(rs.s);
+    char *ns = lx_memguard_check(lb) ? (char *)lx_region_realloc(slot->s, la + lb + 1) : NULL;
+    if (!ns) {
+        if (rs.s != rhs.s) value_free(rs);
+        return 0;
+    }
+    memcpy(ns + la, rs.s, lb + 1);
+    LX_HEAPPROF_MOVE(slot->s, ns);
+    LX_HEAPPROF_ALLOC(LX_HEAP_STRING, ns, lb);
+    slot->s = ns;
+    if (rs.s != rhs.s) value_free(rs);
+    return 1;
+}
+
+static EvalResult vm_execute(VmCode *code, Env *env) {
+    Value local_regs[16];
+    Value *R = local_regs;
+    if (code->nregs > 16) {
+        R = (Value *)malloc((size_t)code->nregs * sizeof(Value));
+        if (!R) {
+            lx_set_error(LX_ERR_INTERNAL, 0, 0, "vm register allocation failed");
+            return vm_result(FLOW_NORMAL, value_null());
+        }
+    }
+    for (int i = 0; i < code->nregs; i++) R[i] = value_null();
+    gc_push_roots(R, code->nregs);
+
+    Value *K = code->consts;
+    VmInsn *base = code->code;
+    VmInsn *ip = base;
+    EvalResult result = vm_result(FLOW_NORMAL, value_null());
+    int okf = 1;
+
+#define TAKE(r) (tmp_ = R[(r)], R[(r)] = value_null(), tmp_)
+#define CHECK() do { if (!okf || lx_has_error()) goto fail; } while (0)
+    Value tmp_;
+
+#ifdef VM_COMPUTED_GOTO
+    static void *dispatch_table[VM_OP_COUNT] = {
+        &&L_VM_LOADK, &&L_VM_LOADVAR, &&L_VM_STOREVAR, &&L_VM_ASSIGNOP,
+        &&L_VM_ADDI_VAR, &&L_VM_INCDEC, &&L_VM_BINARY, &&L_VM_UNARY,
+        &&L_VM_JMP, &&L_VM_JMPF, &&L_VM_JMPT, &&L_VM_JMPNN, &&L_VM_JCMP_VK,
+        &&L_VM_CALL, &&L_VM_TAILCALL, &&L_VM_INDEX, &&L_VM_INDEX_VAR, &&L_VM_INDEX_VK,
+        &&L_VM_JNOTARR, &&L_VM_APPEND_VAR, &&L_VM_ITER, &&L_VM_EVAL,
+        &&L_VM_EXEC, &&L_VM_SAFEPOINT, &&L_VM_CLEAR, &&L_VM_RET, &&L_VM_RETV,
+        &&L_VM_FLOW, &&L_VM_END
+    };
+#define VM_CASE(op) L_##op
+#define DISPATCH() goto *dispatch_table[ip->op]
+    DISPATCH();
+#else
+#define VM_CASE(op) case op
+#define DISPATCH() goto dispatch
+dispatch:
+    switch (ip->op) {
+#endif
+
+    VM_CASE(VM_LOADK):
+        R[ip->a] = value_copy(K[ip->b]);
+        ip++;
+        DISPATCH();
+
+    VM_CASE(VM_LOADVAR): {
+        Value *slot = var_slot(env, ip);
+        R[ip->a] = slot ? value_copy(*slot) : value_undefined();
+        ip++;
+        DISPATCH();
+    }
+
+    VM_CASE(VM_STOREVAR):
+        if (ip->c) {
+            var_store(env, ip, value_copy(R[ip->a]));
+        } else {
+            var_store(env, ip, TAKE(ip->a));
+        }
+        ip++;
+        DISPATCH();
+
+    VM_CASE(VM_ASSIGNOP): {
+        Value *slot = var_slot(env, ip);
+        Operator op = (Operator)ip->c;
+        if (op == OP_CONCAT && slot && slot->type == VAL_STRING && slot->s) {
+            Value rhs = TAKE(ip->a);
+            int done = concat_in_place(slot, rhs);
+            value_free(rhs);
+            if (!done) {
+                if (!lx_has_error()) {
+                    lx_set_error(LX_ERR_INTERNAL, ip->node->line, ip->node->col,
+                                 "string append allocation failed");
+                }
+                goto fail;
+            }
+            if (ip->d) R[ip->a] = value_copy(*slot);
+            ip++;
+            DISPATCH();
+        }
+        Value lhs = slot ? value_copy(*slot) : value_undefined();
+        if (is_nullish(lhs)) {
+            lhs = (op == OP_CONCAT) ? value_string("") : value_int(0);
+        }
+        Value out = eval_assign_op(ip->node, op, lhs, TAKE(ip->a));
+        if (lx_has_error()) { value_free(out); goto fail; }
+        if (ip->d) {
+            var_store(env, ip, value_copy(out));
+            R[ip->a] = out;
+        } else {
+            var_store(env, ip, out);
+        }
+        ip++;
+        DISPATCH();
+    }
+
+    VM_CASE(VM_ADDI_VAR): {
+        Value *slot = var_slot(env, ip);
+        if (slot && slot->type == VAL_INT) {
+            lx_int_t r;
+            if (!lx_add_overflow(slot->i, (lx_int_t)ip->c, &r)) {
+                slot->i = r;
+                ip++;
+                DISPATCH();
+            }
+        }
+        Value lhs = slot ? value_copy(*slot) : value_undefined();
+        if (is_nullish(lhs)) lhs = value_int(0);
+        Value out = eval_assign_op(ip->node, OP_ADD, lhs, value_int(ip->c));
+        if (lx_has_error()) { value_free(out); goto fail; }
+        var_store(env, ip, out);
+        ip++;
+        DISPATCH();
+    }
+
+    VM_CASE(VM_INCDEC): {
+        Value *slot = var_slot(env, ip);
+        if (slot && slot->type == VAL_INT && slot->i != (ip->c > 0 ? LX_INT_MAX : LX_INT_MIN)) {
+            lx_int_t old = slot->i;
+            slot->i = old + ip->c;
+            if (ip->a >= 0) R[ip->a] = value_int(ip->d ? slot->i : old);
+            ip++;
+            DISPATCH();
+        }
+        Value v = eval_expr_value(ip->node, env, &okf);
+        CHECK();
+        if (ip->a >= 0) R[ip->a] = v;
+        else value_free(v);
+        ip++;
+        DISPATCH();
+    }
+
+    VM_CASE(VM_BINARY): {
+        Value a = TAKE(ip->b);
+        Value b = TAKE(ip->c);
+        if (a.type == VAL_INT && b.type == VAL_INT) {
+            int done = 1;
+            lx_int_t r;
+            switch ((Operator)ip->d) {
+                case OP_ADD: done = !lx_add_overflow(a.i, b.i, &r); R[ip->a] = value_int(r); break;
+                case OP_SUB: done = !lx_sub_overflow(a.i, b.i, &r); R[ip->a] = value_int(r); break;
+                case OP_MUL: done = !lx_mul_overflow(a.i, b.i, &r); R[ip->a] = value_int(r); break;
+                case OP_LT:  R[ip->a] = value_bool(a.i <  b.i); break;
+                case OP_LTE: R[ip->a] = value_bool(a.i <= b.i); break;
+                case OP_GT:  R[ip->a] = value_bool(a.i >  b.i); break;
+                case OP_GTE: R[ip->a] = value_bool(a.i >= b.i); break;
+                case OP_EQ:  R[ip->a] = value_bool(a.i == b.i); break;
+                case OP_NEQ: R[ip->a] = value_bool(a.i != b.i); break;
+                case OP_SEQ: R[ip->a] = value_bool(a.i == b.i); break;
+                case OP_SNEQ: R[ip->a] = value_bool(a.i != b.i); break;
+                default: done = 0; break;
+            }
+            if (done) {
+                ip++;
+                DISPATCH();
+            }
+        }
+        R[ip->a] = eval_binary_values(ip->node, (Operator)ip->d, a, b, &okf);
+        CHECK();
+        ip++;
+        DISPATCH();
+    }
+
+    VM_CASE(VM_UNARY):
+        R[ip->a] = eval_unary_value((Operator)ip->c, TAKE(ip->b), &okf);
+        CHECK();
+        ip++;
+        DISPATCH();
+
+    VM_CASE(VM_JMP):
+        ip = base + ip->a;
+        DISPATCH();
+
+    VM_CASE(VM_JMPF): {
+        Value v = TAKE(ip->b);
+        int t = value_is_true(v);
+        value_free(v);
+        ip = t ? ip + 1 : base + ip->a;
+        DISPATCH();
+    }
+
+    VM_CASE(VM_JMPT): {
+        Value v = TAKE(ip->b);
+        int t = value_is_true(v);
+        value_free(v);
+        ip = t ? base + ip->a : ip + 1;
+        DISPATCH();
+    }
+
+    VM_CASE(VM_JMPNN):
+        ip = is_nullish(R[ip->b]) ? ip + 1 : base + ip->a;
+        DISPATCH();
+
+    VM_CASE(VM_JCMP_VK): {
+        Value *slot = var_slot(env, ip);
+        Value k = K[ip->b];
+        int t;
+        if (slot && slot->type == VAL_INT) {
+            lx_int_t x = slot->i, y = k.i;
+            switch ((Operator)ip->c) {
+                case OP_LT:  t = x <  y; break;
+                case OP_LTE: t = x <= y; break;
+                case OP_GT:  t = x >  y; break;
+                case OP_GTE: t = x >= y; break;
+                case OP_EQ:  t = x == y; break;
+                default:     t = x != y; break;
+            }
+        } else {
+            Value lhs = slot ? value_copy(*slot) : value_undefined();
+            Value r = eval_binary_values(ip->node, (Operator)ip->c, lhs, value_copy(k), &okf);
+            t = value_is_true(r);
+            value_free(r);
+            CHECK();
+        }
+        ip = t ? ip + 1 : base + ip->a;
+        DISPATCH();
+    }
+
+    VM_CASE(VM_CALL):
+        R[ip->a] = eval_call_values(ip->node, env, &R[ip->b], ip->c, &okf);
+        for (int i = 0; i < ip->c; i++) R[ip->b + i] = value_null();
+        CHECK();
+        ip++;
+        DISPATCH();
+
+    VM_CASE(VM_TAILCALL):
+        if (eval_tail_call(ip->node, &R[ip->b], ip->c)) {
+            for (int i = 0; i < ip->c; i++) R[ip->b + i] = value_null();
+            result = vm_result(FLOW_RETURN, value_void());
+            goto done;
+        }
+        R[ip->a] = eval_call_values(ip->node, env, &R[ip->b], ip->c, &okf);
+        for (int i = 0; i < ip->c; i++) R[ip->b + i] = value_null();
+        CHECK();
+        ip++;
+        DISPATCH();
+
+    VM_CASE(VM_INDEX): {
+        Value t = TAKE(ip->b);
+        Value x = TAKE(ip->c);
+        R[ip->a] = eval_index_value(t, x);
+        value_free(t);
+        value_free(x);
+        ip++;
+        DISPATCH();
+    }
+
+    VM_CASE(VM_INDEX_VAR): {
+        Value *slot = var_slot(env, ip);
+        Value x = TAKE(ip->c);
+        R[ip->a] = slot ? eval_index_value(*slot, x) : value_undefined();
+        value_free(x);
+        ip++;
+        DISPATCH();
+    }
+
+    VM_CASE(VM_INDEX_VK): {
+        Value *slot = var_slot(env, ip);
+        if (slot && slot->type == VAL_ARRAY && K[ip->c].type == VAL_STRING) {
+            Key k;
+            k.type = KEY_STRING;
+            k.s = K[ip->c].s ? K[ip->c].s : "";
+            Value *v = array_lookup_cached(slot->a, k, &ip->node->ic);
+            R[ip->a] = v ? value_copy(*v) : value_undefined();
+        } else {
+            R[ip->a] = slot ? eval_index_value(*slot, K[ip->c]) : value_undefined();
+        }
+        ip++;
+        DISPATCH();
+    }
+
+    VM_CASE(VM_JNOTARR): {
+        Value *slot = var_slot(env, ip);
+        ip = (slot && slot->type == VAL_ARRAY && slot->a) ? ip + 1 : base + ip->a;
+        DISPATCH();
+    }
+
+    VM_CASE(VM_APPEND_VAR): {
+        Value *slot = var_slot(env, ip);
+        Value v = TAKE(ip->a);
+        if (slot && slot->type == VAL_ARRAY && slot->a) {
+            array_push(slot->a, v);
+        } else {
+            value_free(v);
+        }
+        CHECK();
+        ip++;
+        DISPATCH();
+    }
+
+    VM_CASE(VM_ITER): {
+        AstNode *n = ip->node;
+        Value *it = &R[ip->b];
+        lx_int_t i = R[ip->c].i;
+        ArrayEntry *e = NULL;
+        const char *str = NULL;
+        Value vv = value_undefined();
+        if (it->type == VAL_ARRAY && it->a && (size_t)i < it->a->size) {
+            e = &it->a->entries[i];
+            if (it->a->refcount == 1 && !it->a->shared) {
+                /* only this loop sees the array: move the element out */
+                vv = e->value;
+                e->value = value_null();
+            } else if (e->value.type == VAL_STRING && e->value.s) {
+                str = e->value.s;
+            } else {
+                vv = value_copy(e->value);
+            }
+        } else if (it->type == VAL_STRING && it->s && it->s[i] != '\0') {
+            str = &it->s[i];
+        } else if (it->type == VAL_BLOB && it->blob && (size_t)i < it->blob->len) {
+            vv = value_byte(it->blob->data[i]);
+        } else {
+            ip = base + ip->a;
+            DISPATCH();
+        }
+        if (n->foreach_stmt.key_name) {
+            Value *ks = env_lookup(env, n->foreach_stmt.key_name, &ip->hint2);
+            if (!ks) ks = env_get_ref(env, n->foreach_stmt.key_name);
+            if (ks && e && e->key.type == KEY_STRING) {
+                value_assign_string_n(ks, e->key.s, strlen(e->key.s));
+            } else if (ks) {
+                value_free(*ks);
+                *ks = value_int(e ? e->key.i : i);
+            }
+        }
+        Value *vs = env_lookup(env, n->foreach_stmt.value_name, &ip->hint);
+        if (!vs) vs = env_get_ref(env, n->foreach_stmt.value_name);
+        if (vs && str) {
+            value_assign_string_n(vs, str, e ? strlen(str) : 1);
+        } else if (vs) {
+            value_free(*vs);
+            *vs = vv;
+        } else {
+            value_free(vv);
+        }
+        R[ip->c].i = i + 1;
+        ip++;
+        DISPATCH();
+    }
+
+    VM_CASE(VM_EVAL):
+        R[ip->a] = eval_expr_value(ip->node, env, &okf);
+        CHECK();
+        ip++;
+        DISPATCH();
+
+    VM_CASE(VM_EXEC): {
+        EvalResult r = eval_node(ip->node, env);
+        if (lx_has_error()) { value_free(r.value); goto fail; }
+        if (r.flow == FLOW_NORMAL) {
+            value_free(r.value);
+            ip++;
+            DISPATCH();
+        }
+        if (r.flow == FLOW_BREAK && ip->a >= 0) {
+            value_free(r.value);
+            ip = base + ip->a;
+            DISPATCH();
+        }
+        if (r.flow == FLOW_CONTINUE && ip->b >= 0) {
+            value_free(r.value);
+            ip = base + ip->b;
+            DISPATCH();
+        }
+        result = r;
+        goto done;
+    }
+
+    VM_CASE(VM_SAFEPOINT):
+        if (lx_has_error()) goto fail;
+        lx_heapprof_node = ip->node;
+        gc_maybe_collect(env);
+        ip++;
+        DISPATCH();
+
+    VM_CASE(VM_CLEAR):
+        value_free(TAKE(ip->a));
+        ip++;
+        DISPATCH();
+
+    VM_CASE(VM_RET):
+        result = vm_result(FLOW_RETURN, TAKE(ip->a));
+        goto done;
+
+    VM_CASE(VM_RETV):
+        result = vm_result(FLOW_RETURN, value_void());
+        goto done;
+
+    VM_CASE(VM_FLOW):
+        result = vm_result((EvalFlow)ip->a, value_void());
+        goto done;
+
+    VM_CASE(VM_END):
+        goto done;
+
+#ifndef VM_COMPUTED_GOTO
+    default:
+        goto done;
+    }
+#endif
+
+fail:
+    result = vm_result(FLOW_NORMAL, value_null());
+done:
+    gc_pop_roots(1);
+    for (int i = 0; i < code->nregs; i++) value_free(R[i]);
+    if (R != local_regs) free(R);
+    return result;
+
+#undef TAKE
+#undef CHECK
+#undef VM_CASE
+#undef DISPATCH
+}
+
+EvalResult vm_run(AstNode *n, Env *env) {
+    if (lx_has_error() || !n) return vm_result(FLOW_NORMAL, value_null());
+    if (!n->vm_code) {
+        n->vm_code = vm_compile(n);
+        if (!n->vm_code) return eval_node(n, env);
+    }
+    return vm_execute(n->vm_code, env);
+}
+
+void vm_enable(int on) {
+    eval_set_body_runner(on ? vm_run : NULL);
+}
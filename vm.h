@@ -0,0 +1,33 @@
+/**
+ * @file vm.h
+ * @brief Bytecode compiler and register virtual machine.
+ *
+ * The VM is an alternative execution engine for the AST produced by the
+ * parser. Statements and expressions it does not compile natively are
+ * delegated to the tree walker (eval.c), so both engines share the same
+ * semantics.
+ */
+#ifndef VM_H
+#define VM_H
+
+#include "eval.h"
+
+/** Compiled bytecode for one statement tree. */
+typedef struct VmCode VmCode;
+
+/** Compile @p n (a program, block or statement) to bytecode. */
+VmCode *vm_compile(AstNode *n);
+
+/** Free compiled bytecode. */
+void vm_code_free(VmCode *code);
+
+/**
+ * Execute @p n on the VM. The bytecode is compiled on first use and
+ * cached on the node until the AST is freed.
+ */
+EvalResult vm_run(AstNode *n, Env *env);
+
+/** Route user function bodies through the VM (@p on != 0) or the tree walker. */
+void vm_enable(int on);
+
+#endif